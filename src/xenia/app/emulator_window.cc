@@ -30,6 +30,7 @@
 #include "build/version.h"
 
 DECLARE_bool(debug);
+DECLARE_path(sampling_profile_path);
 
 namespace xe {
 namespace app {
@@ -234,6 +235,12 @@ bool EmulatorWindow::Initialize() {
         "Ctrl+Pause/Break",
         std::bind(&EmulatorWindow::CpuBreakIntoHostDebugger, this)));
   }
+  cpu_menu->AddChild(MenuItem::Create(MenuItem::Type::kSeparator));
+  {
+    cpu_menu->AddChild(MenuItem::Create(
+        MenuItem::Type::kString, "&Write Sampling Profile",
+        std::bind(&EmulatorWindow::CpuWriteSamplingProfile, this)));
+  }
   main_menu->AddChild(std::move(cpu_menu));
 
   // GPU menu.
@@ -405,6 +412,16 @@ void EmulatorWindow::CpuBreakIntoDebugger() {
 
 void EmulatorWindow::CpuBreakIntoHostDebugger() { xe::debugging::Break(); }
 
+void EmulatorWindow::CpuWriteSamplingProfile() {
+  if (!emulator()->processor()->WriteSamplingProfile(
+          cvars::sampling_profile_path)) {
+    xe::ui::ImGuiDialog::ShowMessageBox(
+        window_.get(), "Sampling Profiler",
+        "Xenia must be launched with the --sampling_profiler flag in order to "
+        "write a sampling profile.");
+  }
+}
+
 void EmulatorWindow::GpuTraceFrame() {
   emulator()->graphics_system()->RequestFrameTrace();
 }
@@ -0,0 +1,173 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/free_page_index.h"
+
+#include <algorithm>
+
+#include "xenia/base/math.h"
+
+namespace xe {
+
+void FreePageIndex::Reset(uint32_t page_count) {
+  page_count_ = page_count;
+  size_t word_count = (size_t(page_count) + 63) >> 6;
+  free_bits_.assign(word_count, 0);
+  words_with_free_.assign((word_count + 63) >> 6, 0);
+  words_with_used_.assign((word_count + 63) >> 6, 0);
+  Mark(0, page_count, true);
+}
+
+void FreePageIndex::Mark(uint32_t first_page, uint32_t page_count,
+                         bool free) {
+  if (!page_count) {
+    return;
+  }
+  uint32_t last_page = first_page + page_count - 1;
+  size_t first_word = first_page >> 6;
+  size_t last_word = last_page >> 6;
+  for (size_t word = first_word; word <= last_word; ++word) {
+    uint64_t mask = ~uint64_t(0);
+    if (word == first_word) {
+      mask &= ~uint64_t(0) << (first_page & 63);
+    }
+    if (word == last_word) {
+      mask &= ~uint64_t(0) >> (63 - (last_page & 63));
+    }
+    if (free) {
+      free_bits_[word] |= mask;
+    } else {
+      free_bits_[word] &= ~mask;
+    }
+    UpdateSummary(word);
+  }
+}
+
+void FreePageIndex::UpdateSummary(size_t word) {
+  uint64_t summary_bit = uint64_t(1) << (word & 63);
+  if (free_bits_[word]) {
+    words_with_free_[word >> 6] |= summary_bit;
+  } else {
+    words_with_free_[word >> 6] &= ~summary_bit;
+  }
+  if (~free_bits_[word]) {
+    words_with_used_[word >> 6] |= summary_bit;
+  } else {
+    words_with_used_[word >> 6] &= ~summary_bit;
+  }
+}
+
+uint32_t FreePageIndex::FindNext(uint32_t begin, uint32_t end,
+                                 bool free) const {
+  if (begin >= end) {
+    return end;
+  }
+  const std::vector<uint64_t>& summary =
+      free ? words_with_free_ : words_with_used_;
+  size_t word = begin >> 6;
+  uint64_t bits = GetWord(word, free) & (~uint64_t(0) << (begin & 63));
+  while (!bits) {
+    // Skip the words without such pages.
+    ++word;
+    if ((word << 6) >= end) {
+      return end;
+    }
+    size_t summary_index = word >> 6;
+    uint64_t summary_bits =
+        summary[summary_index] & (~uint64_t(0) << (word & 63));
+    while (!summary_bits) {
+      if (++summary_index >= summary.size()) {
+        return end;
+      }
+      summary_bits = summary[summary_index];
+    }
+    word = (summary_index << 6) + xe::tzcnt(summary_bits);
+    bits = GetWord(word, free);
+  }
+  return uint32_t(std::min((word << 6) + xe::tzcnt(bits), size_t(end)));
+}
+
+uint32_t FreePageIndex::FindPrevious(uint32_t begin, uint32_t end,
+                                     bool free) const {
+  if (begin >= end) {
+    return UINT32_MAX;
+  }
+  const std::vector<uint64_t>& summary =
+      free ? words_with_free_ : words_with_used_;
+  size_t word = (end - 1) >> 6;
+  uint64_t bits =
+      GetWord(word, free) & (~uint64_t(0) >> (63 - ((end - 1) & 63)));
+  while (!bits) {
+    // Skip the words without such pages.
+    if ((word << 6) <= begin) {
+      return UINT32_MAX;
+    }
+    --word;
+    size_t summary_index = word >> 6;
+    uint64_t summary_bits =
+        summary[summary_index] & (~uint64_t(0) >> (63 - (word & 63)));
+    while (!summary_bits) {
+      if (!summary_index) {
+        return UINT32_MAX;
+      }
+      summary_bits = summary[--summary_index];
+    }
+    word = (summary_index << 6) + 63 - xe::lzcnt(summary_bits);
+    bits = GetWord(word, free);
+  }
+  size_t page = (word << 6) + 63 - xe::lzcnt(bits);
+  return page >= begin ? uint32_t(page) : UINT32_MAX;
+}
+
+bool FreePageIndex::Find(uint32_t low_base, uint32_t high_base,
+                         uint32_t page_count, uint32_t stride, bool top_down,
+                         uint32_t* out_base) const {
+  if (!page_count || !stride || low_base > high_base) {
+    return false;
+  }
+  if (top_down) {
+    uint32_t base = high_base - high_base % stride;
+    while (base >= low_base) {
+      uint32_t used_page = FindPrevious(base, base + page_count, false);
+      if (used_page == UINT32_MAX) {
+        *out_base = base;
+        return true;
+      }
+      // The range must end below the run of used pages containing the used
+      // page.
+      uint32_t free_page = FindPrevious(low_base, used_page, true);
+      if (free_page == UINT32_MAX || free_page - low_base + 1 < page_count) {
+        return false;
+      }
+      base = free_page + 1 - page_count;
+      base -= base % stride;
+    }
+    return false;
+  }
+  uint32_t page = low_base;
+  while (true) {
+    // Skip the run of used pages.
+    page = FindNext(page, high_base + 1, true);
+    if (page > high_base) {
+      return false;
+    }
+    uint32_t base = (page + stride - 1) / stride * stride;
+    if (base > high_base) {
+      return false;
+    }
+    uint32_t used_page = FindNext(base, base + page_count, false);
+    if (used_page == base + page_count) {
+      *out_base = base;
+      return true;
+    }
+    page = used_page + 1;
+  }
+}
+
+}  // namespace xe
@@ -0,0 +1,72 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_FREE_PAGE_INDEX_H_
+#define XENIA_BASE_FREE_PAGE_INDEX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace xe {
+
+// Index of the free pages of a heap for finding free ranges without walking
+// the pages one by one. A bit per page, summarized by a bit per 64 pages for
+// whether any of them is free and whether any of them is used, so searches
+// skip whole runs of free or used pages with bit scans.
+class FreePageIndex {
+ public:
+  // Resizes the index to page_count pages, all free.
+  void Reset(uint32_t page_count);
+
+  uint32_t page_count() const { return page_count_; }
+
+  bool is_free(uint32_t page) const {
+    return (free_bits_[page >> 6] >> (page & 63)) & 1;
+  }
+
+  void MarkUsed(uint32_t first_page, uint32_t page_count) {
+    Mark(first_page, page_count, false);
+  }
+  void MarkFree(uint32_t first_page, uint32_t page_count) {
+    Mark(first_page, page_count, true);
+  }
+
+  // Finds the lowest, or the highest if top_down, base page that's a multiple
+  // of stride within [low_base, high_base] and is followed by page_count free
+  // pages including itself. The pages must be within the index.
+  bool Find(uint32_t low_base, uint32_t high_base, uint32_t page_count,
+            uint32_t stride, bool top_down, uint32_t* out_base) const;
+
+ private:
+  void Mark(uint32_t first_page, uint32_t page_count, bool free);
+  void UpdateSummary(size_t word);
+
+  uint64_t GetWord(size_t word, bool free) const {
+    return free ? free_bits_[word] : ~free_bits_[word];
+  }
+
+  // Returns the first page within [begin, end) that is free if free, or used
+  // otherwise, or end if there's none.
+  uint32_t FindNext(uint32_t begin, uint32_t end, bool free) const;
+  // Returns the last page within [begin, end) that is free if free, or used
+  // otherwise, or UINT32_MAX if there's none.
+  uint32_t FindPrevious(uint32_t begin, uint32_t end, bool free) const;
+
+  uint32_t page_count_ = 0;
+  // Bit per page, set if free. Pages past page_count_ are used.
+  std::vector<uint64_t> free_bits_;
+  // Bit per free_bits_ word, set if it has any free or any used pages.
+  std::vector<uint64_t> words_with_free_;
+  std::vector<uint64_t> words_with_used_;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_FREE_PAGE_INDEX_H_
@@ -306,7 +306,9 @@ inline T log2_ceil(T v) {
 
 template <typename T>
 inline T rotate_left(T v, uint8_t sh) {
-  return (T(v) << sh) | (T(v) >> ((sizeof(T) * 8) - sh));
+  // Masked so that a rotate by 0 doesn't shift by the full width.
+  return (T(v) << sh) |
+         (T(v) >> (((sizeof(T) * 8) - sh) & (sizeof(T) * 8 - 1)));
 }
 #if XE_PLATFORM_WIN32
 template <>
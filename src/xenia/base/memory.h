@@ -84,6 +84,31 @@ bool Protect(void* base_address, size_t length, PageAccess access,
 // the region.
 bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out);
 
+// Calls the callback in address order for each run of mapped pages in the
+// range that have the same access rights, clipped to the range. Unmapped pages
+// are skipped. Supported on all platforms, and reads the mappings only once on
+// Linux, so it suits large ranges. The callback may change the access rights.
+// Returns false if they can't be queried.
+bool QueryProtectRanges(
+    void* base_address, size_t length,
+    const std::function<void(void* range_base_address, size_t range_length,
+                             PageAccess access)>& callback);
+
+// Size of the huge pages the host can back memory with transparently, or 0 if
+// it can't.
+size_t huge_page_size();
+
+// Asks the host to back the page-aligned range with huge pages where it can,
+// to reduce TLB misses. The host splits huge pages back into regular pages
+// wherever part of one is protected differently, and memory allocated or
+// mapped over the range later must be advised again. Returns false if
+// unsupported.
+bool AdviseHugePages(void* base_address, size_t length);
+
+// Returns how many bytes of the mappings overlapping the range are currently
+// backed by huge pages.
+size_t QueryHugePageBytes(const void* base_address, size_t length);
+
 // Allocates a block of memory for a type with the given alignment.
 // The memory must be freed with AlignedFree.
 template <typename T>
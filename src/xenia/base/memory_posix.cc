@@ -13,6 +13,11 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
 #include "xenia/base/math.h"
 #include "xenia/base/platform.h"
 #include "xenia/base/string.h"
@@ -82,6 +87,115 @@ bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out) {
   return false;
 }
 
+bool QueryProtectRanges(
+    void* base_address, size_t length,
+    const std::function<void(void* range_base_address, size_t range_length,
+                             PageAccess access)>& callback) {
+  FILE* maps = fopen("/proc/self/maps", "r");
+  if (!maps) {
+    return false;
+  }
+  struct Range {
+    uint64_t start;
+    uint64_t end;
+    PageAccess access;
+  };
+  // Gathered before calling back, as changing the access rights changes the
+  // mappings being read.
+  std::vector<Range> ranges;
+  uint64_t range_start = uint64_t(base_address);
+  uint64_t range_end = range_start + length;
+  char line[4096];
+  while (fgets(line, sizeof(line), maps)) {
+    unsigned long long mapping_start, mapping_end;
+    char perms[5];
+    if (sscanf(line, "%llx-%llx %4s", &mapping_start, &mapping_end, perms) !=
+        3) {
+      continue;
+    }
+    uint64_t start = std::max(uint64_t(mapping_start), range_start);
+    uint64_t end = std::min(uint64_t(mapping_end), range_end);
+    if (start >= end) {
+      continue;
+    }
+    PageAccess access;
+    if (perms[0] != 'r') {
+      access = PageAccess::kNoAccess;
+    } else if (perms[2] == 'x') {
+      access = perms[1] == 'w' ? PageAccess::kExecuteReadWrite
+                               : PageAccess::kExecuteReadOnly;
+    } else {
+      access = perms[1] == 'w' ? PageAccess::kReadWrite : PageAccess::kReadOnly;
+    }
+    // Adjacent mappings may have the same access rights.
+    if (!ranges.empty() && ranges.back().end == start &&
+        ranges.back().access == access) {
+      ranges.back().end = end;
+    } else {
+      ranges.push_back({start, end, access});
+    }
+  }
+  fclose(maps);
+  for (const Range& range : ranges) {
+    callback(reinterpret_cast<void*>(uintptr_t(range.start)),
+             size_t(range.end - range.start), range.access);
+  }
+  return true;
+}
+
+size_t huge_page_size() {
+  static const size_t value = []() -> size_t {
+    FILE* file =
+        fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+    if (!file) {
+      return 0;
+    }
+    unsigned long long size;
+    if (fscanf(file, "%llu", &size) != 1) {
+      size = 0;
+    }
+    fclose(file);
+    return size_t(size);
+  }();
+  return value;
+}
+
+bool AdviseHugePages(void* base_address, size_t length) {
+#ifdef MADV_HUGEPAGE
+  return madvise(base_address, length, MADV_HUGEPAGE) == 0;
+#else
+  return false;
+#endif
+}
+
+size_t QueryHugePageBytes(const void* base_address, size_t length) {
+  FILE* smaps = fopen("/proc/self/smaps", "r");
+  if (!smaps) {
+    return 0;
+  }
+  uint64_t range_start = uint64_t(base_address);
+  uint64_t range_end = range_start + length;
+  bool in_range = false;
+  size_t huge_bytes = 0;
+  char line[4096];
+  while (fgets(line, sizeof(line), smaps)) {
+    // Each mapping starts with its address range, followed by its fields.
+    unsigned long long mapping_start, mapping_end, kilobytes;
+    char field[32];
+    if (sscanf(line, "%llx-%llx ", &mapping_start, &mapping_end) == 2) {
+      in_range = mapping_start < range_end && mapping_end > range_start;
+    } else if (in_range &&
+               sscanf(line, "%31[^:]: %llu kB", field, &kilobytes) == 2 &&
+               (!strcmp(field, "AnonHugePages") ||
+                !strcmp(field, "ShmemPmdMapped") ||
+                !strcmp(field, "FilePmdMapped"))) {
+      huge_bytes += size_t(kilobytes) * 1024;
+    }
+  }
+  fclose(smaps);
+  return huge_bytes;
+}
+
 FileMappingHandle CreateFileMappingHandle(const std::filesystem::path& path,
                                           size_t length, PageAccess access,
                                           bool commit) {
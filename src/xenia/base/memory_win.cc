@@ -9,6 +9,8 @@
 
 #include "xenia/base/memory.h"
 
+#include <algorithm>
+
 #include "xenia/base/platform_win.h"
 
 #if WINAPI_FAMILY_PARTITION(WINAPI_PARTITION_DESKTOP | \
@@ -172,6 +174,41 @@ bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out) {
   return true;
 }
 
+bool QueryProtectRanges(
+    void* base_address, size_t length,
+    const std::function<void(void* range_base_address, size_t range_length,
+                             PageAccess access)>& callback) {
+  auto address = reinterpret_cast<uint8_t*>(base_address);
+  auto end = address + length;
+  while (address < end) {
+    MEMORY_BASIC_INFORMATION info;
+    if (!VirtualQuery(address, &info, sizeof(info))) {
+      return false;
+    }
+    // The region may start before the address if it's the first one.
+    auto region_end =
+        std::min(reinterpret_cast<uint8_t*>(info.BaseAddress) + info.RegionSize,
+                 end);
+    if (info.State == MEM_COMMIT) {
+      callback(address, size_t(region_end - address),
+               ToXeniaProtectFlags(info.Protect));
+    }
+    address = region_end;
+  }
+  return true;
+}
+
+// Large pages must be allocated upfront by a process holding
+// SeLockMemoryPrivilege, can't be paged out, and can't be protected in parts,
+// so they're unsuitable for guest memory and code.
+size_t huge_page_size() { return 0; }
+
+bool AdviseHugePages(void* base_address, size_t length) { return false; }
+
+size_t QueryHugePageBytes(const void* base_address, size_t length) {
+  return 0;
+}
+
 FileMappingHandle CreateFileMappingHandle(const std::filesystem::path& path,
                                           size_t length, PageAccess access,
                                           bool commit) {
@@ -0,0 +1,220 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/free_page_index.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+#include "third_party/fmt/include/fmt/format.h"
+
+namespace xe {
+namespace base {
+namespace test {
+
+namespace {
+
+// Pages of the 4 KB virtual heap.
+constexpr uint32_t kHeapPageCount = 0x40000;
+
+struct TraceOp {
+  // Index of the earlier allocation op to release, or UINT32_MAX to allocate.
+  uint32_t release_op;
+  uint32_t page_count;
+  uint32_t stride;
+  bool top_down;
+};
+
+// Generates a trace like the allocations of a title keeping the heap around
+// three quarters full with allocations of mixed sizes and lifetimes, which
+// leaves it fragmented.
+std::vector<TraceOp> GenerateTrace(uint32_t op_count) {
+  std::mt19937 random(0x360);
+  std::vector<TraceOp> trace;
+  std::vector<uint32_t> live_ops;
+  uint32_t live_page_count = 0;
+  for (uint32_t i = 0; i < op_count; ++i) {
+    if (!live_ops.empty() &&
+        (live_page_count > kHeapPageCount / 4 * 3 || random() % 100 < 45)) {
+      size_t live_index = random() % live_ops.size();
+      uint32_t release_op = live_ops[live_index];
+      live_ops[live_index] = live_ops.back();
+      live_ops.pop_back();
+      live_page_count -= trace[release_op].page_count;
+      trace.push_back({release_op, 0, 0, false});
+      continue;
+    }
+    uint32_t size_class = random() % 100;
+    uint32_t page_count;
+    if (size_class < 75) {
+      page_count = 1 + random() % 16;
+    } else if (size_class < 95) {
+      page_count = 16 + random() % 240;
+    } else {
+      page_count = 256 + random() % 3840;
+    }
+    uint32_t stride = random() % 4 ? 1 : 16;
+    bool top_down = random() % 10 < 3;
+    live_ops.push_back(i);
+    live_page_count += page_count;
+    trace.push_back({UINT32_MAX, page_count, stride, top_down});
+  }
+  return trace;
+}
+
+// The page-by-page scan BaseHeap::AllocRange did before the index.
+bool ScanFind(const std::vector<uint8_t>& used, uint32_t low_base,
+              uint32_t high_base, uint32_t page_count, uint32_t stride,
+              bool top_down, uint32_t* out_base) {
+  if (top_down) {
+    for (int64_t base = high_base - high_base % stride; base >= low_base;
+         base -= stride) {
+      uint32_t page = uint32_t(base);
+      while (page < base + page_count && !used[page]) {
+        ++page;
+      }
+      if (page == base + page_count) {
+        *out_base = uint32_t(base);
+        return true;
+      }
+      if (page < page_count) {
+        return false;
+      }
+      base = page - page_count;
+      base -= base % stride;
+      base += stride;
+    }
+    return false;
+  }
+  for (uint32_t base = (low_base + stride - 1) / stride * stride;
+       base <= high_base; base += stride) {
+    uint32_t page = base;
+    while (page < base + page_count && !used[page]) {
+      ++page;
+    }
+    if (page == base + page_count) {
+      *out_base = base;
+      return true;
+    }
+    base = (page + stride) / stride * stride - stride;
+  }
+  return false;
+}
+
+// Replays the trace, returning the base page of every allocation, or
+// UINT32_MAX where it failed.
+std::vector<uint32_t> ReplayTrace(const std::vector<TraceOp>& trace,
+                                  bool use_index) {
+  FreePageIndex index;
+  index.Reset(kHeapPageCount);
+  std::vector<uint8_t> used(kHeapPageCount);
+  std::vector<uint32_t> bases(trace.size(), UINT32_MAX);
+  for (size_t i = 0; i < trace.size(); ++i) {
+    const TraceOp& op = trace[i];
+    if (op.release_op != UINT32_MAX) {
+      uint32_t base = bases[op.release_op];
+      uint32_t page_count = trace[op.release_op].page_count;
+      if (base == UINT32_MAX) {
+        continue;
+      }
+      if (use_index) {
+        index.MarkFree(base, page_count);
+      } else {
+        std::fill_n(used.begin() + base, page_count, 0);
+      }
+      continue;
+    }
+    uint32_t base;
+    uint32_t high_base = kHeapPageCount - op.page_count;
+    if (use_index) {
+      if (!index.Find(0, high_base, op.page_count, op.stride, op.top_down,
+                      &base)) {
+        continue;
+      }
+      index.MarkUsed(base, op.page_count);
+    } else {
+      if (!ScanFind(used, 0, high_base, op.page_count, op.stride, op.top_down,
+                    &base)) {
+        continue;
+      }
+      std::fill_n(used.begin() + base, op.page_count, 1);
+    }
+    bases[i] = base;
+  }
+  return bases;
+}
+
+}  // namespace
+
+TEST_CASE("free_page_index_find", "[free_page_index]") {
+  FreePageIndex index;
+  index.Reset(1000);
+  index.MarkUsed(0, 10);
+  index.MarkUsed(100, 200);
+  index.MarkUsed(990, 10);
+  uint32_t base;
+
+  REQUIRE(index.Find(0, 999, 5, 1, false, &base));
+  REQUIRE(base == 10);
+  REQUIRE(index.Find(0, 999, 5, 16, false, &base));
+  REQUIRE(base == 16);
+  REQUIRE(index.Find(0, 999, 91, 1, false, &base));
+  REQUIRE(base == 300);
+  REQUIRE(index.Find(20, 999, 5, 1, false, &base));
+  REQUIRE(base == 20);
+
+  REQUIRE(index.Find(0, 985, 5, 1, true, &base));
+  REQUIRE(base == 985);
+  REQUIRE(index.Find(0, 985, 5, 16, true, &base));
+  REQUIRE(base == 976);
+  REQUIRE(index.Find(0, 299, 5, 1, true, &base));
+  REQUIRE(base == 95);
+  REQUIRE(index.Find(0, 999, 690, 1, true, &base));
+  REQUIRE(base == 300);
+
+  REQUIRE(!index.Find(0, 999, 691, 1, false, &base));
+  REQUIRE(!index.Find(0, 999, 691, 1, true, &base));
+  REQUIRE(!index.Find(0, 9, 1, 1, false, &base));
+
+  index.MarkFree(100, 200);
+  REQUIRE(index.Find(0, 999, 691, 1, false, &base));
+  REQUIRE(base == 10);
+  REQUIRE(index.is_free(150));
+  REQUIRE(!index.is_free(995));
+}
+
+TEST_CASE("free_page_index_trace", "[free_page_index]") {
+  // Must place allocations exactly where the page-by-page scan did.
+  auto trace = GenerateTrace(20000);
+  REQUIRE(ReplayTrace(trace, true) == ReplayTrace(trace, false));
+}
+
+// Run explicitly with "[.benchmark]" to compare the index to scanning the
+// pages on a fragmented heap.
+TEST_CASE("free_page_index_trace_benchmark",
+          "[free_page_index][.benchmark]") {
+  auto trace = GenerateTrace(200000);
+  for (bool use_index : {false, true}) {
+    auto start = std::chrono::steady_clock::now();
+    ReplayTrace(trace, use_index);
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    WARN(fmt::format("{}: {} ops in {} us ({:.1f} ns/op)",
+                     use_index ? "FreePageIndex" : "Page scan", trace.size(),
+                     duration.count(),
+                     duration.count() * 1000.0 / trace.size()));
+  }
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
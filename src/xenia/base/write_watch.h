@@ -0,0 +1,48 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_WRITE_WATCH_H_
+#define XENIA_BASE_WRITE_WATCH_H_
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace xe {
+namespace memory {
+
+// Detects writes to pages without access violations. The host marks watched
+// pages as written on their first write without involving the process, and
+// the written pages are collected in bulk when polled, which is much cheaper
+// than a signal per page when many pages are written.
+class WriteWatch {
+ public:
+  // Returns nullptr if the host doesn't support it.
+  static std::unique_ptr<WriteWatch> Create();
+
+  virtual ~WriteWatch() = default;
+
+  // Starts watching the page-aligned range for writes. Mapping memory over
+  // the range stops the watch. Returns false if the range can't be watched.
+  virtual bool Watch(void* base_address, size_t length) = 0;
+
+  // Appends the ranges of pages within the page-aligned range written since
+  // they were last watched, as offsets from base_address and lengths. Pages
+  // stay written until watched again, and pages never watched may be
+  // reported as written. Returns false if the written pages are unknown.
+  virtual bool GetWritten(
+      void* base_address, size_t length,
+      std::vector<std::pair<size_t, size_t>>* out_ranges) = 0;
+};
+
+}  // namespace memory
+}  // namespace xe
+
+#endif  // XENIA_BASE_WRITE_WATCH_H_
@@ -0,0 +1,132 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/write_watch.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <linux/userfaultfd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+
+// Asynchronous userfaultfd write protection, resolving write faults in the
+// kernel without a handler, and collecting the pages no longer protected
+// with PAGEMAP_SCAN, both appeared in Linux 6.7.
+#if defined(UFFD_FEATURE_WP_ASYNC) && defined(PAGEMAP_SCAN)
+#define XE_WRITE_WATCH_USERFAULTFD 1
+#else
+#define XE_WRITE_WATCH_USERFAULTFD 0
+#endif
+
+namespace xe {
+namespace memory {
+
+#if XE_WRITE_WATCH_USERFAULTFD
+
+class UserfaultfdWriteWatch : public WriteWatch {
+ public:
+  UserfaultfdWriteWatch(int userfaultfd, int pagemap)
+      : userfaultfd_(userfaultfd), pagemap_(pagemap) {}
+  ~UserfaultfdWriteWatch() override {
+    close(pagemap_);
+    close(userfaultfd_);
+  }
+
+  bool Watch(void* base_address, size_t length) override {
+    // Registering again is fine, and needed as mapping memory over the range
+    // unregisters it.
+    uffdio_register uffd_register = {};
+    uffd_register.range.start = uint64_t(base_address);
+    uffd_register.range.len = length;
+    uffd_register.mode = UFFDIO_REGISTER_MODE_WP;
+    if (ioctl(userfaultfd_, UFFDIO_REGISTER, &uffd_register) < 0) {
+      return false;
+    }
+    uffdio_writeprotect write_protect = {};
+    write_protect.range = uffd_register.range;
+    write_protect.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+    return ioctl(userfaultfd_, UFFDIO_WRITEPROTECT, &write_protect) == 0;
+  }
+
+  bool GetWritten(void* base_address, size_t length,
+                  std::vector<std::pair<size_t, size_t>>* out_ranges) override {
+    page_region regions[64];
+    pm_scan_arg scan = {};
+    scan.size = sizeof(scan);
+    scan.start = uint64_t(base_address);
+    scan.end = uint64_t(base_address) + length;
+    scan.vec = uint64_t(regions);
+    scan.vec_len = xe::countof(regions);
+    scan.category_mask = PAGE_IS_WRITTEN;
+    scan.return_mask = PAGE_IS_WRITTEN;
+    while (true) {
+      int region_count = ioctl(pagemap_, PAGEMAP_SCAN, &scan);
+      if (region_count < 0) {
+        return false;
+      }
+      for (int i = 0; i < region_count; ++i) {
+        out_ranges->emplace_back(regions[i].start - uint64_t(base_address),
+                                 regions[i].end - regions[i].start);
+      }
+      // Stops early once the regions are filled.
+      if (scan.walk_end >= scan.end) {
+        return true;
+      }
+      scan.start = scan.walk_end;
+    }
+  }
+
+ private:
+  int userfaultfd_;
+  int pagemap_;
+};
+
+std::unique_ptr<WriteWatch> WriteWatch::Create() {
+  // Only handling faults in user mode doesn't need privileges, but appeared
+  // later than the rest.
+  int userfaultfd = int(
+      syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY));
+  if (userfaultfd < 0) {
+    userfaultfd = int(syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK));
+  }
+  if (userfaultfd < 0) {
+    XELOGI("userfaultfd is unavailable (error {})", errno);
+    return nullptr;
+  }
+  // Not yet populated pages must be protected too, as memory is committed
+  // lazily.
+  uffdio_api api = {};
+  api.api = UFFD_API;
+  api.features = UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_UNPOPULATED;
+  if (ioctl(userfaultfd, UFFDIO_API, &api) < 0) {
+    XELOGI("Asynchronous userfaultfd write protection is unavailable");
+    close(userfaultfd);
+    return nullptr;
+  }
+  int pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  if (pagemap < 0) {
+    close(userfaultfd);
+    return nullptr;
+  }
+  return std::make_unique<UserfaultfdWriteWatch>(userfaultfd, pagemap);
+}
+
+#else
+
+std::unique_ptr<WriteWatch> WriteWatch::Create() { return nullptr; }
+
+#endif  // XE_WRITE_WATCH_USERFAULTFD
+
+}  // namespace memory
+}  // namespace xe
@@ -0,0 +1,20 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/write_watch.h"
+
+namespace xe {
+namespace memory {
+
+// GetWriteWatch only supports memory allocated with VirtualAlloc, not views
+// of file mappings like guest memory.
+std::unique_ptr<WriteWatch> WriteWatch::Create() { return nullptr; }
+
+}  // namespace memory
+}  // namespace xe
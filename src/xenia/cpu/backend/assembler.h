@@ -41,6 +41,10 @@ class Assembler {
                         uint32_t debug_info_flags,
                         std::unique_ptr<FunctionDebugInfo> debug_info) = 0;
 
+  // Sets the function up from machine code persisted by a previous launch,
+  // skipping translation entirely. Returns false if no usable code is stored.
+  virtual bool AssembleFromStorage(GuestFunction* function) { return false; }
+
  protected:
   Backend* backend_;
 };
@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_BACKEND_BACKEND_H_
 #define XENIA_CPU_BACKEND_BACKEND_H_
 
+#include <filesystem>
 #include <memory>
 
 #include "xenia/cpu/backend/machine_info.h"
@@ -43,6 +44,15 @@ class Backend {
 
   virtual bool Initialize(Processor* processor);
 
+  // Directory where translated code may be persisted between launches, if the
+  // backend supports that. Must be set before executable ranges are committed.
+  const std::filesystem::path& code_storage_root() const {
+    return code_storage_root_;
+  }
+  void set_code_storage_root(const std::filesystem::path& code_storage_root) {
+    code_storage_root_ = code_storage_root;
+  }
+
   virtual void* AllocThreadData();
   virtual void FreeThreadData(void* thread_data);
 
@@ -60,6 +70,27 @@ class Backend {
   virtual uint64_t CalculateNextHostInstruction(ThreadDebugInfo* thread_info,
                                                 uint64_t current_pc) = 0;
 
+  // Captures the host PCs of the frames of the current thread, innermost
+  // first, starting with host_pc and following the callers in generated code.
+  // stack_high is the end of the stack, which host_sp points into. Called from
+  // signal handlers, so it must not lock or allocate.
+  // Returns the number of PCs written.
+  virtual size_t CaptureStack(uint64_t host_pc, uint64_t host_sp,
+                              uint64_t stack_high, uint64_t* frame_host_pcs,
+                              size_t frame_count) {
+    if (!frame_count) {
+      return 0;
+    }
+    frame_host_pcs[0] = host_pc;
+    return 1;
+  }
+
+  // Makes the next call of the function translate it again, for when its
+  // guest code has changed or is going away. Its current code is discarded
+  // once no thread may be running it anymore, if the backend supports that.
+  // The function must be claimed for definition by the caller.
+  virtual void InvalidateFunction(GuestFunction* function) {}
+
   virtual void InstallBreakpoint(Breakpoint* breakpoint) {}
   virtual void InstallBreakpoint(Breakpoint* breakpoint, Function* fn) {}
   virtual void UninstallBreakpoint(Breakpoint* breakpoint) {}
@@ -68,6 +99,7 @@ class Backend {
   Processor* processor_ = nullptr;
   MachineInfo machine_info_;
   CodeCache* code_cache_ = nullptr;
+  std::filesystem::path code_storage_root_;
 };
 
 }  // namespace backend
@@ -29,6 +29,9 @@ struct MachineInfo {
     char name[4];
     uint32_t types;
     uint32_t count;
+    // Registers (by index) that keep their values across calls into host
+    // code. Values that live for a whole function are only placed in these.
+    uint32_t preserved_mask;
   } register_sets[8];
 };
 
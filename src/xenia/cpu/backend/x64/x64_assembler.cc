@@ -74,33 +74,62 @@ bool X64Assembler::Assemble(GuestFunction* function, HIRBuilder* builder,
   // Reset when we leave.
   xe::make_reset_scope(this);
 
-  // Lower HIR -> x64.
+  // Lower HIR -> x64. When tiering up, other threads may be running the
+  // function, walking its frames or mapping its addresses, so nothing about
+  // it changes until the new code is published as a whole.
+  auto code = std::make_shared<GuestFunction::Code>();
   void* machine_code = nullptr;
   size_t code_size = 0;
   if (!emitter_->Emit(function, builder, debug_info_flags, debug_info.get(),
-                      &machine_code, &code_size, &function->source_map())) {
+                      &machine_code, &code_size, &code->source_map)) {
     return false;
   }
 
   // Stash generated machine code.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmMachineCode) {
-    DumpMachineCode(machine_code, code_size, function->source_map(),
+    DumpMachineCode(machine_code, code_size, code->source_map,
                     &string_buffer_);
     debug_info->set_machine_code_disasm(strdup(string_buffer_.buffer()));
     string_buffer_.Reset();
   }
 
-  function->set_debug_info(std::move(debug_info));
-  static_cast<X64Function*>(function)->Setup(
-      reinterpret_cast<uint8_t*>(machine_code), code_size);
+  code->machine_code = reinterpret_cast<uint8_t*>(machine_code);
+  code->machine_code_length = code_size;
+  code->debug_info = std::move(debug_info);
+  auto x64_function = static_cast<X64Function*>(function);
+  uint8_t* old_machine_code = x64_function->machine_code();
+  x64_function->Setup(std::move(code));
 
   // Install into indirection table.
   uint64_t host_address = reinterpret_cast<uint64_t>(machine_code);
   assert_true((host_address >> 32) == 0);
-  reinterpret_cast<X64CodeCache*>(backend_->code_cache())
-      ->AddIndirection(function->address(),
-                       static_cast<uint32_t>(host_address));
+  auto code_cache = reinterpret_cast<X64CodeCache*>(backend_->code_cache());
+  code_cache->AddIndirection(function->address(),
+                             static_cast<uint32_t>(host_address));
 
+  // If this replaces earlier code (when tiering up), direct calls linked to
+  // that code go back through the resolve thunk to pick up the new one, and
+  // the earlier code is reclaimed once no thread is running it anymore.
+  x64_function->UnlinkCallSites(code_cache);
+  x64_backend_->RetireCode(old_machine_code);
+
+  return true;
+}
+
+bool X64Assembler::AssembleFromStorage(GuestFunction* function) {
+  auto code_cache = x64_backend_->code_cache();
+  if (!code_cache->has_code_storage() || cvars::validate_stored_jit_code) {
+    return false;
+  }
+
+  // Indirection table entry is written when placing the code.
+  auto code = code_cache->RestoreGuestCode(
+      backend_->processor()->memory(), function,
+      reinterpret_cast<void*>(x64_backend_->resolve_call_site_thunk()));
+  if (!code) {
+    return false;
+  }
+  static_cast<X64Function*>(function)->Setup(std::move(code));
   return true;
 }
 
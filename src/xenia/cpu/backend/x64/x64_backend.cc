@@ -11,11 +11,16 @@
 
 #include <stddef.h>
 
+#include <algorithm>
+#include <string>
+
 #include "third_party/capstone/include/capstone/capstone.h"
 #include "third_party/capstone/include/capstone/x86.h"
+#include "third_party/fmt/include/fmt/format.h"
 
 #include "xenia/base/exception_handler.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/backend/x64/x64_assembler.h"
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/backend/x64/x64_emitter.h"
@@ -23,13 +28,39 @@
 #include "xenia/cpu/backend/x64/x64_sequences.h"
 #include "xenia/cpu/backend/x64/x64_stack_layout.h"
 #include "xenia/cpu/breakpoint.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/stack_walker.h"
+#include "xenia/cpu/thread_state.h"
 
 DEFINE_bool(
     use_haswell_instructions, true,
     "Uses the AVX2/FMA/etc instructions on Haswell processors when available.",
     "CPU");
+DEFINE_int32(max_x64_isa_level, 2,
+             "Highest x64 instruction set level to generate code for, to "
+             "compare code generation tiers: 0 for AVX, 1 for AVX2, FMA, "
+             "LZCNT, BMI2, F16C and MOVBE, 2 for AVX-512 (F, VL, BW, DQ and "
+             "VBMI). Extensions the host lacks are never used.",
+             "CPU");
+DEFINE_int32(inline_cache_size, 2,
+             "Number of targets (0 to 4) remembered by each indirect call or "
+             "branch site and called directly when matched. 0 always looks the "
+             "target up in the indirection table.",
+             "CPU");
+DEFINE_bool(log_inline_cache_stats, false,
+            "Count the hits and misses of the inline caches of indirect call "
+            "sites and log the busiest sites on exit.",
+            "CPU");
+DEFINE_bool(log_code_cache_stats, false,
+            "Log how much JIT code is live, waiting to be reclaimed and "
+            "reclaimed on exit.",
+            "CPU");
+
+DECLARE_bool(store_all_context_values);
+DECLARE_bool(global_context_promotion);
+DECLARE_bool(emit_source_annotations);
+DECLARE_bool(link_direct_calls);
 
 namespace xe {
 namespace cpu {
@@ -43,6 +74,7 @@ class X64ThunkEmitter : public X64Emitter {
   HostToGuestThunk EmitHostToGuestThunk();
   GuestToHostThunk EmitGuestToHostThunk();
   ResolveFunctionThunk EmitResolveFunctionThunk();
+  ResolveFunctionThunk EmitResolveCallSiteThunk();
 
  private:
   // The following four functions provide save/load functionality for registers.
@@ -64,6 +96,54 @@ X64Backend::X64Backend() : Backend(), code_cache_(nullptr) {
 }
 
 X64Backend::~X64Backend() {
+  if (cvars::log_inline_cache_stats) {
+    // Only of the code still reachable, reclaimed code has freed its sites.
+    std::vector<IndirectCallSite*> sites;
+    for (auto& code_sites : indirect_call_sites_) {
+      if (code_sites.second.retired) {
+        continue;
+      }
+      for (auto& site : code_sites.second.sites) {
+        sites.push_back(site.get());
+      }
+    }
+    auto total_count = [](const IndirectCallSite* site) {
+      uint64_t count = site->misses;
+      for (uint32_t i = 0; i < site->entry_count; ++i) {
+        count += site->hits[i];
+      }
+      return count;
+    };
+    std::sort(sites.begin(), sites.end(),
+              [&](const IndirectCallSite* a, const IndirectCallSite* b) {
+                return total_count(a) > total_count(b);
+              });
+    XELOGI("Busiest indirect call sites (of {}):", sites.size());
+    for (size_t i = 0; i < std::min(sites.size(), size_t(100)); ++i) {
+      auto site = sites[i];
+      if (!total_count(site)) {
+        break;
+      }
+      std::string targets;
+      for (uint32_t j = 0; j < site->used_count; ++j) {
+        targets += fmt::format(" {:08X}={}", site->targets[j], site->hits[j]);
+      }
+      XELOGI("  {:08X}{}: {} misses,{}", site->guest_address,
+             site->is_tail_call ? " (tail)" : "", site->misses,
+             targets.empty() ? " no targets" : targets);
+    }
+  }
+
+  if (cvars::log_code_cache_stats && code_cache_) {
+    auto stats = code_cache_->GetStats();
+    XELOGI(
+        "Code cache: {} bytes live in {} pieces, {} bytes in {} pieces "
+        "waiting to be reclaimed, {} bytes in {} pieces reclaimed, {} bytes "
+        "free",
+        stats.live_bytes, stats.live_count, stats.dead_bytes, stats.dead_count,
+        stats.reclaimed_bytes, stats.reclaimed_count, stats.free_bytes);
+  }
+
   if (capstone_handle_) {
     cs_close(&capstone_handle_);
   }
@@ -84,7 +164,7 @@ bool X64Backend::Initialize(Processor* processor) {
   }
 
   // Need movbe to do advanced LOAD/STORE tricks.
-  if (cvars::use_haswell_instructions) {
+  if (cvars::use_haswell_instructions && cvars::max_x64_isa_level >= 1) {
     machine_info_.supports_extended_load_store =
         cpu.has(Xbyak::util::Cpu::tMOVBE);
   } else {
@@ -96,6 +176,8 @@ bool X64Backend::Initialize(Processor* processor) {
   std::strcpy(gprs.name, "gpr");
   gprs.types = MachineInfo::RegisterSet::INT_TYPES;
   gprs.count = X64Emitter::GPR_COUNT;
+  // r10/r11 are saved by the guest-to-host thunk, the rest by the host.
+  gprs.preserved_mask = (1u << X64Emitter::GPR_COUNT) - 1;
 
   auto& xmms = machine_info_.register_sets[1];
   xmms.id = 1;
@@ -103,6 +185,13 @@ bool X64Backend::Initialize(Processor* processor) {
   xmms.types = MachineInfo::RegisterSet::FLOAT_TYPES |
                MachineInfo::RegisterSet::VEC_TYPES;
   xmms.count = X64Emitter::XMM_COUNT;
+#if XE_PLATFORM_WIN32
+  // xmm4/xmm5 are saved by the guest-to-host thunk, xmm6-xmm15 by the host.
+  xmms.preserved_mask = (1u << X64Emitter::XMM_COUNT) - 1;
+#else
+  // Only xmm4/xmm5 (saved by the guest-to-host thunk) survive host calls.
+  xmms.preserved_mask = 0b11;
+#endif  // XE_PLATFORM_WIN32
 
   code_cache_ = X64CodeCache::Create();
   Backend::code_cache_ = code_cache_.get();
@@ -116,6 +205,8 @@ bool X64Backend::Initialize(Processor* processor) {
   host_to_guest_thunk_ = thunk_emitter.EmitHostToGuestThunk();
   guest_to_host_thunk_ = thunk_emitter.EmitGuestToHostThunk();
   resolve_function_thunk_ = thunk_emitter.EmitResolveFunctionThunk();
+  resolve_call_site_thunk_ = thunk_emitter.EmitResolveCallSiteThunk();
+  emitter_feature_flags_ = thunk_emitter.feature_flags();
 
   // Set the code cache to use the ResolveFunction thunk for default
   // indirections.
@@ -135,9 +226,144 @@ bool X64Backend::Initialize(Processor* processor) {
   return true;
 }
 
+void* X64Backend::AllocThreadData() {
+  auto code_thread = new X64CodeCache::CodeThread();
+  code_cache_->RegisterThread(code_thread);
+  return code_thread;
+}
+
+void X64Backend::FreeThreadData(void* thread_data) {
+  auto code_thread = reinterpret_cast<X64CodeCache::CodeThread*>(thread_data);
+  code_cache_->UnregisterThread(code_thread);
+  delete code_thread;
+}
+
+void X64Backend::ReportSafepoint(ThreadState* thread_state, uint64_t host_sp) {
+  // Deep enough for most guest call stacks. Deeper ones just don't report
+  // until they return.
+  static const size_t kMaxFrameCount = 256;
+
+  auto code_thread =
+      reinterpret_cast<X64CodeCache::CodeThread*>(thread_state->backend_data());
+  uint64_t epoch = code_cache_->retire_epoch();
+  if (code_thread->safe_epoch.load(std::memory_order_relaxed) == epoch ||
+      code_thread->guest_depth.load(std::memory_order_relaxed) != 1) {
+    // Nothing retired since the last report, or host frames in between
+    // guest frames that the stack can't be walked past.
+    return;
+  }
+  // The return address of the thunk is the innermost guest frame.
+  uint64_t frame_host_pcs[kMaxFrameCount];
+  size_t frame_count =
+      CaptureStack(*reinterpret_cast<const uint64_t*>(host_sp), host_sp + 8,
+                   UINT64_MAX, frame_host_pcs, kMaxFrameCount);
+  // Only a walk all the way up to the entry into guest code accounts for all
+  // the code the thread may return to.
+  X64CodeCache::CodeFrameInfo outermost_frame;
+  if (frame_count >= kMaxFrameCount ||
+      !code_cache_->LookupCodeFrame(frame_host_pcs[frame_count - 1],
+                                    &outermost_frame) ||
+      outermost_frame.code !=
+          reinterpret_cast<const uint8_t*>(host_to_guest_thunk_)) {
+    return;
+  }
+  code_cache_->ReportSafepoint(code_thread, epoch, frame_host_pcs,
+                               frame_count);
+}
+
+void X64Backend::AddIndirectCallSites(
+    const uint8_t* machine_code,
+    std::vector<std::unique_ptr<IndirectCallSite>> sites) {
+  if (sites.empty()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(indirect_call_sites_mutex_);
+  auto& code_sites = indirect_call_sites_[machine_code];
+  assert_true(code_sites.sites.empty());
+  code_sites.sites = std::move(sites);
+  code_sites.retired = false;
+}
+
+void X64Backend::ReleaseIndirectCallSites(const uint8_t* machine_code) {
+  std::lock_guard<std::mutex> lock(indirect_call_sites_mutex_);
+  indirect_call_sites_.erase(machine_code);
+}
+
+void X64Backend::RetireCode(const uint8_t* machine_code) {
+  if (!machine_code) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(indirect_call_sites_mutex_);
+    auto it = indirect_call_sites_.find(machine_code);
+    if (it != indirect_call_sites_.end()) {
+      it->second.retired = true;
+    }
+  }
+  code_cache_->RetireCode(machine_code);
+}
+
+uint8_t* X64Backend::AddIndirectCallSiteTarget(IndirectCallSite* site,
+                                               X64Function* function) {
+  std::lock_guard<std::mutex> lock(indirect_call_sites_mutex_);
+  uint32_t guest_address = function->address();
+  uint32_t index = 0;
+  for (; index < site->used_count; ++index) {
+    if (site->targets[index] == guest_address) {
+      // Added by another thread that missed at the same time.
+      return function->machine_code();
+    }
+  }
+  if (index >= site->entry_count) {
+    return function->machine_code();
+  }
+  // Tail calls have no return address for the call site thunk to find the
+  // site with, so after the callee is recompiled they keep resolving it.
+  auto unlink_target =
+      site->is_tail_call
+          ? reinterpret_cast<void*>(resolve_function_thunk_)
+          : reinterpret_cast<void*>(resolve_call_site_thunk_);
+  // Link the call before making the entry match, so that a thread matching
+  // it never takes the placeholder target.
+  uint8_t* machine_code = function->LinkCallSite(
+      code_cache_.get(), site->call_sites[index], unlink_target);
+  if (!machine_code) {
+    // Invalidated, leave the entry for the caller to resolve it again.
+    return nullptr;
+  }
+  code_cache_->PatchCode32(site->compare_immediates[index], guest_address);
+  site->targets[index] = guest_address;
+  ++site->used_count;
+  return machine_code;
+}
+
+// Hash of the options changing the code emitted for the same guest code, which
+// stored code must have been emitted with to be reused.
+static uint64_t HashCodegenOptions() {
+  const int32_t options[] = {
+      cvars::disable_global_lock,        cvars::inline_max_instructions,
+      cvars::store_all_context_values,   cvars::global_context_promotion,
+      cvars::dead_store_elimination,     cvars::value_reduction,
+      cvars::global_register_allocation, cvars::block_layout,
+      cvars::emit_source_annotations,    cvars::link_direct_calls,
+      cvars::inline_cache_size,
+  };
+  return XXH3_64bits(options, sizeof(options));
+}
+
 void X64Backend::CommitExecutableRange(uint32_t guest_low,
                                        uint32_t guest_high) {
   code_cache_->CommitExecutableRange(guest_low, guest_high);
+
+  if (cvars::store_jit_code && !code_storage_root_.empty()) {
+    // Key the stored code by the guest code it was translated from.
+    uint64_t guest_code_hash =
+        XXH3_64bits(processor_->memory()->TranslateVirtual(guest_low),
+                    guest_high - guest_low);
+    code_cache_->InitializeCodeStorage(
+        code_storage_root_, guest_low, guest_high, guest_code_hash,
+        emitter_feature_flags_, HashCodegenOptions(), emitter_data_);
+  }
 }
 
 std::unique_ptr<Assembler> X64Backend::CreateAssembler() {
@@ -146,7 +372,7 @@ std::unique_ptr<Assembler> X64Backend::CreateAssembler() {
 
 std::unique_ptr<GuestFunction> X64Backend::CreateGuestFunction(
     Module* module, uint32_t address) {
-  return std::make_unique<X64Function>(module, address);
+  return std::make_unique<X64Function>(module, address, this);
 }
 
 uint64_t ReadCapstoneReg(X64Context* context, x86_reg reg) {
@@ -333,6 +559,119 @@ uint64_t X64Backend::CalculateNextHostInstruction(ThreadDebugInfo* thread_info,
   }
 }
 
+// Whether the stack space of the frame has already been freed at the offset,
+// by the epilog or before a tail call.
+static bool IsFrameStackFreed(const X64CodeCache::CodeFrameInfo& frame,
+                              uint32_t offset) {
+  if (offset < frame.prolog_stack_alloc_offset ||
+      (offset > frame.epilog_offset && offset < frame.cold_offset)) {
+    return true;
+  }
+  // add rsp, imm8 / add rsp, imm32 just before.
+  const uint8_t* code = frame.code + offset;
+  if (offset >= 4 && code[-4] == 0x48 && code[-3] == 0x83 &&
+      code[-2] == 0xC4 && code[-1] == uint8_t(frame.stack_size) &&
+      frame.stack_size < 0x80) {
+    return true;
+  }
+  if (offset >= 7 && code[-7] == 0x48 && code[-6] == 0x81 &&
+      code[-5] == 0xC4 &&
+      xe::load<uint32_t>(code - 4) == frame.stack_size) {
+    return true;
+  }
+  return false;
+}
+
+// Whether the code just before the address is a call, so that the address
+// may be a return address.
+static bool FollowsCall(const X64CodeCache::CodeFrameInfo& frame,
+                        uint64_t address) {
+  uint32_t offset = uint32_t(address - reinterpret_cast<uintptr_t>(frame.code));
+  const uint8_t* code = frame.code + offset;
+  // call r64
+  if (offset >= 2 && code[-2] == 0xFF && (code[-1] & 0xF8) == 0xD0) {
+    return true;
+  }
+  // call rel32
+  return offset >= 5 && code[-5] == 0xE8;
+}
+
+size_t X64Backend::CaptureStack(uint64_t host_pc, uint64_t host_sp,
+                                uint64_t stack_high, uint64_t* frame_host_pcs,
+                                size_t frame_count) {
+  // Host code called from generated code may be anywhere in the stack
+  // between the two, at most this far.
+  static const uint64_t kMaxHostStackScan = 64 * 1024;
+
+  if (!frame_count) {
+    return 0;
+  }
+  size_t count = 0;
+  frame_host_pcs[count++] = host_pc;
+
+  uint64_t pc = host_pc;
+  uint64_t sp = host_sp;
+  X64CodeCache::CodeFrameInfo frame;
+  if (!code_cache_->LookupCodeFrame(pc, &frame)) {
+    // Without unwind info for host code, look for the return address of the
+    // call out of generated code instead, the first one found being the
+    // innermost.
+    uint64_t scan_end = std::min(stack_high, host_sp + kMaxHostStackScan);
+    bool found = false;
+    for (uint64_t slot = host_sp; slot + 8 <= scan_end; slot += 8) {
+      uint64_t value = *reinterpret_cast<const uint64_t*>(slot);
+      if (code_cache_->LookupCodeFrame(value, &frame) &&
+          FollowsCall(frame, value)) {
+        pc = value;
+        sp = slot + 8;
+        found = true;
+        break;
+      }
+    }
+    if (!found || count >= frame_count) {
+      return count;
+    }
+    frame_host_pcs[count++] = pc;
+  }
+
+  // Generated code frames all have a known size, with the return address at
+  // the top.
+  while (count < frame_count) {
+    uint64_t slot = sp;
+    if (!IsFrameStackFreed(
+            frame, uint32_t(pc - reinterpret_cast<uintptr_t>(frame.code)))) {
+      slot += frame.stack_size;
+    }
+    if (slot + 8 > stack_high) {
+      break;
+    }
+    pc = *reinterpret_cast<const uint64_t*>(slot);
+    sp = slot + 8;
+    // Returning to the host code that entered generated code ends the walk.
+    if (!code_cache_->LookupCodeFrame(pc, &frame)) {
+      break;
+    }
+    frame_host_pcs[count++] = pc;
+  }
+  return count;
+}
+
+void X64Backend::InvalidateFunction(GuestFunction* function) {
+  auto x64_function = static_cast<X64Function*>(function);
+  uint8_t* machine_code = x64_function->machine_code();
+  if (!machine_code) {
+    return;
+  }
+  // Nothing may lead to the code anymore once retired: calls through the
+  // indirection table, direct calls and inline caches resolve the function
+  // again, translating it anew.
+  code_cache_->AddIndirection(function->address(),
+                              uint32_t(uint64_t(resolve_function_thunk_)));
+  x64_function->Setup(nullptr);
+  x64_function->UnlinkCallSites(code_cache_.get());
+  RetireCode(machine_code);
+}
+
 void X64Backend::InstallBreakpoint(Breakpoint* breakpoint) {
   breakpoint->ForEachHostAddress([breakpoint](uint64_t host_address) {
     auto ptr = reinterpret_cast<void*>(host_address);
@@ -463,6 +802,14 @@ HostToGuestThunk X64ThunkEmitter::EmitHostToGuestThunk() {
   return (HostToGuestThunk)fn;
 }
 
+// Called by the guest-to-host thunk before calling the host function.
+static void GuestToHostSafepoint(void* raw_context, uint64_t host_sp) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  auto backend =
+      static_cast<X64Backend*>(thread_state->processor()->backend());
+  backend->ReportSafepoint(thread_state, host_sp);
+}
+
 GuestToHostThunk X64ThunkEmitter::EmitGuestToHostThunk() {
   // rcx = target function
   // rdx = arg0
@@ -490,6 +837,19 @@ GuestToHostThunk X64ThunkEmitter::EmitGuestToHostThunk() {
   // Save off volatile registers.
   EmitSaveVolatileRegs();
 
+  if (cvars::reclaim_jit_code) {
+    // All the generated code the thread may return to is on the stack now,
+    // which lets retired code be reclaimed.
+    mov(rcx, GetContextReg());
+    lea(rdx, ptr[rsp + stack_size]);
+    mov(rax, reinterpret_cast<uint64_t>(&GuestToHostSafepoint));
+    call(rax);
+    mov(rcx, qword[rsp + offsetof(StackLayout::Thunk, r[1])]);
+    mov(rdx, qword[rsp + offsetof(StackLayout::Thunk, r[2])]);
+    mov(r8, qword[rsp + offsetof(StackLayout::Thunk, r[5])]);
+    mov(r9, qword[rsp + offsetof(StackLayout::Thunk, r[6])]);
+  }
+
   mov(rax, rcx);              // function
   mov(rcx, GetContextReg());  // context
   call(rax);
@@ -575,6 +935,66 @@ ResolveFunctionThunk X64ThunkEmitter::EmitResolveFunctionThunk() {
   return (ResolveFunctionThunk)fn;
 }
 
+// X64Emitter handles linking call sites.
+uint64_t ResolveCallSite(void* raw_context, uint64_t target_address,
+                         uint64_t call_site);
+
+ResolveFunctionThunk X64ThunkEmitter::EmitResolveCallSiteThunk() {
+  // ebx = target PPC address
+  // rcx = guest return address
+  // rsp + 0 = the end of the call site
+
+  struct _code_offsets {
+    size_t prolog;
+    size_t prolog_stack_alloc;
+    size_t body;
+    size_t epilog;
+    size_t tail;
+  } code_offsets = {};
+
+  const size_t stack_size = StackLayout::THUNK_STACK_SIZE;
+
+  code_offsets.prolog = getSize();
+
+  // rsp + 0 = return address
+  sub(rsp, stack_size);
+
+  code_offsets.prolog_stack_alloc = getSize();
+  code_offsets.body = getSize();
+
+  // Save volatile registers
+  EmitSaveVolatileRegs();
+
+  mov(rcx, rsi);  // context
+  mov(rdx, rbx);
+  mov(r8, qword[rsp + stack_size]);
+  mov(rax, reinterpret_cast<uint64_t>(&ResolveCallSite));
+  call(rax);
+
+  EmitLoadVolatileRegs();
+
+  code_offsets.epilog = getSize();
+
+  add(rsp, stack_size);
+  jmp(rax);
+
+  code_offsets.tail = getSize();
+
+  assert_zero(code_offsets.prolog);
+  EmitFunctionInfo func_info = {};
+  func_info.code_size.total = getSize();
+  func_info.code_size.prolog = code_offsets.body - code_offsets.prolog;
+  func_info.code_size.body = code_offsets.epilog - code_offsets.body;
+  func_info.code_size.epilog = code_offsets.tail - code_offsets.epilog;
+  func_info.code_size.tail = getSize() - code_offsets.tail;
+  func_info.prolog_stack_alloc_offset =
+      code_offsets.prolog_stack_alloc - code_offsets.prolog;
+  func_info.stack_size = stack_size;
+
+  void* fn = Emplace(func_info);
+  return (ResolveFunctionThunk)fn;
+}
+
 void X64ThunkEmitter::EmitSaveVolatileRegs() {
   // Save off volatile registers.
   // mov(qword[rsp + offsetof(StackLayout::Thunk, r[0])], rax);
@@ -11,14 +11,24 @@
 #define XENIA_CPU_BACKEND_X64_X64_BACKEND_H_
 
 #include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include "xenia/base/cvar.h"
 #include "xenia/cpu/backend/backend.h"
 
 DECLARE_bool(use_haswell_instructions);
+DECLARE_int32(max_x64_isa_level);
+DECLARE_int32(inline_cache_size);
+DECLARE_bool(log_inline_cache_stats);
+DECLARE_bool(log_code_cache_stats);
 
 namespace xe {
 class Exception;
+namespace cpu {
+class ThreadState;
+}  // namespace cpu
 }  // namespace xe
 namespace xe {
 namespace cpu {
@@ -26,6 +36,7 @@ namespace backend {
 namespace x64 {
 
 class X64CodeCache;
+class X64Function;
 
 #define XENIA_HAS_X64_BACKEND 1
 
@@ -33,6 +44,29 @@ typedef void* (*HostToGuestThunk)(void* target, void* arg0, void* arg1);
 typedef void* (*GuestToHostThunk)(void* target, void* arg0, void* arg1);
 typedef void (*ResolveFunctionThunk)();
 
+// Inline cache of an indirect call site, see X64Emitter::CallIndirect. Each
+// entry compares the target against a guest address embedded in the code and
+// calls the matching function directly. Entries are filled in on misses.
+struct IndirectCallSite {
+  static const uint32_t kMaxEntryCount = 4;
+  // Guest address of the call instruction.
+  uint32_t guest_address;
+  // Entries emitted in the code.
+  uint32_t entry_count;
+  // Entries filled in so far. Read by the code to skip the resolve call once
+  // all entries are taken.
+  uint32_t used_count;
+  uint32_t is_tail_call;
+  // Counted only with log_inline_cache_stats.
+  uint32_t hits[kMaxEntryCount];
+  uint32_t misses;
+  uint32_t targets[kMaxEntryCount];
+  // Execute addresses of the guest address immediates compared against and of
+  // the ends of the call or jmp instructions.
+  uint8_t* compare_immediates[kMaxEntryCount];
+  uint8_t* call_sites[kMaxEntryCount];
+};
+
 class X64Backend : public Backend {
  public:
   static const uint32_t kForceReturnAddress = 0x9FFF0000u;
@@ -42,6 +76,8 @@ class X64Backend : public Backend {
 
   X64CodeCache* code_cache() const { return code_cache_.get(); }
   uintptr_t emitter_data() const { return emitter_data_; }
+  // X64EmitterFeatureFlags used by all emitters of this backend.
+  uint32_t emitter_feature_flags() const { return emitter_feature_flags_; }
 
   // Call a generated function, saving all stack parameters.
   HostToGuestThunk host_to_guest_thunk() const { return host_to_guest_thunk_; }
@@ -51,9 +87,38 @@ class X64Backend : public Backend {
   ResolveFunctionThunk resolve_function_thunk() const {
     return resolve_function_thunk_;
   }
+  // Target of unlinked direct call sites, which resolves the callee and
+  // patches the call site to call it directly from then on.
+  ResolveFunctionThunk resolve_call_site_thunk() const {
+    return resolve_call_site_thunk_;
+  }
 
   bool Initialize(Processor* processor) override;
 
+  // X64CodeCache::CodeThread of the thread.
+  void* AllocThreadData() override;
+  void FreeThreadData(void* thread_data) override;
+  // Called by the guest-to-host thunk with the stack pointer at its return
+  // address, to let the code cache reclaim the retired code that the thread
+  // isn't running anymore.
+  void ReportSafepoint(ThreadState* thread_state, uint64_t host_sp);
+
+  // Takes ownership of the inline caches of placed code until the code is
+  // reclaimed.
+  void AddIndirectCallSites(
+      const uint8_t* machine_code,
+      std::vector<std::unique_ptr<IndirectCallSite>> sites);
+  // Frees the inline caches of reclaimed code, as nothing may run it anymore.
+  void ReleaseIndirectCallSites(const uint8_t* machine_code);
+  // Fills in the next free entry of the site for the function if there's one
+  // left. Returns the machine code of the function, or nullptr if it has been
+  // invalidated.
+  uint8_t* AddIndirectCallSiteTarget(IndirectCallSite* site,
+                                     X64Function* function);
+
+  // Retires code that nothing leads to anymore, see X64CodeCache::RetireCode.
+  void RetireCode(const uint8_t* machine_code);
+
   void CommitExecutableRange(uint32_t guest_low, uint32_t guest_high) override;
 
   std::unique_ptr<Assembler> CreateAssembler() override;
@@ -64,6 +129,11 @@ class X64Backend : public Backend {
   uint64_t CalculateNextHostInstruction(ThreadDebugInfo* thread_info,
                                         uint64_t current_pc) override;
 
+  size_t CaptureStack(uint64_t host_pc, uint64_t host_sp, uint64_t stack_high,
+                      uint64_t* frame_host_pcs, size_t frame_count) override;
+
+  void InvalidateFunction(GuestFunction* function) override;
+
   void InstallBreakpoint(Breakpoint* breakpoint) override;
   void InstallBreakpoint(Breakpoint* breakpoint, Function* fn) override;
   void UninstallBreakpoint(Breakpoint* breakpoint) override;
@@ -76,10 +146,22 @@ class X64Backend : public Backend {
 
   std::unique_ptr<X64CodeCache> code_cache_;
   uintptr_t emitter_data_ = 0;
+  uint32_t emitter_feature_flags_ = 0;
 
   HostToGuestThunk host_to_guest_thunk_;
   GuestToHostThunk guest_to_host_thunk_;
   ResolveFunctionThunk resolve_function_thunk_;
+  ResolveFunctionThunk resolve_call_site_thunk_;
+
+  // Inline caches by the placed code they're in.
+  struct CodeIndirectCallSites {
+    std::vector<std::unique_ptr<IndirectCallSite>> sites;
+    // Left out of the statistics, as the code isn't reachable anymore.
+    bool retired = false;
+  };
+  std::mutex indirect_call_sites_mutex_;
+  std::unordered_map<const uint8_t*, CodeIndirectCallSites>
+      indirect_call_sites_;
 };
 
 }  // namespace x64
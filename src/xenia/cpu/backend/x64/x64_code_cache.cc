@@ -9,6 +9,7 @@
 
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 
@@ -17,23 +18,74 @@
 #pragma comment(lib, "../third_party/vtune/lib64/jitprofiling.lib")
 #endif
 
+#include "build/version.h"
 #include "third_party/fmt/include/fmt/format.h"
 #include "xenia/base/assert.h"
+#include "xenia/base/byte_order.h"
 #include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/xxhash.h"
+#include "xenia/cpu/backend/x64/x64_perf_map.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/module.h"
+#include "xenia/memory.h"
+
+DEFINE_bool(store_jit_code, true,
+            "Store translated guest code in the cache directory and reuse it "
+            "on subsequent launches of the same executable.",
+            "CPU");
+DEFINE_bool(validate_stored_jit_code, false,
+            "Retranslate functions present in the stored JIT code and log any "
+            "differences from the stored machine code instead of using it.",
+            "CPU");
+DEFINE_bool(perf_map, false,
+            "Write the names of placed JIT code to /tmp/perf-<pid>.map for "
+            "Linux perf.",
+            "CPU");
+DEFINE_bool(perf_jitdump, false,
+            "Write placed JIT code and the guest addresses it was emitted for "
+            "to /tmp/jit-<pid>.dump, for perf inject --jit.",
+            "CPU");
+DEFINE_bool(reclaim_jit_code, true,
+            "Reuse the space of JIT code replaced by optimized code or "
+            "invalidated once no thread may be running it anymore.",
+            "CPU");
+
+DECLARE_bool(huge_pages);
 
 namespace xe {
 namespace cpu {
 namespace backend {
 namespace x64 {
 
-X64CodeCache::X64CodeCache() = default;
+X64CodeCache::X64CodeCache() {
+  for (auto& page : code_frame_pages_) {
+    page.store(nullptr, std::memory_order_relaxed);
+  }
+}
 
 X64CodeCache::~X64CodeCache() {
+  ShutdownCodeStorage();
+
+  if (cvars::huge_pages && generated_code_execute_base_) {
+    size_t huge_page_bytes = xe::memory::QueryHugePageBytes(
+        generated_code_execute_base_, generated_code_commit_mark_);
+    size_t huge_page_size = xe::memory::huge_page_size();
+    XELOGI("Code cache was backed by {} huge pages ({} MB) of {} MB committed",
+           huge_page_size ? huge_page_bytes / huge_page_size : 0,
+           huge_page_bytes >> 20, size_t(generated_code_commit_mark_) >> 20);
+  }
+
+  for (auto& page : code_frame_pages_) {
+    delete page.load(std::memory_order_relaxed);
+  }
+  for (auto page : retired_code_frame_pages_) {
+    delete page;
+  }
+
   if (indirection_table_base_) {
     xe::memory::DeallocFixed(indirection_table_base_, 0,
                              xe::memory::DeallocationType::kRelease);
@@ -117,8 +169,8 @@ bool X64CodeCache::Initialize() {
     }
   }
 
-  // Preallocate the function map to a large, reasonable size.
-  generated_code_map_.reserve(kMaximumFunctionCount);
+  perf_map_writer_ =
+      PerfMapWriter::Create(cvars::perf_map, cvars::perf_jitdump);
 
   return true;
 }
@@ -138,6 +190,33 @@ void X64CodeCache::AddIndirection(uint32_t guest_address,
   *indirection_slot = host_address;
 }
 
+void X64CodeCache::PatchCode32(uint8_t* address, uint32_t value) {
+  auto write_address = reinterpret_cast<std::atomic<uint32_t>*>(
+      generated_code_write_base_ + (address - generated_code_execute_base_));
+  assert_zero(reinterpret_cast<uintptr_t>(write_address) & 3);
+  write_address->store(value, std::memory_order_release);
+}
+
+void X64CodeCache::PatchCallSite(uint8_t* call_site, const void* target) {
+  int64_t displacement = reinterpret_cast<intptr_t>(target) -
+                         reinterpret_cast<intptr_t>(call_site);
+  assert_true(displacement == int32_t(displacement));
+  // Threads executing the call concurrently go to either the old or the new
+  // target, both of which are valid.
+  PatchCode32(call_site - 4, uint32_t(int32_t(displacement)));
+}
+
+void X64CodeCache::PatchCallSite(uint8_t* call_site, const void* target,
+                                 uint64_t code_id) {
+  // The code can't be reclaimed and replaced while checking and patching it.
+  std::lock_guard<std::mutex> lock(placement_mutex_);
+  CodeFrameInfo frame;
+  if (LookupCodeFrame(reinterpret_cast<uintptr_t>(call_site - 1), &frame) &&
+      frame.id == code_id) {
+    PatchCallSite(call_site, target);
+  }
+}
+
 void X64CodeCache::CommitExecutableRange(uint32_t guest_low,
                                          uint32_t guest_high) {
   if (!indirection_table_base_) {
@@ -172,88 +251,65 @@ void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
                                   GuestFunction* function_info,
                                   void*& code_execute_address_out,
                                   void*& code_write_address_out) {
-  // Hold a lock while we bump the pointers up. This is important as the
-  // unwind table requires entries AND code to be sorted in order.
-  size_t low_mark;
-  size_t high_mark;
-  uint8_t* code_execute_address;
-  UnwindReservation unwind_reservation;
+  // Hold a lock while we reserve the space and register the frame, as the
+  // free space and the frame table are shared. Nothing else needs ordering,
+  // so copying the code and notifying subclasses happen outside of it, and
+  // threads placing different functions at the same time only wait on each
+  // other for the reservation.
+  // Always move the code to land on 16b alignment, followed by the unwind
+  // info. We go on the high size of the unwind info as we don't know how big
+  // we need it, and a few extra bytes of padding isn't the worst thing.
+  size_t code_reserved_size = xe::round_up(func_info.code_size.total, 16);
+  size_t reserved_size =
+      code_reserved_size + xe::round_up(unwind_info_size(), 16);
+  size_t offset;
   {
-    auto global_lock = global_critical_region_.Acquire();
+    std::lock_guard<std::mutex> lock(placement_mutex_);
+    offset = AllocateCodeSpace(reserved_size);
 
-    low_mark = generated_code_offset_;
+    // Store in the frame table. Nothing looks up the code before it is
+    // returned, so it's fine to publish it before it's copied.
+    CodeFrameInfo frame;
+    frame.id = next_code_id_++;
+    frame.code = generated_code_execute_base_ + offset;
+    frame.code_size = uint32_t(func_info.code_size.total);
+    frame.reserved_size = uint32_t(reserved_size);
+    frame.prolog_stack_alloc_offset =
+        uint32_t(func_info.prolog_stack_alloc_offset);
+    frame.epilog_offset =
+        uint32_t(func_info.code_size.prolog + func_info.code_size.body);
+    frame.cold_offset =
+        frame.epilog_offset + uint32_t(func_info.code_size.epilog);
+    frame.stack_size = uint32_t(func_info.stack_size);
+    frame.function = function_info;
+    InsertCodeFrame(frame);
 
-    // Reserve code.
-    // Always move the code to land on 16b alignment.
-    code_execute_address =
-        generated_code_execute_base_ + generated_code_offset_;
-    code_execute_address_out = code_execute_address;
-    uint8_t* code_write_address =
-        generated_code_write_base_ + generated_code_offset_;
-    code_write_address_out = code_write_address;
-    generated_code_offset_ += xe::round_up(func_info.code_size.total, 16);
-
-    auto tail_write_address =
-        generated_code_write_base_ + generated_code_offset_;
-
-    // Reserve unwind info.
-    // We go on the high size of the unwind info as we don't know how big we
-    // need it, and a few extra bytes of padding isn't the worst thing.
-    unwind_reservation = RequestUnwindReservation(generated_code_write_base_ +
-                                                  generated_code_offset_);
-    generated_code_offset_ += xe::round_up(unwind_reservation.data_size, 16);
-
-    auto end_write_address =
-        generated_code_write_base_ + generated_code_offset_;
-
-    high_mark = generated_code_offset_;
-
-    // Store in map. It is maintained in sorted order of host PC dependent on
-    // us also being append-only.
-    generated_code_map_.emplace_back(
-        (uint64_t(code_execute_address - generated_code_execute_base_) << 32) |
-            generated_code_offset_,
-        function_info);
-
-    // TODO(DrChat): The following code doesn't really need to be under the
-    // global lock except for PlaceCode (but it depends on the previous code
-    // already being ran)
-
-    // If we are going above the high water mark of committed memory, commit
-    // some more. It's ok if multiple threads do this, as redundant commits
-    // aren't harmful.
-    size_t old_commit_mark, new_commit_mark;
-    do {
-      old_commit_mark = generated_code_commit_mark_;
-      if (high_mark <= old_commit_mark) break;
-
-      new_commit_mark = old_commit_mark + 16 * 1024 * 1024;
-      if (generated_code_execute_base_ == generated_code_write_base_) {
-        xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
-                               xe::memory::AllocationType::kCommit,
-                               xe::memory::PageAccess::kExecuteReadWrite);
-      } else {
-        xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
-                               xe::memory::AllocationType::kCommit,
-                               xe::memory::PageAccess::kExecuteReadOnly);
-        xe::memory::AllocFixed(generated_code_write_base_, new_commit_mark,
-                               xe::memory::AllocationType::kCommit,
-                               xe::memory::PageAccess::kReadWrite);
-      }
-    } while (generated_code_commit_mark_.compare_exchange_weak(
-        old_commit_mark, new_commit_mark));
+    stats_.live_bytes += reserved_size;
+    ++stats_.live_count;
+  }
+  uint8_t* code_execute_address = generated_code_execute_base_ + offset;
+  uint8_t* code_write_address = generated_code_write_base_ + offset;
+  uint8_t* tail_write_address = code_write_address + func_info.code_size.total;
+  uint8_t* end_write_address = code_write_address + reserved_size;
+  UnwindReservation unwind_reservation;
+  unwind_reservation.data_size = reserved_size - code_reserved_size;
+  unwind_reservation.entry_address = code_write_address + code_reserved_size;
+  code_execute_address_out = code_execute_address;
+  code_write_address_out = code_write_address;
 
-    // Copy code.
-    std::memcpy(code_write_address, machine_code, func_info.code_size.total);
+  CommitCode(offset + reserved_size);
 
-    // Fill unused slots with 0xCC
-    std::memset(tail_write_address, 0xCC,
-                static_cast<size_t>(end_write_address - tail_write_address));
+  // Copy code.
+  std::memcpy(code_write_address, machine_code, func_info.code_size.total);
 
-    // Notify subclasses of placed code.
-    PlaceCode(guest_address, machine_code, func_info, code_execute_address,
-              unwind_reservation);
-  }
+  // Fill unused slots with 0xCC, including the unwind info space that
+  // subclasses may fill next.
+  std::memset(tail_write_address, 0xCC,
+              static_cast<size_t>(end_write_address - tail_write_address));
+
+  // Notify subclasses of placed code.
+  PlaceCode(guest_address, machine_code, func_info, code_execute_address,
+            unwind_reservation);
 
 #if ENABLE_VTUNE
   if (iJIT_IsProfilingActive() == iJIT_SAMPLING_ON) {
@@ -287,21 +343,309 @@ void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
   }
 }
 
-uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
-  // Hold a lock while we bump the pointers up.
-  size_t high_mark;
-  uint8_t* data_address = nullptr;
-  {
-    auto global_lock = global_critical_region_.Acquire();
+void X64CodeCache::DescribePlacedCode(
+    uint32_t guest_address, GuestFunction* function_info,
+    const std::vector<SourceMapEntry>* source_map,
+    const void* code_execute_address, size_t code_size) {
+  if (!perf_map_writer_) {
+    return;
+  }
+  // Names from the module map, if one has been loaded, are already set.
+  static const std::vector<SourceMapEntry> empty_source_map;
+  std::string name;
+  std::string file_name;
+  if (!function_info) {
+    name = fmt::format("xe_host_code_{:X}",
+                       reinterpret_cast<uintptr_t>(code_execute_address));
+  } else {
+    name = function_info->name().empty()
+               ? fmt::format("sub_{:08X}", guest_address)
+               : function_info->name();
+    file_name = function_info->module()->name();
+  }
+  perf_map_writer_->WriteCode(
+      code_execute_address, code_size, name, file_name,
+      source_map ? *source_map : empty_source_map);
+}
 
-    // Reserve code.
-    // Always move the code to land on 16b alignment.
-    data_address = generated_code_write_base_ + generated_code_offset_;
-    generated_code_offset_ += xe::round_up(length, 16);
+bool X64CodeCache::LookupCodeFrame(uint64_t host_pc,
+                                   CodeFrameInfo* out_frame) const {
+  if (host_pc < uintptr_t(generated_code_execute_base_) ||
+      host_pc >= uintptr_t(generated_code_execute_base_) + kGeneratedCodeSize) {
+    return false;
+  }
+  // Replaced pages aren't deleted while any lookup is in progress.
+  code_frame_lookup_count_.fetch_add(1);
+  const CodeFramePage* page =
+      code_frame_pages_[(host_pc - uintptr_t(generated_code_execute_base_)) >>
+                        kCodeFramePageShift]
+          .load();
+  bool found = false;
+  if (page) {
+    uint32_t count = page->count.load(std::memory_order_acquire);
+    const CodeFrameInfo* frames = page->frames.get();
+    auto it = std::upper_bound(
+        frames, frames + count, host_pc,
+        [](uint64_t host_pc, const CodeFrameInfo& frame) {
+          return host_pc < reinterpret_cast<uintptr_t>(frame.code);
+        });
+    if (it != frames) {
+      --it;
+      if (host_pc < reinterpret_cast<uintptr_t>(it->code) + it->code_size) {
+        *out_frame = *it;
+        found = true;
+      }
+    }
+  }
+  code_frame_lookup_count_.fetch_sub(1);
+  return found;
+}
+
+void X64CodeCache::InsertCodeFrame(const CodeFrameInfo& frame) {
+  size_t offset = size_t(frame.code - generated_code_execute_base_);
+  size_t first_page = offset >> kCodeFramePageShift;
+  size_t last_page = (offset + std::max(frame.code_size, uint32_t(1)) - 1) >>
+                     kCodeFramePageShift;
+  for (size_t i = first_page; i <= last_page; ++i) {
+    CodeFramePage* page = code_frame_pages_[i].load(std::memory_order_relaxed);
+    uint32_t count = page ? page->count.load(std::memory_order_relaxed) : 0;
+    const CodeFrameInfo* frames = page ? page->frames.get() : nullptr;
+    uint32_t position = uint32_t(
+        std::upper_bound(frames, frames + count, frame.code,
+                         [](const uint8_t* code, const CodeFrameInfo& frame) {
+                           return code < frame.code;
+                         }) -
+        frames);
+    if (page && position == count && count < page->capacity) {
+      // Appending, which lookups can see happen through the count.
+      page->frames[count] = frame;
+      page->count.store(count + 1, std::memory_order_release);
+      continue;
+    }
+    auto new_page = new CodeFramePage;
+    new_page->capacity = std::max(uint32_t(16), count * 2);
+    new_page->frames.reset(new CodeFrameInfo[new_page->capacity]);
+    std::copy(frames, frames + position, new_page->frames.get());
+    new_page->frames[position] = frame;
+    std::copy(frames + position, frames + count,
+              new_page->frames.get() + position + 1);
+    new_page->count.store(count + 1, std::memory_order_relaxed);
+    code_frame_pages_[i].store(new_page);
+    if (page) {
+      retired_code_frame_pages_.push_back(page);
+    }
+  }
+  if (!retired_code_frame_pages_.empty() && !code_frame_lookup_count_.load()) {
+    for (auto page : retired_code_frame_pages_) {
+      delete page;
+    }
+    retired_code_frame_pages_.clear();
+  }
+}
 
-    high_mark = generated_code_offset_;
+void X64CodeCache::RemoveCodeFrame(const CodeFrameInfo& frame) {
+  size_t offset = size_t(frame.code - generated_code_execute_base_);
+  size_t first_page = offset >> kCodeFramePageShift;
+  size_t last_page = (offset + std::max(frame.code_size, uint32_t(1)) - 1) >>
+                     kCodeFramePageShift;
+  for (size_t i = first_page; i <= last_page; ++i) {
+    CodeFramePage* page = code_frame_pages_[i].load(std::memory_order_relaxed);
+    if (!page) {
+      continue;
+    }
+    uint32_t count = page->count.load(std::memory_order_relaxed);
+    const CodeFrameInfo* frames = page->frames.get();
+    auto it = std::find_if(frames, frames + count,
+                           [&frame](const CodeFrameInfo& page_frame) {
+                             return page_frame.code == frame.code;
+                           });
+    if (it == frames + count) {
+      continue;
+    }
+    CodeFramePage* new_page = nullptr;
+    if (count > 1) {
+      new_page = new CodeFramePage;
+      new_page->capacity = page->capacity;
+      new_page->frames.reset(new CodeFrameInfo[new_page->capacity]);
+      auto new_end = std::copy(frames, it, new_page->frames.get());
+      std::copy(it + 1, frames + count, new_end);
+      new_page->count.store(count - 1, std::memory_order_relaxed);
+    }
+    code_frame_pages_[i].store(new_page);
+    retired_code_frame_pages_.push_back(page);
   }
+  if (!retired_code_frame_pages_.empty() && !code_frame_lookup_count_.load()) {
+    for (auto page : retired_code_frame_pages_) {
+      delete page;
+    }
+    retired_code_frame_pages_.clear();
+  }
+}
 
+size_t X64CodeCache::AllocateCodeSpace(size_t size) {
+  // Best fit among the reclaimed space, splitting what's left over.
+  auto it = free_code_space_by_size_.lower_bound(size);
+  if (it != free_code_space_by_size_.end()) {
+    size_t offset = it->second;
+    size_t free_size = it->first;
+    free_code_space_by_size_.erase(it);
+    free_code_space_.erase(offset);
+    if (free_size > size) {
+      free_code_space_.emplace(offset + size, free_size - size);
+      free_code_space_by_size_.emplace(free_size - size, offset + size);
+    }
+    return offset;
+  }
+  size_t offset = generated_code_offset_;
+  generated_code_offset_ += size;
+  assert_true(generated_code_offset_ <= kGeneratedCodeSize);
+  return offset;
+}
+
+void X64CodeCache::FreeCodeSpace(size_t offset, size_t size) {
+  auto erase_by_size = [this](size_t offset, size_t size) {
+    auto range = free_code_space_by_size_.equal_range(size);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == offset) {
+        free_code_space_by_size_.erase(it);
+        break;
+      }
+    }
+  };
+  // Merge with the adjacent free space.
+  auto next = free_code_space_.lower_bound(offset);
+  if (next != free_code_space_.end() && next->first == offset + size) {
+    size += next->second;
+    erase_by_size(next->first, next->second);
+    next = free_code_space_.erase(next);
+  }
+  if (next != free_code_space_.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      offset = prev->first;
+      size += prev->second;
+      erase_by_size(prev->first, prev->second);
+      free_code_space_.erase(prev);
+    }
+  }
+  if (offset + size == generated_code_offset_) {
+    generated_code_offset_ = offset;
+    return;
+  }
+  free_code_space_.emplace(offset, size);
+  free_code_space_by_size_.emplace(size, offset);
+}
+
+void X64CodeCache::RegisterThread(CodeThread* thread) {
+  std::lock_guard<std::mutex> lock(placement_mutex_);
+  code_threads_.push_back(thread);
+}
+
+void X64CodeCache::UnregisterThread(CodeThread* thread) {
+  std::lock_guard<std::mutex> lock(placement_mutex_);
+  auto it = std::find(code_threads_.begin(), code_threads_.end(), thread);
+  if (it != code_threads_.end()) {
+    code_threads_.erase(it);
+  }
+  // The thread may have been the one holding back reclamation.
+  ReclaimCode();
+}
+
+void X64CodeCache::RetireCode(const void* code_execute_address) {
+  if (!cvars::reclaim_jit_code || !code_execute_address) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(placement_mutex_);
+  CodeFrameInfo frame;
+  if (!LookupCodeFrame(reinterpret_cast<uintptr_t>(code_execute_address),
+                       &frame) ||
+      frame.code != code_execute_address) {
+    assert_always();
+    return;
+  }
+  // The frame stays registered until the code is reclaimed, for the threads
+  // still running it to be able to walk their stacks.
+  RetiredCode retired;
+  retired.offset = size_t(frame.code - generated_code_execute_base_);
+  retired.size = frame.reserved_size;
+  retired.epoch = retire_epoch_.fetch_add(1) + 1;
+  retired_code_.push_back(retired);
+  stats_.live_bytes -= retired.size;
+  --stats_.live_count;
+  stats_.dead_bytes += retired.size;
+  ++stats_.dead_count;
+  ReclaimCode();
+}
+
+void X64CodeCache::ReportSafepoint(CodeThread* thread, uint64_t epoch,
+                                   const uint64_t* frame_host_pcs,
+                                   size_t frame_count) {
+  std::lock_guard<std::mutex> lock(placement_mutex_);
+  for (const auto& retired : retired_code_) {
+    if (retired.epoch > epoch) {
+      continue;
+    }
+    uintptr_t retired_address =
+        uintptr_t(generated_code_execute_base_) + retired.offset;
+    for (size_t i = 0; i < frame_count; ++i) {
+      if (frame_host_pcs[i] - retired_address < retired.size) {
+        // Still running the code, try again at the next safepoint.
+        return;
+      }
+    }
+  }
+  thread->safe_epoch.store(epoch);
+  ReclaimCode();
+}
+
+void X64CodeCache::ReclaimCode() {
+  if (retired_code_.empty()) {
+    return;
+  }
+  // Threads not running guest code will get the latest code when they enter
+  // it.
+  uint64_t safe_epoch = UINT64_MAX;
+  for (auto thread : code_threads_) {
+    if (thread->guest_depth.load()) {
+      safe_epoch = std::min(safe_epoch, thread->safe_epoch.load());
+    }
+  }
+  auto it = retired_code_.begin();
+  while (it != retired_code_.end()) {
+    if (it->epoch > safe_epoch) {
+      ++it;
+      continue;
+    }
+    CodeFrameInfo frame;
+    if (LookupCodeFrame(uintptr_t(generated_code_execute_base_) + it->offset,
+                        &frame)) {
+      RemoveCodeFrame(frame);
+      // Nothing may be running the code anymore to be described.
+      if (frame.function) {
+        frame.function->ReleaseCode(frame.code);
+      }
+    }
+    std::memset(generated_code_write_base_ + it->offset, 0xCC, it->size);
+    FreeCodeSpace(it->offset, it->size);
+    stats_.dead_bytes -= it->size;
+    --stats_.dead_count;
+    stats_.reclaimed_bytes += it->size;
+    ++stats_.reclaimed_count;
+    it = retired_code_.erase(it);
+  }
+}
+
+X64CodeCache::Stats X64CodeCache::GetStats() {
+  std::lock_guard<std::mutex> lock(placement_mutex_);
+  Stats stats = stats_;
+  stats.free_bytes = 0;
+  for (const auto& it : free_code_space_) {
+    stats.free_bytes += it.second;
+  }
+  return stats;
+}
+
+void X64CodeCache::CommitCode(size_t high_mark) {
   // If we are going above the high water mark of committed memory, commit some
   // more. It's ok if multiple threads do this, as redundant commits aren't
   // harmful.
@@ -323,8 +667,30 @@ uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
                              xe::memory::AllocationType::kCommit,
                              xe::memory::PageAccess::kReadWrite);
     }
+    // Code is only ever protected as a whole, so all of it can be in huge
+    // pages, which mostly matters for the execute view. Advised after every
+    // commit as that may map new memory over the range.
+    if (cvars::huge_pages) {
+      xe::memory::AdviseHugePages(generated_code_execute_base_,
+                                  new_commit_mark);
+    }
   } while (generated_code_commit_mark_.compare_exchange_weak(old_commit_mark,
                                                              new_commit_mark));
+}
+
+uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
+  // Hold a lock while we reserve the space.
+  size_t offset;
+  {
+    std::lock_guard<std::mutex> lock(placement_mutex_);
+
+    // Reserve code.
+    // Always move the code to land on 16b alignment.
+    offset = AllocateCodeSpace(xe::round_up(length, 16));
+  }
+  uint8_t* data_address = generated_code_write_base_ + offset;
+
+  CommitCode(offset + xe::round_up(length, 16));
 
   // Copy code.
   std::memcpy(data_address, data, length);
@@ -333,30 +699,386 @@ uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
 }
 
 GuestFunction* X64CodeCache::LookupFunction(uint64_t host_pc) {
-  uint32_t key = uint32_t(host_pc - kGeneratedCodeExecuteBase);
-  void* fn_entry = std::bsearch(
-      &key, generated_code_map_.data(), generated_code_map_.size() + 1,
-      sizeof(std::pair<uint32_t, Function*>),
-      [](const void* key_ptr, const void* element_ptr) {
-        auto key = *reinterpret_cast<const uint32_t*>(key_ptr);
-        auto element =
-            reinterpret_cast<const std::pair<uint64_t, GuestFunction*>*>(
-                element_ptr);
-        if (key < (element->first >> 32)) {
-          return -1;
-        } else if (key > uint32_t(element->first)) {
-          return 1;
-        } else {
-          return 0;
-        }
-      });
-  if (fn_entry) {
-    return reinterpret_cast<const std::pair<uint64_t, GuestFunction*>*>(
-               fn_entry)
-        ->second;
+  CodeFrameInfo frame;
+  return LookupCodeFrame(host_pc, &frame) ? frame.function : nullptr;
+}
+
+namespace {
+
+// 'XEJC'.
+constexpr uint32_t kCodeStorageMagic = 0x434A4558;
+// Update if anything in the stored format or the code emission conventions
+// relied upon by stored code changes.
+constexpr uint32_t kCodeStorageVersion = 0x20210713;
+
+struct CodeStorageFileHeader {
+  uint32_t magic;
+  uint32_t version_swapped;
+  uint32_t feature_flags;
+  uint32_t guest_low;
+  uint32_t guest_high;
+  uint32_t padding;
+  uint64_t guest_code_hash;
+  uint64_t codegen_options_hash;
+  // Stored code embeds host thunk addresses, so it's only valid for the build
+  // that generated it.
+  uint64_t build_hash;
+  // Stored code also embeds the address of the emitter constant table, which
+  // may be placed elsewhere on another launch.
+  uint64_t emitter_data;
+};
+
+struct StoredGuestFunctionHeader {
+  uint32_t guest_address;
+  uint32_t guest_end_address;
+  uint64_t guest_code_hash;
+  uint32_t code_size_prolog;
+  uint32_t code_size_body;
+  uint32_t code_size_epilog;
+  uint32_t code_size_tail;
+  uint32_t code_size_total;
+  uint32_t prolog_stack_alloc_offset;
+  uint32_t stack_size;
+  uint32_t source_map_count;
+  uint32_t relocations_count;
+  uint32_t code_size_cold;
+  uint32_t call_sites_count;
+  // Hash of everything following the header.
+  uint64_t payload_hash;
+};
+
+// Host image addresses are stored relative to this, as the image may be
+// loaded at a different address every launch.
+uint64_t GetHostImageAnchor() {
+  return reinterpret_cast<uint64_t>(&GetHostImageAnchor);
+}
+
+uint64_t HashGuestFunctionCode(Memory* memory, uint32_t address,
+                               uint32_t end_address) {
+  return XXH3_64bits(memory->TranslateVirtual(address),
+                     end_address + 4 - address);
+}
+
+// Direct calls are linked to whatever code their callees have at runtime.
+void UnlinkCallSites(uint8_t* code, const std::vector<uint32_t>& call_sites) {
+  for (uint32_t offset : call_sites) {
+    std::memset(code + offset - sizeof(uint32_t), 0, sizeof(uint32_t));
+  }
+}
+
+void RelocateHostImageAddresses(uint8_t* code,
+                                const std::vector<uint32_t>& relocations,
+                                uint64_t delta) {
+  for (uint32_t offset : relocations) {
+    uint64_t value;
+    std::memcpy(&value, code + offset, sizeof(value));
+    value += delta;
+    std::memcpy(code + offset, &value, sizeof(value));
+  }
+}
+
+}  // namespace
+
+bool X64CodeCache::InitializeCodeStorage(
+    const std::filesystem::path& storage_root, uint32_t guest_low,
+    uint32_t guest_high, uint64_t guest_code_hash, uint32_t feature_flags,
+    uint64_t codegen_options_hash, uintptr_t emitter_data) {
+  std::lock_guard<std::mutex> lock(code_storage_mutex_);
+
+  for (const auto& storage : code_storages_) {
+    if (guest_low < storage->guest_high && guest_high > storage->guest_low) {
+      // Already have a storage covering this range (module reloaded?).
+      return false;
+    }
+  }
+
+  if (!std::filesystem::exists(storage_root)) {
+    std::error_code ec;
+    if (!std::filesystem::create_directories(storage_root, ec)) {
+      XELOGE(
+          "Failed to create the JIT code storage directory, persistent JIT "
+          "code storage will be disabled: {}",
+          xe::path_to_utf8(storage_root));
+      return false;
+    }
+  }
+
+  auto file_path =
+      storage_root / fmt::format("{:016X}.{:08X}.{:016X}.xjit", guest_code_hash,
+                                 feature_flags, codegen_options_hash);
+  FILE* file = xe::filesystem::OpenFile(file_path, "a+b");
+  if (!file) {
+    XELOGE(
+        "Failed to open the JIT code storage file, persistent JIT code "
+        "storage will be disabled: {}",
+        xe::path_to_utf8(file_path));
+    return false;
+  }
+
+  auto storage = std::make_unique<CodeStorage>();
+  storage->guest_low = guest_low;
+  storage->guest_high = guest_high;
+  storage->file = file;
+
+  CodeStorageFileHeader expected_header = {};
+  expected_header.magic = kCodeStorageMagic;
+  expected_header.version_swapped = xe::byte_swap(kCodeStorageVersion);
+  expected_header.feature_flags = feature_flags;
+  expected_header.guest_low = guest_low;
+  expected_header.guest_high = guest_high;
+  expected_header.guest_code_hash = guest_code_hash;
+  expected_header.codegen_options_hash = codegen_options_hash;
+  static const char kBuildId[] = XE_BUILD_COMMIT " " XE_BUILD_DATE;
+  expected_header.build_hash = XXH3_64bits(kBuildId, sizeof(kBuildId) - 1);
+  expected_header.emitter_data = uint64_t(emitter_data);
+
+  uint64_t valid_bytes = 0;
+  CodeStorageFileHeader file_header;
+  xe::filesystem::Seek(file, 0, SEEK_END);
+  int64_t file_size = xe::filesystem::Tell(file);
+  xe::filesystem::Seek(file, 0, SEEK_SET);
+  if (fread(&file_header, sizeof(file_header), 1, file) &&
+      !std::memcmp(&file_header, &expected_header, sizeof(file_header))) {
+    valid_bytes = sizeof(file_header);
+    // Read functions until the end of the file or until a corrupted one is
+    // found.
+    StoredGuestFunctionHeader function_header;
+    std::vector<uint8_t> payload;
+    while (fread(&function_header, sizeof(function_header), 1, file)) {
+      size_t payload_size =
+          function_header.code_size_total +
+          function_header.source_map_count * sizeof(SourceMapEntry) +
+          function_header.relocations_count * sizeof(uint32_t) +
+          function_header.call_sites_count * sizeof(uint32_t);
+      // Don't trust the sizes in a truncated or corrupted header.
+      if (payload_size > uint64_t(file_size) - valid_bytes -
+                             sizeof(function_header)) {
+        break;
+      }
+      payload.resize(payload_size);
+      if (fread(payload.data(), payload_size, 1, file) != 1 ||
+          XXH3_64bits(payload.data(), payload_size) !=
+              function_header.payload_hash) {
+        break;
+      }
+      StoredGuestFunction stored;
+      stored.guest_end_address = function_header.guest_end_address;
+      stored.guest_code_hash = function_header.guest_code_hash;
+      stored.func_info.code_size.prolog = function_header.code_size_prolog;
+      stored.func_info.code_size.body = function_header.code_size_body;
+      stored.func_info.code_size.epilog = function_header.code_size_epilog;
+      stored.func_info.code_size.cold = function_header.code_size_cold;
+      stored.func_info.code_size.tail = function_header.code_size_tail;
+      stored.func_info.code_size.total = function_header.code_size_total;
+      stored.func_info.prolog_stack_alloc_offset =
+          function_header.prolog_stack_alloc_offset;
+      stored.func_info.stack_size = function_header.stack_size;
+      stored.code_offset = storage->data.size();
+      stored.code_size = function_header.code_size_total;
+      stored.source_map_offset = stored.code_offset + stored.code_size;
+      stored.source_map_count = function_header.source_map_count;
+      stored.relocations_offset =
+          stored.source_map_offset +
+          stored.source_map_count * sizeof(SourceMapEntry);
+      stored.relocations_count = function_header.relocations_count;
+      stored.call_sites_offset =
+          stored.relocations_offset +
+          stored.relocations_count * sizeof(uint32_t);
+      stored.call_sites_count = function_header.call_sites_count;
+      storage->data.insert(storage->data.end(), payload.begin(),
+                           payload.end());
+      storage->functions[function_header.guest_address] = stored;
+      valid_bytes += sizeof(function_header) + payload_size;
+    }
+  }
+
+  // Drop anything invalid or from another build and start appending after the
+  // last valid function.
+  if (!valid_bytes) {
+    xe::filesystem::TruncateStdioFile(file, 0);
+    fwrite(&expected_header, sizeof(expected_header), 1, file);
   } else {
-    return nullptr;
+    xe::filesystem::TruncateStdioFile(file, valid_bytes);
+  }
+  xe::filesystem::Seek(file, 0, SEEK_END);
+
+  XELOGI("Loaded {} stored JIT functions for {:08X}-{:08X}",
+         storage->functions.size(), guest_low, guest_high);
+  code_storages_.push_back(std::move(storage));
+  has_code_storage_ = true;
+  return true;
+}
+
+void X64CodeCache::ShutdownCodeStorage() {
+  std::lock_guard<std::mutex> lock(code_storage_mutex_);
+  has_code_storage_ = false;
+  for (auto& storage : code_storages_) {
+    fflush(storage->file);
+    fclose(storage->file);
+  }
+  code_storages_.clear();
+}
+
+X64CodeCache::CodeStorage* X64CodeCache::LookupCodeStorage(
+    uint32_t guest_address) {
+  for (auto& storage : code_storages_) {
+    if (guest_address >= storage->guest_low &&
+        guest_address < storage->guest_high) {
+      return storage.get();
+    }
+  }
+  return nullptr;
+}
+
+void X64CodeCache::StoreGuestCode(
+    Memory* memory, GuestFunction* function, const EmitFunctionInfo& func_info,
+    const std::vector<SourceMapEntry>& source_map,
+    const void* code_execute_address,
+    const std::vector<uint32_t>& host_image_relocations,
+    const std::vector<uint32_t>& call_sites) {
+  std::lock_guard<std::mutex> lock(code_storage_mutex_);
+  auto storage = LookupCodeStorage(function->address());
+  if (!storage || storage->functions.count(function->address())) {
+    return;
+  }
+
+  size_t code_size = func_info.code_size.total;
+  std::vector<uint8_t> payload(
+      code_size + source_map.size() * sizeof(SourceMapEntry) +
+      (host_image_relocations.size() + call_sites.size()) * sizeof(uint32_t));
+  std::memcpy(payload.data(), code_execute_address, code_size);
+  RelocateHostImageAddresses(payload.data(), host_image_relocations,
+                             0 - GetHostImageAnchor());
+  UnlinkCallSites(payload.data(), call_sites);
+  if (!source_map.empty()) {
+    std::memcpy(payload.data() + code_size, source_map.data(),
+                source_map.size() * sizeof(SourceMapEntry));
+  }
+  if (!host_image_relocations.empty()) {
+    std::memcpy(payload.data() + code_size +
+                    source_map.size() * sizeof(SourceMapEntry),
+                host_image_relocations.data(),
+                host_image_relocations.size() * sizeof(uint32_t));
+  }
+  if (!call_sites.empty()) {
+    std::memcpy(payload.data() + payload.size() -
+                    call_sites.size() * sizeof(uint32_t),
+                call_sites.data(), call_sites.size() * sizeof(uint32_t));
+  }
+
+  StoredGuestFunctionHeader function_header = {};
+  function_header.guest_address = function->address();
+  function_header.guest_end_address = function->end_address();
+  function_header.guest_code_hash = HashGuestFunctionCode(
+      memory, function->address(), function->end_address());
+  function_header.code_size_prolog = uint32_t(func_info.code_size.prolog);
+  function_header.code_size_body = uint32_t(func_info.code_size.body);
+  function_header.code_size_epilog = uint32_t(func_info.code_size.epilog);
+  function_header.code_size_cold = uint32_t(func_info.code_size.cold);
+  function_header.code_size_tail = uint32_t(func_info.code_size.tail);
+  function_header.code_size_total = uint32_t(func_info.code_size.total);
+  function_header.prolog_stack_alloc_offset =
+      uint32_t(func_info.prolog_stack_alloc_offset);
+  function_header.stack_size = uint32_t(func_info.stack_size);
+  function_header.source_map_count = uint32_t(source_map.size());
+  function_header.relocations_count = uint32_t(host_image_relocations.size());
+  function_header.call_sites_count = uint32_t(call_sites.size());
+  function_header.payload_hash = XXH3_64bits(payload.data(), payload.size());
+  fwrite(&function_header, sizeof(function_header), 1, storage->file);
+  fwrite(payload.data(), payload.size(), 1, storage->file);
+}
+
+std::shared_ptr<GuestFunction::Code> X64CodeCache::RestoreGuestCode(
+    Memory* memory, GuestFunction* function, const void* call_site_target) {
+  auto restored = std::make_shared<GuestFunction::Code>();
+  std::vector<uint8_t> code;
+  std::vector<uint32_t> call_sites;
+  EmitFunctionInfo func_info;
+  {
+    std::lock_guard<std::mutex> lock(code_storage_mutex_);
+    auto storage = LookupCodeStorage(function->address());
+    if (!storage) {
+      return nullptr;
+    }
+    auto it = storage->functions.find(function->address());
+    if (it == storage->functions.end()) {
+      return nullptr;
+    }
+    const StoredGuestFunction& stored = it->second;
+    // The range hash may still match if the guest code was modified after the
+    // range has been committed, so check the function itself too.
+    if (stored.guest_end_address < function->address() ||
+        stored.guest_end_address >= storage->guest_high ||
+        HashGuestFunctionCode(memory, function->address(),
+                              stored.guest_end_address) !=
+            stored.guest_code_hash) {
+      return nullptr;
+    }
+    func_info = stored.func_info;
+    const uint8_t* data = storage->data.data();
+    code.assign(data + stored.code_offset,
+                data + stored.code_offset + stored.code_size);
+    std::vector<uint32_t> relocations(stored.relocations_count);
+    std::memcpy(relocations.data(), data + stored.relocations_offset,
+                stored.relocations_count * sizeof(uint32_t));
+    RelocateHostImageAddresses(code.data(), relocations, GetHostImageAnchor());
+    call_sites.resize(stored.call_sites_count);
+    std::memcpy(call_sites.data(), data + stored.call_sites_offset,
+                stored.call_sites_count * sizeof(uint32_t));
+    auto source_map_entries = reinterpret_cast<const SourceMapEntry*>(
+        data + stored.source_map_offset);
+    restored->source_map.assign(source_map_entries,
+                                source_map_entries + stored.source_map_count);
+    function->set_end_address(stored.guest_end_address);
+  }
+
+  void* code_execute_address;
+  void* code_write_address;
+  PlaceGuestCode(function->address(), code.data(), func_info, function,
+                 code_execute_address, code_write_address);
+  // Linked when first called, like freshly emitted code.
+  for (uint32_t offset : call_sites) {
+    PatchCallSite(reinterpret_cast<uint8_t*>(code_execute_address) + offset,
+                  call_site_target);
   }
+  DescribePlacedCode(function->address(), function, &restored->source_map,
+                     code_execute_address, func_info.code_size.total);
+  restored->machine_code = reinterpret_cast<uint8_t*>(code_execute_address);
+  restored->machine_code_length = func_info.code_size.total;
+  return restored;
+}
+
+bool X64CodeCache::ValidateStoredGuestCode(
+    GuestFunction* function, const void* code_execute_address,
+    size_t code_size, const std::vector<uint32_t>& host_image_relocations,
+    const std::vector<uint32_t>& call_sites) {
+  std::lock_guard<std::mutex> lock(code_storage_mutex_);
+  auto storage = LookupCodeStorage(function->address());
+  if (!storage) {
+    return true;
+  }
+  auto it = storage->functions.find(function->address());
+  if (it == storage->functions.end()) {
+    return true;
+  }
+  const StoredGuestFunction& stored = it->second;
+  std::vector<uint8_t> code(
+      reinterpret_cast<const uint8_t*>(code_execute_address),
+      reinterpret_cast<const uint8_t*>(code_execute_address) + code_size);
+  RelocateHostImageAddresses(code.data(), host_image_relocations,
+                             0 - GetHostImageAnchor());
+  UnlinkCallSites(code.data(), call_sites);
+  if (stored.guest_end_address != function->end_address() ||
+      stored.code_size != code_size ||
+      std::memcmp(storage->data.data() + stored.code_offset, code.data(),
+                  code_size)) {
+    XELOGW(
+        "Stored JIT code for {:08X} differs from the retranslated code "
+        "({} bytes stored, {} bytes translated)",
+        function->address(), stored.code_size, code_size);
+    return false;
+  }
+  return true;
 }
 
 }  // namespace x64
@@ -13,25 +13,45 @@
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "xenia/base/cvar.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/backend/code_cache.h"
 
+DECLARE_bool(store_jit_code);
+DECLARE_bool(validate_stored_jit_code);
+DECLARE_bool(perf_map);
+DECLARE_bool(perf_jitdump);
+DECLARE_bool(reclaim_jit_code);
+
+namespace xe {
+class Memory;
+}  // namespace xe
+
 namespace xe {
 namespace cpu {
 namespace backend {
 namespace x64 {
 
+class PerfMapWriter;
+
 struct EmitFunctionInfo {
   struct _code_size {
     size_t prolog;
     size_t body;
     size_t epilog;
+    // Rarely executed blocks, after the epilog.
+    size_t cold;
     size_t tail;
     size_t total;
   } code_size;
@@ -53,7 +73,6 @@ class X64CodeCache : public CodeCache {
   }
   size_t total_size() const override { return kGeneratedCodeSize; }
 
-  // TODO(benvanik): ELF serialization/etc
   // TODO(benvanik): keep track of code blocks
   // TODO(benvanik): padding/guards/etc
 
@@ -61,6 +80,17 @@ class X64CodeCache : public CodeCache {
   void set_indirection_default(uint32_t default_value);
   void AddIndirection(uint32_t guest_address, uint32_t host_address);
 
+  // Replaces a 4-byte aligned dword of placed code (at an execute address)
+  // with a single store, so threads running the code concurrently see either
+  // the old or the new value.
+  void PatchCode32(uint8_t* address, uint32_t value);
+  // Points the rel32 call or jmp instruction ending at call_site to target.
+  // The displacement must be 4-byte aligned.
+  void PatchCallSite(uint8_t* call_site, const void* target);
+  // Same, unless the code with the given id (see CodeFrameInfo) containing
+  // the call site has been reclaimed since.
+  void PatchCallSite(uint8_t* call_site, const void* target, uint64_t code_id);
+
   void CommitExecutableRange(uint32_t guest_low, uint32_t guest_high);
 
   void PlaceHostCode(uint32_t guest_address, void* machine_code,
@@ -73,9 +103,117 @@ class X64CodeCache : public CodeCache {
                       void*& code_execute_address_out,
                       void*& code_write_address_out);
   uint32_t PlaceData(const void* data, size_t length);
+  // Describes code to profilers once it is final, after the emitter has
+  // resolved its labels.
+  void DescribePlacedCode(uint32_t guest_address, GuestFunction* function_info,
+                          const std::vector<SourceMapEntry>* source_map,
+                          const void* code_execute_address, size_t code_size);
 
   GuestFunction* LookupFunction(uint64_t host_pc) override;
 
+  // Stack frame layout of placed code, for walking the stack without unwind
+  // info.
+  struct CodeFrameInfo {
+    // Unique to each placement, as code space may be reused.
+    uint64_t id;
+    const uint8_t* code;
+    uint32_t code_size;
+    // Including the padding and the unwind info after the code.
+    uint32_t reserved_size;
+    // Before this offset and between the epilog and the cold code offsets,
+    // the return address is at rsp rather than rsp + stack_size.
+    uint32_t prolog_stack_alloc_offset;
+    uint32_t epilog_offset;
+    uint32_t cold_offset;
+    uint32_t stack_size;
+    // nullptr for host code.
+    GuestFunction* function;
+  };
+  // Finds the placed code containing host_pc. Doesn't lock or allocate, so it
+  // may be called from signal handlers.
+  bool LookupCodeFrame(uint64_t host_pc, CodeFrameInfo* out_frame) const;
+
+  // A thread that may run placed code. Retired code is only reclaimed once
+  // every thread running guest code has reported a safepoint without it on
+  // its stack.
+  struct CodeThread {
+    // Nesting of calls into guest code from host code.
+    std::atomic<uint32_t> guest_depth = {0};
+    // Latest retire_epoch() at which the thread had none of the code retired
+    // so far on its stack.
+    std::atomic<uint64_t> safe_epoch = {0};
+  };
+  void RegisterThread(CodeThread* thread);
+  void UnregisterThread(CodeThread* thread);
+
+  // Incremented whenever code is retired. Threads whose safe_epoch differs
+  // may be keeping retired code from being reclaimed.
+  uint64_t retire_epoch() const {
+    return retire_epoch_.load(std::memory_order_acquire);
+  }
+  // Marks placed code as no longer reachable, to be reclaimed once no thread
+  // may be running it. The indirection table and any call sites linked to the
+  // code must not lead to it anymore. Does nothing unless reclaim_jit_code is
+  // set.
+  void RetireCode(const void* code_execute_address);
+  // Reports that the thread, outside of generated code, has the given host
+  // PCs (from X64Backend::CaptureStack) on its stack, all the way up to the
+  // host code that entered guest code, as captured after reading epoch from
+  // retire_epoch(). Reclaims whatever retired code no thread may be running
+  // anymore.
+  void ReportSafepoint(CodeThread* thread, uint64_t epoch,
+                       const uint64_t* frame_host_pcs, size_t frame_count);
+
+  struct Stats {
+    // Placed code still reachable, including padding and unwind info.
+    size_t live_bytes;
+    size_t live_count;
+    // Retired code waiting for the threads that may be running it.
+    size_t dead_bytes;
+    size_t dead_count;
+    // Reclaimed space not yet reused.
+    size_t free_bytes;
+    // Total reclaimed so far.
+    uint64_t reclaimed_bytes;
+    uint64_t reclaimed_count;
+  };
+  Stats GetStats();
+
+  // Persistent storage of emitted guest code.
+  // Storage is keyed by the hash of the guest code range, the emitter feature
+  // flags, the hash of the options code generation depends on, the build and
+  // the address of the emitter constant table, so anything stored can be
+  // reused as-is after relocating the host image addresses it references.
+  // Each committed executable range gets its own storage file.
+  bool has_code_storage() const { return has_code_storage_; }
+  bool InitializeCodeStorage(const std::filesystem::path& storage_root,
+                             uint32_t guest_low, uint32_t guest_high,
+                             uint64_t guest_code_hash, uint32_t feature_flags,
+                             uint64_t codegen_options_hash,
+                             uintptr_t emitter_data);
+  void ShutdownCodeStorage();
+  // Appends the placed code of the function to the storage of its range.
+  // host_image_relocations are offsets of 64-bit host image addresses embedded
+  // in the code. call_sites are offsets of the ends of direct calls (see
+  // PatchCallSite), linked at runtime, so stored unlinked.
+  void StoreGuestCode(Memory* memory, GuestFunction* function,
+                      const EmitFunctionInfo& func_info,
+                      const std::vector<SourceMapEntry>& source_map,
+                      const void* code_execute_address,
+                      const std::vector<uint32_t>& host_image_relocations,
+                      const std::vector<uint32_t>& call_sites);
+  // Places previously stored code for the function, if present and still
+  // matching the guest code, with its direct calls pointed at
+  // call_site_target. Returns the code to publish or nullptr.
+  std::shared_ptr<GuestFunction::Code> RestoreGuestCode(
+      Memory* memory, GuestFunction* function, const void* call_site_target);
+  // Compares freshly emitted code against what is stored for the function.
+  // Returns false if stored code exists and differs.
+  bool ValidateStoredGuestCode(
+      GuestFunction* function, const void* code_execute_address,
+      size_t code_size, const std::vector<uint32_t>& host_image_relocations,
+      const std::vector<uint32_t>& call_sites);
+
  protected:
   // All executable code falls within 0x80000000 to 0x9FFFFFFF, so we can
   // only map enough for lookups within that range.
@@ -90,22 +228,21 @@ class X64CodeCache : public CodeCache {
   static const uintptr_t kGeneratedCodeWriteBase =
       kGeneratedCodeExecuteBase + kGeneratedCodeSize + 1;
 
-  // This is picked to be high enough to cover whatever we can reasonably
-  // expect. If we hit issues with this it probably means some corner case
-  // in analysis triggering.
-  static const size_t kMaximumFunctionCount = 100000;
+  // Code frames are looked up by the page of the code region they overlap.
+  static const size_t kCodeFramePageShift = 16;
+  static const size_t kCodeFramePageCount =
+      (kGeneratedCodeSize >> kCodeFramePageShift) + 1;
 
   struct UnwindReservation {
     size_t data_size = 0;
-    size_t table_slot = 0;
     uint8_t* entry_address = 0;
   };
 
   X64CodeCache();
 
-  virtual UnwindReservation RequestUnwindReservation(uint8_t* entry_address) {
-    return UnwindReservation();
-  }
+  // Size of the unwind info reserved after each piece of code.
+  virtual size_t unwind_info_size() const { return 0; }
+  // Called without any lock, possibly on several threads at once.
   virtual void PlaceCode(uint32_t guest_address, void* machine_code,
                          const EmitFunctionInfo& func_info,
                          void* code_execute_address,
@@ -115,9 +252,22 @@ class X64CodeCache : public CodeCache {
   xe::memory::FileMappingHandle mapping_ =
       xe::memory::kFileMappingHandleInvalid;
 
-  // NOTE: the global critical region must be held when manipulating the offsets
-  // or counts of anything, to keep the tables consistent and ordered.
-  xe::global_critical_region global_critical_region_;
+  // Commits the code memory up to the offset if it isn't yet.
+  void CommitCode(size_t high_mark);
+
+  // The following require placement_mutex_.
+  // Returns the offset of free code space, reusing reclaimed space if
+  // possible.
+  size_t AllocateCodeSpace(size_t size);
+  void FreeCodeSpace(size_t offset, size_t size);
+  void InsertCodeFrame(const CodeFrameInfo& frame);
+  void RemoveCodeFrame(const CodeFrameInfo& frame);
+  void ReclaimCode();
+
+  // NOTE: must be held when manipulating the offsets or counts of anything, to
+  // keep the tables consistent and ordered. Not the global critical region, so
+  // that placing code doesn't wait for unrelated emulation.
+  std::mutex placement_mutex_;
 
   // Value that the indirection table will be initialized with upon commit.
   uint32_t indirection_default_value_ = 0xFEEDF00D;
@@ -133,14 +283,72 @@ class X64CodeCache : public CodeCache {
   // PageAccess::kExecuteReadWrite is not supported, for writing the generated
   // code. Equals to generated_code_execute_base_ when it's supported.
   uint8_t* generated_code_write_base_ = nullptr;
-  // Current offset to empty space in generated code.
+  // Current offset to empty space in generated code, after which nothing has
+  // been placed.
   size_t generated_code_offset_ = 0;
   // Current high water mark of COMMITTED code.
   std::atomic<size_t> generated_code_commit_mark_ = {0};
-  // Sorted map by host PC base offsets to source function info.
-  // This can be used to bsearch on host PC to find the guest function.
-  // The key is [start address | end address].
-  std::vector<std::pair<uint64_t, GuestFunction*>> generated_code_map_;
+  // Frame layouts and functions of the placed code overlapping each page of
+  // the code region, in address order, used to bsearch on host PC to find the
+  // guest function. Frames are appended in place, published through the
+  // count, and pages are replaced as a whole for anything else, so that they
+  // can be read without the lock.
+  struct CodeFramePage {
+    std::atomic<uint32_t> count = {0};
+    uint32_t capacity = 0;
+    std::unique_ptr<CodeFrameInfo[]> frames;
+  };
+  std::atomic<CodeFramePage*> code_frame_pages_[kCodeFramePageCount];
+  // Lookups in progress, which may be reading replaced pages.
+  mutable std::atomic<uint32_t> code_frame_lookup_count_ = {0};
+  // Replaced pages, deleted once no lookup is in progress.
+  std::vector<CodeFramePage*> retired_code_frame_pages_;
+
+  // Reclaimed code space, by offset and by size.
+  std::map<size_t, size_t> free_code_space_;
+  std::multimap<size_t, size_t> free_code_space_by_size_;
+
+  struct RetiredCode {
+    size_t offset;
+    size_t size;
+    uint64_t epoch;
+  };
+  std::vector<RetiredCode> retired_code_;
+  std::atomic<uint64_t> retire_epoch_ = {0};
+  uint64_t next_code_id_ = 1;
+  std::vector<CodeThread*> code_threads_;
+  Stats stats_ = {};
+
+  struct StoredGuestFunction {
+    uint32_t guest_end_address;
+    uint64_t guest_code_hash;
+    EmitFunctionInfo func_info;
+    // Offsets into CodeStorage::data.
+    size_t code_offset;
+    size_t code_size;
+    size_t source_map_offset;
+    size_t source_map_count;
+    size_t relocations_offset;
+    size_t relocations_count;
+    size_t call_sites_offset;
+    size_t call_sites_count;
+  };
+  struct CodeStorage {
+    uint32_t guest_low;
+    uint32_t guest_high;
+    FILE* file;
+    // Payloads of all functions read from the file on initialization.
+    std::vector<uint8_t> data;
+    std::unordered_map<uint32_t, StoredGuestFunction> functions;
+  };
+  CodeStorage* LookupCodeStorage(uint32_t guest_address);
+  // Guards code_storages_ and writes to the storage files.
+  std::mutex code_storage_mutex_;
+  std::vector<std::unique_ptr<CodeStorage>> code_storages_;
+  std::atomic<bool> has_code_storage_ = {false};
+
+  // Set when placed code is described to perf.
+  std::unique_ptr<PerfMapWriter> perf_map_writer_;
 };
 
 }  // namespace x64
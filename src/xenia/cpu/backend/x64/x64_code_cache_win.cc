@@ -20,12 +20,6 @@
 #include "xenia/base/platform_win.h"
 #include "xenia/cpu/function.h"
 
-// Function pointer definitions
-using FnRtlAddGrowableFunctionTable = decltype(&RtlAddGrowableFunctionTable);
-using FnRtlGrowFunctionTable = decltype(&RtlGrowFunctionTable);
-using FnRtlDeleteGrowableFunctionTable =
-    decltype(&RtlDeleteGrowableFunctionTable);
-
 namespace xe {
 namespace cpu {
 namespace backend {
@@ -94,6 +88,9 @@ typedef struct _UNWIND_INFO {
 // TODO(benvanik): move this to emitter.
 static const uint32_t kUnwindInfoSize =
     sizeof(UNWIND_INFO) + (sizeof(UNWIND_CODE) * (6 - 1));
+// The function entry returned for the code is placed before its unwind info.
+static const uint32_t kUnwindEntrySize =
+    uint32_t(xe::round_up(sizeof(RUNTIME_FUNCTION), 16));
 
 class Win32X64CodeCache : public X64CodeCache {
  public:
@@ -105,28 +102,17 @@ class Win32X64CodeCache : public X64CodeCache {
   void* LookupUnwindInfo(uint64_t host_pc) override;
 
  private:
-  UnwindReservation RequestUnwindReservation(uint8_t* entry_address) override;
+  size_t unwind_info_size() const override {
+    return kUnwindEntrySize + kUnwindInfoSize;
+  }
   void PlaceCode(uint32_t guest_address, void* machine_code,
                  const EmitFunctionInfo& func_info, void* code_execute_address,
                  UnwindReservation unwind_reservation) override;
 
   void InitializeUnwindEntry(uint8_t* unwind_entry_address,
-                             size_t unwind_table_slot,
-                             void* code_execute_address,
                              const EmitFunctionInfo& func_info);
 
-  // Growable function table system handle.
-  void* unwind_table_handle_ = nullptr;
-  // Actual unwind table entries.
-  std::vector<RUNTIME_FUNCTION> unwind_table_;
-  // Current number of entries in the table.
-  std::atomic<uint32_t> unwind_table_count_ = {0};
-  // Does this version of Windows support growable funciton tables?
-  bool supports_growable_table_ = false;
-
-  FnRtlAddGrowableFunctionTable add_growable_table_ = nullptr;
-  FnRtlDeleteGrowableFunctionTable delete_growable_table_ = nullptr;
-  FnRtlGrowFunctionTable grow_table_ = nullptr;
+  bool function_table_installed_ = false;
 };
 
 std::unique_ptr<X64CodeCache> X64CodeCache::Create() {
@@ -136,15 +122,9 @@ std::unique_ptr<X64CodeCache> X64CodeCache::Create() {
 Win32X64CodeCache::Win32X64CodeCache() = default;
 
 Win32X64CodeCache::~Win32X64CodeCache() {
-  if (supports_growable_table_) {
-    if (unwind_table_handle_) {
-      delete_growable_table_(unwind_table_handle_);
-    }
-  } else {
-    if (generated_code_execute_base_) {
-      RtlDeleteFunctionTable(reinterpret_cast<PRUNTIME_FUNCTION>(
-          reinterpret_cast<DWORD64>(generated_code_execute_base_) | 0x3));
-    }
+  if (function_table_installed_) {
+    RtlDeleteFunctionTable(reinterpret_cast<PRUNTIME_FUNCTION>(
+        reinterpret_cast<DWORD64>(generated_code_execute_base_) | 0x3));
   }
 }
 
@@ -153,85 +133,47 @@ bool Win32X64CodeCache::Initialize() {
     return false;
   }
 
-  // Compute total number of unwind entries we should allocate.
-  // We don't support reallocing right now, so this should be high.
-  unwind_table_.resize(kMaximumFunctionCount);
-
-  // Check if this version of Windows supports growable function tables.
-  auto ntdll_handle = GetModuleHandleW(L"ntdll.dll");
-  if (!ntdll_handle) {
-    add_growable_table_ = nullptr;
-    delete_growable_table_ = nullptr;
-    grow_table_ = nullptr;
-  } else {
-    add_growable_table_ = (FnRtlAddGrowableFunctionTable)GetProcAddress(
-        ntdll_handle, "RtlAddGrowableFunctionTable");
-    delete_growable_table_ = (FnRtlDeleteGrowableFunctionTable)GetProcAddress(
-        ntdll_handle, "RtlDeleteGrowableFunctionTable");
-    grow_table_ = (FnRtlGrowFunctionTable)GetProcAddress(
-        ntdll_handle, "RtlGrowFunctionTable");
-  }
-  supports_growable_table_ =
-      add_growable_table_ && delete_growable_table_ && grow_table_;
-
-  // Create table and register with the system. It's empty now, but we'll grow
-  // it as functions are added.
-  if (supports_growable_table_) {
-    if (add_growable_table_(
-            &unwind_table_handle_, unwind_table_.data(), unwind_table_count_,
-            DWORD(unwind_table_.size()),
-            reinterpret_cast<ULONG_PTR>(generated_code_execute_base_),
-            reinterpret_cast<ULONG_PTR>(generated_code_execute_base_ +
-                                        kGeneratedCodeSize))) {
-      XELOGE("Unable to create unwind function table");
-      return false;
-    }
-  } else {
-    // Install a callback that the debugger will use to lookup unwind info on
-    // demand.
-    if (!RtlInstallFunctionTableCallback(
-            reinterpret_cast<DWORD64>(generated_code_execute_base_) | 0x3,
-            reinterpret_cast<DWORD64>(generated_code_execute_base_),
-            kGeneratedCodeSize,
-            [](DWORD64 control_pc, PVOID context) {
-              auto code_cache = reinterpret_cast<Win32X64CodeCache*>(context);
-              return reinterpret_cast<PRUNTIME_FUNCTION>(
-                  code_cache->LookupUnwindInfo(control_pc));
-            },
-            this, nullptr)) {
-      XELOGE("Unable to install function table callback");
-      return false;
-    }
+  // Install a callback that the system will use to lookup unwind info on
+  // demand. A sorted table (even a growable one) can't be kept up to date
+  // without locking while code is placed anywhere in the code region, and
+  // code is both placed into reclaimed space and reclaimed, so the entries
+  // are looked up in the frame table instead.
+  if (!RtlInstallFunctionTableCallback(
+          reinterpret_cast<DWORD64>(generated_code_execute_base_) | 0x3,
+          reinterpret_cast<DWORD64>(generated_code_execute_base_),
+          kGeneratedCodeSize,
+          [](DWORD64 control_pc, PVOID context) {
+            auto code_cache = reinterpret_cast<Win32X64CodeCache*>(context);
+            return reinterpret_cast<PRUNTIME_FUNCTION>(
+                code_cache->LookupUnwindInfo(control_pc));
+          },
+          this, nullptr)) {
+    XELOGE("Unable to install function table callback");
+    return false;
   }
+  function_table_installed_ = true;
 
   return true;
 }
 
-Win32X64CodeCache::UnwindReservation
-Win32X64CodeCache::RequestUnwindReservation(uint8_t* entry_address) {
-  assert_false(unwind_table_count_ >= kMaximumFunctionCount);
-  UnwindReservation unwind_reservation;
-  unwind_reservation.data_size = xe::round_up(kUnwindInfoSize, 16);
-  unwind_reservation.table_slot = unwind_table_count_++;
-  unwind_reservation.entry_address = entry_address;
-  return unwind_reservation;
-}
-
 void Win32X64CodeCache::PlaceCode(uint32_t guest_address, void* machine_code,
                                   const EmitFunctionInfo& func_info,
                                   void* code_execute_address,
                                   UnwindReservation unwind_reservation) {
-  // Add unwind info.
-  InitializeUnwindEntry(unwind_reservation.entry_address,
-                        unwind_reservation.table_slot, code_execute_address,
+  // Add the function entry and the unwind info.
+  auto fn_entry =
+      reinterpret_cast<RUNTIME_FUNCTION*>(unwind_reservation.entry_address);
+  fn_entry->BeginAddress =
+      DWORD(reinterpret_cast<uint8_t*>(code_execute_address) -
+            generated_code_execute_base_);
+  fn_entry->EndAddress =
+      DWORD(fn_entry->BeginAddress + func_info.code_size.total);
+  fn_entry->UnwindData =
+      DWORD(unwind_reservation.entry_address + kUnwindEntrySize -
+            generated_code_write_base_);
+  InitializeUnwindEntry(unwind_reservation.entry_address + kUnwindEntrySize,
                         func_info);
 
-  if (supports_growable_table_) {
-    // Notify that the unwind table has grown.
-    // We do this outside of the lock, but with the latest total count.
-    grow_table_(unwind_table_handle_, unwind_table_count_);
-  }
-
   // This isn't needed on x64 (probably), but is convention.
   // On UWP, FlushInstructionCache available starting from 10.0.16299.0.
   // https://docs.microsoft.com/en-us/uwp/win32-and-com/win32-apis
@@ -240,8 +182,7 @@ void Win32X64CodeCache::PlaceCode(uint32_t guest_address, void* machine_code,
 }
 
 void Win32X64CodeCache::InitializeUnwindEntry(
-    uint8_t* unwind_entry_address, size_t unwind_table_slot,
-    void* code_execute_address, const EmitFunctionInfo& func_info) {
+    uint8_t* unwind_entry_address, const EmitFunctionInfo& func_info) {
   auto unwind_info = reinterpret_cast<UNWIND_INFO*>(unwind_entry_address);
   UNWIND_CODE* unwind_code = nullptr;
 
@@ -301,34 +242,15 @@ void Win32X64CodeCache::InitializeUnwindEntry(
     std::memset(&unwind_info->UnwindCode[unwind_info->CountOfCodes + 1], 0,
                 sizeof(UNWIND_CODE));
   }
-
-  // Add entry.
-  auto& fn_entry = unwind_table_[unwind_table_slot];
-  fn_entry.BeginAddress =
-      DWORD(reinterpret_cast<uint8_t*>(code_execute_address) -
-            generated_code_execute_base_);
-  fn_entry.EndAddress =
-      DWORD(fn_entry.BeginAddress + func_info.code_size.total);
-  fn_entry.UnwindData =
-      DWORD(unwind_entry_address - generated_code_execute_base_);
 }
 
 void* Win32X64CodeCache::LookupUnwindInfo(uint64_t host_pc) {
-  return std::bsearch(
-      &host_pc, unwind_table_.data(), unwind_table_count_,
-      sizeof(RUNTIME_FUNCTION),
-      [](const void* key_ptr, const void* element_ptr) {
-        auto key = *reinterpret_cast<const uintptr_t*>(key_ptr) -
-                   kGeneratedCodeExecuteBase;
-        auto element = reinterpret_cast<const RUNTIME_FUNCTION*>(element_ptr);
-        if (key < element->BeginAddress) {
-          return -1;
-        } else if (key > element->EndAddress) {
-          return 1;
-        } else {
-          return 0;
-        }
-      });
+  CodeFrameInfo frame;
+  if (!LookupCodeFrame(host_pc, &frame)) {
+    return nullptr;
+  }
+  return const_cast<uint8_t*>(frame.code) +
+         xe::round_up(frame.code_size, uint32_t(16));
 }
 
 }  // namespace x64
@@ -11,6 +11,7 @@
 
 #include <stddef.h>
 
+#include <algorithm>
 #include <climits>
 #include <cstring>
 
@@ -42,6 +43,11 @@ DEFINE_bool(ignore_undefined_externs, true,
 DEFINE_bool(emit_source_annotations, false,
             "Add extra movs and nops to make disassembly easier to read.",
             "CPU");
+DEFINE_bool(link_direct_calls, true,
+            "Emit direct guest calls as rel32 calls that are patched to point "
+            "at the callee's code once it's compiled, instead of going through "
+            "the indirection table on every call.",
+            "CPU");
 
 namespace xe {
 namespace cpu {
@@ -72,7 +78,11 @@ X64Emitter::X64Emitter(X64Backend* backend, XbyakAllocator* allocator)
       backend_(backend),
       code_cache_(backend->code_cache()),
       allocator_(allocator) {
-  if (cvars::use_haswell_instructions) {
+  int32_t isa_level = cvars::max_x64_isa_level;
+  if (!cvars::use_haswell_instructions) {
+    isa_level = std::min(isa_level, 0);
+  }
+  if (isa_level >= 1) {
     feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tAVX2) ? kX64EmitAVX2 : 0;
     feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tFMA) ? kX64EmitFMA : 0;
     feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tLZCNT) ? kX64EmitLZCNT : 0;
@@ -80,6 +90,18 @@ X64Emitter::X64Emitter(X64Backend* backend, XbyakAllocator* allocator)
     feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tF16C) ? kX64EmitF16C : 0;
     feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tMOVBE) ? kX64EmitMovbe : 0;
   }
+  if (isa_level >= 2) {
+    feature_flags_ |=
+        cpu_.has(Xbyak::util::Cpu::tAVX512F) ? kX64EmitAVX512F : 0;
+    feature_flags_ |=
+        cpu_.has(Xbyak::util::Cpu::tAVX512VL) ? kX64EmitAVX512VL : 0;
+    feature_flags_ |=
+        cpu_.has(Xbyak::util::Cpu::tAVX512BW) ? kX64EmitAVX512BW : 0;
+    feature_flags_ |=
+        cpu_.has(Xbyak::util::Cpu::tAVX512DQ) ? kX64EmitAVX512DQ : 0;
+    feature_flags_ |=
+        cpu_.has(Xbyak::util::Cpu::tAVX512_VBMI) ? kX64EmitAVX512VBMI : 0;
+  }
 
   if (!cpu_.has(Xbyak::util::Cpu::tAVX)) {
     xe::FatalError(
@@ -91,6 +113,14 @@ X64Emitter::X64Emitter(X64Backend* backend, XbyakAllocator* allocator)
 
 X64Emitter::~X64Emitter() = default;
 
+// Called from baseline code once it has been entered often enough.
+uint64_t RequestTierUp(void* raw_context, uint64_t function_ptr) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  thread_state->processor()->RequestTierUp(
+      reinterpret_cast<GuestFunction*>(function_ptr));
+  return 0;
+}
+
 bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
                       uint32_t debug_info_flags, FunctionDebugInfo* debug_info,
                       void** out_code_address, size_t* out_code_size,
@@ -102,6 +132,43 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   debug_info_flags_ = debug_info_flags;
   trace_data_ = &function->trace_data();
   source_map_arena_.Reset();
+  current_guest_address_ = 0;
+  mmio_sites_.clear();
+  if (function->has_mmio_sites()) {
+    mmio_sites_ = processor_->GetMmioSpecializations(function->address());
+  }
+  storable_ = !debug_info_flags && !function->has_inlined_calls();
+  host_image_relocations_.clear();
+  call_sites_.clear();
+  indirect_call_sites_.clear();
+  tier_up_function_ = nullptr;
+  if (function->tier() == GuestFunction::Tier::kBaseline) {
+    // Baseline code is never persisted, only what it gets recompiled to.
+    tier_up_function_ = function;
+    storable_ = false;
+  }
+  branch_counters_.clear();
+  if (tier_up_function_ && cvars::block_layout) {
+    std::vector<std::pair<const hir::Instr*, uint64_t>> branches;
+    BranchProfile::ForEachBranch(
+        builder, [&branches](hir::Instr* branch, uint64_t key) {
+          branches.emplace_back(branch, key);
+        });
+    std::vector<uint64_t> keys;
+    keys.reserve(branches.size());
+    for (auto& branch : branches) {
+      keys.push_back(branch.second);
+    }
+    auto& profile = function->branch_profile();
+    profile.Reset(std::move(keys));
+    for (auto& branch : branches) {
+      auto counts = profile.Lookup(branch.second);
+      if (counts) {
+        branch_counters_.emplace(branch.first->block,
+                                 BranchCounter{branch.first, counts});
+      }
+    }
+  }
 
   // Fill the generator with code.
   EmitFunctionInfo func_info = {};
@@ -109,18 +176,75 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
     return false;
   }
 
-  // Copy the final code to the cache and relocate it.
-  *out_code_size = getSize();
-  *out_code_address = Emplace(func_info, function);
+  if (cvars::log_block_layout_stats && !tier_up_function_) {
+    XELOGI("{:08X}: {} bytes of hot code, {} bytes of cold code",
+           function->address(),
+           func_info.code_size.total - func_info.code_size.cold,
+           func_info.code_size.cold);
+  }
 
   // Stash source map.
   source_map_arena_.CloneContents(out_source_map);
 
+  // Copy the final code to the cache and relocate it.
+  *out_code_size = getSize();
+  *out_code_address = Emplace(func_info, function, out_source_map);
+
+  // Link direct calls to callees that already have code, the rest to the
+  // thunk that links them when first executed. Nothing can run the code yet.
+  for (auto& call_site : call_sites_) {
+    auto call_site_address =
+        reinterpret_cast<uint8_t*>(*out_code_address) + call_site.offset;
+    auto callee = static_cast<X64Function*>(call_site.function);
+    auto resolve_thunk =
+        reinterpret_cast<void*>(backend_->resolve_call_site_thunk());
+    if (!callee->LinkCallSite(code_cache_, call_site_address,
+                              resolve_thunk)) {
+      code_cache_->PatchCallSite(call_site_address, resolve_thunk);
+    }
+  }
+  for (auto& site : indirect_call_sites_) {
+    auto code_address = reinterpret_cast<uint8_t*>(*out_code_address);
+    auto unlink_target =
+        site->is_tail_call
+            ? reinterpret_cast<void*>(backend_->resolve_function_thunk())
+            : reinterpret_cast<void*>(backend_->resolve_call_site_thunk());
+    for (uint32_t i = 0; i < site->entry_count; ++i) {
+      site->compare_immediates[i] =
+          code_address + uintptr_t(site->compare_immediates[i]);
+      site->call_sites[i] = code_address + uintptr_t(site->call_sites[i]);
+      // Unreachable until the entry is filled in, but keep it valid.
+      code_cache_->PatchCallSite(site->call_sites[i], unlink_target);
+    }
+  }
+  backend_->AddIndirectCallSites(reinterpret_cast<uint8_t*>(*out_code_address),
+                                 std::move(indirect_call_sites_));
+  indirect_call_sites_.clear();
+
+  // Persist the code for the next launch, or check it against what has been
+  // persisted by the previous ones.
+  if (storable_ && code_cache_->has_code_storage()) {
+    std::vector<uint32_t> call_site_offsets;
+    call_site_offsets.reserve(call_sites_.size());
+    for (auto& call_site : call_sites_) {
+      call_site_offsets.push_back(call_site.offset);
+    }
+    if (cvars::validate_stored_jit_code) {
+      code_cache_->ValidateStoredGuestCode(
+          function, *out_code_address, *out_code_size,
+          host_image_relocations_, call_site_offsets);
+    }
+    code_cache_->StoreGuestCode(processor_->memory(), function, func_info,
+                                *out_source_map, *out_code_address,
+                                host_image_relocations_, call_site_offsets);
+  }
+
   return true;
 }
 
 void* X64Emitter::Emplace(const EmitFunctionInfo& func_info,
-                          GuestFunction* function) {
+                          GuestFunction* function,
+                          const std::vector<SourceMapEntry>* source_map) {
   // To avoid changing xbyak, we do a switcharoo here.
   // top_ points to the Xbyak buffer, and since we are in AutoGrow mode
   // it has pending relocations. We copy the top_ to our buffer, swap the
@@ -143,6 +267,8 @@ void* X64Emitter::Emplace(const EmitFunctionInfo& func_info,
   top_ = reinterpret_cast<uint8_t*>(new_write_address);
   ready();
   top_ = old_address;
+  code_cache_->DescribePlacedCode(function ? function->address() : 0, function,
+                                  source_map, new_execute_address, size_);
   reset();
   return new_execute_address;
 }
@@ -157,6 +283,12 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
   size_t stack_offset = StackLayout::GUEST_STACK_SIZE;
   for (auto it = locals.begin(); it != locals.end(); ++it) {
     auto slot = *it;
+    if (slot->reg.set) {
+      // Kept in a register by the register allocator. The sequences still
+      // expect the slot to be a constant.
+      slot->set_constant(uint32_t(0));
+      continue;
+    }
     size_t type_size = GetTypeSize(slot->type);
 
     // Align to natural size.
@@ -174,6 +306,7 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
     size_t prolog_stack_alloc;
     size_t body;
     size_t epilog;
+    size_t cold;
     size_t tail;
   } code_offsets = {};
 
@@ -232,37 +365,28 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
   mov(GetMembaseReg(),
       qword[GetContextReg() + offsetof(ppc::PPCContext, virtual_membase)]);
 
-  // Body.
-  auto block = builder->first_block();
-  while (block) {
-    // Mark block labels.
-    auto label = block->label_head;
-    while (label) {
-      L(label->name);
-      label = label->next;
-    }
-
-    // Process instructions.
-    const Instr* instr = block->instr_head;
-    while (instr) {
-      const Instr* new_tail = instr;
-      if (!SelectSequence(this, instr, &new_tail)) {
-        // No sequence found!
-        // NOTE: If you encounter this after adding a new instruction, do a full
-        // rebuild!
-        assert_always();
-        XELOGE("Unable to process HIR opcode {}", instr->opcode->name);
-        break;
-      }
-      instr = new_tail;
-    }
+  // Count entries into baseline code and request the optimized version once
+  // the counter runs out. The counter isn't updated atomically, as a few lost
+  // entries don't matter.
+  if (tier_up_function_) {
+    Xbyak::Label tier_up_skip;
+    mov(rax, reinterpret_cast<uint64_t>(tier_up_function_->tier_up_counter()));
+    sub(dword[rax], 1);
+    jnz(tier_up_skip, CodeGenerator::T_NEAR);
+    CallNative(RequestTierUp, reinterpret_cast<uint64_t>(tier_up_function_));
+    L(tier_up_skip);
+  }
 
+  // Body. Cold blocks come last, and are emitted after the epilog so that
+  // the rest of the function is packed together.
+  auto block = builder->first_block();
+  while (block && !(block->flags & hir::Block::COLD)) {
+    EmitBlock(block);
     block = block->next;
   }
 
   // Function epilog.
   L(epilog_label);
-  epilog_label_ = nullptr;
   EmitTraceUserCallReturn();
   mov(GetContextReg(), qword[rsp + StackLayout::GUEST_CTX_HOME]);
 
@@ -271,6 +395,15 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
   add(rsp, (uint32_t)stack_size);
   ret();
 
+  code_offsets.cold = getSize();
+
+  while (block) {
+    assert_true(block->flags & hir::Block::COLD);
+    EmitBlock(block);
+    block = block->next;
+  }
+  epilog_label_ = nullptr;
+
   code_offsets.tail = getSize();
 
   if (cvars::emit_source_annotations) {
@@ -285,7 +418,8 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
   func_info.code_size.total = getSize();
   func_info.code_size.prolog = code_offsets.body - code_offsets.prolog;
   func_info.code_size.body = code_offsets.epilog - code_offsets.body;
-  func_info.code_size.epilog = code_offsets.tail - code_offsets.epilog;
+  func_info.code_size.epilog = code_offsets.cold - code_offsets.epilog;
+  func_info.code_size.cold = code_offsets.tail - code_offsets.cold;
   func_info.code_size.tail = getSize() - code_offsets.tail;
   func_info.prolog_stack_alloc_offset =
       code_offsets.prolog_stack_alloc - code_offsets.prolog;
@@ -293,11 +427,58 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
   return true;
 }
 
+void X64Emitter::EmitBlock(hir::Block* block) {
+  if (block->flags & hir::Block::LOOP_HEAD) {
+    align(16);
+  }
+
+  // Mark block labels.
+  auto label = block->label_head;
+  while (label) {
+    L(label->name);
+    label = label->next;
+  }
+
+  // Count the entries into blocks ending in a profiled conditional branch,
+  // and the executions not taking it right after the branch. The counters
+  // aren't updated atomically, and flags are never live there.
+  BranchProfile::Counts* branch_counts = nullptr;
+  const Instr* counted_branch = nullptr;
+  auto branch_counter = branch_counters_.find(block);
+  if (branch_counter != branch_counters_.end()) {
+    branch_counts = branch_counter->second.counts;
+    counted_branch = branch_counter->second.branch;
+    mov(rax, reinterpret_cast<uint64_t>(&branch_counts->reached));
+    add(dword[rax], 1);
+  }
+
+  // Process instructions.
+  const Instr* instr = block->instr_head;
+  while (instr) {
+    const Instr* new_tail = instr;
+    bool is_counted_branch = instr == counted_branch;
+    if (!SelectSequence(this, instr, &new_tail)) {
+      // No sequence found!
+      // NOTE: If you encounter this after adding a new instruction, do a full
+      // rebuild!
+      assert_always();
+      XELOGE("Unable to process HIR opcode {}", instr->opcode->name);
+      break;
+    }
+    if (is_counted_branch) {
+      mov(rax, reinterpret_cast<uint64_t>(&branch_counts->not_taken));
+      add(dword[rax], 1);
+    }
+    instr = new_tail;
+  }
+}
+
 void X64Emitter::MarkSourceOffset(const Instr* i) {
   auto entry = source_map_arena_.Alloc<SourceMapEntry>();
   entry->guest_address = static_cast<uint32_t>(i->src1.offset);
   entry->hir_offset = uint32_t(i->block->ordinal << 16) | i->ordinal;
   entry->code_offset = static_cast<uint32_t>(getSize());
+  current_guest_address_ = entry->guest_address;
 
   if (cvars::emit_source_annotations) {
     nop();
@@ -316,6 +497,14 @@ void X64Emitter::MarkSourceOffset(const Instr* i) {
   }
 }
 
+const MMIORange* X64Emitter::LookupMmioSite() const {
+  if (mmio_sites_.empty()) {
+    return nullptr;
+  }
+  auto it = mmio_sites_.find(current_guest_address_);
+  return it != mmio_sites_.end() ? it->second : nullptr;
+}
+
 void X64Emitter::EmitGetCurrentThreadId() {
   // rsi must point to context. We could fetch from the stack if needed.
   mov(ax, word[GetContextReg() + offsetof(ppc::PPCContext, thread_id)]);
@@ -388,22 +577,67 @@ uint64_t ResolveFunction(void* raw_context, uint64_t target_address) {
   // TODO(benvanik): required?
   assert_not_zero(target_address);
 
-  auto fn = thread_state->processor()->ResolveFunction(
-      static_cast<uint32_t>(target_address));
-  assert_not_null(fn);
-  auto x64_fn = static_cast<X64Function*>(fn);
-  uint64_t addr = reinterpret_cast<uint64_t>(x64_fn->machine_code());
+  uint8_t* machine_code;
+  do {
+    // Resolved again if invalidated meanwhile.
+    auto fn = thread_state->processor()->ResolveFunction(
+        static_cast<uint32_t>(target_address));
+    assert_not_null(fn);
+    auto x64_fn = static_cast<X64Function*>(fn);
+    machine_code = x64_fn->machine_code();
+  } while (!machine_code);
+  uint64_t addr = reinterpret_cast<uint64_t>(machine_code);
 
   return addr;
 }
 
+// This is used by the X64ThunkEmitter's ResolveCallSiteThunk.
+uint64_t ResolveCallSite(void* raw_context, uint64_t target_address,
+                         uint64_t call_site) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+
+  auto backend =
+      static_cast<X64Backend*>(thread_state->processor()->backend());
+  uint8_t* machine_code;
+  do {
+    // Resolved again if invalidated meanwhile.
+    auto fn = thread_state->processor()->ResolveFunction(
+        static_cast<uint32_t>(target_address));
+    assert_not_null(fn);
+    auto x64_fn = static_cast<X64Function*>(fn);
+    machine_code = x64_fn->LinkCallSite(
+        backend->code_cache(), reinterpret_cast<uint8_t*>(call_site),
+        reinterpret_cast<void*>(backend->resolve_call_site_thunk()));
+  } while (!machine_code);
+  return reinterpret_cast<uint64_t>(machine_code);
+}
+
 void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   assert_not_null(function);
   auto fn = static_cast<X64Function*>(function);
+  if (cvars::link_direct_calls && !(instr->flags & hir::CALL_TAIL)) {
+    // Direct call, linked after the code is placed, or restored from storage.
+    // A tail call would leave the resolve thunk no return address to find the
+    // call site with.
+    // ebx is only needed by the resolve thunk while unlinked.
+    mov(ebx, function->address());
+    // Return address is from the previous SET_RETURN_ADDRESS.
+    mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+    // Align the displacement so that it can be patched atomically.
+    nop((3 - getSize() % 4) % 4);
+    db(0xE8);
+    dd(0);
+    call_sites_.push_back({static_cast<uint32_t>(getSize()), function});
+    return;
+  }
   // Resolve address to the function to call and store in rax.
-  if (fn->machine_code()) {
+  if (fn->machine_code() && !code_cache_->has_code_storage() &&
+      !cvars::tiered_jit && !cvars::reclaim_jit_code) {
     // TODO(benvanik): is it worth it to do this? It removes the need for
     // a ResolveFunction call, but makes the table less useful.
+    // Not done when the code may be stored, as the callee may be placed
+    // elsewhere on the next launch, or when the callee may be recompiled or
+    // invalidated and its code reclaimed.
     assert_zero(uint64_t(fn->machine_code()) & 0xFFFFFFFF00000000);
     mov(eax, uint32_t(uint64_t(fn->machine_code())));
   } else if (code_cache_->has_indirection_table()) {
@@ -445,6 +679,15 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
     je(epilog_label(), CodeGenerator::T_NEAR);
   }
 
+  if (cvars::inline_cache_size > 0 && code_cache_->has_indirection_table()) {
+    // Makes the function not storable, as the code references the site.
+    if (reg.cvt32() != ebx) {
+      mov(ebx, reg.cvt32());
+    }
+    CallIndirectCached(instr);
+    return;
+  }
+
   // Load the pointer to the indirection table maintained in X64CodeCache.
   // The target dword will either contain the address of the generated code
   // or a thunk to ResolveAddress.
@@ -457,7 +700,7 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
     // Old-style resolve.
     // Not too important because indirection table is almost always available.
     mov(edx, reg.cvt32());
-    mov(rax, reinterpret_cast<uint64_t>(ResolveFunction));
+    MovHostImageAddress(rax, reinterpret_cast<void*>(ResolveFunction));
     mov(rcx, GetContextReg());
     call(rax);
   }
@@ -480,6 +723,120 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
   }
 }
 
+// Called by inline caches on a miss while they have free entries.
+uint64_t ResolveIndirectCallSite(void* raw_context, uint64_t site_ptr,
+                                 uint64_t target_address) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+
+  auto backend =
+      static_cast<X64Backend*>(thread_state->processor()->backend());
+  uint8_t* machine_code;
+  do {
+    // Resolved again if invalidated meanwhile.
+    auto fn = thread_state->processor()->ResolveFunction(
+        static_cast<uint32_t>(target_address));
+    assert_not_null(fn);
+    machine_code = backend->AddIndirectCallSiteTarget(
+        reinterpret_cast<IndirectCallSite*>(site_ptr),
+        static_cast<X64Function*>(fn));
+  } while (!machine_code);
+  return reinterpret_cast<uint64_t>(machine_code);
+}
+
+void X64Emitter::CallIndirectCached(const hir::Instr* instr) {
+  bool is_tail_call = (instr->flags & hir::CALL_TAIL) != 0;
+  bool count = cvars::log_inline_cache_stats;
+
+  // Value-initialized, so all counters start at zero.
+  auto site = std::make_unique<IndirectCallSite>();
+  site->entry_count = std::min(uint32_t(cvars::inline_cache_size),
+                               IndirectCallSite::kMaxEntryCount);
+  site->is_tail_call = is_tail_call ? 1 : 0;
+  for (auto i = instr->prev; i; i = i->prev) {
+    if (i->opcode == &hir::OPCODE_SOURCE_OFFSET_info) {
+      site->guest_address = static_cast<uint32_t>(i->src1.offset);
+      break;
+    }
+  }
+  // The code references the site, which only lives for this session.
+  MarkNotStorable();
+  auto site_address = reinterpret_cast<uint64_t>(site.get());
+
+  // Jumps to the callee's code in rax.
+  auto jump_to_rax = [&]() {
+    if (is_tail_call) {
+      // Since we skip the prolog we need to mark the return here.
+      EmitTraceUserCallReturn();
+      // Pass the callers return address over.
+      mov(rcx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
+      add(rsp, static_cast<uint32_t>(stack_size()));
+      jmp(rax);
+    } else {
+      // Return address is from the previous SET_RETURN_ADDRESS.
+      mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+      call(rax);
+    }
+  };
+
+  // Entries, with immediates that are patched when they're filled in. Both
+  // the compared guest address and the call displacement are 4-byte aligned
+  // so they can be patched while other threads run the code. Until then the
+  // guest address can't match any (aligned) target.
+  Xbyak::Label done_label;
+  for (uint32_t i = 0; i < site->entry_count; ++i) {
+    Xbyak::Label next_label;
+    nop((6 - getSize() % 4) % 4);
+    // cmp ebx, imm32
+    db(0x81);
+    db(0xFB);
+    site->compare_immediates[i] = reinterpret_cast<uint8_t*>(getSize());
+    dd(0xFFFFFFFF);
+    jne(next_label, CodeGenerator::T_NEAR);
+    if (count) {
+      mov(rdx, site_address);
+      inc(dword[rdx + offsetof(IndirectCallSite, hits) + i * 4]);
+    }
+    if (is_tail_call) {
+      EmitTraceUserCallReturn();
+      mov(rcx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
+      add(rsp, static_cast<uint32_t>(stack_size()));
+    } else {
+      mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+    }
+    nop((3 - getSize() % 4) % 4);
+    // call rel32 / jmp rel32
+    db(is_tail_call ? 0xE9 : 0xE8);
+    dd(0);
+    site->call_sites[i] = reinterpret_cast<uint8_t*>(getSize());
+    if (!is_tail_call) {
+      jmp(done_label, CodeGenerator::T_NEAR);
+    }
+    L(next_label);
+  }
+
+  // Miss: fill in an entry if any is free, otherwise use the indirection
+  // table like uncached calls.
+  Xbyak::Label table_label;
+  mov(rdx, site_address);
+  if (count) {
+    inc(dword[rdx + offsetof(IndirectCallSite, misses)]);
+  }
+  cmp(dword[rdx + offsetof(IndirectCallSite, used_count)], site->entry_count);
+  jae(table_label, CodeGenerator::T_NEAR);
+  mov(r8d, ebx);
+  CallNativeSafe(reinterpret_cast<void*>(ResolveIndirectCallSite));
+  jump_to_rax();
+  if (!is_tail_call) {
+    jmp(done_label, CodeGenerator::T_NEAR);
+  }
+  L(table_label);
+  mov(eax, dword[ebx]);
+  jump_to_rax();
+  L(done_label);
+
+  indirect_call_sites_.push_back(std::move(site));
+}
+
 uint64_t UndefinedCallExtern(void* raw_context, uint64_t function_ptr) {
   auto function = reinterpret_cast<Function*>(function_ptr);
   if (!cvars::ignore_undefined_externs) {
@@ -503,9 +860,13 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // r9  = arg2
       auto thunk = backend()->guest_to_host_thunk();
       mov(rax, reinterpret_cast<uint64_t>(thunk));
-      mov(rcx, reinterpret_cast<uint64_t>(builtin_function->handler()));
+      MovHostImageAddress(
+          rcx, reinterpret_cast<void*>(builtin_function->handler()));
       mov(rdx, reinterpret_cast<uint64_t>(builtin_function->arg0()));
       mov(r8, reinterpret_cast<uint64_t>(builtin_function->arg1()));
+      if (builtin_function->arg0() || builtin_function->arg1()) {
+        MarkNotStorable();
+      }
       call(rax);
       // rax = host return
     }
@@ -519,7 +880,8 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // r9  = arg2
       auto thunk = backend()->guest_to_host_thunk();
       mov(rax, reinterpret_cast<uint64_t>(thunk));
-      mov(rcx, reinterpret_cast<uint64_t>(extern_function->extern_handler()));
+      MovHostImageAddress(
+          rcx, reinterpret_cast<void*>(extern_function->extern_handler()));
       mov(rdx,
           qword[GetContextReg() + offsetof(ppc::PPCContext, kernel_state)]);
       call(rax);
@@ -527,6 +889,7 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
     }
   }
   if (undefined) {
+    MarkNotStorable();
     CallNative(UndefinedCallExtern, reinterpret_cast<uint64_t>(function));
   }
 }
@@ -554,7 +917,7 @@ void X64Emitter::CallNativeSafe(void* fn) {
   // r9  = arg2
   auto thunk = backend()->guest_to_host_thunk();
   mov(rax, reinterpret_cast<uint64_t>(thunk));
-  mov(rcx, reinterpret_cast<uint64_t>(fn));
+  MovHostImageAddress(rcx, fn);
   call(rax);
   // rax = host return
 }
@@ -606,6 +969,16 @@ void X64Emitter::nop(size_t length) {
   }
 }
 
+void X64Emitter::MovHostImageAddress(const Xbyak::Reg64& r,
+                                     const void* address) {
+  // Always use the full mov r64, imm64 encoding so the immediate can be
+  // relocated to any value.
+  db(0x48 | (r.getIdx() >= 8 ? 0x01 : 0x00));
+  db(0xB8 | (r.getIdx() & 7));
+  host_image_relocations_.push_back(static_cast<uint32_t>(getSize()));
+  dq(reinterpret_cast<uint64_t>(address));
+}
+
 bool X64Emitter::ConstantFitsIn32Reg(uint64_t v) {
   if ((v & ~0x7FFFFFFF) == 0) {
     // Fits under 31 bits, so just load using normal mov.
@@ -747,6 +1120,42 @@ static const vec128_t xmm_consts[] = {
     /* XMMQNaN                */ vec128i(0x7FC00000u),
     /* XMMInt127              */ vec128i(0x7Fu),
     /* XMM2To32               */ vec128f(0x1.0p32f),
+    /* XMMShiftMaskPI8        */ vec128b(0x07),
+    /* XMMShiftMaskPI16       */ vec128s(0x000F),
+    /* XMMPI16                */ vec128s(16),
+    /* XMMShiftedByteMask1    */ vec128b(0xFE),
+    /* XMMShiftedByteMask2    */ vec128b(0xFC),
+    /* XMMShiftedByteMask4    */ vec128b(0xF0),
+    /* XMMLowByteMaskPI16     */ vec128s(0x00FF),
+    /* XMMInfinityPS          */ vec128i(0x7F800000u),
+    /* XMMNegInfinityPS       */ vec128i(0xFF800000u),
+    /* XMMMinNormalPS         */ vec128i(0x00800000u),
+    /* XMMMantissaMaskPS      */ vec128i(0x007FFFFFu),
+    /* XMMQuietBitPS          */ vec128i(0x00400000u),
+    /* XMMFloat16Bias         */ vec128i((127 - 15) << 23),
+    /* XMMFloat16MinNormal    */ vec128f(0x1.0p-14f),
+    /* XMMFloat16DenormalScale */ vec128f(0x1.0p24f),
+    /* XMMFloat16Max          */ vec128i(0x7BFFu),
+    /* XMMFloat16QuietBit     */ vec128i(0x0200u),
+    /* XMMFloat16NaNBias      */ vec128i(0x38000u),
+    /* XMMFloat16MagnitudeMask */ vec128i(0x7FFFu << 13),
+    /* XMMFloat16ExpMask      */ vec128i(0x7C00u << 13),
+    /* XMMExp2Min             */ vec128f(-150.0f),
+    /* XMMExp2Max             */ vec128f(128.0f),
+    /* XMMExp2C1              */ vec128f(6.93147181e-1f),
+    /* XMMExp2C2              */ vec128f(2.40226507e-1f),
+    /* XMMExp2C3              */ vec128f(5.55041087e-2f),
+    /* XMMExp2C4              */ vec128f(9.61812911e-3f),
+    /* XMMExp2C5              */ vec128f(1.33335581e-3f),
+    /* XMMExp2C6              */ vec128f(1.54035304e-4f),
+    /* XMMExp2C7              */ vec128f(1.52527338e-5f),
+    /* XMMSqrt2               */ vec128f(1.41421356f),
+    /* XMMLog2C1              */ vec128f(2.88539008f),
+    /* XMMLog2C3              */ vec128f(9.61796694e-1f),
+    /* XMMLog2C5              */ vec128f(5.77078016e-1f),
+    /* XMMLog2C7              */ vec128f(4.12198583e-1f),
+    /* XMMLog2C9              */ vec128f(3.20598898e-1f),
+    /* XMMLog2DenormalBias    */ vec128i(24u),
 };
 
 // First location to try and place constants.
@@ -10,6 +10,8 @@
 #ifndef XENIA_CPU_BACKEND_X64_X64_EMITTER_H_
 #define XENIA_CPU_BACKEND_X64_X64_EMITTER_H_
 
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/arena.h"
@@ -38,6 +40,7 @@ namespace x64 {
 
 class X64Backend;
 class X64CodeCache;
+struct IndirectCallSite;
 
 struct EmitFunctionInfo;
 
@@ -116,6 +119,42 @@ enum XmmConst {
   XMMQNaN,
   XMMInt127,
   XMM2To32,
+  XMMShiftMaskPI8,
+  XMMShiftMaskPI16,
+  XMMPI16,
+  XMMShiftedByteMask1,
+  XMMShiftedByteMask2,
+  XMMShiftedByteMask4,
+  XMMLowByteMaskPI16,
+  XMMInfinityPS,
+  XMMNegInfinityPS,
+  XMMMinNormalPS,
+  XMMMantissaMaskPS,
+  XMMQuietBitPS,
+  XMMFloat16Bias,
+  XMMFloat16MinNormal,
+  XMMFloat16DenormalScale,
+  XMMFloat16Max,
+  XMMFloat16QuietBit,
+  XMMFloat16NaNBias,
+  XMMFloat16MagnitudeMask,
+  XMMFloat16ExpMask,
+  XMMExp2Min,
+  XMMExp2Max,
+  XMMExp2C1,
+  XMMExp2C2,
+  XMMExp2C3,
+  XMMExp2C4,
+  XMMExp2C5,
+  XMMExp2C6,
+  XMMExp2C7,
+  XMMSqrt2,
+  XMMLog2C1,
+  XMMLog2C3,
+  XMMLog2C5,
+  XMMLog2C7,
+  XMMLog2C9,
+  XMMLog2DenormalBias,
 };
 
 // Unfortunately due to the design of xbyak we have to pass this to the ctor.
@@ -131,6 +170,18 @@ enum X64EmitterFeatureFlags {
   kX64EmitBMI2 = 1 << 4,
   kX64EmitF16C = 1 << 5,
   kX64EmitMovbe = 1 << 6,
+  kX64EmitAVX512F = 1 << 7,
+  kX64EmitAVX512VL = 1 << 8,
+  kX64EmitAVX512BW = 1 << 9,
+  kX64EmitAVX512DQ = 1 << 10,
+  kX64EmitAVX512VBMI = 1 << 11,
+
+  // AVX-512 instructions on xmm registers need VL along with their own
+  // extension.
+  kX64EmitAVX512Ortho = kX64EmitAVX512F | kX64EmitAVX512VL,
+  kX64EmitAVX512BWVL = kX64EmitAVX512Ortho | kX64EmitAVX512BW,
+  kX64EmitAVX512DQVL = kX64EmitAVX512Ortho | kX64EmitAVX512DQ,
+  kX64EmitAVX512VBMIVL = kX64EmitAVX512Ortho | kX64EmitAVX512VBMI,
 };
 
 class X64Emitter : public Xbyak::CodeGenerator {
@@ -182,6 +233,9 @@ class X64Emitter : public Xbyak::CodeGenerator {
   Xbyak::Label& epilog_label() { return *epilog_label_; }
 
   void MarkSourceOffset(const hir::Instr* i);
+  // Range that the loads and stores of the current guest instruction faulted
+  // on, for them to call it directly when the address is in it, or nullptr.
+  const MMIORange* LookupMmioSite() const;
 
   void DebugBreak();
   void Trap(uint16_t trap_type = 0);
@@ -189,6 +243,8 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
   void Call(const hir::Instr* instr, GuestFunction* function);
   void CallIndirect(const hir::Instr* instr, const Xbyak::Reg64& reg);
+  // Emits an inline cache for CallIndirect, with the target in ebx.
+  void CallIndirectCached(const hir::Instr* instr);
   void CallExtern(const hir::Instr* instr, const Function* function);
   void CallNative(void* fn);
   void CallNative(uint64_t (*fn)(void* raw_context));
@@ -207,6 +263,18 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
   void nop(size_t length = 1);
 
+  // Moves an address within the host executable image (a function or static
+  // data) into a register, recording it so that the code can be relocated
+  // when restored from the persistent code storage.
+  void MovHostImageAddress(const Xbyak::Reg64& r, const void* address);
+  // Marks the function being emitted as referencing host state that differs
+  // between launches, such as heap objects, so that it won't be persisted.
+  void MarkNotStorable() { storable_ = false; }
+  bool storable() const { return storable_; }
+  const std::vector<uint32_t>& host_image_relocations() const {
+    return host_image_relocations_;
+  }
+
   // Moves a 64bit immediate into memory.
   bool ConstantFitsIn32Reg(uint64_t v);
   void MovMem64(const Xbyak::RegExp& addr, uint64_t v);
@@ -220,8 +288,10 @@ class X64Emitter : public Xbyak::CodeGenerator {
   Xbyak::Address StashConstantXmm(int index, double v);
   Xbyak::Address StashConstantXmm(int index, const vec128_t& v);
 
+  uint32_t feature_flags() const { return feature_flags_; }
+  // Whether all of the given features are enabled.
   bool IsFeatureEnabled(uint32_t feature_flag) const {
-    return (feature_flags_ & feature_flag) != 0;
+    return (feature_flags_ & feature_flag) == feature_flag;
   }
 
   FunctionDebugInfo* debug_info() const { return debug_info_; }
@@ -230,8 +300,10 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
  protected:
   void* Emplace(const EmitFunctionInfo& func_info,
-                GuestFunction* function = nullptr);
+                GuestFunction* function = nullptr,
+                const std::vector<SourceMapEntry>* source_map = nullptr);
   bool Emit(hir::HIRBuilder* builder, EmitFunctionInfo& func_info);
+  void EmitBlock(hir::Block* block);
   void EmitGetCurrentThreadId();
   void EmitTraceUserCallReturn();
 
@@ -251,9 +323,36 @@ class X64Emitter : public Xbyak::CodeGenerator {
   uint32_t debug_info_flags_ = 0;
   FunctionTraceData* trace_data_ = nullptr;
   Arena source_map_arena_;
+  uint32_t current_guest_address_ = 0;
+  // Specialized MMIO accesses of the function, by guest address.
+  std::unordered_map<uint32_t, const MMIORange*> mmio_sites_;
 
   size_t stack_size_ = 0;
 
+  bool storable_ = true;
+  std::vector<uint32_t> host_image_relocations_;
+
+  // Set while emitting baseline code that counts its entries.
+  GuestFunction* tier_up_function_ = nullptr;
+  // Conditional branches counted by baseline code, by the block they end,
+  // for the optimized code to be laid out from.
+  struct BranchCounter {
+    const hir::Instr* branch;
+    BranchProfile::Counts* counts;
+  };
+  std::unordered_map<const hir::Block*, BranchCounter> branch_counters_;
+
+  // Direct calls to link once the code is placed, with the offsets of the
+  // ends of their call instructions.
+  struct CallSite {
+    uint32_t offset;
+    GuestFunction* function;
+  };
+  std::vector<CallSite> call_sites_;
+  // Inline caches emitted with code offsets in place of addresses, fixed up
+  // once the code is placed, and then handed over to the backend.
+  std::vector<std::unique_ptr<IndirectCallSite>> indirect_call_sites_;
+
   static const uint32_t gpr_reg_map_[GPR_COUNT];
   static const uint32_t xmm_reg_map_[XMM_COUNT];
 };
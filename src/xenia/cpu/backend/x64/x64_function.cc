@@ -9,7 +9,9 @@
 
 #include "xenia/cpu/backend/x64/x64_function.h"
 
+#include "xenia/base/assert.h"
 #include "xenia/cpu/backend/x64/x64_backend.h"
+#include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/thread_state.h"
 
@@ -18,24 +20,79 @@ namespace cpu {
 namespace backend {
 namespace x64 {
 
-X64Function::X64Function(Module* module, uint32_t address)
-    : GuestFunction(module, address) {}
+X64Function::X64Function(Module* module, uint32_t address,
+                         X64Backend* backend)
+    : GuestFunction(module, address), backend_(backend) {}
 
 X64Function::~X64Function() {
   // machine_code_ is freed by code cache.
 }
 
-void X64Function::Setup(uint8_t* machine_code, size_t machine_code_length) {
-  machine_code_ = machine_code;
-  machine_code_length_ = machine_code_length;
+void X64Function::Setup(std::shared_ptr<const Code> code) {
+  std::lock_guard<std::mutex> lock(call_sites_mutex_);
+  machine_code_ = code ? code->machine_code : nullptr;
+  machine_code_length_ = code ? code->machine_code_length : 0;
+  PublishCode(std::move(code));
+}
+
+void X64Function::ReleaseCode(const uint8_t* machine_code) {
+  GuestFunction::ReleaseCode(machine_code);
+  backend_->ReleaseIndirectCallSites(machine_code);
+}
+
+uint8_t* X64Function::LinkCallSite(X64CodeCache* code_cache,
+                                   uint8_t* call_site,
+                                   const void* unlink_target) {
+  std::lock_guard<std::mutex> lock(call_sites_mutex_);
+  if (!machine_code_) {
+    return nullptr;
+  }
+  X64CodeCache::CodeFrameInfo frame;
+  if (!code_cache->LookupCodeFrame(reinterpret_cast<uintptr_t>(call_site - 1),
+                                   &frame)) {
+    assert_always();
+    return machine_code_;
+  }
+  // Racing threads may link the same site more than once, which only means
+  // it gets unlinked more than once.
+  code_cache->PatchCallSite(call_site, machine_code_);
+  call_sites_.push_back({call_site, unlink_target, frame.id});
+  return machine_code_;
+}
+
+void X64Function::UnlinkCallSites(X64CodeCache* code_cache) {
+  std::lock_guard<std::mutex> lock(call_sites_mutex_);
+  for (auto& linked_call_site : call_sites_) {
+    code_cache->PatchCallSite(linked_call_site.call_site,
+                              linked_call_site.unlink_target,
+                              linked_call_site.code_id);
+  }
+  call_sites_.clear();
 }
 
 bool X64Function::CallImpl(ThreadState* thread_state, uint32_t return_address) {
   auto backend =
       reinterpret_cast<X64Backend*>(thread_state->processor()->backend());
+  // Code retired before entering guest code can't be on the stack of the
+  // thread, and it only reports safepoints when not nested.
+  auto code_thread =
+      reinterpret_cast<X64CodeCache::CodeThread*>(thread_state->backend_data());
+  if (!code_thread->guest_depth++) {
+    code_thread->safe_epoch = backend->code_cache()->retire_epoch();
+  }
+  uint8_t* machine_code = machine_code_;
+  while (!machine_code) {
+    // Invalidated, translate it again.
+    if (!thread_state->processor()->ResolveFunction(address())) {
+      --code_thread->guest_depth;
+      return false;
+    }
+    machine_code = machine_code_;
+  }
   auto thunk = backend->host_to_guest_thunk();
-  thunk(machine_code_, thread_state->context(),
+  thunk(machine_code, thread_state->context(),
         reinterpret_cast<void*>(uintptr_t(return_address)));
+  --code_thread->guest_depth;
   return true;
 }
 
@@ -10,6 +10,9 @@
 #ifndef XENIA_CPU_BACKEND_X64_X64_FUNCTION_H_
 #define XENIA_CPU_BACKEND_X64_X64_FUNCTION_H_
 
+#include <mutex>
+#include <vector>
+
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/thread_state.h"
 
@@ -18,22 +21,53 @@ namespace cpu {
 namespace backend {
 namespace x64 {
 
+class X64Backend;
+class X64CodeCache;
+
 class X64Function : public GuestFunction {
  public:
-  X64Function(Module* module, uint32_t address);
+  X64Function(Module* module, uint32_t address, X64Backend* backend);
   ~X64Function() override;
 
   uint8_t* machine_code() const override { return machine_code_; }
   size_t machine_code_length() const override { return machine_code_length_; }
 
-  void Setup(uint8_t* machine_code, size_t machine_code_length);
+  // Publishes the code, or invalidates the function if nullptr.
+  void Setup(std::shared_ptr<const Code> code);
+  // Also frees the inline caches of the reclaimed code.
+  void ReleaseCode(const uint8_t* machine_code) override;
+
+  // Patches a direct call site (see X64CodeCache::PatchCallSite) to call the
+  // current machine code of this function and remembers it so that it can be
+  // pointed at unlink_target if the code is replaced. unlink_target must be a
+  // thunk that resolves the function again, with the guest address in ebx.
+  // Returns the machine code, or nullptr without patching anything if the
+  // function has been invalidated.
+  uint8_t* LinkCallSite(X64CodeCache* code_cache, uint8_t* call_site,
+                        const void* unlink_target);
+  // Points all linked call sites back to their unlink targets, skipping those
+  // in code reclaimed since they were linked.
+  void UnlinkCallSites(X64CodeCache* code_cache);
 
  protected:
   bool CallImpl(ThreadState* thread_state, uint32_t return_address) override;
 
  private:
+  X64Backend* backend_;
   uint8_t* machine_code_ = nullptr;
   size_t machine_code_length_ = 0;
+
+  // Guards machine_code_ against linking while the code is being replaced.
+  // Held while publishing the code, so that it's updated along with code().
+  std::mutex call_sites_mutex_;
+  // Call sites in other functions' code that call machine_code_ directly.
+  struct LinkedCallSite {
+    uint8_t* call_site;
+    const void* unlink_target;
+    // X64CodeCache::CodeFrameInfo::id of the code containing the call site.
+    uint64_t code_id;
+  };
+  std::vector<LinkedCallSite> call_sites_;
 };
 
 }  // namespace x64
@@ -0,0 +1,271 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/backend/x64/x64_perf_map.h"
+
+#include <cstring>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/platform.h"
+#include "xenia/base/threading.h"
+
+#if XE_PLATFORM_LINUX
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace x64 {
+
+#if XE_PLATFORM_LINUX
+
+namespace {
+
+// From tools/perf/util/jitdump.h in the Linux sources.
+constexpr uint32_t kJitdumpMagic = 0x4A695444;
+constexpr uint32_t kJitdumpVersion = 1;
+constexpr uint32_t kElfMachineX86_64 = 62;
+
+enum JitdumpRecordType : uint32_t {
+  kJitCodeLoad = 0,
+  kJitCodeDebugInfo = 2,
+};
+
+struct JitdumpHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t total_size;
+  uint32_t elf_mach;
+  uint32_t pad1;
+  uint32_t pid;
+  uint64_t timestamp;
+  uint64_t flags;
+};
+
+struct JitdumpRecordHeader {
+  uint32_t id;
+  uint32_t total_size;
+  uint64_t timestamp;
+};
+
+struct JitdumpCodeLoad {
+  JitdumpRecordHeader header;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t code_addr;
+  uint64_t code_size;
+  uint64_t code_index;
+  // Followed by the null-terminated name and the code bytes.
+};
+
+struct JitdumpDebugInfo {
+  JitdumpRecordHeader header;
+  uint64_t code_addr;
+  uint64_t nr_entry;
+  // Followed by the entries.
+};
+
+struct JitdumpDebugEntry {
+  uint64_t code_addr;
+  uint32_t line;
+  uint32_t discrim;
+  // Followed by the null-terminated file name.
+};
+
+// perf record -k mono makes samples use the same clock.
+uint64_t JitdumpTimestamp() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+}
+
+template <typename T>
+void AppendRecordData(std::vector<uint8_t>& record, const T& value) {
+  auto data = reinterpret_cast<const uint8_t*>(&value);
+  record.insert(record.end(), data, data + sizeof(T));
+}
+
+void AppendRecordString(std::vector<uint8_t>& record, const std::string& str) {
+  record.insert(record.end(), str.c_str(), str.c_str() + str.size() + 1);
+}
+
+}  // namespace
+
+PerfMapWriter::~PerfMapWriter() {
+  if (jitdump_marker_) {
+    munmap(jitdump_marker_, jitdump_marker_size_);
+  }
+  if (jitdump_file_) {
+    fclose(jitdump_file_);
+  }
+  if (map_file_) {
+    fclose(map_file_);
+  }
+}
+
+std::unique_ptr<PerfMapWriter> PerfMapWriter::Create(bool write_map,
+                                                     bool write_jitdump) {
+  std::unique_ptr<PerfMapWriter> writer(new PerfMapWriter());
+  bool opened = false;
+  if (write_map) {
+    opened |= writer->OpenMap();
+  }
+  if (write_jitdump) {
+    opened |= writer->OpenJitdump();
+  }
+  if (!opened) {
+    return nullptr;
+  }
+  return writer;
+}
+
+bool PerfMapWriter::OpenMap() {
+  auto path = fmt::format("/tmp/perf-{}.map", getpid());
+  map_file_ = fopen(path.c_str(), "w");
+  if (!map_file_) {
+    XELOGE("Unable to open perf map {}", path);
+    return false;
+  }
+  XELOGI("Writing perf map to {}", path);
+  return true;
+}
+
+bool PerfMapWriter::OpenJitdump() {
+  auto path = fmt::format("/tmp/jit-{}.dump", getpid());
+  jitdump_file_ = fopen(path.c_str(), "w+");
+  if (!jitdump_file_) {
+    XELOGE("Unable to open jitdump {}", path);
+    return false;
+  }
+
+  // perf record only learns about the file from an executable mapping of it,
+  // which perf inject then looks for.
+  jitdump_marker_size_ = size_t(sysconf(_SC_PAGESIZE));
+  jitdump_marker_ = mmap(nullptr, jitdump_marker_size_, PROT_READ | PROT_EXEC,
+                         MAP_PRIVATE, fileno(jitdump_file_), 0);
+  if (jitdump_marker_ == MAP_FAILED) {
+    jitdump_marker_ = nullptr;
+    XELOGE("Unable to map jitdump {}", path);
+    fclose(jitdump_file_);
+    jitdump_file_ = nullptr;
+    return false;
+  }
+
+  JitdumpHeader header = {};
+  header.magic = kJitdumpMagic;
+  header.version = kJitdumpVersion;
+  header.total_size = sizeof(JitdumpHeader);
+  header.elf_mach = kElfMachineX86_64;
+  header.pid = uint32_t(getpid());
+  header.timestamp = JitdumpTimestamp();
+  fwrite(&header, sizeof(header), 1, jitdump_file_);
+  fflush(jitdump_file_);
+  XELOGI("Writing jitdump to {}", path);
+  return true;
+}
+
+void PerfMapWriter::WriteCode(const void* code_address, size_t code_size,
+                              const std::string& name,
+                              const std::string& file_name,
+                              const std::vector<SourceMapEntry>& source_map) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (map_file_) {
+    fmt::print(map_file_, "{:x} {:x} {}\n",
+               reinterpret_cast<uintptr_t>(code_address), code_size, name);
+    fflush(map_file_);
+  }
+  if (jitdump_file_) {
+    WriteJitdumpRecords(code_address, code_size, name, file_name, source_map);
+  }
+}
+
+void PerfMapWriter::WriteJitdumpRecords(
+    const void* code_address, size_t code_size, const std::string& name,
+    const std::string& file_name,
+    const std::vector<SourceMapEntry>& source_map) {
+  auto code_addr = uint64_t(reinterpret_cast<uintptr_t>(code_address));
+  uint64_t timestamp = JitdumpTimestamp();
+
+  // Debug info must precede the load of the code it describes. Guest
+  // addresses are given as line numbers, with runs of entries for the same
+  // guest instruction collapsed.
+  if (!source_map.empty()) {
+    record_.clear();
+    AppendRecordData(record_, JitdumpDebugInfo());
+    uint64_t entry_count = 0;
+    uint32_t last_guest_address = 0;
+    for (auto& entry : source_map) {
+      if (entry_count && entry.guest_address == last_guest_address) {
+        continue;
+      }
+      last_guest_address = entry.guest_address;
+      JitdumpDebugEntry debug_entry;
+      debug_entry.code_addr = code_addr + entry.code_offset;
+      debug_entry.line = entry.guest_address;
+      debug_entry.discrim = 0;
+      AppendRecordData(record_, debug_entry);
+      AppendRecordString(record_, file_name);
+      ++entry_count;
+    }
+    auto debug_info = reinterpret_cast<JitdumpDebugInfo*>(record_.data());
+    debug_info->header.id = kJitCodeDebugInfo;
+    debug_info->header.total_size = uint32_t(record_.size());
+    debug_info->header.timestamp = timestamp;
+    debug_info->code_addr = code_addr;
+    debug_info->nr_entry = entry_count;
+    fwrite(record_.data(), 1, record_.size(), jitdump_file_);
+  }
+
+  record_.clear();
+  AppendRecordData(record_, JitdumpCodeLoad());
+  AppendRecordString(record_, name);
+  auto code = reinterpret_cast<const uint8_t*>(code_address);
+  record_.insert(record_.end(), code, code + code_size);
+  auto code_load = reinterpret_cast<JitdumpCodeLoad*>(record_.data());
+  code_load->header.id = kJitCodeLoad;
+  code_load->header.total_size = uint32_t(record_.size());
+  code_load->header.timestamp = timestamp;
+  code_load->pid = uint32_t(getpid());
+  code_load->tid = xe::threading::current_thread_system_id();
+  code_load->vma = code_addr;
+  code_load->code_addr = code_addr;
+  code_load->code_size = code_size;
+  code_load->code_index = code_index_++;
+  fwrite(record_.data(), 1, record_.size(), jitdump_file_);
+  fflush(jitdump_file_);
+}
+
+#else
+
+PerfMapWriter::~PerfMapWriter() = default;
+
+std::unique_ptr<PerfMapWriter> PerfMapWriter::Create(bool write_map,
+                                                     bool write_jitdump) {
+  if (write_map || write_jitdump) {
+    XELOGW("perf maps and jitdumps are only supported on Linux");
+  }
+  return nullptr;
+}
+
+void PerfMapWriter::WriteCode(const void* code_address, size_t code_size,
+                              const std::string& name,
+                              const std::string& file_name,
+                              const std::vector<SourceMapEntry>& source_map) {}
+
+#endif  // XE_PLATFORM_LINUX
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,75 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_BACKEND_X64_X64_PERF_MAP_H_
+#define XENIA_CPU_BACKEND_X64_X64_PERF_MAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "xenia/cpu/function.h"
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace x64 {
+
+// Describes placed code to Linux perf, which otherwise only sees anonymous
+// executable memory.
+// The perf map (/tmp/perf-<pid>.map) gives symbol names to address ranges for
+// perf report. The jitdump (/tmp/jit-<pid>.dump, to be merged with
+// perf inject --jit) also carries the code bytes for perf annotate, and the
+// guest address each piece of the code was emitted for as its line number.
+// Does nothing on other platforms.
+class PerfMapWriter {
+ public:
+  ~PerfMapWriter();
+
+  // Returns nullptr if neither file could be opened.
+  static std::unique_ptr<PerfMapWriter> Create(bool write_map,
+                                               bool write_jitdump);
+
+  // Records code that has just been placed at code_address. The source map
+  // may be empty, such as for host code.
+  void WriteCode(const void* code_address, size_t code_size,
+                 const std::string& name, const std::string& file_name,
+                 const std::vector<SourceMapEntry>& source_map);
+
+ private:
+  PerfMapWriter() = default;
+
+  bool OpenMap();
+  bool OpenJitdump();
+  void WriteJitdumpRecords(const void* code_address, size_t code_size,
+                           const std::string& name,
+                           const std::string& file_name,
+                           const std::vector<SourceMapEntry>& source_map);
+
+  // Serializes placements from different threads.
+  std::mutex mutex_;
+  FILE* map_file_ = nullptr;
+  FILE* jitdump_file_ = nullptr;
+  // Marker mapping of the jitdump, letting perf record find the file.
+  void* jitdump_marker_ = nullptr;
+  size_t jitdump_marker_size_ = 0;
+  uint64_t code_index_ = 0;
+  std::vector<uint8_t> record_;
+};
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_BACKEND_X64_X64_PERF_MAP_H_
@@ -364,9 +364,11 @@ EMITTER_OPCODE_TABLE(OPCODE_CALL_EXTERN, CALL_EXTERN);
 // ============================================================================
 struct RETURN : Sequence<RETURN, I<OPCODE_RETURN, VoidOp>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    // If this is the last instruction in the last block, just let us
-    // fall through.
-    if (i.instr->next || i.instr->block->next) {
+    // If this is the last instruction before the epilog, just let us fall
+    // through. Cold blocks are emitted after the epilog.
+    auto block = i.instr->block;
+    if (i.instr->next || (block->flags & hir::Block::COLD) ||
+        (block->next && !(block->next->flags & hir::Block::COLD))) {
       e.jmp(e.epilog_label(), CodeGenerator::T_NEAR);
     }
   }
@@ -447,9 +449,132 @@ EMITTER_OPCODE_TABLE(OPCODE_BRANCH, BRANCH);
 // ============================================================================
 // OPCODE_BRANCH_TRUE
 // ============================================================================
+// Jumps on the flags set by the compare right before the branch, see
+// IsFusedCompare. Returns false if the branch isn't fused.
+static bool EmitFusedBranch(X64Emitter& e, const Instr* branch,
+                            bool branch_if_true) {
+  auto compare = branch->prev;
+  if (!compare || !IsFusedCompare(compare)) {
+    return false;
+  }
+  // Constant first operands are compared the other way around.
+  bool swapped = compare->src1.value->IsConstant();
+  auto opcode = compare->opcode->num;
+  if (swapped) {
+    switch (opcode) {
+      case OPCODE_COMPARE_SLT:
+        opcode = OPCODE_COMPARE_SGT;
+        break;
+      case OPCODE_COMPARE_SLE:
+        opcode = OPCODE_COMPARE_SGE;
+        break;
+      case OPCODE_COMPARE_SGT:
+        opcode = OPCODE_COMPARE_SLT;
+        break;
+      case OPCODE_COMPARE_SGE:
+        opcode = OPCODE_COMPARE_SLE;
+        break;
+      case OPCODE_COMPARE_ULT:
+        opcode = OPCODE_COMPARE_UGT;
+        break;
+      case OPCODE_COMPARE_ULE:
+        opcode = OPCODE_COMPARE_UGE;
+        break;
+      case OPCODE_COMPARE_UGT:
+        opcode = OPCODE_COMPARE_ULT;
+        break;
+      case OPCODE_COMPARE_UGE:
+        opcode = OPCODE_COMPARE_ULE;
+        break;
+      default:
+        break;
+    }
+  }
+  auto label = branch->src2.label->name;
+  switch (opcode) {
+    case OPCODE_COMPARE_EQ:
+      if (branch_if_true) {
+        e.je(label, e.T_NEAR);
+      } else {
+        e.jne(label, e.T_NEAR);
+      }
+      break;
+    case OPCODE_COMPARE_NE:
+      if (branch_if_true) {
+        e.jne(label, e.T_NEAR);
+      } else {
+        e.je(label, e.T_NEAR);
+      }
+      break;
+    case OPCODE_COMPARE_SLT:
+      if (branch_if_true) {
+        e.jl(label, e.T_NEAR);
+      } else {
+        e.jge(label, e.T_NEAR);
+      }
+      break;
+    case OPCODE_COMPARE_SLE:
+      if (branch_if_true) {
+        e.jle(label, e.T_NEAR);
+      } else {
+        e.jg(label, e.T_NEAR);
+      }
+      break;
+    case OPCODE_COMPARE_SGT:
+      if (branch_if_true) {
+        e.jg(label, e.T_NEAR);
+      } else {
+        e.jle(label, e.T_NEAR);
+      }
+      break;
+    case OPCODE_COMPARE_SGE:
+      if (branch_if_true) {
+        e.jge(label, e.T_NEAR);
+      } else {
+        e.jl(label, e.T_NEAR);
+      }
+      break;
+    case OPCODE_COMPARE_ULT:
+      if (branch_if_true) {
+        e.jb(label, e.T_NEAR);
+      } else {
+        e.jae(label, e.T_NEAR);
+      }
+      break;
+    case OPCODE_COMPARE_ULE:
+      if (branch_if_true) {
+        e.jbe(label, e.T_NEAR);
+      } else {
+        e.ja(label, e.T_NEAR);
+      }
+      break;
+    case OPCODE_COMPARE_UGT:
+      if (branch_if_true) {
+        e.ja(label, e.T_NEAR);
+      } else {
+        e.jbe(label, e.T_NEAR);
+      }
+      break;
+    case OPCODE_COMPARE_UGE:
+      if (branch_if_true) {
+        e.jae(label, e.T_NEAR);
+      } else {
+        e.jb(label, e.T_NEAR);
+      }
+      break;
+    default:
+      assert_unhandled_case(opcode);
+      break;
+  }
+  return true;
+}
+
 struct BRANCH_TRUE_I8
     : Sequence<BRANCH_TRUE_I8, I<OPCODE_BRANCH_TRUE, VoidOp, I8Op, LabelOp>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (EmitFusedBranch(e, i.instr, true)) {
+      return;
+    }
     e.test(i.src1, i.src1);
     e.jnz(i.src2.value->name, e.T_NEAR);
   }
@@ -499,6 +624,9 @@ EMITTER_OPCODE_TABLE(OPCODE_BRANCH_TRUE, BRANCH_TRUE_I8, BRANCH_TRUE_I16,
 struct BRANCH_FALSE_I8
     : Sequence<BRANCH_FALSE_I8, I<OPCODE_BRANCH_FALSE, VoidOp, I8Op, LabelOp>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (EmitFusedBranch(e, i.instr, false)) {
+      return;
+    }
     e.test(i.src1, i.src1);
     e.jz(i.src2.value->name, e.T_NEAR);
   }
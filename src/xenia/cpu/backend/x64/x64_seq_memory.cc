@@ -103,6 +103,88 @@ RegExp ComputeMemoryAddress(X64Emitter& e, const T& guest) {
   }
 }
 
+// Loads and stores of guest instructions that have faulted on an MMIO range
+// call the range directly when the address is in it instead of faulting
+// again. Emits the check of the address, into the address parameter of the
+// callbacks, jumping to regular_label if it isn't in the range. Constant
+// addresses are already lowered to LOAD_MMIO and STORE_MMIO if in a range.
+template <typename T>
+const MMIORange* EmitMmioRangeCheck(X64Emitter& e, const T& guest,
+                                    int32_t offset,
+                                    Xbyak::Label& regular_label) {
+  auto range = e.LookupMmioSite();
+  if (!range || guest.is_constant) {
+    return nullptr;
+  }
+  // The callbacks embed heap pointers.
+  e.MarkNotStorable();
+  auto address = e.GetNativeParam(1).cvt32();
+  e.mov(address, guest.reg().cvt32());
+  if (offset) {
+    e.add(address, offset);
+  }
+  e.mov(e.eax, address);
+  e.and_(e.eax, range->mask);
+  e.cmp(e.eax, range->address);
+  e.jne(regular_label, CodeGenerator::T_NEAR);
+  return range;
+}
+
+// Emits the MMIO read of a 32-bit load, and the jump to done_label after it.
+// Returns false if the load isn't specialized, emitting nothing.
+template <typename T, typename D>
+bool EmitMmioLoadI32(X64Emitter& e, const Instr* instr, const D& dest,
+                     const T& guest, int32_t offset,
+                     Xbyak::Label& done_label) {
+  Xbyak::Label regular_label;
+  auto range = EmitMmioRangeCheck(e, guest, offset, regular_label);
+  if (!range) {
+    return false;
+  }
+  // uint64_t (context, addr)
+  e.mov(e.GetNativeParam(0), uint64_t(range->callback_context));
+  e.CallNativeSafe(reinterpret_cast<void*>(range->read));
+  // Swapped back if the load is, like the exception handler does.
+  if (!(instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP)) {
+    e.bswap(e.eax);
+  }
+  e.mov(dest, e.eax);
+  e.jmp(done_label, CodeGenerator::T_NEAR);
+  e.L(regular_label);
+  return true;
+}
+
+// Emits the MMIO write of a 32-bit store, and the jump to done_label after
+// it. Returns false if the store isn't specialized, emitting nothing.
+template <typename T, typename V>
+bool EmitMmioStoreI32(X64Emitter& e, const Instr* instr, const T& guest,
+                      int32_t offset, const V& value,
+                      Xbyak::Label& done_label) {
+  Xbyak::Label regular_label;
+  auto range = EmitMmioRangeCheck(e, guest, offset, regular_label);
+  if (!range) {
+    return false;
+  }
+  // void (context, addr, value)
+  bool byte_swap =
+      (instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) != 0;
+  e.mov(e.GetNativeParam(0), uint64_t(range->callback_context));
+  if (value.is_constant) {
+    uint32_t constant = uint32_t(value.constant());
+    e.mov(e.GetNativeParam(2).cvt32(),
+          byte_swap ? constant : xe::byte_swap(constant));
+  } else {
+    e.mov(e.GetNativeParam(2).cvt32(), value);
+    if (!byte_swap) {
+      e.bswap(e.GetNativeParam(2).cvt32());
+    }
+  }
+  e.CallNativeSafe(reinterpret_cast<void*>(range->write));
+  e.jmp(done_label, CodeGenerator::T_NEAR);
+  e.L(regular_label);
+  return true;
+}
+
 // ============================================================================
 // OPCODE_ATOMIC_EXCHANGE
 // ============================================================================
@@ -216,10 +298,38 @@ EMITTER_OPCODE_TABLE(OPCODE_ATOMIC_COMPARE_EXCHANGE,
 // ============================================================================
 // OPCODE_LOAD_LOCAL
 // ============================================================================
+// Locals the register allocator kept in a register for the whole function are
+// accessed with moves, otherwise they live on the stack.
+bool IsRegisterLocal(const Value* slot) { return slot->reg.set != nullptr; }
+template <typename REG>
+REG GetLocalReg(const Value* slot) {
+  REG reg;
+  X64Emitter::SetupReg(slot, reg);
+  return reg;
+}
+void MoveRegister(X64Emitter& e, const Reg& dest, const Reg& src) {
+  e.mov(dest, src);
+}
+void MoveRegister(X64Emitter& e, const Xmm& dest, const Xmm& src) {
+  e.vmovaps(dest, src);
+}
+template <typename OP>
+void LoadRegisterLocal(X64Emitter& e, const OP& dest, const Value* slot) {
+  auto reg = GetLocalReg<typename OP::reg_type>(slot);
+  // Nothing to do if coalesced with the local.
+  if (dest != reg) {
+    MoveRegister(e, dest.reg(), reg);
+  }
+}
+
 // Note: all types are always aligned on the stack.
 struct LOAD_LOCAL_I8
     : Sequence<LOAD_LOCAL_I8, I<OPCODE_LOAD_LOCAL, I8Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (IsRegisterLocal(i.src1.value)) {
+      LoadRegisterLocal(e, i.dest, i.src1.value);
+      return;
+    }
     e.mov(i.dest, e.byte[e.rsp + i.src1.constant()]);
     // e.TraceLoadI8(DATA_LOCAL, i.src1.constant, i.dest);
   }
@@ -227,6 +337,10 @@ struct LOAD_LOCAL_I8
 struct LOAD_LOCAL_I16
     : Sequence<LOAD_LOCAL_I16, I<OPCODE_LOAD_LOCAL, I16Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (IsRegisterLocal(i.src1.value)) {
+      LoadRegisterLocal(e, i.dest, i.src1.value);
+      return;
+    }
     e.mov(i.dest, e.word[e.rsp + i.src1.constant()]);
     // e.TraceLoadI16(DATA_LOCAL, i.src1.constant, i.dest);
   }
@@ -234,6 +348,10 @@ struct LOAD_LOCAL_I16
 struct LOAD_LOCAL_I32
     : Sequence<LOAD_LOCAL_I32, I<OPCODE_LOAD_LOCAL, I32Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (IsRegisterLocal(i.src1.value)) {
+      LoadRegisterLocal(e, i.dest, i.src1.value);
+      return;
+    }
     e.mov(i.dest, e.dword[e.rsp + i.src1.constant()]);
     // e.TraceLoadI32(DATA_LOCAL, i.src1.constant, i.dest);
   }
@@ -241,6 +359,10 @@ struct LOAD_LOCAL_I32
 struct LOAD_LOCAL_I64
     : Sequence<LOAD_LOCAL_I64, I<OPCODE_LOAD_LOCAL, I64Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (IsRegisterLocal(i.src1.value)) {
+      LoadRegisterLocal(e, i.dest, i.src1.value);
+      return;
+    }
     e.mov(i.dest, e.qword[e.rsp + i.src1.constant()]);
     // e.TraceLoadI64(DATA_LOCAL, i.src1.constant, i.dest);
   }
@@ -248,6 +370,10 @@ struct LOAD_LOCAL_I64
 struct LOAD_LOCAL_F32
     : Sequence<LOAD_LOCAL_F32, I<OPCODE_LOAD_LOCAL, F32Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (IsRegisterLocal(i.src1.value)) {
+      LoadRegisterLocal(e, i.dest, i.src1.value);
+      return;
+    }
     e.vmovss(i.dest, e.dword[e.rsp + i.src1.constant()]);
     // e.TraceLoadF32(DATA_LOCAL, i.src1.constant, i.dest);
   }
@@ -255,6 +381,10 @@ struct LOAD_LOCAL_F32
 struct LOAD_LOCAL_F64
     : Sequence<LOAD_LOCAL_F64, I<OPCODE_LOAD_LOCAL, F64Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (IsRegisterLocal(i.src1.value)) {
+      LoadRegisterLocal(e, i.dest, i.src1.value);
+      return;
+    }
     e.vmovsd(i.dest, e.qword[e.rsp + i.src1.constant()]);
     // e.TraceLoadF64(DATA_LOCAL, i.src1.constant, i.dest);
   }
@@ -262,6 +392,10 @@ struct LOAD_LOCAL_F64
 struct LOAD_LOCAL_V128
     : Sequence<LOAD_LOCAL_V128, I<OPCODE_LOAD_LOCAL, V128Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (IsRegisterLocal(i.src1.value)) {
+      LoadRegisterLocal(e, i.dest, i.src1.value);
+      return;
+    }
     e.vmovaps(i.dest, e.ptr[e.rsp + i.src1.constant()]);
     // e.TraceLoadV128(DATA_LOCAL, i.src1.constant, i.dest);
   }
@@ -274,53 +408,133 @@ EMITTER_OPCODE_TABLE(OPCODE_LOAD_LOCAL, LOAD_LOCAL_I8, LOAD_LOCAL_I16,
 // OPCODE_STORE_LOCAL
 // ============================================================================
 // Note: all types are always aligned on the stack.
+// Stored values may be constants since context promotion turns context stores
+// into local stores.
 struct STORE_LOCAL_I8
     : Sequence<STORE_LOCAL_I8, I<OPCODE_STORE_LOCAL, VoidOp, I32Op, I8Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     // e.TraceStoreI8(DATA_LOCAL, i.src1.constant, i.src2);
-    e.mov(e.byte[e.rsp + i.src1.constant()], i.src2);
+    if (IsRegisterLocal(i.src1.value)) {
+      auto reg = GetLocalReg<Reg8>(i.src1.value);
+      if (i.src2.is_constant) {
+        e.mov(reg, i.src2.constant());
+      } else if (i.src2 != reg) {
+        e.mov(reg, i.src2);
+      }
+    } else if (i.src2.is_constant) {
+      e.mov(e.byte[e.rsp + i.src1.constant()], i.src2.constant());
+    } else {
+      e.mov(e.byte[e.rsp + i.src1.constant()], i.src2);
+    }
   }
 };
 struct STORE_LOCAL_I16
     : Sequence<STORE_LOCAL_I16, I<OPCODE_STORE_LOCAL, VoidOp, I32Op, I16Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     // e.TraceStoreI16(DATA_LOCAL, i.src1.constant, i.src2);
-    e.mov(e.word[e.rsp + i.src1.constant()], i.src2);
+    if (IsRegisterLocal(i.src1.value)) {
+      auto reg = GetLocalReg<Reg16>(i.src1.value);
+      if (i.src2.is_constant) {
+        e.mov(reg, i.src2.constant());
+      } else if (i.src2 != reg) {
+        e.mov(reg, i.src2);
+      }
+    } else if (i.src2.is_constant) {
+      e.mov(e.word[e.rsp + i.src1.constant()], i.src2.constant());
+    } else {
+      e.mov(e.word[e.rsp + i.src1.constant()], i.src2);
+    }
   }
 };
 struct STORE_LOCAL_I32
     : Sequence<STORE_LOCAL_I32, I<OPCODE_STORE_LOCAL, VoidOp, I32Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     // e.TraceStoreI32(DATA_LOCAL, i.src1.constant, i.src2);
-    e.mov(e.dword[e.rsp + i.src1.constant()], i.src2);
+    if (IsRegisterLocal(i.src1.value)) {
+      auto reg = GetLocalReg<Reg32>(i.src1.value);
+      if (i.src2.is_constant) {
+        e.mov(reg, i.src2.constant());
+      } else if (i.src2 != reg) {
+        e.mov(reg, i.src2);
+      }
+    } else if (i.src2.is_constant) {
+      e.mov(e.dword[e.rsp + i.src1.constant()], i.src2.constant());
+    } else {
+      e.mov(e.dword[e.rsp + i.src1.constant()], i.src2);
+    }
   }
 };
 struct STORE_LOCAL_I64
     : Sequence<STORE_LOCAL_I64, I<OPCODE_STORE_LOCAL, VoidOp, I32Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     // e.TraceStoreI64(DATA_LOCAL, i.src1.constant, i.src2);
-    e.mov(e.qword[e.rsp + i.src1.constant()], i.src2);
+    if (IsRegisterLocal(i.src1.value)) {
+      auto reg = GetLocalReg<Reg64>(i.src1.value);
+      if (i.src2.is_constant) {
+        e.mov(reg, i.src2.constant());
+      } else if (i.src2 != reg) {
+        e.mov(reg, i.src2);
+      }
+    } else if (i.src2.is_constant) {
+      e.MovMem64(e.rsp + i.src1.constant(), i.src2.constant());
+    } else {
+      e.mov(e.qword[e.rsp + i.src1.constant()], i.src2);
+    }
   }
 };
 struct STORE_LOCAL_F32
     : Sequence<STORE_LOCAL_F32, I<OPCODE_STORE_LOCAL, VoidOp, I32Op, F32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     // e.TraceStoreF32(DATA_LOCAL, i.src1.constant, i.src2);
-    e.vmovss(e.dword[e.rsp + i.src1.constant()], i.src2);
+    if (IsRegisterLocal(i.src1.value)) {
+      auto reg = GetLocalReg<Xmm>(i.src1.value);
+      if (i.src2.is_constant) {
+        e.LoadConstantXmm(reg, i.src2.constant());
+      } else if (i.src2 != reg) {
+        e.vmovaps(reg, i.src2);
+      }
+    } else if (i.src2.is_constant) {
+      e.mov(e.dword[e.rsp + i.src1.constant()], i.src2.value->constant.i32);
+    } else {
+      e.vmovss(e.dword[e.rsp + i.src1.constant()], i.src2);
+    }
   }
 };
 struct STORE_LOCAL_F64
     : Sequence<STORE_LOCAL_F64, I<OPCODE_STORE_LOCAL, VoidOp, I32Op, F64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     // e.TraceStoreF64(DATA_LOCAL, i.src1.constant, i.src2);
-    e.vmovsd(e.qword[e.rsp + i.src1.constant()], i.src2);
+    if (IsRegisterLocal(i.src1.value)) {
+      auto reg = GetLocalReg<Xmm>(i.src1.value);
+      if (i.src2.is_constant) {
+        e.LoadConstantXmm(reg, i.src2.constant());
+      } else if (i.src2 != reg) {
+        e.vmovaps(reg, i.src2);
+      }
+    } else if (i.src2.is_constant) {
+      e.MovMem64(e.rsp + i.src1.constant(), i.src2.value->constant.i64);
+    } else {
+      e.vmovsd(e.qword[e.rsp + i.src1.constant()], i.src2);
+    }
   }
 };
 struct STORE_LOCAL_V128
     : Sequence<STORE_LOCAL_V128, I<OPCODE_STORE_LOCAL, VoidOp, I32Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     // e.TraceStoreV128(DATA_LOCAL, i.src1.constant, i.src2);
-    e.vmovaps(e.ptr[e.rsp + i.src1.constant()], i.src2);
+    if (IsRegisterLocal(i.src1.value)) {
+      auto reg = GetLocalReg<Xmm>(i.src1.value);
+      if (i.src2.is_constant) {
+        e.LoadConstantXmm(reg, i.src2.constant());
+      } else if (i.src2 != reg) {
+        e.vmovaps(reg, i.src2);
+      }
+    } else if (i.src2.is_constant) {
+      e.LoadConstantXmm(e.xmm0, i.src2.constant());
+      e.vmovaps(e.ptr[e.rsp + i.src1.constant()], e.xmm0);
+    } else {
+      e.vmovaps(e.ptr[e.rsp + i.src1.constant()], i.src2);
+    }
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_STORE_LOCAL, STORE_LOCAL_I8, STORE_LOCAL_I16,
@@ -556,6 +770,7 @@ struct LOAD_MMIO_I32
     // uint64_t (context, addr)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto read_address = uint32_t(i.src2.value);
+    e.MarkNotStorable();
     e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
     e.mov(e.GetNativeParam(1).cvt32(), read_address);
     e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->read));
@@ -581,6 +796,7 @@ struct STORE_MMIO_I32
     // void (context, addr, value)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto write_address = uint32_t(i.src2.value);
+    e.MarkNotStorable();
     e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
     e.mov(e.GetNativeParam(1).cvt32(), write_address);
     if (i.src3.is_constant) {
@@ -634,6 +850,9 @@ struct LOAD_OFFSET_I16
 struct LOAD_OFFSET_I32
     : Sequence<LOAD_OFFSET_I32, I<OPCODE_LOAD_OFFSET, I32Op, I64Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Xbyak::Label done_label;
+    bool mmio = EmitMmioLoadI32(e, i.instr, i.dest, i.src1,
+                                int32_t(i.src2.constant()), done_label);
     auto addr = ComputeMemoryAddressOffset(e, i.src1, i.src2);
     if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       if (e.IsFeatureEnabled(kX64EmitMovbe)) {
@@ -645,6 +864,9 @@ struct LOAD_OFFSET_I32
     } else {
       e.mov(i.dest, e.dword[addr]);
     }
+    if (mmio) {
+      e.L(done_label);
+    }
   }
 };
 
@@ -709,6 +931,9 @@ struct STORE_OFFSET_I32
     : Sequence<STORE_OFFSET_I32,
                I<OPCODE_STORE_OFFSET, VoidOp, I64Op, I64Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Xbyak::Label done_label;
+    bool mmio = EmitMmioStoreI32(e, i.instr, i.src1, int32_t(i.src2.constant()),
+                                 i.src3, done_label);
     auto addr = ComputeMemoryAddressOffset(e, i.src1, i.src2);
     if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       assert_false(i.src3.is_constant);
@@ -724,6 +949,9 @@ struct STORE_OFFSET_I32
         e.mov(e.dword[addr], i.src3);
       }
     }
+    if (mmio) {
+      e.L(done_label);
+    }
   }
 };
 
@@ -787,6 +1015,8 @@ struct LOAD_I16 : Sequence<LOAD_I16, I<OPCODE_LOAD, I16Op, I64Op>> {
 };
 struct LOAD_I32 : Sequence<LOAD_I32, I<OPCODE_LOAD, I32Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Xbyak::Label done_label;
+    bool mmio = EmitMmioLoadI32(e, i.instr, i.dest, i.src1, 0, done_label);
     auto addr = ComputeMemoryAddress(e, i.src1);
     if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       if (e.IsFeatureEnabled(kX64EmitMovbe)) {
@@ -803,6 +1033,9 @@ struct LOAD_I32 : Sequence<LOAD_I32, I<OPCODE_LOAD, I32Op, I64Op>> {
       e.lea(e.GetNativeParam(0), e.ptr[addr]);
       e.CallNative(reinterpret_cast<void*>(TraceMemoryLoadI32));
     }
+    if (mmio) {
+      e.L(done_label);
+    }
   }
 };
 struct LOAD_I64 : Sequence<LOAD_I64, I<OPCODE_LOAD, I64Op, I64Op>> {
@@ -919,6 +1152,8 @@ struct STORE_I16 : Sequence<STORE_I16, I<OPCODE_STORE, VoidOp, I64Op, I16Op>> {
 };
 struct STORE_I32 : Sequence<STORE_I32, I<OPCODE_STORE, VoidOp, I64Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Xbyak::Label done_label;
+    bool mmio = EmitMmioStoreI32(e, i.instr, i.src1, 0, i.src2, done_label);
     auto addr = ComputeMemoryAddress(e, i.src1);
     if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       assert_false(i.src2.is_constant);
@@ -940,6 +1175,9 @@ struct STORE_I32 : Sequence<STORE_I32, I<OPCODE_STORE, VoidOp, I64Op, I32Op>> {
       e.lea(e.GetNativeParam(0), e.ptr[addr]);
       e.CallNative(reinterpret_cast<void*>(TraceMemoryStoreI32));
     }
+    if (mmio) {
+      e.L(done_label);
+    }
   }
 };
 struct STORE_I64 : Sequence<STORE_I64, I<OPCODE_STORE, VoidOp, I64Op, I64Op>> {
@@ -14,9 +14,6 @@
 
 #include "xenia/cpu/backend/x64/x64_op.h"
 
-// For OPCODE_PACK/OPCODE_UNPACK
-#include "third_party/half/include/half.hpp"
-
 namespace xe {
 namespace cpu {
 namespace backend {
@@ -154,14 +151,14 @@ struct LOAD_VECTOR_SHL_I8
     if (i.src1.is_constant) {
       auto sh = i.src1.constant();
       assert_true(sh < xe::countof(lvsl_table));
-      e.mov(e.rax, (uintptr_t)&lvsl_table[sh]);
+      e.MovHostImageAddress(e.rax, &lvsl_table[sh]);
       e.vmovaps(i.dest, e.ptr[e.rax]);
     } else {
       // TODO(benvanik): find a cheaper way of doing this.
       e.movzx(e.rdx, i.src1);
       e.and_(e.dx, 0xF);
       e.shl(e.dx, 4);
-      e.mov(e.rax, (uintptr_t)lvsl_table);
+      e.MovHostImageAddress(e.rax, lvsl_table);
       e.vmovaps(i.dest, e.ptr[e.rax + e.rdx]);
     }
   }
@@ -195,14 +192,14 @@ struct LOAD_VECTOR_SHR_I8
     if (i.src1.is_constant) {
       auto sh = i.src1.constant();
       assert_true(sh < xe::countof(lvsr_table));
-      e.mov(e.rax, (uintptr_t)&lvsr_table[sh]);
+      e.MovHostImageAddress(e.rax, &lvsr_table[sh]);
       e.vmovaps(i.dest, e.ptr[e.rax]);
     } else {
       // TODO(benvanik): find a cheaper way of doing this.
       e.movzx(e.rdx, i.src1);
       e.and_(e.dx, 0xF);
       e.shl(e.dx, 4);
-      e.mov(e.rax, (uintptr_t)lvsr_table);
+      e.MovHostImageAddress(e.rax, lvsr_table);
       e.vmovaps(i.dest, e.ptr[e.rax + e.rdx]);
     }
   }
@@ -327,6 +324,62 @@ struct VECTOR_COMPARE_EQ_V128
 };
 EMITTER_OPCODE_TABLE(OPCODE_VECTOR_COMPARE_EQ, VECTOR_COMPARE_EQ_V128);
 
+// Returns src, loaded into the scratch register first if it's a constant.
+template <typename T>
+static Xmm GetXmmSource(X64Emitter& e, const T& src, const Xmm& scratch) {
+  if (src.is_constant) {
+    e.LoadConstantXmm(scratch, src.constant());
+    return scratch;
+  }
+  return src;
+}
+
+// Compares integer elements into k1 and expands the mask into dest, which
+// handles the unsigned and greater-or-equal comparisons in two instructions
+// instead of biasing or combining SSE compares. predicate is the vpcmp
+// immediate (5 for not less than, 6 for not less or equal). Returns false if
+// AVX-512 can't be used.
+template <typename T>
+static bool EmitAVX512IntCompare(X64Emitter& e, const T& i, bool is_unsigned,
+                                 uint8_t predicate) {
+  if (!e.IsFeatureEnabled(kX64EmitAVX512BWVL | kX64EmitAVX512DQ) ||
+      i.instr->flags == FLOAT32_TYPE) {
+    return false;
+  }
+  Xmm src1 = GetXmmSource(e, i.src1, e.xmm0);
+  Xmm src2 = GetXmmSource(e, i.src2, e.xmm1);
+  switch (i.instr->flags) {
+    case INT8_TYPE:
+      if (is_unsigned) {
+        e.vpcmpub(e.k1, src1, src2, predicate);
+      } else {
+        e.vpcmpb(e.k1, src1, src2, predicate);
+      }
+      e.vpmovm2b(i.dest, e.k1);
+      break;
+    case INT16_TYPE:
+      if (is_unsigned) {
+        e.vpcmpuw(e.k1, src1, src2, predicate);
+      } else {
+        e.vpcmpw(e.k1, src1, src2, predicate);
+      }
+      e.vpmovm2w(i.dest, e.k1);
+      break;
+    case INT32_TYPE:
+      if (is_unsigned) {
+        e.vpcmpud(e.k1, src1, src2, predicate);
+      } else {
+        e.vpcmpd(e.k1, src1, src2, predicate);
+      }
+      e.vpmovm2d(i.dest, e.k1);
+      break;
+    default:
+      assert_always();
+      break;
+  }
+  return true;
+}
+
 // ============================================================================
 // OPCODE_VECTOR_COMPARE_SGT
 // ============================================================================
@@ -362,6 +415,9 @@ struct VECTOR_COMPARE_SGE_V128
     : Sequence<VECTOR_COMPARE_SGE_V128,
                I<OPCODE_VECTOR_COMPARE_SGE, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (EmitAVX512IntCompare(e, i, false, 5)) {
+      return;
+    }
     EmitAssociativeBinaryXmmOp(
         e, i, [&i](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
           switch (i.instr->flags) {
@@ -396,6 +452,9 @@ struct VECTOR_COMPARE_UGT_V128
     : Sequence<VECTOR_COMPARE_UGT_V128,
                I<OPCODE_VECTOR_COMPARE_UGT, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (EmitAVX512IntCompare(e, i, true, 6)) {
+      return;
+    }
     Xbyak::Address sign_addr = e.ptr[e.rax];  // dummy
     switch (i.instr->flags) {
       case INT8_TYPE:
@@ -453,6 +512,9 @@ struct VECTOR_COMPARE_UGE_V128
     : Sequence<VECTOR_COMPARE_UGE_V128,
                I<OPCODE_VECTOR_COMPARE_UGE, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (EmitAVX512IntCompare(e, i, true, 5)) {
+      return;
+    }
     Xbyak::Address sign_addr = e.ptr[e.rax];  // dummy
     switch (i.instr->flags) {
       case INT8_TYPE:
@@ -692,21 +754,225 @@ EMITTER_OPCODE_TABLE(OPCODE_VECTOR_SUB, VECTOR_SUB);
 // ============================================================================
 // OPCODE_VECTOR_SHL
 // ============================================================================
-template <typename T, std::enable_if_t<std::is_integral<T>::value, int> = 0>
-static __m128i EmulateVectorShl(void*, __m128i src1, __m128i src2) {
-  alignas(16) T value[16 / sizeof(T)];
-  alignas(16) T shamt[16 / sizeof(T)];
-
-  // Load SSE registers into a C array.
-  _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
-  _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
+// Loads the shift counts into xmm0, masked to the element size like the
+// guest does, as x86 shifts everything out with larger counts instead.
+template <typename T>
+static void LoadShiftCounts(X64Emitter& e, const T& src2, XmmConst mask) {
+  if (src2.is_constant) {
+    e.LoadConstantXmm(e.xmm0, src2.constant());
+    e.vpand(e.xmm0, e.GetXmmConstPtr(mask));
+  } else {
+    e.vpand(e.xmm0, src2, e.GetXmmConstPtr(mask));
+  }
+}
 
-  for (size_t i = 0; i < (16 / sizeof(T)); ++i) {
-    value[i] = value[i] << (shamt[i] & ((sizeof(T) * 8) - 1));
+// Loads the counts of src2 into xmm0 and src1 into dest, in the order that
+// also works when dest is allocated to src2.
+template <typename T>
+static void LoadShiftOperands(X64Emitter& e, const T& i) {
+  if (i.src2.is_constant) {
+    e.LoadConstantXmm(e.xmm0, i.src2.constant());
+  } else {
+    e.vmovdqa(e.xmm0, i.src2);
+  }
+  if (i.src1.is_constant) {
+    e.LoadConstantXmm(i.dest, i.src1.constant());
+  } else if (i.dest != i.src1) {
+    e.vmovdqa(i.dest, i.src1);
   }
+}
+
+enum class VectorShiftKind {
+  kLeft,
+  kLogicalRight,
+  kArithmeticRight,
+  kRotateLeft,
+};
+
+// There are no variable byte shifts even with AVX-512, so the bytes are
+// widened to words in a ymm register, shifted by word and narrowed back.
+// The masked counts are expected in xmm0. Needs kX64EmitAVX512BWVL.
+static void EmitAVX512ByteShift(X64Emitter& e, const Xmm& dest,
+                                const Xmm& src, VectorShiftKind kind) {
+  e.vpmovzxbw(e.ymm0, e.xmm0);
+  if (kind == VectorShiftKind::kArithmeticRight) {
+    e.vpmovsxbw(e.ymm1, src);
+  } else {
+    e.vpmovzxbw(e.ymm1, src);
+  }
+  switch (kind) {
+    case VectorShiftKind::kLeft:
+      e.vpsllvw(e.ymm1, e.ymm1, e.ymm0);
+      break;
+    case VectorShiftKind::kLogicalRight:
+      e.vpsrlvw(e.ymm1, e.ymm1, e.ymm0);
+      break;
+    case VectorShiftKind::kArithmeticRight:
+      e.vpsravw(e.ymm1, e.ymm1, e.ymm0);
+      break;
+    case VectorShiftKind::kRotateLeft:
+      // With the byte repeated in the high half, the bits shifted out of the
+      // top come back in at the bottom: ((x << 8 | x) << n) >> 8.
+      e.vpsllw(e.ymm2, e.ymm1, 8);
+      e.vpor(e.ymm1, e.ymm1, e.ymm2);
+      e.vpsllvw(e.ymm1, e.ymm1, e.ymm0);
+      e.vpsrlw(e.ymm1, e.ymm1, 8);
+      break;
+  }
+  e.vpmovwb(dest, e.ymm1);
+  // Guest values only ever live in the low 128 bits, and dirty upper halves
+  // would slow down SSE code in the host.
+  e.vzeroupper();
+}
+
+// AVX2 only has variable dword shifts, so the words are widened to dwords in
+// a ymm register, shifted and packed back. The masked counts are expected in
+// xmm0. Needs kX64EmitAVX2.
+static void EmitAVX2WordShift(X64Emitter& e, const Xmm& dest, const Xmm& src,
+                              VectorShiftKind kind) {
+  e.vpmovzxwd(e.ymm0, e.xmm0);
+  if (kind == VectorShiftKind::kArithmeticRight) {
+    e.vpmovsxwd(e.ymm1, src);
+  } else {
+    e.vpmovzxwd(e.ymm1, src);
+  }
+  switch (kind) {
+    case VectorShiftKind::kLeft:
+      e.vpsllvd(e.ymm1, e.ymm1, e.ymm0);
+      // Sign extend the low half, so the saturating pack keeps it as is.
+      e.vpslld(e.ymm1, e.ymm1, 16);
+      e.vpsrad(e.ymm1, e.ymm1, 16);
+      break;
+    case VectorShiftKind::kLogicalRight:
+      e.vpsrlvd(e.ymm1, e.ymm1, e.ymm0);
+      break;
+    case VectorShiftKind::kArithmeticRight:
+      e.vpsravd(e.ymm1, e.ymm1, e.ymm0);
+      break;
+    case VectorShiftKind::kRotateLeft:
+      // Same as for bytes: ((x << 16 | x) << n) >> 16.
+      e.vpslld(e.ymm2, e.ymm1, 16);
+      e.vpor(e.ymm1, e.ymm1, e.ymm2);
+      e.vpsllvd(e.ymm1, e.ymm1, e.ymm0);
+      e.vpsrld(e.ymm1, e.ymm1, 16);
+      break;
+  }
+  e.vextracti128(e.xmm2, e.ymm1, 1);
+  if (kind == VectorShiftKind::kLeft ||
+      kind == VectorShiftKind::kArithmeticRight) {
+    e.vpackssdw(dest, e.xmm1, e.xmm2);
+  } else {
+    e.vpackusdw(dest, e.xmm1, e.xmm2);
+  }
+  e.vzeroupper();
+}
 
-  // Store result and return it.
-  return _mm_load_si128(reinterpret_cast<__m128i*>(value));
+// Shifts every element of dest by the count in the same element of xmm0 with
+// a barrel shifter: one shift by each power of two below the element size,
+// kept or dropped with a blend depending on the matching bit of the count.
+// The bits above the element size are never looked at, so the counts don't
+// need masking. Only needs SSE4.1 level instructions. Clobbers xmm1-xmm3.
+static void EmitBarrelShift(X64Emitter& e, const Xmm& dest, TypeName type,
+                            VectorShiftKind kind) {
+  if (type == INT8_TYPE && kind == VectorShiftKind::kArithmeticRight) {
+    // An arithmetic shift is a logical one of the complement for negative
+    // elements, which is easier as x86 has no byte shifts at all.
+    e.vpxor(e.xmm1, e.xmm1, e.xmm1);
+    e.vpcmpgtb(e.xmm1, e.xmm1, dest);
+    e.vpxor(dest, e.xmm1);
+    EmitBarrelShift(e, dest, type, VectorShiftKind::kLogicalRight);
+    e.vpxor(dest, e.xmm1);
+    return;
+  }
+  // 0xFF << n in every byte, for the bits word shifts move between bytes.
+  static const XmmConst byte_masks[] = {
+      XMMShiftedByteMask1,
+      XMMShiftedByteMask2,
+      XMMShiftedByteMask4,
+  };
+  uint8_t element_bits =
+      type == INT8_TYPE ? 8 : (type == INT16_TYPE ? 16 : 32);
+  for (uint8_t bit = 0; (1 << bit) < element_bits; ++bit) {
+    uint8_t amount = uint8_t(1 << bit);
+    switch (type) {
+      case INT8_TYPE: {
+        auto byte_mask = e.GetXmmConstPtr(byte_masks[bit]);
+        switch (kind) {
+          case VectorShiftKind::kLeft:
+            e.vpsllw(e.xmm2, dest, amount);
+            e.vpand(e.xmm2, byte_mask);
+            break;
+          case VectorShiftKind::kLogicalRight:
+            // Drop the bits that would move into the byte below first.
+            e.vpand(e.xmm2, dest, byte_mask);
+            e.vpsrlw(e.xmm2, e.xmm2, amount);
+            break;
+          case VectorShiftKind::kRotateLeft:
+            // (left & mask) | (right & ~mask) as ((left ^ right) & mask) ^
+            // right.
+            e.vpsllw(e.xmm2, dest, amount);
+            e.vpsrlw(e.xmm1, dest, 8 - amount);
+            e.vpxor(e.xmm2, e.xmm1);
+            e.vpand(e.xmm2, byte_mask);
+            e.vpxor(e.xmm2, e.xmm1);
+            break;
+          default:
+            assert_always();
+            break;
+        }
+        // vpblendvb selects by the top bit of each byte.
+        e.vpsllw(e.xmm3, e.xmm0, 7 - bit);
+        e.vpblendvb(dest, dest, e.xmm2, e.xmm3);
+        break;
+      }
+      case INT16_TYPE:
+        switch (kind) {
+          case VectorShiftKind::kLeft:
+            e.vpsllw(e.xmm2, dest, amount);
+            break;
+          case VectorShiftKind::kLogicalRight:
+            e.vpsrlw(e.xmm2, dest, amount);
+            break;
+          case VectorShiftKind::kArithmeticRight:
+            e.vpsraw(e.xmm2, dest, amount);
+            break;
+          case VectorShiftKind::kRotateLeft:
+            e.vpsllw(e.xmm2, dest, amount);
+            e.vpsrlw(e.xmm1, dest, 16 - amount);
+            e.vpor(e.xmm2, e.xmm1);
+            break;
+        }
+        // The bit has to fill both bytes of the word for vpblendvb.
+        e.vpsllw(e.xmm3, e.xmm0, 15 - bit);
+        e.vpsraw(e.xmm3, e.xmm3, 15);
+        e.vpblendvb(dest, dest, e.xmm2, e.xmm3);
+        break;
+      case INT32_TYPE:
+        switch (kind) {
+          case VectorShiftKind::kLeft:
+            e.vpslld(e.xmm2, dest, amount);
+            break;
+          case VectorShiftKind::kLogicalRight:
+            e.vpsrld(e.xmm2, dest, amount);
+            break;
+          case VectorShiftKind::kArithmeticRight:
+            e.vpsrad(e.xmm2, dest, amount);
+            break;
+          case VectorShiftKind::kRotateLeft:
+            e.vpslld(e.xmm2, dest, amount);
+            e.vpsrld(e.xmm1, dest, 32 - amount);
+            e.vpor(e.xmm2, e.xmm1);
+            break;
+        }
+        // vblendvps selects by the top bit of each dword.
+        e.vpslld(e.xmm3, e.xmm0, 31 - bit);
+        e.vblendvps(dest, dest, e.xmm2, e.xmm3);
+        break;
+      default:
+        assert_unhandled_case(type);
+        break;
+    }
+  }
 }
 
 struct VECTOR_SHL_V128
@@ -729,26 +995,17 @@ struct VECTOR_SHL_V128
   }
 
   static void EmitInt8(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): native version (with shift magic).
-    if (i.src2.is_constant) {
-      e.lea(e.GetNativeParam(1), e.StashConstantXmm(1, i.src2.constant()));
-    } else {
-      e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
+    if (e.IsFeatureEnabled(kX64EmitAVX512BWVL)) {
+      LoadShiftCounts(e, i.src2, XMMShiftMaskPI8);
+      EmitAVX512ByteShift(e, i.dest, GetXmmSource(e, i.src1, e.xmm1),
+                          VectorShiftKind::kLeft);
+      return;
     }
-    e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShl<uint8_t>));
-    e.vmovaps(i.dest, e.xmm0);
+    LoadShiftOperands(e, i);
+    EmitBarrelShift(e, i.dest, INT8_TYPE, VectorShiftKind::kLeft);
   }
 
   static void EmitInt16(X64Emitter& e, const EmitArgType& i) {
-    Xmm src1;
-    if (i.src1.is_constant) {
-      src1 = e.xmm2;
-      e.LoadConstantXmm(src1, i.src1.constant());
-    } else {
-      src1 = i.src1;
-    }
-
     if (i.src2.is_constant) {
       const auto& shamt = i.src2.constant();
       bool all_same = true;
@@ -760,54 +1017,26 @@ struct VECTOR_SHL_V128
       }
       if (all_same) {
         // Every count is the same, so we can use vpsllw.
-        e.vpsllw(i.dest, src1, shamt.u16[0] & 0xF);
+        e.vpsllw(i.dest, GetXmmSource(e, i.src1, e.xmm2),
+                 shamt.u16[0] & 0xF);
         return;
       }
     }
 
-    // Shift 8 words in src1 by amount specified in src2.
-    Xbyak::Label emu, end;
-
-    // Only bother with this check if shift amt isn't constant.
-    if (!i.src2.is_constant) {
-      // See if the shift is equal first for a shortcut.
-      e.vpshuflw(e.xmm0, i.src2, 0b00000000);
-      e.vpshufd(e.xmm0, e.xmm0, 0b00000000);
-      e.vpxor(e.xmm1, e.xmm0, i.src2);
-      e.vptest(e.xmm1, e.xmm1);
-      e.jnz(emu);
-
-      // Equal. Shift using vpsllw.
-      e.mov(e.rax, 0xF);
-      e.vmovq(e.xmm1, e.rax);
-      e.vpand(e.xmm0, e.xmm0, e.xmm1);
-      e.vpsllw(i.dest, src1, e.xmm0);
-      e.jmp(end);
-    }
-
-    // TODO(benvanik): native version (with shift magic).
-    e.L(emu);
-    if (i.src2.is_constant) {
-      e.lea(e.GetNativeParam(1), e.StashConstantXmm(1, i.src2.constant()));
+    if (e.IsFeatureEnabled(kX64EmitAVX512BWVL)) {
+      LoadShiftCounts(e, i.src2, XMMShiftMaskPI16);
+      e.vpsllvw(i.dest, GetXmmSource(e, i.src1, e.xmm1), e.xmm0);
+    } else if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+      LoadShiftCounts(e, i.src2, XMMShiftMaskPI16);
+      EmitAVX2WordShift(e, i.dest, GetXmmSource(e, i.src1, e.xmm1),
+                        VectorShiftKind::kLeft);
     } else {
-      e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
+      LoadShiftOperands(e, i);
+      EmitBarrelShift(e, i.dest, INT16_TYPE, VectorShiftKind::kLeft);
     }
-    e.lea(e.GetNativeParam(0), e.StashXmm(0, src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShl<uint16_t>));
-    e.vmovaps(i.dest, e.xmm0);
-
-    e.L(end);
   }
 
   static void EmitInt32(X64Emitter& e, const EmitArgType& i) {
-    Xmm src1;
-    if (i.src1.is_constant) {
-      src1 = e.xmm2;
-      e.LoadConstantXmm(src1, i.src1.constant());
-    } else {
-      src1 = i.src1;
-    }
-
     if (i.src2.is_constant) {
       const auto& shamt = i.src2.constant();
       bool all_same = true;
@@ -819,60 +1048,20 @@ struct VECTOR_SHL_V128
       }
       if (all_same) {
         // Every count is the same, so we can use vpslld.
-        e.vpslld(i.dest, src1, shamt.u8[0] & 0x1F);
+        e.vpslld(i.dest, GetXmmSource(e, i.src1, e.xmm2),
+                 shamt.u8[0] & 0x1F);
         return;
       }
     }
 
     if (e.IsFeatureEnabled(kX64EmitAVX2)) {
-      if (i.src2.is_constant) {
-        const auto& shamt = i.src2.constant();
-        // Counts differ, so pre-mask and load constant.
-        vec128_t masked = i.src2.constant();
-        for (size_t n = 0; n < 4; ++n) {
-          masked.u32[n] &= 0x1F;
-        }
-        e.LoadConstantXmm(e.xmm0, masked);
-        e.vpsllvd(i.dest, src1, e.xmm0);
-      } else {
-        // Fully variable shift.
-        // src shift mask may have values >31, and x86 sets to zero when
-        // that happens so we mask.
-        e.vandps(e.xmm0, i.src2, e.GetXmmConstPtr(XMMShiftMaskPS));
-        e.vpsllvd(i.dest, src1, e.xmm0);
-      }
+      // src shift mask may have values >31, and x86 sets to zero when
+      // that happens so we mask.
+      LoadShiftCounts(e, i.src2, XMMShiftMaskPS);
+      e.vpsllvd(i.dest, GetXmmSource(e, i.src1, e.xmm1), e.xmm0);
     } else {
-      // Shift 4 words in src1 by amount specified in src2.
-      Xbyak::Label emu, end;
-
-      // See if the shift is equal first for a shortcut.
-      // Only bother with this check if shift amt isn't constant.
-      if (!i.src2.is_constant) {
-        e.vpshufd(e.xmm0, i.src2, 0b00000000);
-        e.vpxor(e.xmm1, e.xmm0, i.src2);
-        e.vptest(e.xmm1, e.xmm1);
-        e.jnz(emu);
-
-        // Equal. Shift using vpsrad.
-        e.mov(e.rax, 0x1F);
-        e.vmovq(e.xmm1, e.rax);
-        e.vpand(e.xmm0, e.xmm0, e.xmm1);
-        e.vpslld(i.dest, src1, e.xmm0);
-        e.jmp(end);
-      }
-
-      // TODO(benvanik): native version (with shift magic).
-      e.L(emu);
-      if (i.src2.is_constant) {
-        e.lea(e.GetNativeParam(1), e.StashConstantXmm(1, i.src2.constant()));
-      } else {
-        e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
-      }
-      e.lea(e.GetNativeParam(0), e.StashXmm(0, src1));
-      e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShl<uint32_t>));
-      e.vmovaps(i.dest, e.xmm0);
-
-      e.L(end);
+      LoadShiftOperands(e, i);
+      EmitBarrelShift(e, i.dest, INT32_TYPE, VectorShiftKind::kLeft);
     }
   }
 };
@@ -881,23 +1070,6 @@ EMITTER_OPCODE_TABLE(OPCODE_VECTOR_SHL, VECTOR_SHL_V128);
 // ============================================================================
 // OPCODE_VECTOR_SHR
 // ============================================================================
-template <typename T, std::enable_if_t<std::is_integral<T>::value, int> = 0>
-static __m128i EmulateVectorShr(void*, __m128i src1, __m128i src2) {
-  alignas(16) T value[16 / sizeof(T)];
-  alignas(16) T shamt[16 / sizeof(T)];
-
-  // Load SSE registers into a C array.
-  _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
-  _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
-
-  for (size_t i = 0; i < (16 / sizeof(T)); ++i) {
-    value[i] = value[i] >> (shamt[i] & ((sizeof(T) * 8) - 1));
-  }
-
-  // Store result and return it.
-  return _mm_load_si128(reinterpret_cast<__m128i*>(value));
-}
-
 struct VECTOR_SHR_V128
     : Sequence<VECTOR_SHR_V128, I<OPCODE_VECTOR_SHR, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
@@ -918,15 +1090,14 @@ struct VECTOR_SHR_V128
   }
 
   static void EmitInt8(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): native version (with shift magic).
-    if (i.src2.is_constant) {
-      e.lea(e.GetNativeParam(1), e.StashConstantXmm(1, i.src2.constant()));
-    } else {
-      e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
+    if (e.IsFeatureEnabled(kX64EmitAVX512BWVL)) {
+      LoadShiftCounts(e, i.src2, XMMShiftMaskPI8);
+      EmitAVX512ByteShift(e, i.dest, GetXmmSource(e, i.src1, e.xmm1),
+                          VectorShiftKind::kLogicalRight);
+      return;
     }
-    e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShr<uint8_t>));
-    e.vmovaps(i.dest, e.xmm0);
+    LoadShiftOperands(e, i);
+    EmitBarrelShift(e, i.dest, INT8_TYPE, VectorShiftKind::kLogicalRight);
   }
 
   static void EmitInt16(X64Emitter& e, const EmitArgType& i) {
@@ -940,55 +1111,27 @@ struct VECTOR_SHR_V128
         }
       }
       if (all_same) {
-        // Every count is the same, so we can use vpsllw.
-        e.vpsrlw(i.dest, i.src1, shamt.u16[0] & 0xF);
+        // Every count is the same, so we can use vpsrlw.
+        e.vpsrlw(i.dest, GetXmmSource(e, i.src1, e.xmm2),
+                 shamt.u16[0] & 0xF);
         return;
       }
     }
 
-    // Shift 8 words in src1 by amount specified in src2.
-    Xbyak::Label emu, end;
-
-    // See if the shift is equal first for a shortcut.
-    // Only bother with this check if shift amt isn't constant.
-    if (!i.src2.is_constant) {
-      e.vpshuflw(e.xmm0, i.src2, 0b00000000);
-      e.vpshufd(e.xmm0, e.xmm0, 0b00000000);
-      e.vpxor(e.xmm1, e.xmm0, i.src2);
-      e.vptest(e.xmm1, e.xmm1);
-      e.jnz(emu);
-
-      // Equal. Shift using vpsrlw.
-      e.mov(e.rax, 0xF);
-      e.vmovq(e.xmm1, e.rax);
-      e.vpand(e.xmm0, e.xmm0, e.xmm1);
-      e.vpsrlw(i.dest, i.src1, e.xmm0);
-      e.jmp(end);
-    }
-
-    // TODO(benvanik): native version (with shift magic).
-    e.L(emu);
-    if (i.src2.is_constant) {
-      e.lea(e.GetNativeParam(1), e.StashConstantXmm(1, i.src2.constant()));
+    if (e.IsFeatureEnabled(kX64EmitAVX512BWVL)) {
+      LoadShiftCounts(e, i.src2, XMMShiftMaskPI16);
+      e.vpsrlvw(i.dest, GetXmmSource(e, i.src1, e.xmm1), e.xmm0);
+    } else if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+      LoadShiftCounts(e, i.src2, XMMShiftMaskPI16);
+      EmitAVX2WordShift(e, i.dest, GetXmmSource(e, i.src1, e.xmm1),
+                        VectorShiftKind::kLogicalRight);
     } else {
-      e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
+      LoadShiftOperands(e, i);
+      EmitBarrelShift(e, i.dest, INT16_TYPE, VectorShiftKind::kLogicalRight);
     }
-    e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShr<uint16_t>));
-    e.vmovaps(i.dest, e.xmm0);
-
-    e.L(end);
   }
 
   static void EmitInt32(X64Emitter& e, const EmitArgType& i) {
-    Xmm src1;
-    if (i.src1.is_constant) {
-      src1 = e.xmm2;
-      e.LoadConstantXmm(src1, i.src1.constant());
-    } else {
-      src1 = i.src1;
-    }
-
     if (i.src2.is_constant) {
       const auto& shamt = i.src2.constant();
       bool all_same = true;
@@ -1000,60 +1143,20 @@ struct VECTOR_SHR_V128
       }
       if (all_same) {
         // Every count is the same, so we can use vpsrld.
-        e.vpsrld(i.dest, src1, shamt.u8[0] & 0x1F);
+        e.vpsrld(i.dest, GetXmmSource(e, i.src1, e.xmm2),
+                 shamt.u8[0] & 0x1F);
         return;
-      } else {
-        if (e.IsFeatureEnabled(kX64EmitAVX2)) {
-          // Counts differ, so pre-mask and load constant.
-          vec128_t masked = i.src2.constant();
-          for (size_t n = 0; n < 4; ++n) {
-            masked.u32[n] &= 0x1F;
-          }
-          e.LoadConstantXmm(e.xmm0, masked);
-          e.vpsrlvd(i.dest, src1, e.xmm0);
-          return;
-        }
       }
     }
 
     if (e.IsFeatureEnabled(kX64EmitAVX2)) {
-      // Fully variable shift.
       // src shift mask may have values >31, and x86 sets to zero when
       // that happens so we mask.
-      e.vandps(e.xmm0, i.src2, e.GetXmmConstPtr(XMMShiftMaskPS));
-      e.vpsrlvd(i.dest, src1, e.xmm0);
+      LoadShiftCounts(e, i.src2, XMMShiftMaskPS);
+      e.vpsrlvd(i.dest, GetXmmSource(e, i.src1, e.xmm1), e.xmm0);
     } else {
-      // Shift 4 words in src1 by amount specified in src2.
-      Xbyak::Label emu, end;
-
-      // See if the shift is equal first for a shortcut.
-      // Only bother with this check if shift amt isn't constant.
-      if (!i.src2.is_constant) {
-        e.vpshufd(e.xmm0, i.src2, 0b00000000);
-        e.vpxor(e.xmm1, e.xmm0, i.src2);
-        e.vptest(e.xmm1, e.xmm1);
-        e.jnz(emu);
-
-        // Equal. Shift using vpsrld.
-        e.mov(e.rax, 0x1F);
-        e.vmovq(e.xmm1, e.rax);
-        e.vpand(e.xmm0, e.xmm0, e.xmm1);
-        e.vpsrld(i.dest, src1, e.xmm0);
-        e.jmp(end);
-      }
-
-      // TODO(benvanik): native version.
-      e.L(emu);
-      if (i.src2.is_constant) {
-        e.lea(e.GetNativeParam(1), e.StashConstantXmm(1, i.src2.constant()));
-      } else {
-        e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
-      }
-      e.lea(e.GetNativeParam(0), e.StashXmm(0, src1));
-      e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShr<uint32_t>));
-      e.vmovaps(i.dest, e.xmm0);
-
-      e.L(end);
+      LoadShiftOperands(e, i);
+      EmitBarrelShift(e, i.dest, INT32_TYPE, VectorShiftKind::kLogicalRight);
     }
   }
 };
@@ -1082,15 +1185,14 @@ struct VECTOR_SHA_V128
   }
 
   static void EmitInt8(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): native version (with shift magic).
-    if (i.src2.is_constant) {
-      e.lea(e.GetNativeParam(1), e.StashConstantXmm(1, i.src2.constant()));
-    } else {
-      e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
+    if (e.IsFeatureEnabled(kX64EmitAVX512BWVL)) {
+      LoadShiftCounts(e, i.src2, XMMShiftMaskPI8);
+      EmitAVX512ByteShift(e, i.dest, GetXmmSource(e, i.src1, e.xmm1),
+                          VectorShiftKind::kArithmeticRight);
+      return;
     }
-    e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShr<int8_t>));
-    e.vmovaps(i.dest, e.xmm0);
+    LoadShiftOperands(e, i);
+    EmitBarrelShift(e, i.dest, INT8_TYPE, VectorShiftKind::kArithmeticRight);
   }
 
   static void EmitInt16(X64Emitter& e, const EmitArgType& i) {
@@ -1105,43 +1207,24 @@ struct VECTOR_SHA_V128
       }
       if (all_same) {
         // Every count is the same, so we can use vpsraw.
-        e.vpsraw(i.dest, i.src1, shamt.u16[0] & 0xF);
+        e.vpsraw(i.dest, GetXmmSource(e, i.src1, e.xmm2),
+                 shamt.u16[0] & 0xF);
         return;
       }
     }
 
-    // Shift 8 words in src1 by amount specified in src2.
-    Xbyak::Label emu, end;
-
-    // See if the shift is equal first for a shortcut.
-    // Only bother with this check if shift amt isn't constant.
-    if (!i.src2.is_constant) {
-      e.vpshuflw(e.xmm0, i.src2, 0b00000000);
-      e.vpshufd(e.xmm0, e.xmm0, 0b00000000);
-      e.vpxor(e.xmm1, e.xmm0, i.src2);
-      e.vptest(e.xmm1, e.xmm1);
-      e.jnz(emu);
-
-      // Equal. Shift using vpsraw.
-      e.mov(e.rax, 0xF);
-      e.vmovq(e.xmm1, e.rax);
-      e.vpand(e.xmm0, e.xmm0, e.xmm1);
-      e.vpsraw(i.dest, i.src1, e.xmm0);
-      e.jmp(end);
-    }
-
-    // TODO(benvanik): native version (with shift magic).
-    e.L(emu);
-    if (i.src2.is_constant) {
-      e.lea(e.GetNativeParam(1), e.StashConstantXmm(1, i.src2.constant()));
+    if (e.IsFeatureEnabled(kX64EmitAVX512BWVL)) {
+      LoadShiftCounts(e, i.src2, XMMShiftMaskPI16);
+      e.vpsravw(i.dest, GetXmmSource(e, i.src1, e.xmm1), e.xmm0);
+    } else if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+      LoadShiftCounts(e, i.src2, XMMShiftMaskPI16);
+      EmitAVX2WordShift(e, i.dest, GetXmmSource(e, i.src1, e.xmm1),
+                        VectorShiftKind::kArithmeticRight);
     } else {
-      e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
+      LoadShiftOperands(e, i);
+      EmitBarrelShift(e, i.dest, INT16_TYPE,
+                      VectorShiftKind::kArithmeticRight);
     }
-    e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShr<int16_t>));
-    e.vmovaps(i.dest, e.xmm0);
-
-    e.L(end);
   }
 
   static void EmitInt32(X64Emitter& e, const EmitArgType& i) {
@@ -1156,7 +1239,8 @@ struct VECTOR_SHA_V128
       }
       if (all_same) {
         // Every count is the same, so we can use vpsrad.
-        e.vpsrad(i.dest, i.src1, shamt.u32[0] & 0x1F);
+        e.vpsrad(i.dest, GetXmmSource(e, i.src1, e.xmm2),
+                 shamt.u32[0] & 0x1F);
         return;
       }
     }
@@ -1164,45 +1248,12 @@ struct VECTOR_SHA_V128
     if (e.IsFeatureEnabled(kX64EmitAVX2)) {
       // src shift mask may have values >31, and x86 sets to zero when
       // that happens so we mask.
-      if (i.src2.is_constant) {
-        e.LoadConstantXmm(e.xmm0, i.src2.constant());
-        e.vandps(e.xmm0, e.GetXmmConstPtr(XMMShiftMaskPS));
-      } else {
-        e.vandps(e.xmm0, i.src2, e.GetXmmConstPtr(XMMShiftMaskPS));
-      }
-      e.vpsravd(i.dest, i.src1, e.xmm0);
+      LoadShiftCounts(e, i.src2, XMMShiftMaskPS);
+      e.vpsravd(i.dest, GetXmmSource(e, i.src1, e.xmm1), e.xmm0);
     } else {
-      // Shift 4 words in src1 by amount specified in src2.
-      Xbyak::Label emu, end;
-
-      // See if the shift is equal first for a shortcut.
-      // Only bother with this check if shift amt isn't constant.
-      if (!i.src2.is_constant) {
-        e.vpshufd(e.xmm0, i.src2, 0b00000000);
-        e.vpxor(e.xmm1, e.xmm0, i.src2);
-        e.vptest(e.xmm1, e.xmm1);
-        e.jnz(emu);
-
-        // Equal. Shift using vpsrad.
-        e.mov(e.rax, 0x1F);
-        e.vmovq(e.xmm1, e.rax);
-        e.vpand(e.xmm0, e.xmm0, e.xmm1);
-        e.vpsrad(i.dest, i.src1, e.xmm0);
-        e.jmp(end);
-      }
-
-      // TODO(benvanik): native version.
-      e.L(emu);
-      if (i.src2.is_constant) {
-        e.lea(e.GetNativeParam(1), e.StashConstantXmm(1, i.src2.constant()));
-      } else {
-        e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
-      }
-      e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-      e.CallNativeSafe(reinterpret_cast<void*>(EmulateVectorShr<int32_t>));
-      e.vmovaps(i.dest, e.xmm0);
-
-      e.L(end);
+      LoadShiftOperands(e, i);
+      EmitBarrelShift(e, i.dest, INT32_TYPE,
+                      VectorShiftKind::kArithmeticRight);
     }
   }
 };
@@ -1211,55 +1262,49 @@ EMITTER_OPCODE_TABLE(OPCODE_VECTOR_SHA, VECTOR_SHA_V128);
 // ============================================================================
 // OPCODE_VECTOR_ROTATE_LEFT
 // ============================================================================
-template <typename T, std::enable_if_t<std::is_integral<T>::value, int> = 0>
-static __m128i EmulateVectorRotateLeft(void*, __m128i src1, __m128i src2) {
-  alignas(16) T value[16 / sizeof(T)];
-  alignas(16) T shamt[16 / sizeof(T)];
-
-  // Load SSE registers into a C array.
-  _mm_store_si128(reinterpret_cast<__m128i*>(value), src1);
-  _mm_store_si128(reinterpret_cast<__m128i*>(shamt), src2);
-
-  for (size_t i = 0; i < (16 / sizeof(T)); ++i) {
-    value[i] = xe::rotate_left<T>(value[i], shamt[i] & ((sizeof(T) * 8) - 1));
-  }
-
-  // Store result and return it.
-  return _mm_load_si128(reinterpret_cast<__m128i*>(value));
-}
-
-// TODO(benvanik): AVX512 has a native variable rotate (rolv).
 struct VECTOR_ROTATE_LEFT_V128
     : Sequence<VECTOR_ROTATE_LEFT_V128,
                I<OPCODE_VECTOR_ROTATE_LEFT, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     switch (i.instr->flags) {
       case INT8_TYPE:
-        // TODO(benvanik): native version (with shift magic).
-        if (i.src2.is_constant) {
-          e.lea(e.GetNativeParam(1), e.StashConstantXmm(1, i.src2.constant()));
+        if (e.IsFeatureEnabled(kX64EmitAVX512BWVL)) {
+          LoadShiftCounts(e, i.src2, XMMShiftMaskPI8);
+          EmitAVX512ByteShift(e, i.dest, GetXmmSource(e, i.src1, e.xmm1),
+                              VectorShiftKind::kRotateLeft);
         } else {
-          e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
+          LoadShiftOperands(e, i);
+          EmitBarrelShift(e, i.dest, INT8_TYPE, VectorShiftKind::kRotateLeft);
         }
-        e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-        e.CallNativeSafe(
-            reinterpret_cast<void*>(EmulateVectorRotateLeft<uint8_t>));
-        e.vmovaps(i.dest, e.xmm0);
         break;
       case INT16_TYPE:
-        // TODO(benvanik): native version (with shift magic).
-        if (i.src2.is_constant) {
-          e.lea(e.GetNativeParam(1), e.StashConstantXmm(1, i.src2.constant()));
+        if (e.IsFeatureEnabled(kX64EmitAVX512BWVL)) {
+          LoadShiftCounts(e, i.src2, XMMShiftMaskPI16);
+          Xmm src1 = GetXmmSource(e, i.src1, e.xmm2);
+          // Shift left (to get high bits):
+          e.vpsllvw(e.xmm1, src1, e.xmm0);
+          // Shift right (to get low bits), by 16 (so to 0) for a count of 0:
+          e.vmovdqa(e.xmm3, e.GetXmmConstPtr(XMMPI16));
+          e.vpsubw(e.xmm3, e.xmm0);
+          e.vpsrlvw(i.dest, src1, e.xmm3);
+          // Merge:
+          e.vpor(i.dest, e.xmm1);
+        } else if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+          LoadShiftCounts(e, i.src2, XMMShiftMaskPI16);
+          EmitAVX2WordShift(e, i.dest, GetXmmSource(e, i.src1, e.xmm1),
+                            VectorShiftKind::kRotateLeft);
         } else {
-          e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
+          LoadShiftOperands(e, i);
+          EmitBarrelShift(e, i.dest, INT16_TYPE,
+                          VectorShiftKind::kRotateLeft);
         }
-        e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-        e.CallNativeSafe(
-            reinterpret_cast<void*>(EmulateVectorRotateLeft<uint16_t>));
-        e.vmovaps(i.dest, e.xmm0);
         break;
       case INT32_TYPE: {
-        if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+        if (e.IsFeatureEnabled(kX64EmitAVX512Ortho)) {
+          // The rotate count is taken modulo 32, like the guest does.
+          Xmm src2 = GetXmmSource(e, i.src2, e.xmm0);
+          e.vprolvd(i.dest, GetXmmSource(e, i.src1, e.xmm1), src2);
+        } else if (e.IsFeatureEnabled(kX64EmitAVX2)) {
           Xmm temp = i.dest;
           if (i.dest == i.src1 || i.dest == i.src2) {
             temp = e.xmm2;
@@ -1279,17 +1324,9 @@ struct VECTOR_ROTATE_LEFT_V128
           // Merge:
           e.vpor(i.dest, e.xmm1);
         } else {
-          // TODO(benvanik): non-AVX2 native version.
-          if (i.src2.is_constant) {
-            e.lea(e.GetNativeParam(1),
-                  e.StashConstantXmm(1, i.src2.constant()));
-          } else {
-            e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
-          }
-          e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-          e.CallNativeSafe(
-              reinterpret_cast<void*>(EmulateVectorRotateLeft<uint32_t>));
-          e.vmovaps(i.dest, e.xmm0);
+          LoadShiftOperands(e, i);
+          EmitBarrelShift(e, i.dest, INT32_TYPE,
+                          VectorShiftKind::kRotateLeft);
         }
         break;
       }
@@ -1304,25 +1341,6 @@ EMITTER_OPCODE_TABLE(OPCODE_VECTOR_ROTATE_LEFT, VECTOR_ROTATE_LEFT_V128);
 // ============================================================================
 // OPCODE_VECTOR_AVERAGE
 // ============================================================================
-template <typename T, std::enable_if_t<std::is_integral<T>::value, int> = 0>
-static __m128i EmulateVectorAverage(void*, __m128i src1, __m128i src2) {
-  alignas(16) T src1v[16 / sizeof(T)];
-  alignas(16) T src2v[16 / sizeof(T)];
-  alignas(16) T value[16 / sizeof(T)];
-
-  // Load SSE registers into a C array.
-  _mm_store_si128(reinterpret_cast<__m128i*>(src1v), src1);
-  _mm_store_si128(reinterpret_cast<__m128i*>(src2v), src2);
-
-  for (size_t i = 0; i < (16 / sizeof(T)); ++i) {
-    auto t = (uint64_t(src1v[i]) + uint64_t(src2v[i]) + 1) / 2;
-    value[i] = T(t);
-  }
-
-  // Store result and return it.
-  return _mm_load_si128(reinterpret_cast<__m128i*>(value));
-}
-
 struct VECTOR_AVERAGE
     : Sequence<VECTOR_AVERAGE,
                I<OPCODE_VECTOR_AVERAGE, V128Op, V128Op, V128Op>> {
@@ -1350,30 +1368,17 @@ struct VECTOR_AVERAGE
               }
               break;
             case INT32_TYPE:
-              // No 32bit averages in AVX.
+              // No 32bit averages in AVX, but (a + b + 1) >> 1 without the
+              // overflow is (a | b) - ((a ^ b) >> 1).
+              // xmm0 may hold a constant source.
+              e.vpor(e.xmm1, src1, src2);
+              e.vpxor(e.xmm2, src1, src2);
               if (is_unsigned) {
-                if (i.src2.is_constant) {
-                  e.lea(e.GetNativeParam(1),
-                        e.StashConstantXmm(1, i.src2.constant()));
-                } else {
-                  e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
-                }
-                e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-                e.CallNativeSafe(
-                    reinterpret_cast<void*>(EmulateVectorAverage<uint32_t>));
-                e.vmovaps(i.dest, e.xmm0);
+                e.vpsrld(e.xmm2, e.xmm2, 1);
               } else {
-                if (i.src2.is_constant) {
-                  e.lea(e.GetNativeParam(1),
-                        e.StashConstantXmm(1, i.src2.constant()));
-                } else {
-                  e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
-                }
-                e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-                e.CallNativeSafe(
-                    reinterpret_cast<void*>(EmulateVectorAverage<int32_t>));
-                e.vmovaps(i.dest, e.xmm0);
+                e.vpsrad(e.xmm2, e.xmm2, 1);
               }
+              e.vpsubd(dest, e.xmm1, e.xmm2);
               break;
             default:
               assert_unhandled_case(part_type);
@@ -1498,7 +1503,7 @@ struct EXTRACT_I32
       e.mov(e.al, i.src2);
       e.and_(e.al, 0x03);
       e.shl(e.al, 4);
-      e.mov(e.rdx, reinterpret_cast<uint64_t>(extract_table_32));
+      e.MovHostImageAddress(e.rdx, extract_table_32);
       e.vmovaps(e.xmm0, e.ptr[e.rdx + e.rax]);
       e.vpshufb(e.xmm0, src1, e.xmm0);
       e.vpextrd(i.dest, e.xmm0, 0);
@@ -1663,6 +1668,21 @@ struct PERMUTE_V128
     // Permute bytes between src2 and src3.
     // src1 is an array of indices corresponding to positions within src2 and
     // src3.
+    if (e.IsFeatureEnabled(kX64EmitAVX512VBMIVL)) {
+      // vpermi2b indexes the 32 bytes of both tables at once, ignoring the
+      // upper index bits like the guest does.
+      if (i.src1.is_constant) {
+        e.LoadConstantXmm(e.xmm0, i.src1.constant());
+        e.vxorps(e.xmm0, e.xmm0, e.GetXmmConstPtr(XMMSwapWordMask));
+      } else {
+        e.vxorps(e.xmm0, i.src1, e.GetXmmConstPtr(XMMSwapWordMask));
+      }
+      Xmm src2 = GetXmmSource(e, i.src2, e.xmm1);
+      Xmm src3 = GetXmmSource(e, i.src3, e.xmm2);
+      e.vpermi2b(e.xmm0, src2, src3);
+      e.vmovdqa(i.dest, e.xmm0);
+      return;
+    }
     if (i.src3.value->IsConstantZero()) {
       // Permuting with src2/zero, so just shuffle/mask.
       if (i.src2.value->IsConstantZero()) {
@@ -1817,6 +1837,39 @@ EMITTER_OPCODE_TABLE(OPCODE_SWIZZLE, SWIZZLE);
 // ============================================================================
 // OPCODE_PACK
 // ============================================================================
+// Converts the floats in src to half floats in the low 16 bits of the dwords
+// of dest like vcvtps2ph rounding toward zero does, for hosts without F16C:
+// values too large become the largest finite half and NaNs are made quiet.
+// Clobbers xmm0-xmm3.
+static void EmitFloatToHalf(X64Emitter& e, const Xmm& dest, const Xmm& src) {
+  // Normal halves: rebias the exponent and drop the low mantissa bits.
+  // Anything too large is clamped, and anything too small wraps around to
+  // large values here and is replaced below.
+  e.vandps(e.xmm0, src, e.GetXmmConstPtr(XMMAbsMaskPS));
+  e.vpsubd(e.xmm1, e.xmm0, e.GetXmmConstPtr(XMMFloat16Bias));
+  e.vpsrld(e.xmm1, e.xmm1, 13);
+  e.vpminud(e.xmm1, e.xmm1, e.GetXmmConstPtr(XMMFloat16Max));
+  // Infinity is one above the largest finite half.
+  e.vpcmpeqd(e.xmm2, e.xmm0, e.GetXmmConstPtr(XMMInfinityPS));
+  e.vpsubd(e.xmm1, e.xmm2);
+  // Denormal halves count units of 2^-24, and the conversion truncates.
+  e.vmulps(e.xmm2, e.xmm0, e.GetXmmConstPtr(XMMFloat16DenormalScale));
+  e.vcvttps2dq(e.xmm2, e.xmm2);
+  e.vmovdqa(e.xmm3, e.GetXmmConstPtr(XMMFloat16MinNormal));
+  e.vpcmpgtd(e.xmm3, e.xmm3, e.xmm0);
+  e.vblendvps(e.xmm1, e.xmm1, e.xmm2, e.xmm3);
+  // NaNs keep the top of their payload.
+  e.vpsrld(e.xmm2, e.xmm0, 13);
+  e.vpor(e.xmm2, e.GetXmmConstPtr(XMMFloat16QuietBit));
+  e.vpsubd(e.xmm2, e.GetXmmConstPtr(XMMFloat16NaNBias));
+  e.vcmpunordps(e.xmm3, e.xmm0, e.xmm0);
+  e.vblendvps(e.xmm1, e.xmm1, e.xmm2, e.xmm3);
+  // Sign.
+  e.vandps(e.xmm2, src, e.GetXmmConstPtr(XMMSignMaskPS));
+  e.vpsrld(e.xmm2, e.xmm2, 16);
+  e.vpor(dest, e.xmm1, e.xmm2);
+}
+
 struct PACK : Sequence<PACK, I<OPCODE_PACK, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     switch (i.instr->flags & PACK_TYPE_MODE) {
@@ -1873,83 +1926,50 @@ struct PACK : Sequence<PACK, I<OPCODE_PACK, V128Op, V128Op, V128Op>> {
     //     ((src1.uy & 0xFF) << 8) | (src1.uz & 0xFF)
     e.vpshufb(i.dest, i.dest, e.GetXmmConstPtr(XMMPackD3DCOLOR));
   }
-  static __m128i EmulateFLOAT16_2(void*, __m128 src1) {
-    alignas(16) float a[4];
-    alignas(16) uint16_t b[8];
-    _mm_store_ps(a, src1);
-    std::memset(b, 0, sizeof(b));
-
-    for (int i = 0; i < 2; i++) {
-      b[7 - i] = half_float::detail::float2half<std::round_toward_zero>(a[i]);
-    }
-
-    return _mm_load_si128(reinterpret_cast<__m128i*>(b));
-  }
   static void EmitFLOAT16_2(X64Emitter& e, const EmitArgType& i) {
     assert_true(i.src2.value->IsConstantZero());
     // http://blogs.msdn.com/b/chuckw/archive/2012/09/11/directxmath-f16c-and-fma.aspx
     // dest = [(src1.x | src1.y), 0, 0, 0]
 
+    Xmm src;
+    if (i.src1.is_constant) {
+      src = i.dest;
+      e.LoadConstantXmm(src, i.src1.constant());
+    } else {
+      src = i.src1;
+    }
     if (e.IsFeatureEnabled(kX64EmitF16C)) {
-      Xmm src;
-      if (i.src1.is_constant) {
-        src = i.dest;
-        e.LoadConstantXmm(src, i.src1.constant());
-      } else {
-        src = i.src1;
-      }
       // 0|0|0|0|W|Z|Y|X
       e.vcvtps2ph(i.dest, src, 0b00000011);
-      // Shuffle to X|Y|0|0|0|0|0|0
-      e.vpshufb(i.dest, i.dest, e.GetXmmConstPtr(XMMPackFLOAT16_2));
     } else {
-      if (i.src1.is_constant) {
-        e.lea(e.GetNativeParam(0), e.StashConstantXmm(0, i.src1.constant()));
-      } else {
-        e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-      }
-      e.CallNativeSafe(reinterpret_cast<void*>(EmulateFLOAT16_2));
-      e.vmovaps(i.dest, e.xmm0);
-    }
-  }
-  static __m128i EmulateFLOAT16_4(void*, __m128 src1) {
-    alignas(16) float a[4];
-    alignas(16) uint16_t b[8];
-    _mm_store_ps(a, src1);
-    std::memset(b, 0, sizeof(b));
-
-    for (int i = 0; i < 4; i++) {
-      b[7 - (i ^ 2)] =
-          half_float::detail::float2half<std::round_toward_zero>(a[i]);
+      EmitFloatToHalf(e, i.dest, src);
+      // W|Z|Y|X|W|Z|Y|X
+      e.vpackusdw(i.dest, i.dest, i.dest);
     }
-
-    return _mm_load_si128(reinterpret_cast<__m128i*>(b));
+    // Shuffle to X|Y|0|0|0|0|0|0
+    e.vpshufb(i.dest, i.dest, e.GetXmmConstPtr(XMMPackFLOAT16_2));
   }
   static void EmitFLOAT16_4(X64Emitter& e, const EmitArgType& i) {
     assert_true(i.src2.value->IsConstantZero());
     // dest = [(src1.z | src1.w), (src1.x | src1.y), 0, 0]
 
+    Xmm src;
+    if (i.src1.is_constant) {
+      src = i.dest;
+      e.LoadConstantXmm(src, i.src1.constant());
+    } else {
+      src = i.src1;
+    }
     if (e.IsFeatureEnabled(kX64EmitF16C)) {
-      Xmm src;
-      if (i.src1.is_constant) {
-        src = i.dest;
-        e.LoadConstantXmm(src, i.src1.constant());
-      } else {
-        src = i.src1;
-      }
       // 0|0|0|0|W|Z|Y|X
       e.vcvtps2ph(i.dest, src, 0b00000011);
-      // Shuffle to Z|W|X|Y|0|0|0|0
-      e.vpshufb(i.dest, i.dest, e.GetXmmConstPtr(XMMPackFLOAT16_4));
     } else {
-      if (i.src1.is_constant) {
-        e.lea(e.GetNativeParam(0), e.StashConstantXmm(0, i.src1.constant()));
-      } else {
-        e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-      }
-      e.CallNativeSafe(reinterpret_cast<void*>(EmulateFLOAT16_4));
-      e.vmovaps(i.dest, e.xmm0);
+      EmitFloatToHalf(e, i.dest, src);
+      // W|Z|Y|X|W|Z|Y|X
+      e.vpackusdw(i.dest, i.dest, i.dest);
     }
+    // Shuffle to Z|W|X|Y|0|0|0|0
+    e.vpshufb(i.dest, i.dest, e.GetXmmConstPtr(XMMPackFLOAT16_4));
   }
   static void EmitSHORT_2(X64Emitter& e, const EmitArgType& i) {
     assert_true(i.src2.value->IsConstantZero());
@@ -2043,56 +2063,27 @@ struct PACK : Sequence<PACK, I<OPCODE_PACK, V128Op, V128Op, V128Op>> {
     // Merge XZ and YW.
     e.vorps(i.dest, e.xmm0);
   }
-  static __m128i EmulatePack8_IN_16_UN_UN_SAT(void*, __m128i src1,
-                                              __m128i src2) {
-    alignas(16) uint16_t a[8];
-    alignas(16) uint16_t b[8];
-    alignas(16) uint8_t c[16];
-    _mm_store_si128(reinterpret_cast<__m128i*>(a), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(b), src2);
-    for (int i = 0; i < 8; ++i) {
-      c[i] = uint8_t(std::max(uint16_t(0), std::min(uint16_t(255), a[i])));
-      c[i + 8] = uint8_t(std::max(uint16_t(0), std::min(uint16_t(255), b[i])));
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(c));
-  }
-  static __m128i EmulatePack8_IN_16_UN_UN(void*, __m128i src1, __m128i src2) {
-    alignas(16) uint8_t a[16];
-    alignas(16) uint8_t b[16];
-    alignas(16) uint8_t c[16];
-    _mm_store_si128(reinterpret_cast<__m128i*>(a), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(b), src2);
-    for (int i = 0; i < 8; ++i) {
-      c[i] = a[i * 2];
-      c[i + 8] = b[i * 2];
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(c));
-  }
   static void Emit8_IN_16(X64Emitter& e, const EmitArgType& i, uint32_t flags) {
     // TODO(benvanik): handle src2 (or src1) being constant zero
     if (IsPackInUnsigned(flags)) {
       if (IsPackOutUnsigned(flags)) {
         if (IsPackOutSaturate(flags)) {
           // unsigned -> unsigned + saturate
-          if (i.src2.is_constant) {
-            e.lea(e.GetNativeParam(1),
-                  e.StashConstantXmm(1, i.src2.constant()));
-          } else {
-            e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
-          }
-          e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-          e.CallNativeSafe(
-              reinterpret_cast<void*>(EmulatePack8_IN_16_UN_UN_SAT));
-          e.vmovaps(i.dest, e.xmm0);
-          e.vpshufb(i.dest, i.dest, e.GetXmmConstPtr(XMMByteOrderMask));
+          // vpackuswb saturates signed words, so clamp them first.
+          e.vpminuw(e.xmm0, GetXmmSource(e, i.src1, e.xmm0),
+                    e.GetXmmConstPtr(XMMLowByteMaskPI16));
+          e.vpminuw(e.xmm1, GetXmmSource(e, i.src2, e.xmm1),
+                    e.GetXmmConstPtr(XMMLowByteMaskPI16));
         } else {
           // unsigned -> unsigned
-          e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
-          e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-          e.CallNativeSafe(reinterpret_cast<void*>(EmulatePack8_IN_16_UN_UN));
-          e.vmovaps(i.dest, e.xmm0);
-          e.vpshufb(i.dest, i.dest, e.GetXmmConstPtr(XMMByteOrderMask));
+          // Truncate, so vpackuswb has nothing to saturate.
+          e.vpand(e.xmm0, GetXmmSource(e, i.src1, e.xmm0),
+                  e.GetXmmConstPtr(XMMLowByteMaskPI16));
+          e.vpand(e.xmm1, GetXmmSource(e, i.src2, e.xmm1),
+                  e.GetXmmConstPtr(XMMLowByteMaskPI16));
         }
+        e.vpackuswb(i.dest, e.xmm0, e.xmm1);
+        e.vpshufb(i.dest, i.dest, e.GetXmmConstPtr(XMMByteOrderMask));
       } else {
         if (IsPackOutSaturate(flags)) {
           // unsigned -> signed + saturate
@@ -2234,6 +2225,37 @@ EMITTER_OPCODE_TABLE(OPCODE_PACK, PACK);
 // ============================================================================
 // OPCODE_UNPACK
 // ============================================================================
+// Converts the half floats in the low 16 bits of the dwords of src to floats
+// in dest exactly like vcvtph2ps, for hosts without F16C, including making
+// NaNs quiet. Clobbers xmm0-xmm3.
+static void EmitHalfToFloat(X64Emitter& e, const Xmm& dest, const Xmm& src) {
+  // Exponent and mantissa moved into place and the exponent rebiased, which
+  // is all normal halves need.
+  e.vpslld(e.xmm0, src, 13);
+  e.vpand(e.xmm0, e.GetXmmConstPtr(XMMFloat16MagnitudeMask));
+  e.vpand(e.xmm1, e.xmm0, e.GetXmmConstPtr(XMMFloat16ExpMask));
+  e.vpaddd(e.xmm2, e.xmm0, e.GetXmmConstPtr(XMMFloat16Bias));
+  // Infinity and NaN need the maximum exponent, which is the same bias again.
+  e.vpcmpeqd(e.xmm3, e.xmm1, e.GetXmmConstPtr(XMMFloat16ExpMask));
+  e.vpand(e.xmm3, e.GetXmmConstPtr(XMMFloat16Bias));
+  e.vpaddd(e.xmm2, e.xmm3);
+  e.vpcmpgtd(e.xmm3, e.xmm0, e.GetXmmConstPtr(XMMFloat16ExpMask));
+  e.vpand(e.xmm3, e.GetXmmConstPtr(XMMQuietBitPS));
+  e.vpor(e.xmm2, e.xmm3);
+  // Zeros and denormals: with the exponent of 2^-14 instead of 0, taking
+  // 2^-14 away again normalizes them exactly, without needing the host to
+  // handle denormals.
+  e.vpaddd(e.xmm3, e.xmm2, e.GetXmmConstPtr(XMMMinNormalPS));
+  e.vsubps(e.xmm3, e.GetXmmConstPtr(XMMFloat16MinNormal));
+  e.vpxor(e.xmm0, e.xmm0, e.xmm0);
+  e.vpcmpeqd(e.xmm1, e.xmm0);
+  e.vblendvps(e.xmm2, e.xmm2, e.xmm3, e.xmm1);
+  // Sign.
+  e.vpslld(e.xmm0, src, 16);
+  e.vpand(e.xmm0, e.GetXmmConstPtr(XMMSignMaskPS));
+  e.vpor(dest, e.xmm2, e.xmm0);
+}
+
 struct UNPACK : Sequence<UNPACK, I<OPCODE_UNPACK, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     switch (i.instr->flags & PACK_TYPE_MODE) {
@@ -2289,21 +2311,6 @@ struct UNPACK : Sequence<UNPACK, I<OPCODE_UNPACK, V128Op, V128Op>> {
     e.vpor(i.dest, e.GetXmmConstPtr(XMMOne));
     // To convert to 0 to 1, games multiply by 0x47008081 and add 0xC7008081.
   }
-  static __m128 EmulateFLOAT16_2(void*, __m128i src1) {
-    alignas(16) uint16_t a[8];
-    alignas(16) float b[4];
-    _mm_store_si128(reinterpret_cast<__m128i*>(a), src1);
-
-    for (int i = 0; i < 2; i++) {
-      b[i] = half_float::detail::half2float(a[VEC128_W(6 + i)]);
-    }
-
-    // Constants, or something
-    b[2] = 0.f;
-    b[3] = 1.f;
-
-    return _mm_load_ps(b);
-  }
   static void EmitFLOAT16_2(X64Emitter& e, const EmitArgType& i) {
     // 1 bit sign, 5 bit exponent, 10 bit mantissa
     // D3D10 half float format
@@ -2317,67 +2324,46 @@ struct UNPACK : Sequence<UNPACK, I<OPCODE_UNPACK, V128Op, V128Op>> {
     // Also zero out the high end.
     // TODO(benvanik): special case constant unpacks that just get 0/1/etc.
 
+    Xmm src;
+    if (i.src1.is_constant) {
+      src = i.dest;
+      e.LoadConstantXmm(src, i.src1.constant());
+    } else {
+      src = i.src1;
+    }
+    // sx = src.iw >> 16;
+    // sy = src.iw & 0xFFFF;
+    // dest = { XMConvertHalfToFloat(sx),
+    //          XMConvertHalfToFloat(sy),
+    //          0.0,
+    //          1.0 };
+    // Shuffle to 0|0|0|0|0|0|Y|X
+    e.vpshufb(i.dest, src, e.GetXmmConstPtr(XMMUnpackFLOAT16_2));
     if (e.IsFeatureEnabled(kX64EmitF16C)) {
-      Xmm src;
-      if (i.src1.is_constant) {
-        src = i.dest;
-        e.LoadConstantXmm(src, i.src1.constant());
-      } else {
-        src = i.src1;
-      }
-      // sx = src.iw >> 16;
-      // sy = src.iw & 0xFFFF;
-      // dest = { XMConvertHalfToFloat(sx),
-      //          XMConvertHalfToFloat(sy),
-      //          0.0,
-      //          1.0 };
-      // Shuffle to 0|0|0|0|0|0|Y|X
-      e.vpshufb(i.dest, src, e.GetXmmConstPtr(XMMUnpackFLOAT16_2));
       e.vcvtph2ps(i.dest, i.dest);
-      e.vpshufd(i.dest, i.dest, 0b10100100);
-      e.vpor(i.dest, e.GetXmmConstPtr(XMM0001));
     } else {
-      if (i.src1.is_constant) {
-        e.lea(e.GetNativeParam(0), e.StashConstantXmm(0, i.src1.constant()));
-      } else {
-        e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-      }
-      e.CallNativeSafe(reinterpret_cast<void*>(EmulateFLOAT16_2));
-      e.vmovaps(i.dest, e.xmm0);
+      e.vpmovzxwd(i.dest, i.dest);
+      EmitHalfToFloat(e, i.dest, i.dest);
     }
-  }
-  static __m128 EmulateFLOAT16_4(void*, __m128i src1) {
-    alignas(16) uint16_t a[8];
-    alignas(16) float b[4];
-    _mm_store_si128(reinterpret_cast<__m128i*>(a), src1);
-
-    for (int i = 0; i < 4; i++) {
-      b[i] = half_float::detail::half2float(a[VEC128_W(4 + i)]);
-    }
-
-    return _mm_load_ps(b);
+    e.vpshufd(i.dest, i.dest, 0b10100100);
+    e.vpor(i.dest, e.GetXmmConstPtr(XMM0001));
   }
   static void EmitFLOAT16_4(X64Emitter& e, const EmitArgType& i) {
     // src = [(dest.x | dest.y), (dest.z | dest.w), 0, 0]
+    Xmm src;
+    if (i.src1.is_constant) {
+      src = i.dest;
+      e.LoadConstantXmm(src, i.src1.constant());
+    } else {
+      src = i.src1;
+    }
+    // Shuffle to 0|0|0|0|W|Z|Y|X
+    e.vpshufb(i.dest, src, e.GetXmmConstPtr(XMMUnpackFLOAT16_4));
     if (e.IsFeatureEnabled(kX64EmitF16C)) {
-      Xmm src;
-      if (i.src1.is_constant) {
-        src = i.dest;
-        e.LoadConstantXmm(src, i.src1.constant());
-      } else {
-        src = i.src1;
-      }
-      // Shuffle to 0|0|0|0|W|Z|Y|X
-      e.vpshufb(i.dest, src, e.GetXmmConstPtr(XMMUnpackFLOAT16_4));
       e.vcvtph2ps(i.dest, i.dest);
     } else {
-      if (i.src1.is_constant) {
-        e.lea(e.GetNativeParam(0), e.StashConstantXmm(0, i.src1.constant()));
-      } else {
-        e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-      }
-      e.CallNativeSafe(reinterpret_cast<void*>(EmulateFLOAT16_4));
-      e.vmovaps(i.dest, e.xmm0);
+      e.vpmovzxwd(i.dest, i.dest);
+      EmitHalfToFloat(e, i.dest, i.dest);
     }
   }
   static void EmitSHORT_2(X64Emitter& e, const EmitArgType& i) {
@@ -64,6 +64,7 @@ struct COMMENT : Sequence<COMMENT, I<OPCODE_COMMENT, VoidOp, OffsetOp>> {
       // TODO(benvanik): pass through.
       // TODO(benvanik): don't just leak this memory.
       auto str_copy = strdup(str);
+      e.MarkNotStorable();
       e.mov(e.rdx, reinterpret_cast<uint64_t>(str_copy));
       e.CallNative(reinterpret_cast<void*>(TraceString));
     }
@@ -672,8 +673,26 @@ struct SELECT_I64
 struct SELECT_F32
     : Sequence<SELECT_F32, I<OPCODE_SELECT, F32Op, I8Op, F32Op, F32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): find a shorter sequence.
     // dest = src1 != 0 ? src2 : src3
+    if (e.IsFeatureEnabled(kX64EmitAVX512Ortho)) {
+      // Blend with a mask register set to all or no lanes.
+      Xmm src2 = i.src2.is_constant ? e.xmm1 : i.src2;
+      if (i.src2.is_constant) {
+        e.LoadConstantXmm(src2, i.src2.constant());
+      }
+      Xmm src3 = i.src3.is_constant ? e.xmm2 : i.src3;
+      if (i.src3.is_constant) {
+        e.LoadConstantXmm(src3, i.src3.constant());
+      }
+      e.test(i.src1, i.src1);
+      e.setnz(e.al);
+      e.movzx(e.eax, e.al);
+      e.neg(e.eax);
+      e.kmovw(e.k1, e.eax);
+      e.vpblendmd(i.dest | e.k1, src3, src2);
+      return;
+    }
+    // TODO(benvanik): find a shorter sequence.
     e.movzx(e.eax, i.src1);
     e.vmovd(e.xmm1, e.eax);
     e.vxorps(e.xmm0, e.xmm0);
@@ -719,8 +738,26 @@ struct SELECT_F64
 struct SELECT_V128_I8
     : Sequence<SELECT_V128_I8, I<OPCODE_SELECT, V128Op, I8Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): find a shorter sequence.
     // dest = src1 != 0 ? src2 : src3
+    if (e.IsFeatureEnabled(kX64EmitAVX512Ortho)) {
+      // Blend with a mask register set to all or no lanes.
+      Xmm src2 = i.src2.is_constant ? e.xmm1 : i.src2;
+      if (i.src2.is_constant) {
+        e.LoadConstantXmm(src2, i.src2.constant());
+      }
+      Xmm src3 = i.src3.is_constant ? e.xmm2 : i.src3;
+      if (i.src3.is_constant) {
+        e.LoadConstantXmm(src3, i.src3.constant());
+      }
+      e.test(i.src1, i.src1);
+      e.setnz(e.al);
+      e.movzx(e.eax, e.al);
+      e.neg(e.eax);
+      e.kmovw(e.k1, e.eax);
+      e.vpblendmd(i.dest | e.k1, src3, src2);
+      return;
+    }
+    // TODO(benvanik): find a shorter sequence.
     e.movzx(e.eax, i.src1);
     e.vmovd(e.xmm1, e.eax);
     e.vpbroadcastd(e.xmm1, e.xmm1);
@@ -761,6 +798,21 @@ struct SELECT_V128_V128
     }
 
     // src1 ? src2 : src3;
+    if (e.IsFeatureEnabled(kX64EmitAVX512Ortho)) {
+      // Bitwise select of src3 where src1 is set and src2 elsewhere, with the
+      // ternary logic immediate picked for whichever operand dest aliases.
+      if (i.dest == src1) {
+        e.vpternlogd(i.dest, src3, src2, 0xCA);
+      } else if (i.dest == src3) {
+        e.vpternlogd(i.dest, src1, src2, 0xE2);
+      } else if (i.dest == src2) {
+        e.vpternlogd(i.dest, src3, src1, 0xD8);
+      } else {
+        e.vmovdqa(i.dest, src1);
+        e.vpternlogd(i.dest, src3, src2, 0xCA);
+      }
+      return;
+    }
     e.vpandn(e.xmm3, src1, src2);
     e.vpand(i.dest, src1, src3);
     e.vpor(i.dest, i.dest, e.xmm3);
@@ -899,7 +951,9 @@ struct COMPARE_EQ_I8
         [](X64Emitter& e, const Reg8& src1, int32_t constant) {
           e.cmp(src1, constant);
         });
-    e.sete(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.sete(i.dest);
+    }
   }
 };
 struct COMPARE_EQ_I16
@@ -913,7 +967,9 @@ struct COMPARE_EQ_I16
         [](X64Emitter& e, const Reg16& src1, int32_t constant) {
           e.cmp(src1, constant);
         });
-    e.sete(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.sete(i.dest);
+    }
   }
 };
 struct COMPARE_EQ_I32
@@ -927,7 +983,9 @@ struct COMPARE_EQ_I32
         [](X64Emitter& e, const Reg32& src1, int32_t constant) {
           e.cmp(src1, constant);
         });
-    e.sete(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.sete(i.dest);
+    }
   }
 };
 struct COMPARE_EQ_I64
@@ -941,7 +999,9 @@ struct COMPARE_EQ_I64
         [](X64Emitter& e, const Reg64& src1, int32_t constant) {
           e.cmp(src1, constant);
         });
-    e.sete(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.sete(i.dest);
+    }
   }
 };
 struct COMPARE_EQ_F32
@@ -982,7 +1042,9 @@ struct COMPARE_NE_I8
         [](X64Emitter& e, const Reg8& src1, int32_t constant) {
           e.cmp(src1, constant);
         });
-    e.setne(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.setne(i.dest);
+    }
   }
 };
 struct COMPARE_NE_I16
@@ -996,7 +1058,9 @@ struct COMPARE_NE_I16
         [](X64Emitter& e, const Reg16& src1, int32_t constant) {
           e.cmp(src1, constant);
         });
-    e.setne(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.setne(i.dest);
+    }
   }
 };
 struct COMPARE_NE_I32
@@ -1010,7 +1074,9 @@ struct COMPARE_NE_I32
         [](X64Emitter& e, const Reg32& src1, int32_t constant) {
           e.cmp(src1, constant);
         });
-    e.setne(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.setne(i.dest);
+    }
   }
 };
 struct COMPARE_NE_I64
@@ -1024,7 +1090,9 @@ struct COMPARE_NE_I64
         [](X64Emitter& e, const Reg64& src1, int32_t constant) {
           e.cmp(src1, constant);
         });
-    e.setne(i.dest);
+    if (!IsFusedCompare(i.instr)) {
+      e.setne(i.dest);
+    }
   }
 };
 struct COMPARE_NE_F32
@@ -1054,20 +1122,27 @@ EMITTER_OPCODE_TABLE(OPCODE_COMPARE_NE, COMPARE_NE_I8, COMPARE_NE_I16,
       : Sequence<COMPARE_##op##_##type,                                 \
                  I<OPCODE_COMPARE_##op, I8Op, type, type>> {            \
     static void Emit(X64Emitter& e, const EmitArgType& i) {             \
+      bool fused = IsFusedCompare(i.instr);                             \
       EmitAssociativeCompareOp(                                         \
           e, i,                                                         \
-          [](X64Emitter& e, const Reg8& dest, const reg_type& src1,     \
-             const reg_type& src2, bool inverse) {                      \
+          [fused](X64Emitter& e, const Reg8& dest, const reg_type& src1, \
+                  const reg_type& src2, bool inverse) {                 \
             e.cmp(src1, src2);                                          \
+            if (fused) {                                                \
+              return;                                                   \
+            }                                                           \
             if (!inverse) {                                             \
               e.instr(dest);                                            \
             } else {                                                    \
               e.inverse_instr(dest);                                    \
             }                                                           \
           },                                                            \
-          [](X64Emitter& e, const Reg8& dest, const reg_type& src1,     \
-             int32_t constant, bool inverse) {                          \
+          [fused](X64Emitter& e, const Reg8& dest, const reg_type& src1, \
+                  int32_t constant, bool inverse) {                     \
             e.cmp(src1, constant);                                      \
+            if (fused) {                                                \
+              return;                                                   \
+            }                                                           \
             if (!inverse) {                                             \
               e.instr(dest);                                            \
             } else {                                                    \
@@ -2398,49 +2473,75 @@ EMITTER_OPCODE_TABLE(OPCODE_RECIP, RECIP_F32, RECIP_F64, RECIP_V128);
 // ============================================================================
 // OPCODE_POW2
 // ============================================================================
-// TODO(benvanik): use approx here:
-//     https://jrfonseca.blogspot.com/2008/09/fast-sse2-pow-tables-or-polynomials.html
-struct POW2_F32 : Sequence<POW2_F32, I<OPCODE_POW2, F32Op, F32Op>> {
-  static __m128 EmulatePow2(void*, __m128 src) {
-    float src_value;
-    _mm_store_ss(&src_value, src);
-    float result = std::exp2(src_value);
-    return _mm_load_ss(&result);
+// Computes dest = acc * mul + add, fused if the host can.
+static void EmitMulAddPS(X64Emitter& e, const Xmm& acc, const Xmm& mul,
+                         XmmConst add) {
+  if (e.IsFeatureEnabled(kX64EmitFMA)) {
+    e.vfmadd213ps(acc, mul, e.GetXmmConstPtr(add));
+  } else {
+    e.vmulps(acc, acc, mul);
+    e.vaddps(acc, acc, e.GetXmmConstPtr(add));
   }
+}
+// 2^x as 2^n * 2^f with n the nearest integer and 2^f a polynomial on
+// [-0.5, 0.5], within 1 ulp and exact for integers. Clobbers xmm0-xmm3.
+static void EmitExp2PS(X64Emitter& e, const Xmm& dest, const Xmm& src) {
+  // Clamp to where the result is 0 or infinity, keeping NaNs.
+  e.vmovaps(e.xmm0, e.GetXmmConstPtr(XMMExp2Min));
+  e.vmaxps(e.xmm0, e.xmm0, src);
+  e.vmovaps(e.xmm1, e.GetXmmConstPtr(XMMExp2Max));
+  e.vminps(e.xmm0, e.xmm1, e.xmm0);
+  e.vroundps(e.xmm1, e.xmm0, 0b00000000);
+  e.vsubps(e.xmm0, e.xmm0, e.xmm1);
+  e.vcvtps2dq(e.xmm1, e.xmm1);
+  e.vmovaps(e.xmm2, e.GetXmmConstPtr(XMMExp2C7));
+  EmitMulAddPS(e, e.xmm2, e.xmm0, XMMExp2C6);
+  EmitMulAddPS(e, e.xmm2, e.xmm0, XMMExp2C5);
+  EmitMulAddPS(e, e.xmm2, e.xmm0, XMMExp2C4);
+  EmitMulAddPS(e, e.xmm2, e.xmm0, XMMExp2C3);
+  EmitMulAddPS(e, e.xmm2, e.xmm0, XMMExp2C2);
+  EmitMulAddPS(e, e.xmm2, e.xmm0, XMMExp2C1);
+  EmitMulAddPS(e, e.xmm2, e.xmm0, XMMOne);
+  // 2^n doesn't fit in a float over the whole range, so scale in two halves.
+  e.vpsrad(e.xmm3, e.xmm1, 1);
+  e.vpsubd(e.xmm1, e.xmm1, e.xmm3);
+  e.vpaddd(e.xmm3, e.GetXmmConstPtr(XMMInt127));
+  e.vpslld(e.xmm3, e.xmm3, 23);
+  e.vmulps(e.xmm2, e.xmm2, e.xmm3);
+  e.vpaddd(e.xmm1, e.GetXmmConstPtr(XMMInt127));
+  e.vpslld(e.xmm1, e.xmm1, 23);
+  e.vmulps(dest, e.xmm2, e.xmm1);
+}
+struct POW2_F32 : Sequence<POW2_F32, I<OPCODE_POW2, F32Op, F32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    assert_always();
-    e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulatePow2));
-    e.vmovaps(i.dest, e.xmm0);
+    if (i.src1.is_constant) {
+      e.LoadConstantXmm(i.dest, i.src1.constant());
+      EmitExp2PS(e, i.dest, i.dest);
+    } else {
+      EmitExp2PS(e, i.dest, i.src1);
+    }
   }
 };
 struct POW2_F64 : Sequence<POW2_F64, I<OPCODE_POW2, F64Op, F64Op>> {
-  static __m128d EmulatePow2(void*, __m128d src) {
-    double src_value;
-    _mm_store_sd(&src_value, src);
-    double result = std::exp2(src_value);
-    return _mm_load_sd(&result);
-  }
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    assert_always();
-    e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulatePow2));
-    e.vmovaps(i.dest, e.xmm0);
+    if (i.src1.is_constant) {
+      e.LoadConstantXmm(i.dest, i.src1.constant());
+      e.vcvtsd2ss(i.dest, i.dest);
+    } else {
+      e.vcvtsd2ss(i.dest, i.src1);
+    }
+    EmitExp2PS(e, i.dest, i.dest);
+    e.vcvtss2sd(i.dest, i.dest);
   }
 };
 struct POW2_V128 : Sequence<POW2_V128, I<OPCODE_POW2, V128Op, V128Op>> {
-  static __m128 EmulatePow2(void*, __m128 src) {
-    alignas(16) float values[4];
-    _mm_store_ps(values, src);
-    for (size_t i = 0; i < 4; ++i) {
-      values[i] = std::exp2(values[i]);
-    }
-    return _mm_load_ps(values);
-  }
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulatePow2));
-    e.vmovaps(i.dest, e.xmm0);
+    if (i.src1.is_constant) {
+      e.LoadConstantXmm(i.dest, i.src1.constant());
+      EmitExp2PS(e, i.dest, i.dest);
+    } else {
+      EmitExp2PS(e, i.dest, i.src1);
+    }
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_POW2, POW2_F32, POW2_F64, POW2_V128);
@@ -2448,62 +2549,84 @@ EMITTER_OPCODE_TABLE(OPCODE_POW2, POW2_F32, POW2_F64, POW2_V128);
 // ============================================================================
 // OPCODE_LOG2
 // ============================================================================
-// TODO(benvanik): use approx here:
-//     https://jrfonseca.blogspot.com/2008/09/fast-sse2-pow-tables-or-polynomials.html
-// TODO(benvanik): this emulated fn destroys all xmm registers! don't do it!
+// log2(x) as e + log2(m) with m in [sqrt(2)/2, sqrt(2)], and log2(m) as a
+// series in t = (m - 1) / (m + 1), within 2 ulp and exact for powers of two.
+// Clobbers xmm0-xmm3.
+static void EmitLog2PS(X64Emitter& e, const Xmm& dest, const Xmm& src) {
+  // Normalize denormals first.
+  e.vcmpltps(e.xmm3, src, e.GetXmmConstPtr(XMMMinNormalPS));
+  e.vmulps(e.xmm1, src, e.GetXmmConstPtr(XMMFloat16DenormalScale));
+  e.vblendvps(e.xmm0, src, e.xmm1, e.xmm3);
+  e.vpand(e.xmm3, e.GetXmmConstPtr(XMMLog2DenormalBias));
+  // Split into the exponent and the mantissa in [1, 2), moving the upper
+  // half of the mantissa range down to [sqrt(2)/2, 1).
+  e.vpsrld(e.xmm1, e.xmm0, 23);
+  e.vpsubd(e.xmm1, e.GetXmmConstPtr(XMMInt127));
+  e.vpsubd(e.xmm1, e.xmm3);
+  e.vandps(e.xmm0, e.GetXmmConstPtr(XMMMantissaMaskPS));
+  e.vorps(e.xmm0, e.GetXmmConstPtr(XMMOne));
+  e.vmovaps(e.xmm2, e.GetXmmConstPtr(XMMSqrt2));
+  e.vcmpltps(e.xmm2, e.xmm2, e.xmm0);
+  e.vpsubd(e.xmm1, e.xmm2);
+  e.vpand(e.xmm2, e.GetXmmConstPtr(XMMMinNormalPS));
+  e.vpsubd(e.xmm0, e.xmm2);
+  e.vcvtdq2ps(e.xmm1, e.xmm1);
+  e.vaddps(e.xmm2, e.xmm0, e.GetXmmConstPtr(XMMOne));
+  e.vsubps(e.xmm0, e.xmm0, e.GetXmmConstPtr(XMMOne));
+  e.vdivps(e.xmm0, e.xmm0, e.xmm2);
+  e.vmulps(e.xmm2, e.xmm0, e.xmm0);
+  e.vmovaps(e.xmm3, e.GetXmmConstPtr(XMMLog2C9));
+  EmitMulAddPS(e, e.xmm3, e.xmm2, XMMLog2C7);
+  EmitMulAddPS(e, e.xmm3, e.xmm2, XMMLog2C5);
+  EmitMulAddPS(e, e.xmm3, e.xmm2, XMMLog2C3);
+  EmitMulAddPS(e, e.xmm3, e.xmm2, XMMLog2C1);
+  if (e.IsFeatureEnabled(kX64EmitFMA)) {
+    e.vfmadd213ps(e.xmm3, e.xmm0, e.xmm1);
+  } else {
+    e.vmulps(e.xmm3, e.xmm3, e.xmm0);
+    e.vaddps(e.xmm3, e.xmm3, e.xmm1);
+  }
+  // log2(+inf) = +inf, log2(+-0) = -inf, and log2 of anything negative is
+  // NaN, quieting NaN inputs.
+  e.vcmpeqps(e.xmm0, src, e.GetXmmConstPtr(XMMInfinityPS));
+  e.vblendvps(e.xmm3, e.xmm3, src, e.xmm0);
+  e.vxorps(e.xmm2, e.xmm2, e.xmm2);
+  e.vcmpeqps(e.xmm0, src, e.xmm2);
+  e.vblendvps(e.xmm3, e.xmm3, e.GetXmmConstPtr(XMMNegInfinityPS), e.xmm0);
+  e.vcmpngeps(e.xmm0, src, e.xmm2);
+  e.vaddps(e.xmm2, src, e.GetXmmConstPtr(XMMQNaN));
+  e.vblendvps(dest, e.xmm3, e.xmm2, e.xmm0);
+}
 struct LOG2_F32 : Sequence<LOG2_F32, I<OPCODE_LOG2, F32Op, F32Op>> {
-  static __m128 EmulateLog2(void*, __m128 src) {
-    float src_value;
-    _mm_store_ss(&src_value, src);
-    float result = std::log2(src_value);
-    return _mm_load_ss(&result);
-  }
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    assert_always();
     if (i.src1.is_constant) {
-      e.lea(e.GetNativeParam(0), e.StashConstantXmm(0, i.src1.constant()));
+      e.LoadConstantXmm(i.dest, i.src1.constant());
+      EmitLog2PS(e, i.dest, i.dest);
     } else {
-      e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
+      EmitLog2PS(e, i.dest, i.src1);
     }
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateLog2));
-    e.vmovaps(i.dest, e.xmm0);
   }
 };
 struct LOG2_F64 : Sequence<LOG2_F64, I<OPCODE_LOG2, F64Op, F64Op>> {
-  static __m128d EmulateLog2(void*, __m128d src) {
-    double src_value;
-    _mm_store_sd(&src_value, src);
-    double result = std::log2(src_value);
-    return _mm_load_sd(&result);
-  }
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    assert_always();
     if (i.src1.is_constant) {
-      e.lea(e.GetNativeParam(0), e.StashConstantXmm(0, i.src1.constant()));
+      e.LoadConstantXmm(i.dest, i.src1.constant());
+      e.vcvtsd2ss(i.dest, i.dest);
     } else {
-      e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
+      e.vcvtsd2ss(i.dest, i.src1);
     }
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateLog2));
-    e.vmovaps(i.dest, e.xmm0);
+    EmitLog2PS(e, i.dest, i.dest);
+    e.vcvtss2sd(i.dest, i.dest);
   }
 };
 struct LOG2_V128 : Sequence<LOG2_V128, I<OPCODE_LOG2, V128Op, V128Op>> {
-  static __m128 EmulateLog2(void*, __m128 src) {
-    alignas(16) float values[4];
-    _mm_store_ps(values, src);
-    for (size_t i = 0; i < 4; ++i) {
-      values[i] = std::log2(values[i]);
-    }
-    return _mm_load_ps(values);
-  }
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     if (i.src1.is_constant) {
-      e.lea(e.GetNativeParam(0), e.StashConstantXmm(0, i.src1.constant()));
+      e.LoadConstantXmm(i.dest, i.src1.constant());
+      EmitLog2PS(e, i.dest, i.dest);
     } else {
-      e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
+      EmitLog2PS(e, i.dest, i.src1);
     }
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateLog2));
-    e.vmovaps(i.dest, e.xmm0);
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_LOG2, LOG2_F32, LOG2_F64, LOG2_V128);
@@ -2748,6 +2871,11 @@ struct NOT_I64 : Sequence<NOT_I64, I<OPCODE_NOT, I64Op, I64Op>> {
 };
 struct NOT_V128 : Sequence<NOT_V128, I<OPCODE_NOT, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (e.IsFeatureEnabled(kX64EmitAVX512Ortho)) {
+      // Ternary logic on src1 alone, without loading a constant.
+      e.vpternlogd(i.dest, i.src1, i.src1, 0x55);
+      return;
+    }
     // dest = src ^ 0xFFFF...
     e.vpxor(i.dest, i.src1, e.GetXmmConstPtr(XMMFFFF /* FF... */));
   }
@@ -2800,30 +2928,65 @@ struct SHL_I64 : Sequence<SHL_I64, I<OPCODE_SHL, I64Op, I64Op, I8Op>> {
     EmitShlXX<SHL_I64, Reg64>(e, i);
   }
 };
-struct SHL_V128 : Sequence<SHL_V128, I<OPCODE_SHL, V128Op, V128Op, I8Op>> {
-  static void Emit(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): native version (with shift magic).
-    if (i.src2.is_constant) {
-      e.mov(e.GetNativeParam(1), i.src2.constant());
+// The whole vector as one big-endian 128-bit value, so the guest bytes
+// are in order within each dword and the dwords go from the most significant
+// one in lane 0 to the least significant one in lane 3.
+// Almost all instances are shamt = 1, but non-constant. shamt is [0,7].
+// Clobbers xmm0-xmm3 and eax.
+static void EmitShiftV128(X64Emitter& e, const Xmm& dest, const Xmm& src,
+                          const Reg8* shamt_reg, uint8_t shamt, bool left) {
+  if (!shamt_reg && !shamt) {
+    e.vmovaps(dest, src);
+    return;
+  }
+  // Each dword shifted, plus the bits carried over from its neighbor.
+  if (left) {
+    e.vpsrldq(e.xmm1, src, 4);
+  } else {
+    e.vpslldq(e.xmm1, src, 4);
+  }
+  if (shamt_reg) {
+    e.movzx(e.eax, *shamt_reg);
+    e.and_(e.eax, 0x7);
+    e.vmovd(e.xmm2, e.eax);
+    e.neg(e.eax);
+    e.add(e.eax, 32);
+    e.vmovd(e.xmm3, e.eax);
+    if (left) {
+      e.vpslld(e.xmm0, src, e.xmm2);
+      e.vpsrld(e.xmm1, e.xmm1, e.xmm3);
     } else {
-      e.mov(e.GetNativeParam(1), i.src2);
+      e.vpsrld(e.xmm0, src, e.xmm2);
+      e.vpslld(e.xmm1, e.xmm1, e.xmm3);
     }
-    e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateShlV128));
-    e.vmovaps(i.dest, e.xmm0);
-  }
-  static __m128i EmulateShlV128(void*, __m128i src1, uint8_t src2) {
-    // Almost all instances are shamt = 1, but non-constant.
-    // shamt is [0,7]
-    uint8_t shamt = src2 & 0x7;
-    alignas(16) vec128_t value;
-    _mm_store_si128(reinterpret_cast<__m128i*>(&value), src1);
-    for (int i = 0; i < 15; ++i) {
-      value.u8[i ^ 0x3] = (value.u8[i ^ 0x3] << shamt) |
-                          (value.u8[(i + 1) ^ 0x3] >> (8 - shamt));
+  } else {
+    if (left) {
+      e.vpslld(e.xmm0, src, shamt);
+      e.vpsrld(e.xmm1, e.xmm1, 32 - shamt);
+    } else {
+      e.vpsrld(e.xmm0, src, shamt);
+      e.vpslld(e.xmm1, e.xmm1, 32 - shamt);
     }
-    value.u8[15 ^ 0x3] = value.u8[15 ^ 0x3] << shamt;
-    return _mm_load_si128(reinterpret_cast<__m128i*>(&value));
+  }
+  e.vpor(dest, e.xmm0, e.xmm1);
+}
+template <typename ARGS>
+static void EmitShiftV128(X64Emitter& e, const ARGS& i, bool left) {
+  Xmm src = i.src1;
+  if (i.src1.is_constant) {
+    src = e.xmm0;
+    e.LoadConstantXmm(src, i.src1.constant());
+  }
+  if (i.src2.is_constant) {
+    EmitShiftV128(e, i.dest, src, nullptr, i.src2.constant() & 0x7, left);
+  } else {
+    Reg8 shamt = i.src2;
+    EmitShiftV128(e, i.dest, src, &shamt, 0, left);
+  }
+}
+struct SHL_V128 : Sequence<SHL_V128, I<OPCODE_SHL, V128Op, V128Op, I8Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    EmitShiftV128(e, i, true);
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_SHL, SHL_I8, SHL_I16, SHL_I32, SHL_I64, SHL_V128);
@@ -2879,28 +3042,7 @@ struct SHR_I64 : Sequence<SHR_I64, I<OPCODE_SHR, I64Op, I64Op, I8Op>> {
 };
 struct SHR_V128 : Sequence<SHR_V128, I<OPCODE_SHR, V128Op, V128Op, I8Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): native version (with shift magic).
-    if (i.src2.is_constant) {
-      e.mov(e.GetNativeParam(1), i.src2.constant());
-    } else {
-      e.mov(e.GetNativeParam(1), i.src2);
-    }
-    e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateShrV128));
-    e.vmovaps(i.dest, e.xmm0);
-  }
-  static __m128i EmulateShrV128(void*, __m128i src1, uint8_t src2) {
-    // Almost all instances are shamt = 1, but non-constant.
-    // shamt is [0,7]
-    uint8_t shamt = src2 & 0x7;
-    alignas(16) vec128_t value;
-    _mm_store_si128(reinterpret_cast<__m128i*>(&value), src1);
-    for (int i = 15; i > 0; --i) {
-      value.u8[i ^ 0x3] = (value.u8[i ^ 0x3] >> shamt) |
-                          (value.u8[(i - 1) ^ 0x3] << (8 - shamt));
-    }
-    value.u8[0 ^ 0x3] = value.u8[0 ^ 0x3] >> shamt;
-    return _mm_load_si128(reinterpret_cast<__m128i*>(&value));
+    EmitShiftV128(e, i, false);
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_SHR, SHR_I8, SHR_I16, SHR_I32, SHR_I64, SHR_V128);
@@ -3150,7 +3292,7 @@ struct SET_ROUNDING_MODE_I32
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     e.mov(e.rcx, i.src1);
     e.and_(e.rcx, 0x7);
-    e.mov(e.rax, uintptr_t(mxcsr_table));
+    e.MovHostImageAddress(e.rax, mxcsr_table);
     e.vldmxcsr(e.ptr[e.rax + e.rcx * 4]);
   }
 };
@@ -3166,6 +3308,33 @@ static int anchor_memory_dest = anchor_memory;
 extern volatile int anchor_vector;
 static int anchor_vector_dest = anchor_vector;
 
+bool IsFusedCompare(const Instr* compare) {
+  auto opcode = compare->opcode;
+  if (opcode != &OPCODE_COMPARE_EQ_info && opcode != &OPCODE_COMPARE_NE_info &&
+      opcode != &OPCODE_COMPARE_SLT_info &&
+      opcode != &OPCODE_COMPARE_SLE_info &&
+      opcode != &OPCODE_COMPARE_SGT_info &&
+      opcode != &OPCODE_COMPARE_SGE_info &&
+      opcode != &OPCODE_COMPARE_ULT_info &&
+      opcode != &OPCODE_COMPARE_ULE_info &&
+      opcode != &OPCODE_COMPARE_UGT_info &&
+      opcode != &OPCODE_COMPARE_UGE_info) {
+    return false;
+  }
+  if (compare->src1.value->type > INT64_TYPE) {
+    // comiss/comisd set the flags differently.
+    return false;
+  }
+  auto branch = compare->next;
+  if (!branch || (branch->opcode != &OPCODE_BRANCH_TRUE_info &&
+                  branch->opcode != &OPCODE_BRANCH_FALSE_info)) {
+    return false;
+  }
+  auto dest = compare->dest;
+  return branch->src1.value == dest && dest->use_head &&
+         !dest->use_head->next;
+}
+
 bool SelectSequence(X64Emitter* e, const Instr* i, const Instr** new_tail) {
   const InstrKey key(i);
   auto it = sequence_table.find(key);
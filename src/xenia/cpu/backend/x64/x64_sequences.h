@@ -43,6 +43,11 @@ static bool Register() {
 bool SelectSequence(X64Emitter* e, const hir::Instr* i,
                     const hir::Instr** new_tail);
 
+// Whether an integer compare is directly followed by a conditional branch on
+// its result, which is its only use. The compare then only sets the flags,
+// and the branch jumps on them instead of testing the result.
+bool IsFusedCompare(const hir::Instr* compare);
+
 }  // namespace x64
 }  // namespace backend
 }  // namespace cpu
@@ -0,0 +1,195 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/branch_profile.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/cpu/hir/hir_builder.h"
+
+namespace xe {
+namespace cpu {
+
+using namespace xe::cpu::hir;
+
+namespace {
+
+// 'XEBP'.
+constexpr uint32_t kBranchProfileMagic = 0x50424558;
+constexpr uint32_t kBranchProfileVersion = 1;
+
+struct BranchProfileFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t function_count;
+  uint32_t padding;
+};
+
+struct BranchProfileFunctionHeader {
+  uint32_t guest_address;
+  uint32_t branch_count;
+};
+
+struct BranchProfileEntry {
+  uint64_t key;
+  BranchProfile::Counts counts;
+};
+
+}  // namespace
+
+void BranchProfile::ForEachBranch(
+    HIRBuilder* builder,
+    std::function<void(Instr* branch, uint64_t key)> callback) {
+  uint32_t guest_address = 0;
+  uint32_t index = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &OPCODE_SOURCE_OFFSET_info) {
+        guest_address = uint32_t(i->src1.offset);
+        index = 0;
+      } else if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+                 i->opcode == &OPCODE_BRANCH_FALSE_info) {
+        callback(i, MakeKey(guest_address, index++));
+      }
+    }
+  }
+}
+
+void BranchProfile::Reset(std::vector<uint64_t> keys) {
+  if (counts_) {
+    return;
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  keys_ = std::move(keys);
+  counts_.reset(new Counts[keys_.size()]);
+  std::memset(counts_.get(), 0, sizeof(Counts) * keys_.size());
+}
+
+void BranchProfile::Load(std::vector<uint64_t> keys,
+                         std::vector<Counts> counts) {
+  assert_true(keys.size() == counts.size());
+  assert_true(std::is_sorted(keys.begin(), keys.end()));
+  keys_ = std::move(keys);
+  counts_.reset(new Counts[keys_.size()]);
+  std::memcpy(counts_.get(), counts.data(), sizeof(Counts) * keys_.size());
+}
+
+bool BranchProfile::has_counts() const {
+  for (size_t i = 0; i < keys_.size(); ++i) {
+    if (counts_[i].reached) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool BranchProfile::ReadFile(
+    const std::filesystem::path& path,
+    std::unordered_map<uint32_t, BranchProfile>* profiles) {
+  auto file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    return false;
+  }
+  BranchProfileFileHeader header;
+  bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+               header.magic == kBranchProfileMagic &&
+               header.version == kBranchProfileVersion;
+  for (uint32_t i = 0; valid && i < header.function_count; ++i) {
+    BranchProfileFunctionHeader function_header;
+    if (fread(&function_header, sizeof(function_header), 1, file) != 1) {
+      valid = false;
+      break;
+    }
+    std::vector<BranchProfileEntry> entries(function_header.branch_count);
+    if (fread(entries.data(), sizeof(BranchProfileEntry), entries.size(),
+              file) != entries.size()) {
+      valid = false;
+      break;
+    }
+    std::vector<uint64_t> keys;
+    std::vector<Counts> counts;
+    keys.reserve(entries.size());
+    counts.reserve(entries.size());
+    for (auto& entry : entries) {
+      if (!keys.empty() && entry.key <= keys.back()) {
+        valid = false;
+        break;
+      }
+      keys.push_back(entry.key);
+      counts.push_back(entry.counts);
+    }
+    if (valid) {
+      (*profiles)[function_header.guest_address].Load(std::move(keys),
+                                                      std::move(counts));
+    }
+  }
+  fclose(file);
+  if (!valid) {
+    XELOGW("Ignoring invalid branch profile {}", xe::path_to_utf8(path));
+    profiles->clear();
+    return false;
+  }
+  XELOGI("Loaded branch profiles of {} functions from {}", profiles->size(),
+         xe::path_to_utf8(path));
+  return true;
+}
+
+bool BranchProfile::WriteFile(
+    const std::filesystem::path& path,
+    const std::map<uint32_t, const BranchProfile*>& profiles) {
+  auto file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGE("Unable to open {} for writing branch profiles",
+           xe::path_to_utf8(path));
+    return false;
+  }
+  BranchProfileFileHeader header = {};
+  header.magic = kBranchProfileMagic;
+  header.version = kBranchProfileVersion;
+  header.function_count = uint32_t(profiles.size());
+  fwrite(&header, sizeof(header), 1, file);
+  std::vector<BranchProfileEntry> entries;
+  for (auto& it : profiles) {
+    auto profile = it.second;
+    BranchProfileFunctionHeader function_header;
+    function_header.guest_address = it.first;
+    function_header.branch_count = uint32_t(profile->count());
+    fwrite(&function_header, sizeof(function_header), 1, file);
+    entries.resize(profile->count());
+    for (size_t i = 0; i < profile->count(); ++i) {
+      entries[i].key = profile->key(i);
+      entries[i].counts = profile->counts(i);
+    }
+    fwrite(entries.data(), sizeof(BranchProfileEntry), entries.size(), file);
+  }
+  fclose(file);
+  XELOGI("Saved branch profiles of {} functions to {}", profiles.size(),
+         xe::path_to_utf8(path));
+  return true;
+}
+
+BranchProfile::Counts* BranchProfile::Lookup(uint64_t key) {
+  auto it = std::lower_bound(keys_.begin(), keys_.end(), key);
+  if (it == keys_.end() || *it != key) {
+    return nullptr;
+  }
+  return &counts_[it - keys_.begin()];
+}
+
+const BranchProfile::Counts* BranchProfile::Lookup(uint64_t key) const {
+  return const_cast<BranchProfile*>(this)->Lookup(key);
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,98 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_BRANCH_PROFILE_H_
+#define XENIA_CPU_BRANCH_PROFILE_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace xe {
+namespace cpu {
+namespace hir {
+class HIRBuilder;
+class Instr;
+}  // namespace hir
+
+// Execution counts of the conditional branches of a guest function, gathered
+// by its baseline code (or loaded from a profile saved by an earlier run) and
+// used to lay out the blocks of its optimized code.
+//
+// Branches are identified by the guest instruction they were translated from
+// and their index among the conditional branches of that instruction, which
+// is the same in the HIR of both tiers as long as the passes only differ in
+// what they remove.
+class BranchProfile {
+ public:
+  struct Counts {
+    // Executions of the block ending in the branch.
+    uint32_t reached;
+    // Of those, executions that didn't take the branch.
+    uint32_t not_taken;
+
+    uint32_t taken() const {
+      return reached > not_taken ? reached - not_taken : 0;
+    }
+  };
+
+  static uint64_t MakeKey(uint32_t guest_address, uint32_t index) {
+    return (uint64_t(guest_address) << 32) | index;
+  }
+  static uint32_t GetKeyGuestAddress(uint64_t key) {
+    return uint32_t(key >> 32);
+  }
+
+  // Calls the callback with the key of every conditional branch (BRANCH_TRUE
+  // or BRANCH_FALSE) of the HIR, in block order.
+  static void ForEachBranch(
+      hir::HIRBuilder* builder,
+      std::function<void(hir::Instr* branch, uint64_t key)> callback);
+
+  // Profiles of many functions saved by an earlier run, by the guest address
+  // of the function. Loading fails without a message if there's no file.
+  static bool ReadFile(const std::filesystem::path& path,
+                       std::unordered_map<uint32_t, BranchProfile>* profiles);
+  static bool WriteFile(
+      const std::filesystem::path& path,
+      const std::map<uint32_t, const BranchProfile*>& profiles);
+
+  // Creates zeroed counts for the given branches, for instrumented code to
+  // increment. Existing counts are kept, as code may still be incrementing
+  // them.
+  void Reset(std::vector<uint64_t> keys);
+  // Replaces the profile with counts loaded from a file. Only for profiles
+  // that no code increments.
+  void Load(std::vector<uint64_t> keys, std::vector<Counts> counts);
+
+  size_t count() const { return keys_.size(); }
+  uint64_t key(size_t index) const { return keys_[index]; }
+  const Counts& counts(size_t index) const { return counts_[index]; }
+  // Whether any of the branches have been reached at all.
+  bool has_counts() const;
+
+  // Returns nullptr if the branch isn't in the profile.
+  Counts* Lookup(uint64_t key);
+  const Counts* Lookup(uint64_t key) const;
+
+ private:
+  // Sorted.
+  std::vector<uint64_t> keys_;
+  // Never reallocated while code may be incrementing it.
+  std::unique_ptr<Counts[]> counts_;
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_BRANCH_PROFILE_H_
@@ -9,13 +9,32 @@
 
 #include "xenia/cpu/compiler/compiler.h"
 
+#include <chrono>
+#include <string>
+
 #include "xenia/base/profiling.h"
 #include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/compiler/pass_statistics.h"
+#include "xenia/cpu/compiler/passes/conditional_group_subpass.h"
 
 namespace xe {
 namespace cpu {
 namespace compiler {
 
+namespace {
+
+int64_t CountInstrs(hir::HIRBuilder* builder) {
+  int64_t count = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+}  // namespace
+
 Compiler::Compiler(Processor* processor) : processor_(processor) {}
 
 Compiler::~Compiler() { Reset(); }
@@ -28,12 +47,11 @@ void Compiler::AddPass(std::unique_ptr<CompilerPass> pass) {
 void Compiler::Reset() {}
 
 bool Compiler::Compile(xe::cpu::hir::HIRBuilder* builder) {
-  // TODO(benvanik): sophisticated stuff. Run passes in parallel, run until they
-  //                 stop changing things, etc.
+  // Passes that need to run until they stop changing things are grouped in
+  // ConditionalGroupPasses, which iterate them to a fixpoint.
   for (size_t i = 0; i < passes_.size(); ++i) {
-    auto& pass = passes_[i];
-    scratch_arena_.Reset();
-    if (!pass->Run(builder)) {
+    bool changed;
+    if (!RunPass(passes_[i].get(), builder, nullptr, &changed)) {
       return false;
     }
   }
@@ -41,6 +59,42 @@ bool Compiler::Compile(xe::cpu::hir::HIRBuilder* builder) {
   return true;
 }
 
+bool Compiler::RunPass(CompilerPass* pass, hir::HIRBuilder* builder,
+                       const char* group_name, bool* out_changed) {
+  scratch_arena_.Reset();
+
+  int64_t instr_count = 0;
+  std::chrono::steady_clock::time_point start_time;
+  if (statistics_) {
+    instr_count = CountInstrs(builder);
+    start_time = std::chrono::steady_clock::now();
+  }
+
+  bool changed = true;
+  bool succeeded;
+  auto subpass = dynamic_cast<passes::ConditionalGroupSubpass*>(pass);
+  if (subpass) {
+    succeeded = subpass->Run(builder, changed);
+  } else {
+    succeeded = pass->Run(builder);
+  }
+  *out_changed = changed;
+  if (!succeeded) {
+    return false;
+  }
+
+  if (statistics_) {
+    auto time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_time);
+    std::string name =
+        group_name ? std::string(group_name) + "/" + pass->name()
+                   : std::string(pass->name());
+    statistics_->Record(name, uint64_t(time_ns.count()),
+                        CountInstrs(builder) - instr_count, changed);
+  }
+  return true;
+}
+
 }  // namespace compiler
 }  // namespace cpu
 }  // namespace xe
@@ -27,6 +27,7 @@ namespace cpu {
 namespace compiler {
 
 class CompilerPass;
+class PassStatistics;
 
 class Compiler {
  public:
@@ -36,15 +37,26 @@ class Compiler {
   Processor* processor() const { return processor_; }
   Arena* scratch_arena() { return &scratch_arena_; }
 
+  // Where pass timings are recorded, or null to skip measuring them.
+  PassStatistics* statistics() const { return statistics_; }
+  void set_statistics(PassStatistics* statistics) { statistics_ = statistics; }
+
   void AddPass(std::unique_ptr<CompilerPass> pass);
 
   void Reset();
 
   bool Compile(hir::HIRBuilder* builder);
 
+  // Runs a single pass, recording it under its name (prefixed with the
+  // group's, if any). out_changed receives whether the pass changed the HIR;
+  // passes that can't tell are assumed to have.
+  bool RunPass(CompilerPass* pass, hir::HIRBuilder* builder,
+               const char* group_name, bool* out_changed);
+
  private:
   Processor* processor_;
   Arena scratch_arena_;
+  PassStatistics* statistics_ = nullptr;
 
   std::vector<std::unique_ptr<CompilerPass>> passes_;
 };
@@ -0,0 +1,135 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/pass_statistics.h"
+
+#include <algorithm>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+
+namespace {
+
+size_t TimeBucket(uint64_t time_ns) {
+  uint64_t time_us = time_ns / 1000;
+  if (!time_us) {
+    return 0;
+  }
+  size_t bucket = 64 - xe::lzcnt(time_us);
+  return std::min(bucket, PassStatistics::kTimeBucketCount - 1);
+}
+
+size_t DeltaBucket(int64_t delta) {
+  uint64_t magnitude = uint64_t(delta < 0 ? -delta : delta);
+  size_t distance = magnitude >= 64 ? 4 : magnitude >= 16 ? 3
+                                      : magnitude >= 4    ? 2
+                                      : magnitude >= 1    ? 1
+                                                          : 0;
+  return delta < 0 ? 4 - distance : 4 + distance;
+}
+
+}  // namespace
+
+void PassStatistics::Record(const std::string& pass_name, uint64_t time_ns,
+                            int64_t instr_delta, bool changed) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& entry = entries_[pass_name];
+  ++entry.runs;
+  if (changed) {
+    ++entry.changed_runs;
+  }
+  entry.total_time_ns += time_ns;
+  entry.max_time_ns = std::max(entry.max_time_ns, time_ns);
+  if (instr_delta < 0) {
+    entry.instrs_removed += uint64_t(-instr_delta);
+  } else {
+    entry.instrs_added += uint64_t(instr_delta);
+  }
+  ++entry.time_histogram[TimeBucket(time_ns)];
+  ++entry.delta_histogram[DeltaBucket(instr_delta)];
+}
+
+void PassStatistics::RecordIterations(const std::string& group_name,
+                                      uint32_t iterations, bool converged) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& group = groups_[group_name];
+  ++group.runs;
+  group.total_iterations += iterations;
+  group.max_iterations = std::max(group.max_iterations, iterations);
+  if (!converged) {
+    ++group.unconverged_runs;
+  }
+}
+
+void PassStatistics::AddCount(const std::string& counter_name,
+                              uint64_t count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  counters_[counter_name] += count;
+}
+
+void PassStatistics::Dump(const std::string& title) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (entries_.empty()) {
+    return;
+  }
+  XELOGI("Compiler pass statistics for {}:", title);
+  XELOGI("  {:<44} {:>9} {:>9} {:>10} {:>8} {:>8} {:>10} {:>10}", "pass",
+         "runs", "changed", "total ms", "avg us", "max us", "removed",
+         "added");
+  for (auto& it : entries_) {
+    auto& entry = it.second;
+    XELOGI("  {:<44} {:>9} {:>9} {:>10.2f} {:>8.2f} {:>8} {:>10} {:>10}",
+           it.first, entry.runs, entry.changed_runs,
+           entry.total_time_ns / 1000000.0,
+           entry.total_time_ns / 1000.0 / entry.runs,
+           entry.max_time_ns / 1000, entry.instrs_removed, entry.instrs_added);
+  }
+
+  XELOGI("  Run time histogram (us): <1 <2 <4 ... <1024 >=1024");
+  for (auto& it : entries_) {
+    std::string line;
+    for (uint64_t count : it.second.time_histogram) {
+      line += fmt::format(" {:>7}", count);
+    }
+    XELOGI("  {:<44}{}", it.first, line);
+  }
+
+  XELOGI(
+      "  Instruction delta histogram: <=-64 <=-16 <=-4 <0 0 >0 >=4 >=16 "
+      ">=64");
+  for (auto& it : entries_) {
+    std::string line;
+    for (uint64_t count : it.second.delta_histogram) {
+      line += fmt::format(" {:>7}", count);
+    }
+    XELOGI("  {:<44}{}", it.first, line);
+  }
+
+  for (auto& it : groups_) {
+    auto& group = it.second;
+    XELOGI(
+        "  {}: {} runs, {:.2f} iterations on average, at most {}, {} stopped "
+        "by the iteration limit",
+        it.first, group.runs, double(group.total_iterations) / group.runs,
+        group.max_iterations, group.unconverged_runs);
+  }
+
+  for (auto& it : counters_) {
+    XELOGI("  {}: {}", it.first, it.second);
+  }
+}
+
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,78 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASS_STATISTICS_H_
+#define XENIA_CPU_COMPILER_PASS_STATISTICS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+
+// Accumulates the cost and effect of every compiler pass run, so that passes
+// that take more JIT time than the code they improve is worth can be found.
+// Shared by all translators compiling functions of a module.
+class PassStatistics {
+ public:
+  // Run times in microseconds: [0, 1), [1, 2), [2, 4), ... and the rest.
+  static constexpr size_t kTimeBucketCount = 12;
+  // Instruction count deltas: <= -64, -63..-16, -15..-4, -3..-1, 0, 1..3,
+  // 4..15, 16..63, >= 64.
+  static constexpr size_t kDeltaBucketCount = 9;
+
+  struct Entry {
+    uint64_t runs = 0;
+    // Runs the pass reported as having changed the HIR. Only passes taking
+    // part in fixpoint iteration report this; others always count.
+    uint64_t changed_runs = 0;
+    uint64_t total_time_ns = 0;
+    uint64_t max_time_ns = 0;
+    uint64_t instrs_removed = 0;
+    uint64_t instrs_added = 0;
+    uint64_t time_histogram[kTimeBucketCount] = {};
+    uint64_t delta_histogram[kDeltaBucketCount] = {};
+  };
+
+  void Record(const std::string& pass_name, uint64_t time_ns,
+              int64_t instr_delta, bool changed);
+  // Records how many iterations a fixpoint group needed to settle.
+  void RecordIterations(const std::string& group_name, uint32_t iterations,
+                        bool converged);
+  // Adds to a named count of something passes did, such as stores removed.
+  void AddCount(const std::string& counter_name, uint64_t count);
+
+  // Logs everything recorded so far.
+  void Dump(const std::string& title);
+
+ private:
+  struct GroupEntry {
+    uint64_t runs = 0;
+    uint64_t total_iterations = 0;
+    uint32_t max_iterations = 0;
+    // Runs that hit the iteration limit while passes still made changes.
+    uint64_t unconverged_runs = 0;
+  };
+
+  std::mutex mutex_;
+  // Ordered so dumps come out sorted by name.
+  std::map<std::string, Entry> entries_;
+  std::map<std::string, GroupEntry> groups_;
+  std::map<std::string, uint64_t> counters_;
+};
+
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASS_STATISTICS_H_
@@ -0,0 +1,283 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/block_layout_pass.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/compiler.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+
+BlockLayoutPass::BlockLayoutPass() : CompilerPass() {}
+
+BlockLayoutPass::~BlockLayoutPass() {}
+
+bool BlockLayoutPass::Run(HIRBuilder* builder) {
+  stats_ = {};
+  if (!profile_ || !profile_->has_counts()) {
+    return true;
+  }
+
+  // Gather the blocks and their branches. Ordinals are reassigned by
+  // finalization, so they're free to index blocks_ until then.
+  blocks_.clear();
+  for (auto block = builder->first_block(); block; block = block->next) {
+    if (blocks_.size() >= UINT16_MAX) {
+      return true;
+    }
+    auto tail = block->instr_tail;
+    if (!tail || !builder->IsUnconditionalJump(tail)) {
+      // Falls through into the next block. Leave everything as it is.
+      return true;
+    }
+    BlockInfo info = {};
+    info.block = block;
+    if (tail->opcode == &OPCODE_BRANCH_info) {
+      info.jump = tail;
+      auto prev = tail->prev;
+      if (prev && (prev->opcode == &OPCODE_BRANCH_TRUE_info ||
+                   prev->opcode == &OPCODE_BRANCH_FALSE_info)) {
+        info.branch = prev;
+      }
+    }
+    block->ordinal = uint16_t(blocks_.size());
+    block->flags &= ~(Block::COLD | Block::LOOP_HEAD);
+    blocks_.push_back(info);
+  }
+  stats_.blocks = uint32_t(blocks_.size());
+  BranchProfile::ForEachBranch(builder, [this](Instr* branch, uint64_t key) {
+    auto& info = blocks_[branch->block->ordinal];
+    if (info.branch == branch) {
+      info.counts = profile_->Lookup(key);
+      if (info.counts) {
+        ++stats_.profiled_branches;
+      }
+    }
+  });
+  RecordFallthroughStats(false);
+
+  MarkColdBlocks();
+
+  // Chain each block with its most frequent successor not placed yet,
+  // starting new chains from the earliest hot block left. The entry block
+  // must stay first.
+  std::vector<Block*> order;
+  order.reserve(blocks_.size());
+  size_t next_seed = 0;
+  size_t current = 0;
+  while (true) {
+    auto& info = blocks_[current];
+    info.placed = true;
+    order.push_back(info.block);
+
+    Block* successors[2];
+    uint64_t edge_counts[2];
+    size_t successor_count = GetSuccessors(info, successors, edge_counts);
+    size_t next = blocks_.size();
+    for (size_t i = 0; i < successor_count; ++i) {
+      auto& successor = blocks_[successors[i]->ordinal];
+      if (!successor.placed && !successor.cold) {
+        next = successors[i]->ordinal;
+        break;
+      }
+    }
+    if (next == blocks_.size()) {
+      while (next_seed < blocks_.size() &&
+             (blocks_[next_seed].placed || blocks_[next_seed].cold)) {
+        ++next_seed;
+      }
+      if (next_seed == blocks_.size()) {
+        break;
+      }
+      next = next_seed;
+    }
+    current = next;
+  }
+  size_t hot_count = order.size();
+  for (auto& info : blocks_) {
+    if (info.cold) {
+      info.block->flags |= Block::COLD;
+      order.push_back(info.block);
+      ++stats_.cold_blocks;
+    }
+  }
+  for (auto block : order) {
+    builder->MoveBlockToEnd(block);
+  }
+
+  // Invert the conditional branches whose target now comes next, so that
+  // finalization removes the unconditional branch after them instead.
+  for (auto& info : blocks_) {
+    if (!info.branch) {
+      continue;
+    }
+    auto next = info.block->next;
+    auto target_label = info.branch->src2.label;
+    auto jump_label = info.jump->src1.label;
+    if (!next || target_label->block != next || jump_label->block == next) {
+      continue;
+    }
+    info.branch->opcode = info.branch->opcode == &OPCODE_BRANCH_TRUE_info
+                              ? &OPCODE_BRANCH_FALSE_info
+                              : &OPCODE_BRANCH_TRUE_info;
+    info.branch->src2.label = jump_label;
+    info.jump->src1.label = target_label;
+    info.inverted = true;
+  }
+
+  // Hot blocks targeted from themselves or a later hot block start loops.
+  std::vector<size_t> positions(blocks_.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    positions[order[i]->ordinal] = i;
+  }
+  for (size_t i = 0; i < hot_count; ++i) {
+    auto& info = blocks_[order[i]->ordinal];
+    Block* successors[2];
+    uint64_t edge_counts[2];
+    size_t successor_count = GetSuccessors(info, successors, edge_counts);
+    for (size_t j = 0; j < successor_count; ++j) {
+      auto successor = successors[j];
+      if (positions[successor->ordinal] <= i && edge_counts[j] &&
+          !(successor->flags & (Block::COLD | Block::LOOP_HEAD))) {
+        successor->flags |= Block::LOOP_HEAD;
+        ++stats_.loop_heads;
+      }
+    }
+  }
+
+  RecordFallthroughStats(true);
+  return true;
+}
+
+size_t BlockLayoutPass::GetSuccessors(const BlockInfo& info,
+                                      Block* successors[2],
+                                      uint64_t edge_counts[2]) const {
+  if (!info.jump) {
+    return 0;
+  }
+  auto jump_target = info.jump->src1.label->block;
+  if (!info.branch) {
+    successors[0] = jump_target;
+    edge_counts[0] = kUnknownCount;
+    return 1;
+  }
+  auto branch_target = info.branch->src2.label->block;
+  uint64_t jump_count = kUnknownCount;
+  uint64_t branch_count = kUnknownCount;
+  if (info.counts) {
+    // The counts are of the original branch, which may have been inverted
+    // since.
+    jump_count = info.counts->not_taken;
+    branch_count = info.counts->taken();
+    if (info.inverted) {
+      std::swap(jump_count, branch_count);
+    }
+  }
+  // Prefer the unconditional branch target, originally the next block, when
+  // the branch is as frequent or not profiled.
+  if (info.counts && branch_count > jump_count) {
+    successors[0] = branch_target;
+    edge_counts[0] = branch_count;
+    successors[1] = jump_target;
+    edge_counts[1] = jump_count;
+  } else {
+    successors[0] = jump_target;
+    edge_counts[0] = jump_count;
+    successors[1] = branch_target;
+    edge_counts[1] = branch_count;
+  }
+  return 2;
+}
+
+void BlockLayoutPass::MarkColdBlocks() {
+  // Everything reachable from the entry through edges that aren't known to
+  // be unused is hot, except blocks ending in a branch never reached.
+  for (auto& info : blocks_) {
+    info.cold = true;
+  }
+  std::vector<size_t> worklist;
+  blocks_[0].cold = false;
+  worklist.push_back(0);
+  while (!worklist.empty()) {
+    auto& info = blocks_[worklist.back()];
+    worklist.pop_back();
+    Block* successors[2];
+    uint64_t edge_counts[2];
+    size_t successor_count = GetSuccessors(info, successors, edge_counts);
+    for (size_t i = 0; i < successor_count; ++i) {
+      auto& successor = blocks_[successors[i]->ordinal];
+      if (successor.cold && edge_counts[i]) {
+        successor.cold = false;
+        worklist.push_back(successors[i]->ordinal);
+      }
+    }
+  }
+  for (size_t i = 1; i < blocks_.size(); ++i) {
+    if (blocks_[i].counts && !blocks_[i].counts->reached) {
+      blocks_[i].cold = true;
+    }
+  }
+}
+
+void BlockLayoutPass::RecordFallthroughStats(bool after) {
+  uint32_t hot_fallthroughs = 0;
+  uint64_t jumps = 0;
+  for (auto& info : blocks_) {
+    if (!info.counts) {
+      continue;
+    }
+    Block* successors[2];
+    uint64_t edge_counts[2];
+    GetSuccessors(info, successors, edge_counts);
+    // Cold blocks are emitted after the epilog, so the last hot block falls
+    // through into neither.
+    auto next = info.block->next;
+    if (next && (next->flags ^ info.block->flags) & Block::COLD) {
+      next = nullptr;
+    }
+    if (successors[0] == next) {
+      ++hot_fallthroughs;
+    }
+    uint64_t fallthrough_count = 0;
+    for (size_t i = 0; i < 2; ++i) {
+      if (successors[i] == next) {
+        fallthrough_count = edge_counts[i];
+        break;
+      }
+    }
+    // The counters aren't updated atomically, so they may be off a bit.
+    jumps += info.counts->reached -
+             std::min(fallthrough_count, uint64_t(info.counts->reached));
+  }
+  if (after) {
+    stats_.hot_fallthroughs_after = hot_fallthroughs;
+    stats_.jumps_after = jumps;
+  } else {
+    stats_.hot_fallthroughs_before = hot_fallthroughs;
+    stats_.jumps_before = jumps;
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,96 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_BLOCK_LAYOUT_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_BLOCK_LAYOUT_PASS_H_
+
+#include <vector>
+
+#include "xenia/cpu/branch_profile.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Orders the blocks by the branch profile of the function so that the more
+// frequent successor of each block falls through, inverting conditional
+// branches where needed. Blocks never reached in the profile are flagged cold
+// and moved to the end for the backend to emit them out of the way, and the
+// targets of hot back edges are flagged as loop heads.
+//
+// Must run after register allocation, which depends on the order of the
+// blocks, and before finalization, which removes the branches to the next
+// block that this relies upon.
+class BlockLayoutPass : public CompilerPass {
+ public:
+  BlockLayoutPass();
+  ~BlockLayoutPass() override;
+
+  const char* name() const override { return "BlockLayout"; }
+
+  // Profile of the function about to be compiled, or nullptr to leave the
+  // blocks as they are.
+  void set_profile(const BranchProfile* profile) { profile_ = profile; }
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+  // Counters for the last function laid out.
+  struct Stats {
+    uint32_t blocks;
+    uint32_t cold_blocks;
+    uint32_t loop_heads;
+    // Conditional branches found in the profile.
+    uint32_t profiled_branches;
+    // Of those, branches whose more frequent successor is the next block in
+    // the original / new order.
+    uint32_t hot_fallthroughs_before;
+    uint32_t hot_fallthroughs_after;
+    // Profiled executions of those branches that jump rather than fall
+    // through, in the original / new order.
+    uint64_t jumps_before;
+    uint64_t jumps_after;
+  };
+  const Stats& stats() const { return stats_; }
+
+ private:
+  static const uint64_t kUnknownCount = UINT64_MAX;
+
+  struct BlockInfo {
+    hir::Block* block;
+    // Conditional branch ending the block, before its unconditional branch.
+    hir::Instr* branch;
+    // Unconditional branch ending the block, if it doesn't return or exit.
+    hir::Instr* jump;
+    const BranchProfile::Counts* counts;
+    // Whether the branch has been inverted, swapping its counts.
+    bool inverted;
+    bool cold;
+    bool placed;
+  };
+
+  // Successors of the block, more frequent first (or the one taken by the
+  // unconditional branch first if unknown). Returns the successor count.
+  size_t GetSuccessors(const BlockInfo& info, hir::Block* successors[2],
+                       uint64_t edge_counts[2]) const;
+  void MarkColdBlocks();
+  void RecordFallthroughStats(bool after);
+
+  const BranchProfile* profile_ = nullptr;
+  std::vector<BlockInfo> blocks_;
+  Stats stats_ = {};
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_BLOCK_LAYOUT_PASS_H_
@@ -11,6 +11,7 @@
 
 #include "xenia/base/profiling.h"
 #include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/compiler/pass_statistics.h"
 #include "xenia/cpu/ppc/ppc_context.h"
 #include "xenia/cpu/processor.h"
 
@@ -47,29 +48,31 @@ bool ConditionalGroupPass::Initialize(Compiler* compiler) {
 }
 
 bool ConditionalGroupPass::Run(HIRBuilder* builder) {
+  // Passes may keep finding work in each other's output for a long time in
+  // pathological functions, so stop at an arbitrary bound rather than
+  // spending unbounded JIT time. The HIR is valid after every iteration.
+  const uint32_t max_iterations = 20;
   bool dirty;
-  int loops = 0;
+  uint32_t iterations = 0;
   do {
-    assert_true(loops < 20);  // arbitrary number
     dirty = false;
     for (size_t i = 0; i < passes_.size(); ++i) {
-      scratch_arena()->Reset();
       auto& pass = passes_[i];
-      auto subpass = dynamic_cast<ConditionalGroupSubpass*>(pass.get());
-      if (!subpass) {
-        if (!pass->Run(builder)) {
-          return false;
-        }
-      } else {
-        bool result = false;
-        if (!subpass->Run(builder, result)) {
-          return false;
-        }
-        dirty |= result;
+      bool changed;
+      if (!compiler_->RunPass(pass.get(), builder, name(), &changed)) {
+        return false;
+      }
+      // Only subpasses can report whether they did anything. Others (such as
+      // validation) never make the group loop.
+      if (dynamic_cast<ConditionalGroupSubpass*>(pass.get())) {
+        dirty |= changed;
       }
     }
-    loops++;
-  } while (dirty);
+    iterations++;
+  } while (dirty && iterations < max_iterations);
+  if (compiler_->statistics()) {
+    compiler_->statistics()->RecordIterations(name(), iterations, !dirty);
+  }
   return true;
 }
 
@@ -310,15 +310,24 @@ bool ConstantPropagationPass::Run(HIRBuilder* builder, bool& result) {
                 i->Replace(&OPCODE_ASSIGN_info, 0);
                 i->set_src1(src3);
                 result = true;
-              } else if (i->src2.value->IsConstant() &&
-                         i->src3.value->IsConstant()) {
-                // TODO: Select
-                // v->set_from(i->src2.value);
-                // v->Select(i->src3.value, i->src1.value);
-                // i->Remove();
               }
-            } else {
-              // TODO: vec128 select
+            } else if (i->src2.value->IsConstant() &&
+                       i->src3.value->IsConstant()) {
+              v->set_from(i->src2.value);
+              v->Select(i->src3.value, i->src1.value);
+              i->Remove();
+              result = true;
+            } else if (i->src1.value->IsConstantZero()) {
+              auto src2 = i->src2.value;
+              i->Replace(&OPCODE_ASSIGN_info, 0);
+              i->set_src1(src2);
+              result = true;
+            } else if (i->src1.value->constant.v128.low == UINT64_MAX &&
+                       i->src1.value->constant.v128.high == UINT64_MAX) {
+              auto src3 = i->src3.value;
+              i->Replace(&OPCODE_ASSIGN_info, 0);
+              i->set_src1(src3);
+              result = true;
             }
           }
           break;
@@ -360,7 +369,6 @@ bool ConstantPropagationPass::Run(HIRBuilder* builder, bool& result) {
           }
           break;
 
-        // TODO(benvanik): compares
         case OPCODE_COMPARE_EQ:
           if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
             bool value = i->src1.value->IsConstantEQ(i->src2.value);
@@ -600,6 +608,32 @@ bool ConstantPropagationPass::Run(HIRBuilder* builder, bool& result) {
             result = true;
           }
           break;
+        case OPCODE_MIN:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->Min(i->src2.value);
+            i->Remove();
+            result = true;
+          }
+          break;
+        case OPCODE_VECTOR_MAX:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->VectorMax(i->src2.value, hir::TypeName(i->flags >> 8),
+                         !!(i->flags & ARITHMETIC_UNSIGNED));
+            i->Remove();
+            result = true;
+          }
+          break;
+        case OPCODE_VECTOR_MIN:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->VectorMin(i->src2.value, hir::TypeName(i->flags >> 8),
+                         !!(i->flags & ARITHMETIC_UNSIGNED));
+            i->Remove();
+            result = true;
+          }
+          break;
         case OPCODE_NEG:
           if (i->src1.value->IsConstant()) {
             v->set_from(i->src1.value);
@@ -712,7 +746,14 @@ bool ConstantPropagationPass::Run(HIRBuilder* builder, bool& result) {
             result = true;
           }
           break;
-        // TODO(benvanik): ROTATE_LEFT
+        case OPCODE_ROTATE_LEFT:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->RotateLeft(i->src2.value);
+            i->Remove();
+            result = true;
+          }
+          break;
         case OPCODE_BYTE_SWAP:
           if (i->src1.value->IsConstant()) {
             v->set_from(i->src1.value);
@@ -729,8 +770,49 @@ bool ConstantPropagationPass::Run(HIRBuilder* builder, bool& result) {
             result = true;
           }
           break;
-        // TODO(benvanik): INSERT/EXTRACT
-        // TODO(benvanik): PERMUTE/SWIZZLE
+        case OPCODE_LOAD_VECTOR_SHL:
+          if (i->src1.value->IsConstant()) {
+            v->set_zero(VEC128_TYPE);
+            v->LoadVectorShl(i->src1.value);
+            i->Remove();
+            result = true;
+          }
+          break;
+        case OPCODE_LOAD_VECTOR_SHR:
+          if (i->src1.value->IsConstant()) {
+            v->set_zero(VEC128_TYPE);
+            v->LoadVectorShr(i->src1.value);
+            i->Remove();
+            result = true;
+          }
+          break;
+        case OPCODE_INSERT:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant() &&
+              i->src3.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->Insert(i->src2.value, i->src3.value);
+            i->Remove();
+            result = true;
+          }
+          break;
+        case OPCODE_PERMUTE:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant() &&
+              i->src3.value->IsConstant()) {
+            v->set_zero(VEC128_TYPE);
+            v->Permute(i->src1.value, i->src2.value, i->src3.value,
+                       hir::TypeName(i->flags));
+            i->Remove();
+            result = true;
+          }
+          break;
+        case OPCODE_SWIZZLE:
+          if (i->src1.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->Swizzle(uint32_t(i->src2.offset), hir::TypeName(i->flags));
+            i->Remove();
+            result = true;
+          }
+          break;
         case OPCODE_EXTRACT:
           if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
             v->set_zero(v->type);
@@ -821,6 +903,14 @@ bool ConstantPropagationPass::Run(HIRBuilder* builder, bool& result) {
             result = true;
           }
           break;
+        case OPCODE_VECTOR_SHA:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
+            v->set_from(i->src1.value);
+            v->VectorSha(i->src2.value, hir::TypeName(i->flags));
+            i->Remove();
+            result = true;
+          }
+          break;
         case OPCODE_VECTOR_ROTATE_LEFT:
           if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
             v->set_from(i->src1.value);
@@ -9,7 +9,10 @@
 
 #include "xenia/cpu/compiler/passes/context_promotion_pass.h"
 
+#include <algorithm>
+
 #include "xenia/apu/apu_flags.h"
+#include "xenia/base/assert.h"
 #include "xenia/base/cvar.h"
 #include "xenia/base/profiling.h"
 #include "xenia/cpu/compiler/compiler.h"
@@ -20,6 +23,10 @@ DECLARE_bool(debug);
 
 DEFINE_bool(store_all_context_values, false,
             "Don't strip dead context stores to aid in debugging.", "CPU");
+DEFINE_bool(global_context_promotion, false,
+            "Keep guest registers in function locals across blocks, only "
+            "writing them back to the context around calls and returns.",
+            "CPU");
 
 namespace xe {
 namespace cpu {
@@ -34,6 +41,28 @@ using xe::cpu::hir::HIRBuilder;
 using xe::cpu::hir::Instr;
 using xe::cpu::hir::Value;
 
+namespace {
+
+// Merges src into dest, returning whether dest changed.
+bool MergeBits(llvm::BitVector& dest, const llvm::BitVector& src) {
+  if (!src.test(dest)) {
+    return false;
+  }
+  dest |= src;
+  return true;
+}
+
+void InsertAfter(Instr* i, Instr* position) {
+  if (position->next) {
+    i->MoveBefore(position->next);
+  } else {
+    i->MoveBefore(position);
+    position->MoveBefore(i);
+  }
+}
+
+}  // namespace
+
 ContextPromotionPass::ContextPromotionPass() : CompilerPass() {}
 
 ContextPromotionPass::~ContextPromotionPass() {}
@@ -46,6 +75,7 @@ bool ContextPromotionPass::Initialize(Compiler* compiler) {
   // This is a terrible implementation.
   context_values_.resize(sizeof(ppc::PPCContext));
   context_validity_.resize(static_cast<uint32_t>(sizeof(ppc::PPCContext)));
+  slot_indices_.resize(sizeof(ppc::PPCContext), -1);
 
   return true;
 }
@@ -85,6 +115,14 @@ bool ContextPromotionPass::Run(HIRBuilder* builder) {
     }
   }
 
+  // Carry whatever is still loaded from or stored to the context across
+  // blocks. This needs the dead store removal above, as every store left
+  // becomes a write-back at the next call or return.
+  if (cvars::global_context_promotion && !cvars::debug &&
+      !cvars::store_all_context_values) {
+    PromoteFunction(builder);
+  }
+
   return true;
 }
 
@@ -147,6 +185,303 @@ void ContextPromotionPass::RemoveDeadStoresBlock(Block* block) {
   }
 }
 
+bool ContextPromotionPass::PromoteFunction(HIRBuilder* builder) {
+  // The register allocator works on individual blocks, so values can't live
+  // across them. Instead each promoted slot gets a function local:
+  //   store_context +100, v0        store_local L100, v0
+  //   branch_true v1, label0        branch_true v1, label0
+  // label0:                        label0:
+  //   v2 = load_context +100         v2 = load_local L100
+  //   call foo                       v3 = load_local L100
+  //                                  store_context +100, v3
+  //                                  call foo
+  //                                  (reloads of slots read after the call)
+  // Write-backs are only added for slots that may have been stored since the
+  // last call, and reloads only for slots that may be read before being
+  // stored again.
+  auto entry_block = builder->first_block();
+  if (!entry_block || !entry_block->instr_head) {
+    return false;
+  }
+
+  block_states_.clear();
+  for (auto block = entry_block; block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      // Initial loads go at the head of the entry block, so they must only
+      // execute once.
+      if (i->GetBranchTarget() == entry_block) {
+        return false;
+      }
+    }
+    if (!block->next && block->FallsThrough()) {
+      // Nothing to write back to the context before leaving.
+      return false;
+    }
+    block->ordinal = static_cast<uint16_t>(block_states_.size());
+    BlockState state;
+    state.block = block;
+    block_states_.push_back(std::move(state));
+  }
+
+  GatherPromotableSlots(builder);
+  if (promoted_slots_.empty()) {
+    return false;
+  }
+  ComputeDirtySlots();
+  ComputeLiveSlots();
+  InsertSyncs(builder);
+  return true;
+}
+
+void ContextPromotionPass::GatherPromotableSlots(HIRBuilder* builder) {
+  promoted_slots_.clear();
+  context_accesses_.clear();
+  std::fill(slot_indices_.begin(), slot_indices_.end(), -1);
+
+  // Slots accessed with different types or overlapping other accessed slots
+  // (such as vector elements) can't be moved into a single local.
+  std::vector<bool> conflicting;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      TypeName type;
+      if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+        type = i->dest->type;
+      } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+        type = i->src2.value->type;
+      } else {
+        continue;
+      }
+      size_t offset = i->src1.offset;
+      assert_true(offset < slot_indices_.size());
+      int32_t& index = slot_indices_[offset];
+      if (index < 0) {
+        index = static_cast<int32_t>(promoted_slots_.size());
+        promoted_slots_.push_back({static_cast<uint32_t>(offset), type});
+        conflicting.push_back(false);
+      } else if (promoted_slots_[index].type != type) {
+        conflicting[index] = true;
+      }
+      context_accesses_.push_back(i);
+    }
+  }
+
+  int32_t furthest_index = -1;
+  size_t furthest_end = 0;
+  for (size_t offset = 0; offset < slot_indices_.size(); ++offset) {
+    int32_t index = slot_indices_[offset];
+    if (index < 0) {
+      continue;
+    }
+    size_t end = offset + GetTypeSize(promoted_slots_[index].type);
+    if (offset < furthest_end) {
+      conflicting[furthest_index] = true;
+      conflicting[index] = true;
+    }
+    if (end > furthest_end) {
+      furthest_index = index;
+      furthest_end = end;
+    }
+  }
+
+  // Compact the promotable slots, keeping them ordered by offset.
+  std::vector<PromotedSlot> slots;
+  for (size_t offset = 0; offset < slot_indices_.size(); ++offset) {
+    int32_t& index = slot_indices_[offset];
+    if (index < 0) {
+      continue;
+    }
+    if (conflicting[index]) {
+      index = -1;
+      continue;
+    }
+    PromotedSlot slot = promoted_slots_[index];
+    slot.local = builder->AllocLocal(slot.type);
+    index = static_cast<int32_t>(slots.size());
+    slots.push_back(slot);
+  }
+  promoted_slots_ = std::move(slots);
+}
+
+void ContextPromotionPass::ComputeDirtySlots() {
+  auto slot_count = static_cast<unsigned>(promoted_slots_.size());
+  for (auto& state : block_states_) {
+    state.dirty_in.clear();
+    state.dirty_in.resize(slot_count);
+  }
+
+  // Forward dataflow to a fixed point, followed by one more walk recording
+  // the slots to write back at each sync point.
+  llvm::BitVector dirty;
+  bool changed = true;
+  bool record = false;
+  while (changed || !record) {
+    record = !changed;
+    changed = false;
+    if (record) {
+      sync_points_.clear();
+    }
+    for (auto& state : block_states_) {
+      if (record) {
+        state.first_sync_point = sync_points_.size();
+      }
+      dirty = state.dirty_in;
+      for (auto i = state.block->instr_head; i; i = i->next) {
+        if (i->IsContextSync()) {
+          if (record) {
+            SyncPoint sync_point;
+            sync_point.instr = i;
+            sync_point.flush = dirty;
+            sync_points_.push_back(std::move(sync_point));
+          }
+          dirty.reset();
+        } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+          int32_t index = slot_indices_[i->src1.offset];
+          if (index >= 0) {
+            dirty.set(index);
+          }
+        }
+        auto target = i->GetBranchTarget();
+        if (target) {
+          changed |= MergeBits(block_states_[target->ordinal].dirty_in, dirty);
+        }
+        if (i->IsTerminator()) {
+          // Anything following is unreachable.
+          dirty.reset();
+        }
+      }
+      if (record) {
+        state.sync_point_count =
+            sync_points_.size() - state.first_sync_point;
+      }
+      if (state.block->next && state.block->FallsThrough()) {
+        changed |= MergeBits(
+            block_states_[state.block->next->ordinal].dirty_in, dirty);
+      }
+    }
+    if (record) {
+      break;
+    }
+  }
+}
+
+void ContextPromotionPass::ComputeLiveSlots() {
+  auto slot_count = static_cast<unsigned>(promoted_slots_.size());
+  for (auto& state : block_states_) {
+    state.live_in.clear();
+    state.live_in.resize(slot_count);
+  }
+
+  // Backward dataflow, recording the slots to reload after each sync point
+  // on the final walk. Write-backs read the locals, so a slot is live before
+  // a sync point only if it's written back there.
+  llvm::BitVector live;
+  bool changed = true;
+  bool record = false;
+  while (changed || !record) {
+    record = !changed;
+    changed = false;
+    for (auto it = block_states_.rbegin(); it != block_states_.rend(); ++it) {
+      auto& state = *it;
+      if (state.block->next && state.block->FallsThrough()) {
+        live = block_states_[state.block->next->ordinal].live_in;
+      } else {
+        live.clear();
+        live.resize(slot_count);
+      }
+      size_t sync_index = state.first_sync_point + state.sync_point_count;
+      for (auto i = state.block->instr_tail; i; i = i->prev) {
+        auto target = i->GetBranchTarget();
+        if (i->IsTerminator()) {
+          if (target) {
+            live = block_states_[target->ordinal].live_in;
+          } else {
+            live.reset();
+          }
+        } else if (target) {
+          live |= block_states_[target->ordinal].live_in;
+        }
+        if (i->IsContextSync()) {
+          auto& sync_point = sync_points_[--sync_index];
+          assert_true(sync_point.instr == i);
+          if (record) {
+            sync_point.reload = live;
+          }
+          live = sync_point.flush;
+        } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+          int32_t index = slot_indices_[i->src1.offset];
+          if (index >= 0) {
+            live.set(index);
+          }
+        } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+          int32_t index = slot_indices_[i->src1.offset];
+          if (index >= 0) {
+            live.reset(index);
+          }
+        }
+      }
+      if (live != state.live_in) {
+        state.live_in = live;
+        changed = true;
+      }
+    }
+    if (record) {
+      break;
+    }
+  }
+}
+
+void ContextPromotionPass::InsertSyncs(HIRBuilder* builder) {
+  // Redirect the original accesses to the locals.
+  for (auto i : context_accesses_) {
+    int32_t index = slot_indices_[i->src1.offset];
+    if (index < 0) {
+      continue;
+    }
+    auto local = promoted_slots_[index].local;
+    if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+      i->opcode = &OPCODE_LOAD_LOCAL_info;
+    } else {
+      i->opcode = &OPCODE_STORE_LOCAL_info;
+    }
+    i->set_src1(local);
+  }
+
+  for (auto& sync_point : sync_points_) {
+    auto i = sync_point.instr;
+    for (int index = sync_point.flush.find_first(); index != -1;
+         index = sync_point.flush.find_next(index)) {
+      auto& slot = promoted_slots_[index];
+      auto value = builder->LoadLocal(slot.local);
+      value->def->MoveBefore(i);
+      builder->StoreContext(slot.offset, value);
+      builder->last_instr()->MoveBefore(i);
+    }
+    auto position = i;
+    for (int index = sync_point.reload.find_first(); index != -1;
+         index = sync_point.reload.find_next(index)) {
+      auto& slot = promoted_slots_[index];
+      auto value = builder->LoadContext(slot.offset, slot.type);
+      InsertAfter(value->def, position);
+      builder->StoreLocal(slot.local, value);
+      position = builder->last_instr();
+      InsertAfter(position, value->def);
+    }
+  }
+
+  // Load everything the function may read before storing it.
+  auto entry_block = block_states_.front().block;
+  auto& entry_live = block_states_.front().live_in;
+  auto head = entry_block->instr_head;
+  for (int index = entry_live.find_first(); index != -1;
+       index = entry_live.find_next(index)) {
+    auto& slot = promoted_slots_[index];
+    auto value = builder->LoadContext(slot.offset, slot.type);
+    value->def->MoveBefore(head);
+    builder->StoreLocal(slot.local, value);
+    builder->last_instr()->MoveBefore(head);
+  }
+}
+
 }  // namespace passes
 }  // namespace compiler
 }  // namespace cpu
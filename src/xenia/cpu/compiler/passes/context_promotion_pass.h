@@ -38,15 +38,58 @@ class ContextPromotionPass : public CompilerPass {
 
   bool Initialize(Compiler* compiler) override;
 
+  const char* name() const override { return "ContextPromotion"; }
+
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
   void PromoteBlock(hir::Block* block);
   void RemoveDeadStoresBlock(hir::Block* block);
 
+  // Function-wide promotion: context slots that are still accessed after the
+  // block-local forwarding are moved into function locals that are written
+  // back to the context only before instructions that may observe it (calls,
+  // returns, traps, ...) and reloaded after them.
+  bool PromoteFunction(hir::HIRBuilder* builder);
+  // Assigns a dense index to each context slot that can be promoted.
+  void GatherPromotableSlots(hir::HIRBuilder* builder);
+  void ComputeDirtySlots();
+  void ComputeLiveSlots();
+  void InsertSyncs(hir::HIRBuilder* builder);
+
  private:
   std::vector<hir::Value*> context_values_;
   llvm::BitVector context_validity_;
+
+  struct PromotedSlot {
+    uint32_t offset;
+    hir::TypeName type;
+    hir::Value* local;
+  };
+  // Point at which promoted slots must be flushed to the context before the
+  // instruction executes and reloaded from it afterwards.
+  struct SyncPoint {
+    hir::Instr* instr;
+    llvm::BitVector flush;
+    llvm::BitVector reload;
+  };
+  struct BlockState {
+    hir::Block* block;
+    // Promoted slots that may have been written without being flushed yet.
+    llvm::BitVector dirty_in;
+    // Promoted slots whose local may be read before being redefined.
+    llvm::BitVector live_in;
+    // Range of this block's entries in sync_points_.
+    size_t first_sync_point;
+    size_t sync_point_count;
+  };
+  std::vector<PromotedSlot> promoted_slots_;
+  // Index into promoted_slots_ by context offset, or -1.
+  std::vector<int32_t> slot_indices_;
+  std::vector<BlockState> block_states_;
+  std::vector<SyncPoint> sync_points_;
+  // Original loads and stores of context slots.
+  std::vector<hir::Instr*> context_accesses_;
 };
 
 }  // namespace passes
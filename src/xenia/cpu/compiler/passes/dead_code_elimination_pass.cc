@@ -23,11 +23,12 @@ using xe::cpu::hir::HIRBuilder;
 using xe::cpu::hir::Instr;
 using xe::cpu::hir::Value;
 
-DeadCodeEliminationPass::DeadCodeEliminationPass() : CompilerPass() {}
+DeadCodeEliminationPass::DeadCodeEliminationPass()
+    : ConditionalGroupSubpass() {}
 
 DeadCodeEliminationPass::~DeadCodeEliminationPass() {}
 
-bool DeadCodeEliminationPass::Run(HIRBuilder* builder) {
+bool DeadCodeEliminationPass::Run(HIRBuilder* builder, bool& result) {
   // ContextPromotion/DSE will likely leave around a lot of dead statements.
   // Code generated for comparison/testing produces many unused statements and
   // with proper use analysis it should be possible to remove most of them:
@@ -64,6 +65,7 @@ bool DeadCodeEliminationPass::Run(HIRBuilder* builder) {
   // all removed ops with NOP and then do a single pass that removes them
   // all.
 
+  result = false;
   bool any_instr_removed = false;
   bool any_locals_removed = false;
   auto block = builder->first_block();
@@ -83,6 +85,7 @@ bool DeadCodeEliminationPass::Run(HIRBuilder* builder) {
         // Assignment. These are useless, so just try to remove by completely
         // replacing the value.
         ReplaceAssignment(i);
+        result = true;
       }
 
       i = prev;
@@ -111,6 +114,8 @@ bool DeadCodeEliminationPass::Run(HIRBuilder* builder) {
     block = block->next;
   }
 
+  result |= any_instr_removed || any_locals_removed;
+
   // Remove all nops.
   if (any_instr_removed) {
     block = builder->first_block();
@@ -10,19 +10,21 @@
 #ifndef XENIA_CPU_COMPILER_PASSES_DEAD_CODE_ELIMINATION_PASS_H_
 #define XENIA_CPU_COMPILER_PASSES_DEAD_CODE_ELIMINATION_PASS_H_
 
-#include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/compiler/passes/conditional_group_subpass.h"
 
 namespace xe {
 namespace cpu {
 namespace compiler {
 namespace passes {
 
-class DeadCodeEliminationPass : public CompilerPass {
+class DeadCodeEliminationPass : public ConditionalGroupSubpass {
  public:
   DeadCodeEliminationPass();
   ~DeadCodeEliminationPass() override;
 
-  bool Run(hir::HIRBuilder* builder) override;
+  const char* name() const override { return "DeadCodeElimination"; }
+
+  bool Run(hir::HIRBuilder* builder, bool& result) override;
 
  private:
   void MakeNopRecursive(hir::Instr* i);
@@ -0,0 +1,189 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/dead_store_elimination_pass.h"
+
+#include "xenia/base/cvar.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/compiler/pass_statistics.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+#include "xenia/cpu/processor.h"
+
+DECLARE_bool(debug);
+DECLARE_bool(store_all_context_values);
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+namespace {
+
+bool AnySet(const llvm::BitVector& bits, uint32_t begin, uint32_t end) {
+  for (uint32_t n = begin; n < end; ++n) {
+    if (bits.test(n)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+DeadStoreEliminationPass::DeadStoreEliminationPass() : CompilerPass() {}
+
+DeadStoreEliminationPass::~DeadStoreEliminationPass() {}
+
+bool DeadStoreEliminationPass::Initialize(Compiler* compiler) {
+  if (!CompilerPass::Initialize(compiler)) {
+    return false;
+  }
+  context_size_ = static_cast<uint32_t>(sizeof(ppc::PPCContext));
+  return true;
+}
+
+bool DeadStoreEliminationPass::Run(HIRBuilder* builder) {
+  // Like the block-local removal in context promotion, this loses register
+  // values needed for debugging.
+  if (cvars::debug || cvars::store_all_context_values) {
+    return true;
+  }
+
+  block_states_.clear();
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block->ordinal = static_cast<uint16_t>(block_states_.size());
+    block_states_.push_back({block});
+  }
+  if (block_states_.empty()) {
+    return true;
+  }
+
+  // Locals are only ever accessed with load_local/store_local, so they can't
+  // alias each other or the context.
+  local_indices_.clear();
+  for (auto local : builder->locals()) {
+    local_indices_.emplace(
+        local, context_size_ + static_cast<uint32_t>(local_indices_.size()));
+  }
+
+  removed_context_stores_ = 0;
+  removed_local_stores_ = 0;
+  ComputeLiveness(false);
+  ComputeLiveness(true);
+
+  auto statistics = compiler_->statistics();
+  if (statistics) {
+    statistics->AddCount("DeadStoreElimination: context stores removed",
+                         removed_context_stores_);
+    statistics->AddCount("DeadStoreElimination: local stores removed",
+                         removed_local_stores_);
+  }
+  return true;
+}
+
+void DeadStoreEliminationPass::ComputeLiveness(bool remove_stores) {
+  auto bit_count =
+      context_size_ + static_cast<uint32_t>(local_indices_.size());
+  if (!remove_stores) {
+    for (auto& state : block_states_) {
+      state.live_in.clear();
+      state.live_in.resize(bit_count);
+    }
+  }
+
+  // The caller may read anything in the context after the function returns,
+  // while locals die with it.
+  llvm::BitVector exit_live(bit_count);
+  exit_live.set(0, context_size_);
+
+  llvm::BitVector live;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto it = block_states_.rbegin(); it != block_states_.rend(); ++it) {
+      auto& state = *it;
+      if (!state.block->FallsThrough()) {
+        live.clear();
+        live.resize(bit_count);
+      } else if (state.block->next) {
+        live = block_states_[state.block->next->ordinal].live_in;
+      } else {
+        live = exit_live;
+      }
+      auto i = state.block->instr_tail;
+      while (i) {
+        auto prev = i->prev;
+        auto target = i->GetBranchTarget();
+        if (i->IsTerminator()) {
+          live = target ? block_states_[target->ordinal].live_in : exit_live;
+        } else if (target) {
+          live |= block_states_[target->ordinal].live_in;
+        }
+        if (!TransferInstr(i, live) && remove_stores) {
+          if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+            ++removed_context_stores_;
+          } else {
+            ++removed_local_stores_;
+          }
+          i->Remove();
+        }
+        i = prev;
+      }
+      if (remove_stores) {
+        // Liveness is already final, and removing the stores doesn't change
+        // it as nothing could read what they wrote.
+        continue;
+      }
+      if (live != state.live_in) {
+        state.live_in = live;
+        changed = true;
+      }
+    }
+  }
+}
+
+bool DeadStoreEliminationPass::TransferInstr(Instr* i, llvm::BitVector& live) {
+  if (i->IsContextSync()) {
+    live.set(0, context_size_);
+    return true;
+  }
+  if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+    auto begin = static_cast<uint32_t>(i->src1.offset);
+    live.set(begin, begin + static_cast<uint32_t>(GetTypeSize(i->dest->type)));
+  } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+    auto begin = static_cast<uint32_t>(i->src1.offset);
+    auto end =
+        begin + static_cast<uint32_t>(GetTypeSize(i->src2.value->type));
+    bool observed = AnySet(live, begin, end);
+    live.reset(begin, end);
+    return observed;
+  } else if (i->opcode == &OPCODE_LOAD_LOCAL_info) {
+    live.set(local_indices_[i->src1.value]);
+  } else if (i->opcode == &OPCODE_STORE_LOCAL_info) {
+    auto index = local_indices_[i->src1.value];
+    bool observed = live.test(index);
+    live.reset(index);
+    return observed;
+  }
+  return true;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
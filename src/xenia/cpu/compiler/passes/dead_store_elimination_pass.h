@@ -0,0 +1,77 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/platform.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+#if XE_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#pragma warning(disable : 4267)
+#include <llvm/ADT/BitVector.h>
+#pragma warning(pop)
+#else
+#include <llvm/ADT/BitVector.h>
+#endif  // XE_COMPILER_MSVC
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Removes context and local stores that can't be observed: those overwritten
+// on every path through the function before anything may read them. Context
+// promotion only does this within blocks, which leaves the speculative CR,
+// XER[CA] and FPSCR updates of one block alive when the next block clobbers
+// them again.
+class DeadStoreEliminationPass : public CompilerPass {
+ public:
+  DeadStoreEliminationPass();
+  ~DeadStoreEliminationPass() override;
+
+  bool Initialize(Compiler* compiler) override;
+
+  const char* name() const override { return "DeadStoreElimination"; }
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  // Backward liveness of context bytes and locals to a fixed point, followed
+  // by one more walk removing the stores to dead ones.
+  void ComputeLiveness(bool remove_stores);
+  // Updates live for one instruction, walking backwards. Returns false if the
+  // instruction is a store that may be removed.
+  bool TransferInstr(hir::Instr* i, llvm::BitVector& live);
+
+ private:
+  struct BlockState {
+    hir::Block* block;
+    // Context bytes (then locals) that may be read before being overwritten.
+    llvm::BitVector live_in;
+  };
+  uint32_t context_size_ = 0;
+  std::vector<BlockState> block_states_;
+  // Bit index of each local, following the context bytes.
+  std::unordered_map<hir::Value*, uint32_t> local_indices_;
+  uint32_t removed_context_stores_ = 0;
+  uint32_t removed_local_stores_ = 0;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
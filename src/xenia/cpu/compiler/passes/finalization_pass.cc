@@ -59,7 +59,9 @@ bool FinalizationPass::Run(HIRBuilder* builder) {
     if (tail && tail->opcode == &OPCODE_BRANCH_info) {
       // Jump. Check target.
       auto target = tail->src1.label;
-      if (target->block == block->next) {
+      // The epilog is emitted between hot and cold blocks.
+      if (target->block == block->next &&
+          !((block->flags ^ block->next->flags) & Block::COLD)) {
         // Jumping to subsequent block. Remove.
         tail->Remove();
       }
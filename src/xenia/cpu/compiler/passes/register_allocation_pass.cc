@@ -15,7 +15,19 @@
 #include "xenia/base/assert.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
+#include "xenia/base/platform.h"
 #include "xenia/base/profiling.h"
+#include "xenia/cpu/cpu_flags.h"
+
+#if XE_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#pragma warning(disable : 4267)
+#include <llvm/ADT/BitVector.h>
+#pragma warning(pop)
+#else
+#include <llvm/ADT/BitVector.h>
+#endif  // XE_COMPILER_MSVC
 
 namespace xe {
 namespace cpu {
@@ -35,6 +47,24 @@ using xe::cpu::hir::Value;
 
 #define ASSERT_NO_CYCLES 0
 
+namespace {
+
+// Instructions that may run other guest code or call into the host without
+// preserving any of the allocatable registers. Conditional branches are only
+// volatile to keep them in place.
+bool MayClobberRegisters(const Instr* i) {
+  return (i->opcode->flags & OPCODE_FLAG_VOLATILE) &&
+         i->opcode != &OPCODE_BRANCH_TRUE_info &&
+         i->opcode != &OPCODE_BRANCH_FALSE_info;
+}
+
+bool IsLocalAccess(const Instr* i) {
+  return i->opcode == &OPCODE_LOAD_LOCAL_info ||
+         i->opcode == &OPCODE_STORE_LOCAL_info;
+}
+
+}  // namespace
+
 RegisterAllocationPass::RegisterAllocationPass(const MachineInfo* machine_info)
     : CompilerPass() {
   // Initialize register sets.
@@ -76,6 +106,14 @@ bool RegisterAllocationPass::Run(HIRBuilder* builder) {
   // optimized with some intra-block analysis (dominators/etc).
   // Really, it'd just be nice to have someone who knew what they
   // were doing lower SSA and do this right.
+  // Function locals (the only values that outlive a block) can be placed in
+  // registers for the whole function beforehand.
+  stats_ = {};
+  register_locals_.clear();
+  block_ranges_.clear();
+  if (cvars::global_register_allocation) {
+    AllocateLocals(builder);
+  }
 
   uint16_t block_ordinal = 0;
   uint32_t instr_ordinal = 0;
@@ -85,7 +123,7 @@ bool RegisterAllocationPass::Run(HIRBuilder* builder) {
     block->ordinal = block_ordinal++;
 
     // Reset all state.
-    PrepareBlockState();
+    PrepareBlockState(block);
 
     // Renumber all instructions in the block. This is required so that
     // we can sort the usage pointers below.
@@ -104,6 +142,10 @@ bool RegisterAllocationPass::Run(HIRBuilder* builder) {
       // Update the register use heaps.
       AdvanceUses(instr);
 
+      if (IsLocalAccess(instr) && instr->src1.value->reg.set) {
+        ++stats_.moves;
+      }
+
       // Check sources for retirement. If any are unused after this instruction
       // we can eagerly evict them to speed up register allocation.
       // Since X64 (and other platforms) can often take advantage of dest==src1
@@ -118,7 +160,8 @@ bool RegisterAllocationPass::Run(HIRBuilder* builder) {
           // Pull off preferred register. We will try to reuse this for the
           // dest.
           // NOTE: set may be null if this is a store local.
-          if (preferred_reg.set) {
+          if (cvars::global_register_allocation &&
+              instr->src1.value->reg.set) {
             has_preferred_reg = true;
             preferred_reg = instr->src1.value->reg;
           }
@@ -136,7 +179,11 @@ bool RegisterAllocationPass::Run(HIRBuilder* builder) {
         // If we have a preferred register, use that.
         // This way we can help along the stupid X86 two opcode instructions.
         bool allocated;
-        if (has_preferred_reg) {
+        if (instr->opcode == &OPCODE_LOAD_LOCAL_info &&
+            TryCoalesceLocalLoad(instr)) {
+          // Shares the reserved register of the local, nothing to track.
+          allocated = true;
+        } else if (has_preferred_reg) {
           // Allocate with the given preferred register. If the register is in
           // the wrong set it will not be reused.
           allocated = TryAllocateRegister(instr->dest, preferred_reg);
@@ -170,6 +217,237 @@ bool RegisterAllocationPass::Run(HIRBuilder* builder) {
     block = block->next;
   }
 
+  for (auto slot : builder->locals()) {
+    if (!slot->reg.set) {
+      ++stats_.stack_locals;
+    }
+  }
+
+  return true;
+}
+
+void RegisterAllocationPass::AllocateLocals(HIRBuilder* builder) {
+  if (builder->locals().empty()) {
+    return;
+  }
+  ComputeLocalIntervals(builder);
+
+  // Classic linear scan: walk the intervals by start, expiring those that
+  // ended, and when out of registers keep whichever of the new interval and
+  // the active ones ends last on the stack.
+  std::vector<LocalInterval*> intervals;
+  for (auto& interval : local_intervals_) {
+    // Locals live across calls would need saving around them anyway.
+    // Context promotion already splits guest registers at calls, so this is
+    // mostly spill slots.
+    if (!interval.crosses_call && interval.start <= interval.end) {
+      intervals.push_back(&interval);
+    }
+  }
+  std::sort(intervals.begin(), intervals.end(),
+            [](const LocalInterval* a, const LocalInterval* b) {
+              return a->start < b->start;
+            });
+
+  struct SetState {
+    RegisterSetUsage* usage_set;
+    uint32_t used_mask;
+    std::vector<LocalInterval*> active;
+  };
+  std::vector<SetState> set_states;
+  auto get_set_state = [&](RegisterSetUsage* usage_set) -> SetState& {
+    for (auto& set_state : set_states) {
+      if (set_state.usage_set == usage_set) {
+        return set_state;
+      }
+    }
+    set_states.push_back({usage_set, 0});
+    return set_states.back();
+  };
+
+  for (auto interval : intervals) {
+    auto& set_state = get_set_state(RegisterSetForValue(interval->slot));
+    auto usage_set = set_state.usage_set;
+    auto& active = set_state.active;
+    for (auto it = active.begin(); it != active.end();) {
+      if ((*it)->end < interval->start) {
+        set_state.used_mask &= ~(1u << (*it)->slot->reg.index);
+        it = active.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    // Leave at least half of the set to the values within blocks. Take
+    // registers from the top as the block allocator starts from the bottom,
+    // and only those that survive calls into the host from sequences.
+    uint32_t limit = usage_set->count / 2;
+    int32_t index = -1;
+    if (xe::bit_count(set_state.used_mask) < limit) {
+      for (int32_t n = int32_t(usage_set->count) - 1; n >= 0; --n) {
+        uint32_t bit = 1u << n;
+        if ((usage_set->set->preserved_mask & bit) &&
+            !(set_state.used_mask & bit)) {
+          index = n;
+          break;
+        }
+      }
+    }
+    if (index == -1) {
+      if (active.empty()) {
+        continue;
+      }
+      auto furthest = std::max_element(
+          active.begin(), active.end(),
+          [](const LocalInterval* a, const LocalInterval* b) {
+            return a->end < b->end;
+          });
+      if ((*furthest)->end <= interval->end) {
+        continue;
+      }
+      // Steal the register from the interval that lives longer.
+      index = (*furthest)->slot->reg.index;
+      (*furthest)->slot->reg.set = nullptr;
+      active.erase(furthest);
+    }
+
+    interval->slot->reg.set = usage_set->set;
+    interval->slot->reg.index = index;
+    set_state.used_mask |= 1u << index;
+    active.push_back(interval);
+  }
+
+  for (auto& interval : local_intervals_) {
+    if (interval.slot->reg.set) {
+      register_locals_.push_back(interval);
+      ++stats_.register_locals;
+    }
+  }
+}
+
+void RegisterAllocationPass::ComputeLocalIntervals(HIRBuilder* builder) {
+  local_indices_.clear();
+  local_intervals_.clear();
+  for (auto slot : builder->locals()) {
+    local_indices_.emplace(slot, uint32_t(local_intervals_.size()));
+    local_intervals_.push_back({slot, UINT32_MAX, 0, false});
+  }
+  auto local_count = uint32_t(local_intervals_.size());
+
+  // Number the instructions of the whole function. The per-block allocation
+  // renumbers them as it inserts spills, so the reservations are tracked by
+  // block.
+  std::vector<Block*> blocks;
+  uint32_t ordinal = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block->ordinal = uint16_t(blocks.size());
+    blocks.push_back(block);
+    BlockRange range;
+    range.first_ordinal = ordinal;
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      instr->ordinal = ordinal++;
+    }
+    range.end_ordinal = ordinal;
+    block_ranges_.push_back(range);
+  }
+
+  // Backward liveness over the blocks, with successors taken from the
+  // branches as the CFG isn't maintained up to this point.
+  std::vector<llvm::BitVector> live_in(blocks.size(),
+                                       llvm::BitVector(local_count));
+  llvm::BitVector live(local_count);
+  llvm::BitVector crosses_call(local_count);
+  auto walk_block = [&](Block* block, bool record) {
+    if (block->next && block->FallsThrough()) {
+      live = live_in[block->next->ordinal];
+    } else {
+      live.reset();
+    }
+    auto& range = block_ranges_[block->ordinal];
+    auto extend = [&](uint32_t index, uint32_t at) {
+      auto& interval = local_intervals_[index];
+      interval.start = std::min(interval.start, at);
+      interval.end = std::max(interval.end, at);
+    };
+    if (record && range.end_ordinal > range.first_ordinal) {
+      for (int n = live.find_first(); n != -1; n = live.find_next(n)) {
+        extend(n, range.end_ordinal - 1);
+      }
+    }
+    for (auto instr = block->instr_tail; instr; instr = instr->prev) {
+      auto target = instr->GetBranchTarget();
+      if (instr->IsTerminator()) {
+        if (target) {
+          live = live_in[target->ordinal];
+        } else {
+          live.reset();
+        }
+      } else if (target) {
+        live |= live_in[target->ordinal];
+      }
+      if (record && MayClobberRegisters(instr)) {
+        crosses_call |= live;
+      }
+      if (IsLocalAccess(instr)) {
+        auto it = local_indices_.find(instr->src1.value);
+        if (it == local_indices_.end()) {
+          continue;
+        }
+        if (record) {
+          extend(it->second, instr->ordinal);
+        }
+        if (instr->opcode == &OPCODE_LOAD_LOCAL_info) {
+          live.set(it->second);
+        } else {
+          live.reset(it->second);
+        }
+      }
+    }
+    if (record) {
+      for (int n = live.find_first(); n != -1; n = live.find_next(n)) {
+        extend(n, range.first_ordinal);
+      }
+    }
+  };
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto it = blocks.rbegin(); it != blocks.rend(); ++it) {
+      walk_block(*it, false);
+      if (live != live_in[(*it)->ordinal]) {
+        live_in[(*it)->ordinal] = live;
+        changed = true;
+      }
+    }
+  }
+  for (auto block : blocks) {
+    walk_block(block, true);
+  }
+  for (uint32_t n = 0; n < local_count; ++n) {
+    local_intervals_[n].crosses_call = crosses_call.test(n);
+  }
+}
+
+bool RegisterAllocationPass::TryCoalesceLocalLoad(Instr* instr) {
+  auto slot = instr->src1.value;
+  auto value = instr->dest;
+  if (!slot->reg.set || !value->use_head) {
+    return false;
+  }
+  // The use list is sorted, so the tail is the last use.
+  auto last_use = value->use_head;
+  while (last_use->next) {
+    last_use = last_use->next;
+  }
+  for (auto i = instr->next; i && i != last_use->instr; i = i->next) {
+    if (MayClobberRegisters(i) ||
+        (i->opcode == &OPCODE_STORE_LOCAL_info && i->src1.value == slot)) {
+      return false;
+    }
+  }
+  value->reg = slot->reg;
+  ++stats_.coalesced_moves;
   return true;
 }
 
@@ -195,7 +473,7 @@ void RegisterAllocationPass::DumpUsage(const char* name) {
 #endif
 }
 
-void RegisterAllocationPass::PrepareBlockState() {
+void RegisterAllocationPass::PrepareBlockState(Block* block) {
   for (size_t i = 0; i < xe::countof(usage_sets_.all_sets); ++i) {
     auto usage_set = usage_sets_.all_sets[i];
     if (usage_set) {
@@ -203,6 +481,18 @@ void RegisterAllocationPass::PrepareBlockState() {
       usage_set->upcoming_uses.clear();
     }
   }
+  // Blocks added during allocation (for spills) come last and can't overlap
+  // any local.
+  if (block->ordinal < block_ranges_.size()) {
+    auto& range = block_ranges_[block->ordinal];
+    for (auto& interval : register_locals_) {
+      if (interval.start < range.end_ordinal &&
+          interval.end >= range.first_ordinal) {
+        RegisterSetForValue(interval.slot)
+            ->availability.set(interval.slot->reg.index, false);
+      }
+    }
+  }
   DumpUsage("PrepareBlockState");
 }
 
@@ -374,6 +664,7 @@ bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
   } else {
     // Allocate a local slot.
     spill_value->local_slot = builder->AllocLocal(spill_value->type);
+    ++stats_.spills;
 
     // Add store.
     builder->StoreLocal(spill_value->local_slot, spill_value);
@@ -419,6 +710,7 @@ bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
   // automatically when we get to it.
   auto new_value = builder->LoadLocal(spill_value->local_slot);
   auto spill_load = builder->last_instr();
+  ++stats_.reloads;
   spill_load->MoveBefore(next_use->instr);
   // Note: implicit first use added.
 
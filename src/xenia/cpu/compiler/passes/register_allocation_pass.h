@@ -13,6 +13,7 @@
 #include <algorithm>
 #include <bitset>
 #include <functional>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/cpu/backend/machine_info.h"
@@ -28,8 +29,27 @@ class RegisterAllocationPass : public CompilerPass {
   explicit RegisterAllocationPass(const backend::MachineInfo* machine_info);
   ~RegisterAllocationPass() override;
 
+  const char* name() const override { return "RegisterAllocation"; }
+
   bool Run(hir::HIRBuilder* builder) override;
 
+  // Counters for the last function allocated.
+  struct Stats {
+    // Values stored to the stack to free their register.
+    uint32_t spills;
+    // Loads of spilled values back into a register.
+    uint32_t reloads;
+    // Accesses to locals kept in registers, which are register moves.
+    uint32_t moves;
+    // Of those, loads that need no move as the loaded value shares the
+    // register of the local.
+    uint32_t coalesced_moves;
+    // Function locals kept in registers / left on the stack.
+    uint32_t register_locals;
+    uint32_t stack_locals;
+  };
+  const Stats& stats() const { return stats_; }
+
  private:
   // TODO(benvanik): rewrite all this set shit -- too much indirection, the
   // complexity is not needed.
@@ -51,8 +71,32 @@ class RegisterAllocationPass : public CompilerPass {
     std::vector<RegisterUsage> upcoming_uses;
   };
 
+  // Function-wide live range of a local, in instruction ordinals covering
+  // every point at which it may be live.
+  struct LocalInterval {
+    hir::Value* slot;
+    uint32_t start;
+    uint32_t end;
+    // Live across an instruction that may clobber all registers (a call).
+    bool crosses_call;
+  };
+  struct BlockRange {
+    uint32_t first_ordinal;
+    // One past the last instruction of the block.
+    uint32_t end_ordinal;
+  };
+
+  // Assigns registers to function locals for their whole live range with a
+  // linear scan over the function, before the per-block allocation of SSA
+  // values works around them.
+  void AllocateLocals(hir::HIRBuilder* builder);
+  void ComputeLocalIntervals(hir::HIRBuilder* builder);
+  // Loads the local's value by sharing its register if the local isn't
+  // written while the loaded value is alive.
+  bool TryCoalesceLocalLoad(hir::Instr* instr);
+
   void DumpUsage(const char* name);
-  void PrepareBlockState();
+  void PrepareBlockState(hir::Block* block);
   void AdvanceUses(hir::Instr* instr);
   bool IsRegInUse(const hir::RegAssignment& reg);
   RegisterSetUsage* MarkRegUsed(const hir::RegAssignment& reg,
@@ -76,6 +120,14 @@ class RegisterAllocationPass : public CompilerPass {
     RegisterSetUsage* vec_set = nullptr;
     RegisterSetUsage* all_sets[3];
   } usage_sets_;
+
+  std::unordered_map<const hir::Value*, uint32_t> local_indices_;
+  std::vector<LocalInterval> local_intervals_;
+  // Locals kept in registers, whose registers are unavailable to SSA values
+  // in the blocks overlapping their interval.
+  std::vector<LocalInterval> register_locals_;
+  std::vector<BlockRange> block_ranges_;
+  Stats stats_;
 };
 
 }  // namespace passes
@@ -31,6 +31,7 @@ bool SimplificationPass::Run(HIRBuilder* builder, bool& result) {
   result = false;
   result |= EliminateConversions(builder);
   result |= SimplifyAssignments(builder);
+  result |= SinkCompares(builder);
   return true;
 }
 
@@ -165,6 +166,49 @@ bool SimplificationPass::SimplifyAssignments(HIRBuilder* builder) {
   return result;
 }
 
+bool SimplificationPass::SinkCompares(HIRBuilder* builder) {
+  //   v1 = compare_slt v0, 0
+  //   v2 = load_context +100
+  //   branch_true v1, label0
+  // becomes:
+  //   v2 = load_context +100
+  //   v1 = compare_slt v0, 0
+  //   branch_true v1, label0
+  // Compares have no side effects and their sources are already defined, so
+  // they can always be moved down within their block.
+  bool result = false;
+  auto block = builder->first_block();
+  while (block) {
+    auto i = block->instr_head;
+    while (i) {
+      if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+          i->opcode == &OPCODE_BRANCH_FALSE_info) {
+        auto def = i->src1.value->def;
+        if (def && def != i->prev && def->block == block &&
+            i->src1.value->use_head && !i->src1.value->use_head->next) {
+          auto opcode = def->opcode;
+          if (opcode == &OPCODE_COMPARE_EQ_info ||
+              opcode == &OPCODE_COMPARE_NE_info ||
+              opcode == &OPCODE_COMPARE_SLT_info ||
+              opcode == &OPCODE_COMPARE_SLE_info ||
+              opcode == &OPCODE_COMPARE_SGT_info ||
+              opcode == &OPCODE_COMPARE_SGE_info ||
+              opcode == &OPCODE_COMPARE_ULT_info ||
+              opcode == &OPCODE_COMPARE_ULE_info ||
+              opcode == &OPCODE_COMPARE_UGT_info ||
+              opcode == &OPCODE_COMPARE_UGE_info) {
+            def->MoveBefore(i);
+            result = true;
+          }
+        }
+      }
+      i = i->next;
+    }
+    block = block->next;
+  }
+  return result;
+}
+
 Value* SimplificationPass::CheckValue(Value* value, bool& result) {
   auto def = value->def;
   if (def && def->opcode == &OPCODE_ASSIGN_info) {
@@ -22,6 +22,8 @@ class SimplificationPass : public ConditionalGroupSubpass {
   SimplificationPass();
   ~SimplificationPass() override;
 
+  const char* name() const override { return "Simplification"; }
+
   bool Run(hir::HIRBuilder* builder, bool& result) override;
 
  private:
@@ -30,6 +32,10 @@ class SimplificationPass : public ConditionalGroupSubpass {
   bool CheckByteSwap(hir::Instr* i);
 
   bool SimplifyAssignments(hir::HIRBuilder* builder);
+
+  // Moves compares used only by a conditional branch right before it, so the
+  // backend can fuse them.
+  bool SinkCompares(hir::HIRBuilder* builder);
   hir::Value* CheckValue(hir::Value* value, bool& result);
 };
 
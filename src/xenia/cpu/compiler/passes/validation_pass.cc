@@ -61,6 +61,10 @@ bool ValidationPass::Run(HIRBuilder* builder) {
       instr = instr->next;
     }
 
+    if (!ValidateValueOrdinals(block)) {
+      return false;
+    }
+
     block = block->next;
   }
 
@@ -102,6 +106,64 @@ bool ValidationPass::ValidateInstruction(Block* block, Instr* instr) {
   return true;
 }
 
+bool ValidationPass::ValidateValueOrdinals(Block* block) {
+  // Remaining uses of the value holding each ordinal. Locals and constants
+  // aren't defined in the block and are left out.
+  live_values_.clear();
+  auto use_value = [this](Value* value) {
+    if (!value->def || value->IsConstant()) {
+      return true;
+    }
+    auto it = live_values_.find(value->ordinal);
+    if (it == live_values_.end()) {
+      return true;
+    }
+    assert_true(it->second.first == value);
+    if (it->second.first != value) {
+      return false;
+    }
+    if (!--it->second.second) {
+      live_values_.erase(it);
+    }
+    return true;
+  };
+
+  for (auto instr = block->instr_head; instr; instr = instr->next) {
+    uint32_t signature = instr->opcode->signature;
+    if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+        !use_value(instr->src1.value)) {
+      return false;
+    }
+    if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V &&
+        !use_value(instr->src2.value)) {
+      return false;
+    }
+    if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V &&
+        !use_value(instr->src3.value)) {
+      return false;
+    }
+    auto dest = instr->dest;
+    if (!dest || dest->IsConstant()) {
+      continue;
+    }
+    uint32_t use_count = 0;
+    for (auto use = dest->use_head; use; use = use->next) {
+      ++use_count;
+    }
+    if (!use_count) {
+      continue;
+    }
+    bool inserted =
+        live_values_.emplace(dest->ordinal, std::make_pair(dest, use_count))
+            .second;
+    assert_true(inserted);
+    if (!inserted) {
+      return false;
+    }
+  }
+  return true;
+}
+
 bool ValidationPass::ValidateValue(Block* block, Instr* instr, Value* value) {
   // if (value->def) {
   //  auto def = value->def;
@@ -10,6 +10,9 @@
 #ifndef XENIA_CPU_COMPILER_PASSES_VALIDATION_PASS_H_
 #define XENIA_CPU_COMPILER_PASSES_VALIDATION_PASS_H_
 
+#include <unordered_map>
+#include <utility>
+
 #include "xenia/cpu/compiler/compiler_pass.h"
 
 namespace xe {
@@ -22,11 +25,19 @@ class ValidationPass : public CompilerPass {
   ValidationPass();
   ~ValidationPass() override;
 
+  const char* name() const override { return "Validation"; }
+
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
   bool ValidateInstruction(hir::Block* block, hir::Instr* instr);
   bool ValidateValue(hir::Block* block, hir::Instr* instr, hir::Value* value);
+  // Checks that values live at the same time have distinct ordinals, as value
+  // reduction reuses them.
+  bool ValidateValueOrdinals(hir::Block* block);
+
+ private:
+  std::unordered_map<uint32_t, std::pair<hir::Value*, uint32_t>> live_values_;
 };
 
 }  // namespace passes
@@ -9,6 +9,9 @@
 
 #include "xenia/cpu/compiler/passes/value_reduction_pass.h"
 
+#include <algorithm>
+#include <unordered_set>
+
 #include "xenia/base/platform.h"
 #include "xenia/base/profiling.h"
 #include "xenia/cpu/backend/backend.h"
@@ -61,13 +64,53 @@ void ValueReductionPass::ComputeLastUse(Value* value) {
 
 bool ValueReductionPass::Run(HIRBuilder* builder) {
   // Walk each block and reuse variable ordinals as much as possible.
+  // Values are only used in the block defining them, so blocks can all
+  // start from the same ordinal. Locals and constants have no defining
+  // instruction and may be used anywhere, so they are numbered first and keep
+  // their ordinals for the whole function.
+  std::unordered_set<Value*> pinned_values;
+  uint32_t pinned_count = 0;
+  auto pin = [&](Value* v) {
+    if (pinned_values.insert(v).second) {
+      v->ordinal = pinned_count++;
+    }
+  };
+  for (auto local : builder->locals()) {
+    pin(local);
+  }
+  auto block = builder->first_block();
+  while (block) {
+    auto instr = block->instr_head;
+    while (instr) {
+      const OpcodeInfo* info = instr->opcode;
+      if (GET_OPCODE_SIG_TYPE_SRC1(info->signature) == OPCODE_SIG_TYPE_V &&
+          (!instr->src1.value->def || instr->src1.value->IsConstant())) {
+        pin(instr->src1.value);
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC2(info->signature) == OPCODE_SIG_TYPE_V &&
+          (!instr->src2.value->def || instr->src2.value->IsConstant())) {
+        pin(instr->src2.value);
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC3(info->signature) == OPCODE_SIG_TYPE_V &&
+          (!instr->src3.value->def || instr->src3.value->IsConstant())) {
+        pin(instr->src3.value);
+      }
+      if (instr->dest && instr->dest->IsConstant()) {
+        pin(instr->dest);
+      }
+      instr = instr->next;
+    }
+    block = block->next;
+  }
 
   llvm::BitVector ordinals(builder->max_value_ordinal());
+  uint32_t max_ordinal = pinned_count;
 
-  auto block = builder->first_block();
+  block = builder->first_block();
   while (block) {
     // Reset used ordinals.
     ordinals.reset();
+    ordinals.set(0, pinned_count);
 
     // Renumber all instructions to make liveness tracking easier.
     uint32_t instr_ordinal = 0;
@@ -86,52 +129,43 @@ bool ValueReductionPass::Run(HIRBuilder* builder) {
       auto src3_type = GET_OPCODE_SIG_TYPE_SRC3(info->signature);
       if (src1_type == OPCODE_SIG_TYPE_V) {
         auto v = instr->src1.value;
-        if (!v->last_use) {
-          ComputeLastUse(v);
-        }
-        if (v->last_use == instr) {
+        if (v->last_use == instr && !pinned_values.count(v)) {
           // Available.
-          if (!instr->src1.value->IsConstant()) {
-            ordinals.reset(v->ordinal);
-          }
+          ordinals.reset(v->ordinal);
         }
       }
       if (src2_type == OPCODE_SIG_TYPE_V) {
         auto v = instr->src2.value;
-        if (!v->last_use) {
-          ComputeLastUse(v);
-        }
-        if (v->last_use == instr) {
+        if (v->last_use == instr && !pinned_values.count(v)) {
           // Available.
-          if (!instr->src2.value->IsConstant()) {
-            ordinals.reset(v->ordinal);
-          }
+          ordinals.reset(v->ordinal);
         }
       }
       if (src3_type == OPCODE_SIG_TYPE_V) {
         auto v = instr->src3.value;
-        if (!v->last_use) {
-          ComputeLastUse(v);
-        }
-        if (v->last_use == instr) {
+        if (v->last_use == instr && !pinned_values.count(v)) {
           // Available.
-          if (!instr->src3.value->IsConstant()) {
-            ordinals.reset(v->ordinal);
-          }
+          ordinals.reset(v->ordinal);
         }
       }
-      if (dest_type == OPCODE_SIG_TYPE_V) {
+      if (dest_type == OPCODE_SIG_TYPE_V && !pinned_values.count(instr->dest)) {
         // Dest values are processed last, as they may be able to reuse a
         // source value ordinal.
         auto v = instr->dest;
-        // Find a lower ordinal.
-        for (auto n = 0u; n < ordinals.size(); n++) {
+        // Last uses left over from earlier passes may be stale.
+        ComputeLastUse(v);
+        // Find a lower ordinal. Values that are never used don't need to
+        // keep theirs.
+        for (auto n = pinned_count; n < ordinals.size(); n++) {
           if (!ordinals.test(n)) {
-            ordinals.set(n);
+            if (v->last_use) {
+              ordinals.set(n);
+            }
             v->ordinal = n;
             break;
           }
         }
+        max_ordinal = std::max(max_ordinal, v->ordinal + 1);
       }
 
       instr = instr->next;
@@ -140,6 +174,9 @@ bool ValueReductionPass::Run(HIRBuilder* builder) {
     block = block->next;
   }
 
+  // Values added by later passes are numbered after the ones in use.
+  builder->set_max_value_ordinal(max_ordinal);
+
   return true;
 }
 
@@ -35,9 +35,97 @@ DEFINE_bool(
     "Disables global lock usage in guest code. Does not affect host code.",
     "CPU");
 
+DEFINE_int32(precompile_threads, -1,
+             "Number of background threads compiling the functions of loaded "
+             "modules ahead of execution. -1 picks a count based on the host "
+             "processor, 0 disables precompilation.",
+             "CPU");
+
+DEFINE_bool(tiered_jit, true,
+            "Compile functions with a minimal set of optimizations first and "
+            "recompile them with all optimizations once they become hot.",
+            "CPU");
+DEFINE_int32(tier_up_threshold, 1000,
+             "Number of times a baseline-compiled function must be entered "
+             "before it is recompiled with all optimizations.",
+             "CPU");
+
 DEFINE_bool(validate_hir, false,
             "Perform validation checks on the HIR during compilation.", "CPU");
 
+DEFINE_int32(inline_max_instructions, 24,
+             "Largest guest leaf function (in instructions, including the "
+             "blr) inlined into optimized callers. 0 disables inlining.",
+             "CPU");
+
+DEFINE_bool(dead_store_elimination, true,
+            "Remove guest register and function local stores that are "
+            "overwritten on every path before anything can read them.",
+            "CPU");
+DEFINE_bool(value_reduction, true,
+            "Renumber HIR values so that values not live at the same time "
+            "share ordinals, keeping dumps and ordinal-indexed sets compact.",
+            "CPU");
+
+DEFINE_bool(global_register_allocation, true,
+            "Keep function locals (such as guest registers promoted across "
+            "blocks) in host registers for the whole function instead of on "
+            "the stack.",
+            "CPU");
+DEFINE_bool(log_register_allocation_stats, false,
+            "Log the spills, reloads and moves added by register allocation "
+            "for each optimized function.",
+            "CPU");
+DEFINE_bool(block_layout, true,
+            "Count how often the conditional branches of baseline code are "
+            "taken, and lay out the optimized code so that the more frequent "
+            "side of each branch falls through and blocks never reached are "
+            "moved after the rest of the function.",
+            "CPU");
+DEFINE_path(branch_profile_path, "",
+            "File branch counts are loaded from on launch and saved to on "
+            "exit, so that functions compiled without a baseline tier (such "
+            "as with tiered_jit disabled) are laid out from an earlier run.",
+            "CPU");
+DEFINE_bool(log_block_layout_stats, false,
+            "Log the blocks moved and the branches falling through before "
+            "and after laying out each optimized function, and its hot and "
+            "cold code sizes.",
+            "CPU");
+DEFINE_bool(dump_pass_statistics, false,
+            "Measure the time taken and instructions removed by each compiler "
+            "pass for optimized functions, and log the totals for every "
+            "module on exit.",
+            "CPU");
+DEFINE_bool(specialize_mmio_access, true,
+            "Recompile functions whose loads and stores keep faulting on MMIO "
+            "ranges so that they call the ranges directly when the address "
+            "is in them.",
+            "CPU");
+DEFINE_int32(mmio_specialize_threshold, 8,
+             "Faults of a load or store on MMIO ranges before its function is "
+             "recompiled to call them directly.",
+             "CPU");
+DEFINE_bool(log_mmio_sites, false,
+            "Log the guest loads and stores that faulted on MMIO ranges the "
+            "most on exit, with their fault counts.",
+            "CPU");
+
+DEFINE_bool(sampling_profiler, false,
+            "Periodically sample where guest threads are running and write "
+            "the profile to sampling_profile_path on exit (or on request).",
+            "CPU");
+DEFINE_int32(sampling_profiler_interval_us, 1000,
+             "Thread CPU time between two samples of the sampling profiler. "
+             "On Windows, the time between two samples of the threads that "
+             "have run in between.",
+             "CPU");
+DEFINE_path(sampling_profile_path, "xenia_profile.folded",
+            "File the sampling profiler writes folded stacks to, one line "
+            "per unique stack with its sample count, as read by "
+            "flamegraph.pl and speedscope.",
+            "CPU");
+
 // Breakpoints:
 DEFINE_uint64(break_on_instruction, 0,
               "int3 before the given guest address is executed.", "CPU");
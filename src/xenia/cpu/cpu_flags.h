@@ -24,8 +24,32 @@ DECLARE_bool(trace_function_data);
 
 DECLARE_bool(disable_global_lock);
 
+DECLARE_int32(precompile_threads);
+
+DECLARE_bool(tiered_jit);
+DECLARE_int32(tier_up_threshold);
+
 DECLARE_bool(validate_hir);
 
+DECLARE_int32(inline_max_instructions);
+
+DECLARE_bool(dead_store_elimination);
+DECLARE_bool(value_reduction);
+
+DECLARE_bool(global_register_allocation);
+DECLARE_bool(log_register_allocation_stats);
+DECLARE_bool(block_layout);
+DECLARE_path(branch_profile_path);
+DECLARE_bool(log_block_layout_stats);
+DECLARE_bool(dump_pass_statistics);
+DECLARE_bool(specialize_mmio_access);
+DECLARE_int32(mmio_specialize_threshold);
+DECLARE_bool(log_mmio_sites);
+
+DECLARE_bool(sampling_profiler);
+DECLARE_int32(sampling_profiler_interval_us);
+DECLARE_path(sampling_profile_path);
+
 DECLARE_uint64(break_on_instruction);
 DECLARE_int32(break_condition_gpr);
 DECLARE_uint64(break_condition_value);
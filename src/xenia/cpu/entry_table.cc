@@ -9,79 +9,176 @@
 
 #include "xenia/cpu/entry_table.h"
 
+#include "xenia/base/assert.h"
 #include "xenia/base/profiling.h"
-#include "xenia/base/threading.h"
 
 namespace xe {
 namespace cpu {
 
-EntryTable::EntryTable() = default;
+EntryTable::EntryTable() {
+  for (auto& page : pages_) {
+    page.store(nullptr, std::memory_order_relaxed);
+  }
+}
 
 EntryTable::~EntryTable() {
-  auto global_lock = global_critical_region_.Acquire();
-  for (auto it : map_) {
-    Entry* entry = it.second;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (Entry* entry : all_entries_) {
     delete entry;
   }
+  for (auto& page : pages_) {
+    delete page.load(std::memory_order_relaxed);
+  }
 }
 
-Entry* EntryTable::Get(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
-  if (entry) {
-    // TODO(benvanik): wait if needed?
-    if (entry->status != Entry::STATUS_READY) {
-      entry = nullptr;
+std::atomic<Entry*>* EntryTable::LookupSlot(uint32_t address, bool create) {
+  if (address < kTableBase || address >= kTableEnd) {
+    return nullptr;
+  }
+  uint32_t offset = address - kTableBase;
+  auto& page_ptr = pages_[offset >> kPageShift];
+  Page* page = page_ptr.load(std::memory_order_acquire);
+  if (!page) {
+    if (!create) {
+      return nullptr;
     }
+    // Racing threads may allocate the same page; the loser frees its copy.
+    auto new_page = new Page();
+    for (auto& slot : new_page->slots) {
+      slot.store(nullptr, std::memory_order_relaxed);
+    }
+    if (page_ptr.compare_exchange_strong(page, new_page,
+                                         std::memory_order_acq_rel,
+                                         std::memory_order_acquire)) {
+      page = new_page;
+    } else {
+      delete new_page;
+    }
+  }
+  return &page->slots[(offset & ((1u << kPageShift) - 1)) >> 2];
+}
+
+Entry* EntryTable::CreateEntry(uint32_t address) {
+  auto entry = new Entry();
+  entry->address = address;
+  entry->end_address = 0;
+  entry->status.store(Entry::STATUS_COMPILING, std::memory_order_relaxed);
+  entry->function = nullptr;
+  return entry;
+}
+
+Entry* EntryTable::Get(uint32_t address) {
+  Entry* entry;
+  auto slot = LookupSlot(address, false);
+  if (slot) {
+    entry = slot->load(std::memory_order_acquire);
+  } else if (address >= kTableBase && address < kTableEnd) {
+    // Page not allocated yet.
+    return nullptr;
+  } else {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = map_.find(address);
+    entry = it != map_.end() ? it->second : nullptr;
+  }
+  // TODO(benvanik): wait if needed?
+  if (entry &&
+      entry->status.load(std::memory_order_acquire) != Entry::STATUS_READY) {
+    entry = nullptr;
   }
   return entry;
 }
 
 Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
-  // TODO(benvanik): replace with a map with wait-free for find.
-  // https://github.com/facebook/folly/blob/master/folly/AtomicHashMap.h
-
-  auto global_lock = global_critical_region_.Acquire();
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
-  Entry::Status status;
-  if (entry) {
-    // If we aren't ready yet spin and wait.
-    if (entry->status == Entry::STATUS_COMPILING) {
-      // Still compiling, so spin.
-      do {
-        global_lock.unlock();
-        // TODO(benvanik): sleep for less time?
-        xe::threading::Sleep(std::chrono::microseconds(10));
-        global_lock.lock();
-      } while (entry->status == Entry::STATUS_COMPILING);
+  Entry* entry = nullptr;
+  bool created = false;
+  auto slot = LookupSlot(address, true);
+  if (slot) {
+    entry = slot->load(std::memory_order_acquire);
+    if (!entry) {
+      auto new_entry = CreateEntry(address);
+      if (slot->compare_exchange_strong(entry, new_entry,
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_acquire)) {
+        entry = new_entry;
+        created = true;
+      } else {
+        // Someone else got there first; entry now holds theirs.
+        delete new_entry;
+      }
     }
-    status = entry->status;
   } else {
-    // Create and return for initialization.
-    entry = new Entry();
-    entry->address = address;
-    entry->end_address = 0;
-    entry->status = Entry::STATUS_COMPILING;
-    entry->function = 0;
-    map_[address] = entry;
-    status = Entry::STATUS_NEW;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = map_.find(address);
+    if (it != map_.end()) {
+      entry = it->second;
+    } else {
+      entry = CreateEntry(address);
+      map_[address] = entry;
+      created = true;
+    }
   }
-  global_lock.unlock();
   *out_entry = entry;
+
+  if (created) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    all_entries_.push_back(entry);
+    return Entry::STATUS_NEW;
+  }
+  return WaitForEntry(entry);
+}
+
+Entry::Status EntryTable::WaitForEntry(Entry* entry) {
+  Entry::Status status = entry->status.load(std::memory_order_acquire);
+  if (status != Entry::STATUS_COMPILING) {
+    return status;
+  }
+  SCOPE_profile_cpu_f("cpu");
+  auto& wait_slot = GetWaitSlot(entry);
+  std::unique_lock<std::mutex> lock(wait_slot.mutex);
+  wait_slot.cond.wait(lock, [entry, &status]() {
+    status = entry->status.load(std::memory_order_acquire);
+    return status != Entry::STATUS_COMPILING;
+  });
   return status;
 }
 
+void EntryTable::Complete(Entry* entry, Entry::Status status) {
+  assert_true(status == Entry::STATUS_READY ||
+              status == Entry::STATUS_FAILED);
+  auto& wait_slot = GetWaitSlot(entry);
+  {
+    // Holding the slot lock ensures a waiter can't miss the wakeup between
+    // checking the status and going to sleep.
+    std::lock_guard<std::mutex> lock(wait_slot.mutex);
+    entry->status.store(status, std::memory_order_release);
+  }
+  wait_slot.cond.notify_all();
+}
+
 std::vector<Function*> EntryTable::FindWithAddress(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
+  std::lock_guard<std::mutex> lock(mutex_);
   std::vector<Function*> fns;
-  for (auto& it : map_) {
-    Entry* entry = it.second;
+  for (Entry* entry : all_entries_) {
+    // end_address is only valid once the entry is ready.
+    if (entry->status.load(std::memory_order_acquire) != Entry::STATUS_READY) {
+      continue;
+    }
     if (address >= entry->address && address <= entry->end_address) {
-      if (entry->status == Entry::STATUS_READY) {
-        fns.push_back(entry->function);
-      }
+      fns.push_back(entry->function);
+    }
+  }
+  return fns;
+}
+
+std::vector<Function*> EntryTable::FindInRange(uint32_t low, uint32_t high) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<Function*> fns;
+  for (Entry* entry : all_entries_) {
+    if (entry->status.load(std::memory_order_acquire) != Entry::STATUS_READY) {
+      continue;
+    }
+    if (entry->address >= low && entry->address < high) {
+      fns.push_back(entry->function);
     }
   }
   return fns;
@@ -10,11 +10,12 @@
 #ifndef XENIA_CPU_ENTRY_TABLE_H_
 #define XENIA_CPU_ENTRY_TABLE_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
 
-#include "xenia/base/mutex.h"
-
 namespace xe {
 namespace cpu {
 
@@ -30,24 +31,70 @@ typedef struct Entry_t {
 
   uint32_t address;
   uint32_t end_address;
-  Status status;
+  // Written with release semantics after function/end_address are set.
+  std::atomic<Status> status;
   Function* function;
 } Entry;
 
+// Maps guest function addresses to their compilation state.
+// Lookups of addresses in the usual code range (0x80000000-0x9FFFFFFF) are
+// lock-free: entries live in a lazily allocated two-level table indexed by
+// the address and are published with a single compare-and-swap. Threads
+// waiting on a function that's being compiled block on a wait slot picked by
+// the entry address rather than on a global lock.
 class EntryTable {
  public:
   EntryTable();
   ~EntryTable();
 
   Entry* Get(uint32_t address);
+  // Returns STATUS_NEW if the caller created the entry and must compile the
+  // function and then call Complete. Otherwise waits until any in-progress
+  // compilation finishes and returns the final status.
   Entry::Status GetOrCreate(uint32_t address, Entry** out_entry);
+  // Publishes the result of compiling a STATUS_NEW entry and wakes waiters.
+  void Complete(Entry* entry, Entry::Status status);
 
   std::vector<Function*> FindWithAddress(uint32_t address);
+  // Functions starting in [low, high).
+  std::vector<Function*> FindInRange(uint32_t low, uint32_t high);
 
  private:
-  xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): replace with a better data structure.
+  static constexpr uint32_t kTableBase = 0x80000000u;
+  static constexpr uint32_t kTableEnd = 0xA0000000u;
+  // Each page covers 64KB of guest code (16384 function slots).
+  static constexpr uint32_t kPageShift = 16;
+  static constexpr uint32_t kPageSlotCount = 1u << (kPageShift - 2);
+  static constexpr uint32_t kPageCount =
+      (kTableEnd - kTableBase) >> kPageShift;
+  static constexpr uint32_t kWaitSlotCount = 64;
+
+  struct Page {
+    std::atomic<Entry*> slots[kPageSlotCount];
+  };
+  struct WaitSlot {
+    std::mutex mutex;
+    std::condition_variable cond;
+  };
+
+  // Returns the slot for the address in the direct table, or nullptr if the
+  // address is outside of it.
+  std::atomic<Entry*>* LookupSlot(uint32_t address, bool create);
+  Entry* CreateEntry(uint32_t address);
+  WaitSlot& GetWaitSlot(const Entry* entry) {
+    return wait_slots_[(entry->address >> 2) % kWaitSlotCount];
+  }
+  Entry::Status WaitForEntry(Entry* entry);
+
+  std::atomic<Page*> pages_[kPageCount];
+  WaitSlot wait_slots_[kWaitSlotCount];
+
+  // Guards everything below. Only taken when creating entries, for addresses
+  // outside of the direct table, and for slow queries.
+  std::mutex mutex_;
+  // Entries for addresses outside of the direct table.
   std::unordered_map<uint32_t, Entry*> map_;
+  std::vector<Entry*> all_entries_;
 };
 
 }  // namespace cpu
@@ -9,6 +9,8 @@
 
 #include "xenia/cpu/function.h"
 
+#include <algorithm>
+
 #include "xenia/base/logging.h"
 #include "xenia/cpu/symbol.h"
 #include "xenia/cpu/thread_state.h"
@@ -66,58 +68,112 @@ void GuestFunction::SetupExtern(ExternHandler handler, Export* export_data) {
   export_data_ = export_data;
 }
 
-const SourceMapEntry* GuestFunction::LookupGuestAddress(
-    uint32_t guest_address) const {
-  // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (size_t i = 0; i < source_map_.size(); ++i) {
-    const auto& entry = source_map_[i];
-    if (entry.guest_address == guest_address) {
-      return &entry;
+std::shared_ptr<const GuestFunction::Code> GuestFunction::code() const {
+  std::lock_guard<std::mutex> lock(code_mutex_);
+  return code_;
+}
+
+std::shared_ptr<const GuestFunction::Code> GuestFunction::LookupCode(
+    uintptr_t host_address) const {
+  auto contains = [host_address](const Code& code) {
+    return host_address - reinterpret_cast<uintptr_t>(code.machine_code) <
+           code.machine_code_length;
+  };
+  std::lock_guard<std::mutex> lock(code_mutex_);
+  if (code_ && contains(*code_)) {
+    return code_;
+  }
+  for (const auto& replaced_code : replaced_code_) {
+    if (contains(*replaced_code)) {
+      return replaced_code;
     }
   }
   return nullptr;
 }
 
-const SourceMapEntry* GuestFunction::LookupHIROffset(uint32_t offset) const {
+void GuestFunction::PublishCode(std::shared_ptr<const Code> code) {
+  std::lock_guard<std::mutex> lock(code_mutex_);
+  if (code_) {
+    replaced_code_.push_back(std::move(code_));
+  }
+  code_ = std::move(code);
+}
+
+void GuestFunction::ReleaseCode(const uint8_t* machine_code) {
+  std::lock_guard<std::mutex> lock(code_mutex_);
+  auto it = std::find_if(
+      replaced_code_.begin(), replaced_code_.end(),
+      [machine_code](const std::shared_ptr<const Code>& code) {
+        return code->machine_code == machine_code;
+      });
+  if (it != replaced_code_.end()) {
+    replaced_code_.erase(it);
+  }
+}
+
+FunctionDebugInfo* GuestFunction::debug_info() const {
+  std::lock_guard<std::mutex> lock(code_mutex_);
+  return code_ ? code_->debug_info.get() : nullptr;
+}
+
+namespace {
+
+const SourceMapEntry* LookupGuestAddress(
+    const std::vector<SourceMapEntry>& source_map, uint32_t guest_address) {
   // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (size_t i = 0; i < source_map_.size(); ++i) {
-    const auto& entry = source_map_[i];
-    if (entry.hir_offset >= offset) {
+  for (size_t i = 0; i < source_map.size(); ++i) {
+    const auto& entry = source_map[i];
+    if (entry.guest_address == guest_address) {
       return &entry;
     }
   }
   return nullptr;
 }
 
-const SourceMapEntry* GuestFunction::LookupMachineCodeOffset(
-    uint32_t offset) const {
+const SourceMapEntry* LookupMachineCodeOffset(
+    const std::vector<SourceMapEntry>& source_map, uint32_t offset) {
   // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (int64_t i = source_map_.size() - 1; i >= 0; --i) {
-    const auto& entry = source_map_[i];
+  for (int64_t i = source_map.size() - 1; i >= 0; --i) {
+    const auto& entry = source_map[i];
     if (entry.code_offset <= offset) {
       return &entry;
     }
   }
-  return source_map_.empty() ? nullptr : &source_map_[0];
+  return source_map.empty() ? nullptr : &source_map[0];
 }
 
+}  // namespace
+
 uint32_t GuestFunction::MapGuestAddressToMachineCodeOffset(
     uint32_t guest_address) const {
-  auto entry = LookupGuestAddress(guest_address);
+  auto code = this->code();
+  if (!code) {
+    return 0;
+  }
+  auto entry = LookupGuestAddress(code->source_map, guest_address);
   return entry ? entry->code_offset : 0;
 }
 
 uintptr_t GuestFunction::MapGuestAddressToMachineCode(
     uint32_t guest_address) const {
-  auto entry = LookupGuestAddress(guest_address);
-  return reinterpret_cast<uintptr_t>(machine_code()) +
+  auto code = this->code();
+  if (!code) {
+    return 0;
+  }
+  auto entry = LookupGuestAddress(code->source_map, guest_address);
+  return reinterpret_cast<uintptr_t>(code->machine_code) +
          (entry ? entry->code_offset : 0);
 }
 
 uint32_t GuestFunction::MapMachineCodeToGuestAddress(
     uintptr_t host_address) const {
-  auto entry = LookupMachineCodeOffset(static_cast<uint32_t>(
-      host_address - reinterpret_cast<uintptr_t>(machine_code())));
+  auto code = LookupCode(host_address);
+  if (!code) {
+    return address();
+  }
+  auto entry = LookupMachineCodeOffset(
+      code->source_map,
+      uint32_t(host_address - reinterpret_cast<uintptr_t>(code->machine_code)));
   return entry ? entry->guest_address : address();
 }
 
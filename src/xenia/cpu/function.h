@@ -10,9 +10,12 @@
 #ifndef XENIA_CPU_FUNCTION_H_
 #define XENIA_CPU_FUNCTION_H_
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <vector>
 
+#include "xenia/cpu/branch_profile.h"
 #include "xenia/cpu/function_debug_info.h"
 #include "xenia/cpu/function_trace_data.h"
 #include "xenia/cpu/ppc/ppc_context.h"
@@ -100,6 +103,14 @@ class GuestFunction : public Function {
   typedef void (*ExternHandler)(ppc::PPCContext* ppc_context,
                                 kernel::KernelState* kernel_state);
 
+  // Optimization level of the machine code. Baseline code is emitted with a
+  // minimal pass pipeline and counts its entries so that it can be recompiled
+  // once it becomes hot.
+  enum class Tier {
+    kBaseline,
+    kOptimized,
+  };
+
   GuestFunction(Module* module, uint32_t address);
   ~GuestFunction() override;
 
@@ -111,21 +122,55 @@ class GuestFunction : public Function {
   virtual uint8_t* machine_code() const = 0;
   virtual size_t machine_code_length() const = 0;
 
-  FunctionDebugInfo* debug_info() const { return debug_info_.get(); }
-  void set_debug_info(std::unique_ptr<FunctionDebugInfo> debug_info) {
-    debug_info_ = std::move(debug_info);
-  }
+  // Machine code along with what describes it, published as a whole so that
+  // threads walking stacks or mapping addresses while the function is being
+  // recompiled never combine the source map of one code with another. Code
+  // that has been replaced stays described until the code cache reclaims it,
+  // as threads may still be running it.
+  struct Code {
+    uint8_t* machine_code = nullptr;
+    size_t machine_code_length = 0;
+    std::vector<SourceMapEntry> source_map;
+    std::unique_ptr<FunctionDebugInfo> debug_info;
+  };
+  // Current code, or nullptr if not compiled or invalidated.
+  std::shared_ptr<const Code> code() const;
+  // Current or replaced code containing host_address, or nullptr if none.
+  std::shared_ptr<const Code> LookupCode(uintptr_t host_address) const;
+  // Stops describing replaced code once it has been reclaimed.
+  virtual void ReleaseCode(const uint8_t* machine_code);
+
+  // Of the current code, valid until it's reclaimed.
+  FunctionDebugInfo* debug_info() const;
   FunctionTraceData& trace_data() { return trace_data_; }
-  std::vector<SourceMapEntry>& source_map() { return source_map_; }
+
+  // Tier of the code most recently compiled (or being compiled).
+  Tier tier() const { return tier_; }
+  void set_tier(Tier tier) { tier_ = tier; }
+  // Entries left until baseline code requests an optimized recompile.
+  uint32_t* tier_up_counter() { return &tier_up_counter_; }
+  // Returns true only for the first request of the function.
+  bool MarkTierUpRequested() { return !tier_up_requested_.exchange(true); }
+  // Lets new baseline code request again, after invalidation.
+  void ResetTierUpRequest() { tier_up_requested_ = false; }
+  // Counted by baseline code, outliving it as it may still be running after
+  // the optimized code has replaced it.
+  BranchProfile& branch_profile() { return branch_profile_; }
+  // Whether loads or stores of the function have faulted on MMIO ranges often
+  // enough for its code to be recompiled calling the ranges directly. Such
+  // code is never loaded from or saved to storage.
+  bool has_mmio_sites() const { return has_mmio_sites_; }
+  void set_has_mmio_sites() { has_mmio_sites_ = true; }
+  // Whether other guest functions have been inlined into code of the function.
+  // Stored code is only checked against the guest code of its own function
+  // when loaded, so such code is never saved to storage.
+  bool has_inlined_calls() const { return has_inlined_calls_; }
+  void set_has_inlined_calls() { has_inlined_calls_ = true; }
 
   ExternHandler extern_handler() const { return extern_handler_; }
   Export* export_data() const { return export_data_; }
   void SetupExtern(ExternHandler handler, Export* export_data = nullptr);
 
-  const SourceMapEntry* LookupGuestAddress(uint32_t guest_address) const;
-  const SourceMapEntry* LookupHIROffset(uint32_t offset) const;
-  const SourceMapEntry* LookupMachineCodeOffset(uint32_t offset) const;
-
   uint32_t MapGuestAddressToMachineCodeOffset(uint32_t guest_address) const;
   uintptr_t MapGuestAddressToMachineCode(uint32_t guest_address) const;
   uint32_t MapMachineCodeToGuestAddress(uintptr_t host_address) const;
@@ -135,12 +180,23 @@ class GuestFunction : public Function {
  protected:
   virtual bool CallImpl(ThreadState* thread_state, uint32_t return_address) = 0;
 
+  // Makes the code current, keeping the code it replaces described until
+  // released.
+  void PublishCode(std::shared_ptr<const Code> code);
+
  protected:
-  std::unique_ptr<FunctionDebugInfo> debug_info_;
+  mutable std::mutex code_mutex_;
+  std::shared_ptr<const Code> code_;
+  std::vector<std::shared_ptr<const Code>> replaced_code_;
   FunctionTraceData trace_data_;
-  std::vector<SourceMapEntry> source_map_;
   ExternHandler extern_handler_ = nullptr;
   Export* export_data_ = nullptr;
+  Tier tier_ = Tier::kOptimized;
+  uint32_t tier_up_counter_ = 0;
+  std::atomic<bool> tier_up_requested_ = {false};
+  BranchProfile branch_profile_;
+  std::atomic<bool> has_mmio_sites_ = {false};
+  std::atomic<bool> has_inlined_calls_ = {false};
 };
 
 }  // namespace cpu
@@ -39,6 +39,10 @@ void Block::AssertNoCycles() {
   }
 }
 
+bool Block::FallsThrough() const {
+  return !instr_tail || !instr_tail->IsTerminator();
+}
+
 }  // namespace hir
 }  // namespace cpu
 }  // namespace xe
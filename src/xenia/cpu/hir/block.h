@@ -45,6 +45,14 @@ class Edge {
 };
 
 class Block {
+ public:
+  enum BlockFlags {
+    // Rarely executed, emitted after the rest of the function.
+    COLD = (1 << 0),
+    // Target of a back edge, aligned by the backend.
+    LOOP_HEAD = (1 << 1),
+  };
+
  public:
   Arena* arena;
 
@@ -62,8 +70,12 @@ class Block {
   Instr* instr_tail;
 
   uint16_t ordinal;
+  uint16_t flags;
 
   void AssertNoCycles();
+  // Whether execution may continue into the next block after the last
+  // instruction.
+  bool FallsThrough() const;
 };
 
 }  // namespace hir
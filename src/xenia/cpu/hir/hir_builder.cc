@@ -387,6 +387,7 @@ void HIRBuilder::InsertLabel(Label* label, Instr* prev_instr) {
 
   Block* new_block = arena_->Alloc<Block>();
   new_block->ordinal = UINT16_MAX;
+  new_block->flags = 0;
   new_block->incoming_values = nullptr;
   new_block->arena = arena_;
   new_block->prev = prev_block;
@@ -629,9 +630,26 @@ void HIRBuilder::MergeAdjacentBlocks(Block* left, Block* right) {
   }
 }
 
+void HIRBuilder::MoveBlockToEnd(Block* block) {
+  if (block == block_tail_) {
+    return;
+  }
+  if (block->prev) {
+    block->prev->next = block->next;
+  } else {
+    block_head_ = block->next;
+  }
+  block->next->prev = block->prev;
+  block->prev = block_tail_;
+  block->next = nullptr;
+  block_tail_->next = block;
+  block_tail_ = block;
+}
+
 Block* HIRBuilder::AppendBlock() {
   Block* block = arena_->Alloc<Block>();
   block->ordinal = UINT16_MAX;
+  block->flags = 0;
   block->incoming_values = nullptr;
   block->arena = arena_;
   block->next = NULL;
@@ -1349,7 +1367,7 @@ Value* HIRBuilder::Select(Value* cond, Value* value1, Value* value2) {
   assert_true(cond->type == INT8_TYPE || cond->type == VEC128_TYPE);  // for now
   ASSERT_TYPES_EQUAL(value1, value2);
 
-  if (cond->IsConstant()) {
+  if (cond->IsConstant() && cond->type != VEC128_TYPE) {
     return cond->IsConstantTrue() ? value1 : value2;
   }
 
@@ -49,6 +49,8 @@ class HIRBuilder {
   std::vector<Value*>& locals() { return locals_; }
 
   uint32_t max_value_ordinal() const { return next_value_ordinal_; }
+  // Only valid once no value has an ordinal at or above the new maximum.
+  void set_max_value_ordinal(uint32_t value) { next_value_ordinal_ = value; }
 
   Block* first_block() const { return block_head_; }
   Block* last_block() const { return block_tail_; }
@@ -65,6 +67,10 @@ class HIRBuilder {
   void RemoveEdge(Edge* edge);
   void RemoveBlock(Block* block);
   void MergeAdjacentBlocks(Block* left, Block* right);
+  // Only changes the order of the blocks, which must not fall through into
+  // each other.
+  void MoveBlockToEnd(Block* block);
+  bool IsUnconditionalJump(Instr* instr);
 
   // static allocations:
   // Value* AllocStatic(size_t length);
@@ -270,7 +276,6 @@ class HIRBuilder {
  private:
   Block* AppendBlock();
   void EndBlock();
-  bool IsUnconditionalJump(Instr* instr);
   Instr* AppendInstr(const OpcodeInfo& opcode, uint16_t flags, Value* dest = 0);
   void CommentBuffer(const char* p);
   Value* CompareXX(const OpcodeInfo& opcode, Value* value1, Value* value2);
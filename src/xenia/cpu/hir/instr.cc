@@ -10,6 +10,7 @@
 #include "xenia/cpu/hir/instr.h"
 
 #include "xenia/cpu/hir/block.h"
+#include "xenia/cpu/hir/label.h"
 
 namespace xe {
 namespace cpu {
@@ -115,6 +116,34 @@ void Instr::Remove() {
   }
 }
 
+Block* Instr::GetBranchTarget() const {
+  if (opcode == &OPCODE_BRANCH_info) {
+    return src1.label->block;
+  } else if (opcode == &OPCODE_BRANCH_TRUE_info ||
+             opcode == &OPCODE_BRANCH_FALSE_info) {
+    return src2.label->block;
+  }
+  return nullptr;
+}
+
+bool Instr::IsTerminator() const {
+  if (opcode == &OPCODE_CALL_info || opcode == &OPCODE_CALL_INDIRECT_info) {
+    return (flags & CALL_TAIL) != 0;
+  }
+  return opcode == &OPCODE_BRANCH_info || opcode == &OPCODE_RETURN_info;
+}
+
+bool Instr::IsContextSync() const {
+  if (opcode == &OPCODE_CONTEXT_BARRIER_info) {
+    return true;
+  }
+  if (!(opcode->flags & OPCODE_FLAG_VOLATILE)) {
+    return false;
+  }
+  return opcode != &OPCODE_BRANCH_TRUE_info &&
+         opcode != &OPCODE_BRANCH_FALSE_info;
+}
+
 }  // namespace hir
 }  // namespace cpu
 }  // namespace xe
@@ -59,6 +59,16 @@ class Instr {
   void MoveBefore(Instr* other);
   void Replace(const OpcodeInfo* new_opcode, uint16_t new_flags);
   void Remove();
+
+  // Block branched to by BRANCH/BRANCH_TRUE/BRANCH_FALSE, otherwise null.
+  Block* GetBranchTarget() const;
+  // Whether execution never continues past this instruction within the
+  // function (unconditional branches, returns and tail calls).
+  bool IsTerminator() const;
+  // Whether other code may access the context while this instruction
+  // executes (volatile instructions and context barriers). Conditional
+  // branches are volatile only to keep them in place, so they don't count.
+  bool IsContextSync() const;
 };
 
 }  // namespace hir
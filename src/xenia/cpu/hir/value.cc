@@ -9,6 +9,7 @@
 
 #include "xenia/cpu/hir/value.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 
@@ -494,6 +495,27 @@ void Value::Max(Value* other) {
   }
 }
 
+void Value::Min(Value* other) {
+  assert_true(type == other->type);
+  switch (type) {
+    case FLOAT32_TYPE:
+      constant.f32 = std::min(constant.f32, other->constant.f32);
+      break;
+    case FLOAT64_TYPE:
+      constant.f64 = std::min(constant.f64, other->constant.f64);
+      break;
+    case VEC128_TYPE:
+      for (int i = 0; i < 4; i++) {
+        constant.v128.f32[i] =
+            std::min(constant.v128.f32[i], other->constant.v128.f32[i]);
+      }
+      break;
+    default:
+      assert_unhandled_case(type);
+      break;
+  }
+}
+
 void Value::MulAdd(Value* dest, Value* value1, Value* value2, Value* value3) {
   switch (dest->type) {
     case VEC128_TYPE:
@@ -813,20 +835,43 @@ void Value::Sha(Value* other) {
   }
 }
 
+void Value::RotateLeft(Value* other) {
+  assert_true(other->type == INT8_TYPE);
+  switch (type) {
+    case INT8_TYPE:
+      constant.u8 = xe::rotate_left(constant.u8, other->constant.u8 & 0x7);
+      break;
+    case INT16_TYPE:
+      constant.u16 = xe::rotate_left(constant.u16, other->constant.u8 & 0xF);
+      break;
+    case INT32_TYPE:
+      constant.u32 = xe::rotate_left(constant.u32, other->constant.u8 & 0x1F);
+      break;
+    case INT64_TYPE:
+      constant.u64 = xe::rotate_left(constant.u64, other->constant.u8 & 0x3F);
+      break;
+    default:
+      assert_unhandled_case(type);
+      break;
+  }
+}
+
 void Value::Extract(Value* vec, Value* index) {
   assert_true(vec->type == VEC128_TYPE);
+  // Indices are in guest element order, like the lvx/stvx byte swapped
+  // layout of vec128_t.
   switch (type) {
     case INT8_TYPE:
-      constant.u8 = vec->constant.v128.u8[index->constant.u8 & 0x1F];
+      constant.u8 = vec->constant.v128.u8[(index->constant.u8 & 0xF) ^ 0x3];
       break;
     case INT16_TYPE:
-      constant.u16 = vec->constant.v128.u16[index->constant.u16 & 0x7];
+      constant.u16 = vec->constant.v128.u16[(index->constant.u8 & 0x7) ^ 0x1];
       break;
     case INT32_TYPE:
-      constant.u32 = vec->constant.v128.u32[index->constant.u32 & 0x3];
+      constant.u32 = vec->constant.v128.u32[index->constant.u8 & 0x3];
       break;
     case INT64_TYPE:
-      constant.u64 = vec->constant.v128.u64[index->constant.u64 & 0x1];
+      constant.u64 = vec->constant.v128.u64[index->constant.u8 & 0x1];
       break;
     default:
       assert_unhandled_case(type);
@@ -834,9 +879,36 @@ void Value::Extract(Value* vec, Value* index) {
   }
 }
 
+void Value::Insert(Value* index, Value* part) {
+  assert_true(type == VEC128_TYPE);
+  switch (part->type) {
+    case INT8_TYPE:
+      constant.v128.u8[(index->constant.u8 & 0xF) ^ 0x3] = part->constant.u8;
+      break;
+    case INT16_TYPE:
+      constant.v128.u16[(index->constant.u8 & 0x7) ^ 0x1] = part->constant.u16;
+      break;
+    case INT32_TYPE:
+      constant.v128.u32[index->constant.u8 & 0x3] = part->constant.u32;
+      break;
+    default:
+      assert_unhandled_case(part->type);
+      break;
+  }
+}
+
 void Value::Select(Value* other, Value* ctrl) {
-  // TODO
-  assert_always();
+  if (ctrl->type == VEC128_TYPE) {
+    // Bitwise, taking other where ctrl is set.
+    assert_true(type == VEC128_TYPE);
+    for (int i = 0; i < 4; i++) {
+      constant.v128.u32[i] =
+          (ctrl->constant.v128.u32[i] & other->constant.v128.u32[i]) |
+          (~ctrl->constant.v128.u32[i] & constant.v128.u32[i]);
+    }
+  } else if (ctrl->IsConstantFalse()) {
+    set_from(other);
+  }
 }
 
 void Value::Splat(Value* other) {
@@ -870,6 +942,68 @@ void Value::Splat(Value* other) {
   }
 }
 
+void Value::Permute(Value* ctrl, Value* value1, Value* value2,
+                    TypeName type) {
+  assert_true(this->type == VEC128_TYPE);
+  const vec128_t& a = value1->constant.v128;
+  const vec128_t& b = value2->constant.v128;
+  switch (type) {
+    case INT8_TYPE:
+      // Guest byte i of the result is byte ctrl[i] of a:b.
+      for (int i = 0; i < 16; i++) {
+        uint8_t index = ctrl->constant.v128.u8[i ^ 0x3] & 0x1F;
+        constant.v128.u8[i ^ 0x3] =
+            index < 16 ? a.u8[index ^ 0x3] : b.u8[(index - 16) ^ 0x3];
+      }
+      break;
+    case INT16_TYPE:
+      for (int i = 0; i < 8; i++) {
+        uint16_t index = ctrl->constant.v128.u16[i ^ 0x1] & 0xF;
+        constant.v128.u16[i ^ 0x1] =
+            index < 8 ? a.u16[index ^ 0x1] : b.u16[(index - 8) ^ 0x1];
+      }
+      break;
+    case INT32_TYPE:
+      // One control byte per word, from the low byte up.
+      assert_true(ctrl->type == INT32_TYPE);
+      for (int i = 0; i < 4; i++) {
+        uint32_t index = (ctrl->constant.u32 >> (i * 8)) & 0x7;
+        constant.v128.u32[i] = index < 4 ? a.u32[index] : b.u32[index - 4];
+      }
+      break;
+    default:
+      assert_unhandled_case(type);
+      break;
+  }
+}
+
+void Value::Swizzle(uint32_t mask, TypeName type) {
+  assert_true(this->type == VEC128_TYPE);
+  assert_true(type == INT32_TYPE || type == FLOAT32_TYPE);
+  vec128_t src = constant.v128;
+  for (int i = 0; i < 4; i++) {
+    constant.v128.u32[i] = src.u32[(mask >> (i * 2)) & 0x3];
+  }
+}
+
+void Value::LoadVectorShl(Value* sh) {
+  assert_true(type == VEC128_TYPE && sh->type == INT8_TYPE);
+  // lvsl: guest byte i is sh + i.
+  uint8_t base = sh->constant.u8 & 0xF;
+  for (int i = 0; i < 16; i++) {
+    constant.v128.u8[i ^ 0x3] = uint8_t(base + i);
+  }
+}
+
+void Value::LoadVectorShr(Value* sh) {
+  assert_true(type == VEC128_TYPE && sh->type == INT8_TYPE);
+  // lvsr: guest byte i is 16 - sh + i.
+  uint8_t base = uint8_t(16 - (sh->constant.u8 & 0xF));
+  for (int i = 0; i < 16; i++) {
+    constant.v128.u8[i ^ 0x3] = uint8_t(base + i);
+  }
+}
+
 void Value::VectorCompareEQ(Value* other, TypeName type) {
   assert_true(this->type == VEC128_TYPE && other->type == VEC128_TYPE);
   switch (type) {
@@ -1121,6 +1255,30 @@ void Value::VectorShr(Value* other, TypeName type) {
   }
 }
 
+void Value::VectorSha(Value* other, TypeName type) {
+  assert_true(this->type == VEC128_TYPE && other->type == VEC128_TYPE);
+  switch (type) {
+    case INT8_TYPE:
+      for (int i = 0; i < 16; i++) {
+        constant.v128.i8[i] >>= other->constant.v128.u8[i] & 0x7;
+      }
+      break;
+    case INT16_TYPE:
+      for (int i = 0; i < 8; i++) {
+        constant.v128.i16[i] >>= other->constant.v128.u16[i] & 0xF;
+      }
+      break;
+    case INT32_TYPE:
+      for (int i = 0; i < 4; i++) {
+        constant.v128.i32[i] >>= other->constant.v128.u32[i] & 0x1F;
+      }
+      break;
+    default:
+      assert_unhandled_case(type);
+      break;
+  }
+}
+
 void Value::VectorRol(Value* other, TypeName type) {
   assert_true(this->type == VEC128_TYPE && other->type == VEC128_TYPE);
   switch (type) {
@@ -1380,6 +1538,82 @@ void Value::VectorSub(Value* other, TypeName type, bool is_unsigned,
   }
 }
 
+void Value::VectorMax(Value* other, TypeName type, bool is_unsigned) {
+  assert_true(this->type == VEC128_TYPE && other->type == VEC128_TYPE);
+  auto& a = constant.v128;
+  auto& b = other->constant.v128;
+  switch (type) {
+    case INT8_TYPE:
+      for (int i = 0; i < 16; i++) {
+        if (is_unsigned) {
+          a.u8[i] = std::max(a.u8[i], b.u8[i]);
+        } else {
+          a.i8[i] = std::max(a.i8[i], b.i8[i]);
+        }
+      }
+      break;
+    case INT16_TYPE:
+      for (int i = 0; i < 8; i++) {
+        if (is_unsigned) {
+          a.u16[i] = std::max(a.u16[i], b.u16[i]);
+        } else {
+          a.i16[i] = std::max(a.i16[i], b.i16[i]);
+        }
+      }
+      break;
+    case INT32_TYPE:
+      for (int i = 0; i < 4; i++) {
+        if (is_unsigned) {
+          a.u32[i] = std::max(a.u32[i], b.u32[i]);
+        } else {
+          a.i32[i] = std::max(a.i32[i], b.i32[i]);
+        }
+      }
+      break;
+    default:
+      assert_unhandled_case(type);
+      break;
+  }
+}
+
+void Value::VectorMin(Value* other, TypeName type, bool is_unsigned) {
+  assert_true(this->type == VEC128_TYPE && other->type == VEC128_TYPE);
+  auto& a = constant.v128;
+  auto& b = other->constant.v128;
+  switch (type) {
+    case INT8_TYPE:
+      for (int i = 0; i < 16; i++) {
+        if (is_unsigned) {
+          a.u8[i] = std::min(a.u8[i], b.u8[i]);
+        } else {
+          a.i8[i] = std::min(a.i8[i], b.i8[i]);
+        }
+      }
+      break;
+    case INT16_TYPE:
+      for (int i = 0; i < 8; i++) {
+        if (is_unsigned) {
+          a.u16[i] = std::min(a.u16[i], b.u16[i]);
+        } else {
+          a.i16[i] = std::min(a.i16[i], b.i16[i]);
+        }
+      }
+      break;
+    case INT32_TYPE:
+      for (int i = 0; i < 4; i++) {
+        if (is_unsigned) {
+          a.u32[i] = std::min(a.u32[i], b.u32[i]);
+        } else {
+          a.i32[i] = std::min(a.i32[i], b.i32[i]);
+        }
+      }
+      break;
+    default:
+      assert_unhandled_case(type);
+      break;
+  }
+}
+
 void Value::DotProduct3(Value* other) {
   assert_true(this->type == VEC128_TYPE && other->type == VEC128_TYPE);
   switch (type) {
@@ -505,6 +505,7 @@ class Value {
   void MulHi(Value* other, bool is_unsigned);
   void Div(Value* other, bool is_unsigned);
   void Max(Value* other);
+  void Min(Value* other);
   static void MulAdd(Value* dest, Value* value1, Value* value2, Value* value3);
   static void MulSub(Value* dest, Value* value1, Value* value2, Value* value3);
   void Neg();
@@ -519,9 +520,15 @@ class Value {
   void Shl(Value* other);
   void Shr(Value* other);
   void Sha(Value* other);
+  void RotateLeft(Value* other);
   void Extract(Value* vec, Value* index);
+  void Insert(Value* index, Value* part);
   void Select(Value* other, Value* ctrl);
   void Splat(Value* other);
+  void Permute(Value* ctrl, Value* value1, Value* value2, TypeName type);
+  void Swizzle(uint32_t mask, TypeName type);
+  void LoadVectorShl(Value* sh);
+  void LoadVectorShr(Value* sh);
   void VectorCompareEQ(Value* other, TypeName type);
   void VectorCompareSGT(Value* other, TypeName type);
   void VectorCompareSGE(Value* other, TypeName type);
@@ -531,9 +538,12 @@ class Value {
   void VectorConvertF2I(Value* other, bool is_unsigned);
   void VectorShl(Value* other, TypeName type);
   void VectorShr(Value* other, TypeName type);
+  void VectorSha(Value* other, TypeName type);
   void VectorRol(Value* other, TypeName type);
   void VectorAdd(Value* other, TypeName type, bool is_unsigned, bool saturate);
   void VectorSub(Value* other, TypeName type, bool is_unsigned, bool saturate);
+  void VectorMax(Value* other, TypeName type, bool is_unsigned);
+  void VectorMin(Value* other, TypeName type, bool is_unsigned);
   void DotProduct3(Value* other);
   void DotProduct4(Value* other);
   void VectorAverage(Value* other, TypeName type, bool is_unsigned,
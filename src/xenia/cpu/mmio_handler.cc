@@ -375,6 +375,10 @@ bool MMIOHandler::ExceptionCallback(Exception* ex) {
   // Advance RIP to the next instruction so that we resume properly.
   ex->set_resume_pc(rip + mov.length);
 
+  if (fault_callback_) {
+    fault_callback_(fault_callback_context_, rip, range);
+  }
+
   return true;
 }
 
@@ -48,6 +48,10 @@ class MMIOHandler {
   typedef bool (*AccessViolationCallback)(
       std::unique_lock<std::recursive_mutex> global_lock_locked_once,
       void* context, void* host_address, bool is_write);
+  // Called after each load or store of a range handled through an access
+  // violation, with the address of the host instruction that faulted.
+  typedef void (*FaultCallback)(void* context, uint64_t host_pc,
+                                const MMIORange* range);
 
   // access_violation_callback is called with global_critical_region locked once
   // on the thread, so if multiple threads trigger an access violation in the
@@ -60,6 +64,12 @@ class MMIOHandler {
       void* access_violation_callback_context);
   static MMIOHandler* global_handler() { return global_handler_; }
 
+  // Must be set before any guest code runs.
+  void SetFaultCallback(FaultCallback callback, void* context) {
+    fault_callback_ = callback;
+    fault_callback_context_ = context;
+  }
+
   bool RegisterRange(uint32_t virtual_address, uint32_t mask, uint32_t size,
                      void* context, MMIOReadCallback read_callback,
                      MMIOWriteCallback write_callback);
@@ -90,6 +100,9 @@ class MMIOHandler {
   AccessViolationCallback access_violation_callback_;
   void* access_violation_callback_context_;
 
+  FaultCallback fault_callback_ = nullptr;
+  void* fault_callback_context_ = nullptr;
+
   static MMIOHandler* global_handler_;
 
   xe::global_critical_region global_critical_region_;
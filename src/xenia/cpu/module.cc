@@ -15,66 +15,78 @@
 #include <string>
 
 #include "xenia/base/profiling.h"
-#include "xenia/base/threading.h"
+#include "xenia/cpu/compiler/pass_statistics.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/processor.h"
 
 namespace xe {
 namespace cpu {
 
 Module::Module(Processor* processor)
-    : processor_(processor), memory_(processor->memory()) {}
+    : processor_(processor), memory_(processor->memory()) {
+  if (cvars::dump_pass_statistics) {
+    pass_statistics_ = std::make_unique<compiler::PassStatistics>();
+  }
+}
 
 Module::~Module() = default;
 
 bool Module::ContainsAddress(uint32_t address) { return true; }
 
+void Symbol::set_status(Status value) {
+  if (!module_) {
+    status_.store(value, std::memory_order_release);
+    return;
+  }
+  module_->SetSymbolStatus(this, value);
+}
+
+void Module::SetSymbolStatus(Symbol* symbol, Symbol::Status status) {
+  {
+    // Changed under the lock so that a waiter can't miss the notification
+    // between checking the status and starting to wait.
+    std::lock_guard<std::mutex> lock(symbol_mutex_);
+    symbol->status_.store(status, std::memory_order_release);
+  }
+  symbol_status_cond_.notify_all();
+}
+
 Symbol* Module::LookupSymbol(uint32_t address, bool wait) {
-  auto global_lock = global_critical_region_.Acquire();
+  std::unique_lock<std::mutex> lock(symbol_mutex_);
   const auto it = map_.find(address);
   Symbol* symbol = it != map_.end() ? it->second : nullptr;
   if (symbol) {
     if (symbol->status() == Symbol::Status::kDeclaring) {
       // Some other thread is declaring the symbol - wait.
       if (wait) {
-        do {
-          global_lock.unlock();
-          // TODO(benvanik): sleep for less time?
-          xe::threading::Sleep(std::chrono::microseconds(100));
-          global_lock.lock();
-        } while (symbol->status() == Symbol::Status::kDeclaring);
+        symbol_status_cond_.wait(lock, [symbol]() {
+          return symbol->status() != Symbol::Status::kDeclaring;
+        });
       } else {
         // Immediate request, just return.
         symbol = nullptr;
       }
     }
   }
-  global_lock.unlock();
   return symbol;
 }
 
 Symbol::Status Module::DeclareSymbol(Symbol::Type type, uint32_t address,
                                      Symbol** out_symbol) {
   *out_symbol = nullptr;
-  auto global_lock = global_critical_region_.Acquire();
+  std::unique_lock<std::mutex> lock(symbol_mutex_);
   auto it = map_.find(address);
   Symbol* symbol = it != map_.end() ? it->second : nullptr;
   Symbol::Status status;
   if (symbol) {
     // If we exist but are the wrong type, die.
     if (symbol->type() != type) {
-      global_lock.unlock();
       return Symbol::Status::kFailed;
     }
-    // If we aren't ready yet spin and wait.
-    if (symbol->status() == Symbol::Status::kDeclaring) {
-      // Still declaring, so spin.
-      do {
-        global_lock.unlock();
-        // TODO(benvanik): sleep for less time?
-        xe::threading::Sleep(std::chrono::microseconds(100));
-        global_lock.lock();
-      } while (symbol->status() == Symbol::Status::kDeclaring);
-    }
+    // If we aren't ready yet wait for the declaring thread.
+    symbol_status_cond_.wait(lock, [symbol]() {
+      return symbol->status() != Symbol::Status::kDeclaring;
+    });
     status = symbol->status();
   } else {
     // Create and return for initialization.
@@ -90,7 +102,7 @@ Symbol::Status Module::DeclareSymbol(Symbol::Type type, uint32_t address,
     list_.emplace_back(symbol);
     status = Symbol::Status::kNew;
   }
-  global_lock.unlock();
+  lock.unlock();
   *out_symbol = symbol;
 
   // Get debug info from providers, if this is new.
@@ -117,25 +129,20 @@ Symbol::Status Module::DeclareVariable(uint32_t address, Symbol** out_symbol) {
 }
 
 Symbol::Status Module::DefineSymbol(Symbol* symbol) {
-  auto global_lock = global_critical_region_.Acquire();
-  Symbol::Status status;
-  if (symbol->status() == Symbol::Status::kDeclared) {
+  std::unique_lock<std::mutex> lock(symbol_mutex_);
+  // If still defining, wait for the defining thread. Other functions are
+  // defined in parallel meanwhile. It may leave the symbol declared again if
+  // it was invalidating it.
+  symbol_status_cond_.wait(lock, [symbol]() {
+    return symbol->status() != Symbol::Status::kDefining;
+  });
+  Symbol::Status status = symbol->status();
+  if (status == Symbol::Status::kDeclared) {
     // Declared but undefined, so request caller define it.
-    symbol->set_status(Symbol::Status::kDefining);
+    symbol->status_.store(Symbol::Status::kDefining,
+                          std::memory_order_release);
     status = Symbol::Status::kNew;
-  } else if (symbol->status() == Symbol::Status::kDefining) {
-    // Still defining, so spin.
-    do {
-      global_lock.unlock();
-      // TODO(benvanik): sleep for less time?
-      xe::threading::Sleep(std::chrono::microseconds(100));
-      global_lock.lock();
-    } while (symbol->status() == Symbol::Status::kDefining);
-    status = symbol->status();
-  } else {
-    status = symbol->status();
   }
-  global_lock.unlock();
   return status;
 }
 
@@ -143,12 +150,26 @@ Symbol::Status Module::DefineFunction(Function* symbol) {
   return DefineSymbol(symbol);
 }
 
+Symbol::Status Module::RedefineFunction(Function* symbol) {
+  std::unique_lock<std::mutex> lock(symbol_mutex_);
+  symbol_status_cond_.wait(lock, [symbol]() {
+    return symbol->status() != Symbol::Status::kDefining;
+  });
+  Symbol::Status status = symbol->status();
+  if (status == Symbol::Status::kDefined) {
+    symbol->status_.store(Symbol::Status::kDefining,
+                          std::memory_order_release);
+    status = Symbol::Status::kNew;
+  }
+  return status;
+}
+
 Symbol::Status Module::DefineVariable(Symbol* symbol) {
   return DefineSymbol(symbol);
 }
 
 void Module::ForEachFunction(std::function<void(Function*)> callback) {
-  auto global_lock = global_critical_region_.Acquire();
+  std::lock_guard<std::mutex> lock(symbol_mutex_);
   for (auto& symbol : list_) {
     if (symbol->type() == Symbol::Type::kFunction) {
       Function* info = static_cast<Function*>(symbol.get());
@@ -159,7 +180,7 @@ void Module::ForEachFunction(std::function<void(Function*)> callback) {
 
 void Module::ForEachSymbol(size_t start_index, size_t end_index,
                            std::function<void(Symbol*)> callback) {
-  auto global_lock = global_critical_region_.Acquire();
+  std::lock_guard<std::mutex> lock(symbol_mutex_);
   start_index = std::min(start_index, list_.size());
   end_index = std::min(end_index, list_.size());
   for (size_t i = start_index; i <= end_index; ++i) {
@@ -169,7 +190,7 @@ void Module::ForEachSymbol(size_t start_index, size_t end_index,
 }
 
 size_t Module::QuerySymbolCount() {
-  auto global_lock = global_critical_region_.Acquire();
+  std::lock_guard<std::mutex> lock(symbol_mutex_);
   return list_.size();
 }
 
@@ -10,19 +10,23 @@
 #ifndef XENIA_CPU_MODULE_H_
 #define XENIA_CPU_MODULE_H_
 
+#include <condition_variable>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
-#include "xenia/base/mutex.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/symbol.h"
 #include "xenia/memory.h"
 
 namespace xe {
 namespace cpu {
+namespace compiler {
+class PassStatistics;
+}  // namespace compiler
 
 class Processor;
 
@@ -44,6 +48,10 @@ class Module {
   virtual Symbol::Status DeclareVariable(uint32_t address, Symbol** out_symbol);
 
   Symbol::Status DefineFunction(Function* symbol);
+  // Claims a defined function to replace or invalidate its code, returning
+  // kNew if claimed, in which case the caller must set its status to
+  // kDefined or kDeclared once done. Waits for any definition in progress.
+  Symbol::Status RedefineFunction(Function* symbol);
   Symbol::Status DefineVariable(Symbol* symbol);
 
   void ForEachFunction(std::function<void(Function*)> callback);
@@ -53,6 +61,12 @@ class Module {
 
   bool ReadMap(const char* file_name);
 
+  // Statistics of the compiler passes run on the functions of this module, or
+  // null if they aren't being collected.
+  compiler::PassStatistics* pass_statistics() const {
+    return pass_statistics_.get();
+  }
+
  protected:
   virtual std::unique_ptr<Function> CreateFunction(uint32_t address) = 0;
 
@@ -64,10 +78,20 @@ class Module {
                                Symbol** out_symbol);
   Symbol::Status DefineSymbol(Symbol* symbol);
 
-  xe::global_critical_region global_critical_region_;
+  friend class Symbol;
+  void SetSymbolStatus(Symbol* symbol, Symbol::Status status);
+
+  // Guards map_ and list_ and symbol status changes, so that threads waiting
+  // for another one to declare or define a symbol are woken up when it's done.
+  // Specific to the module rather than the global critical region, so that
+  // functions are resolved without waiting for unrelated emulation.
+  std::mutex symbol_mutex_;
+  std::condition_variable symbol_status_cond_;
   // TODO(benvanik): replace with a better data structure.
   std::unordered_map<uint32_t, Symbol*> map_;
   std::vector<std::unique_ptr<Symbol>> list_;
+
+  std::unique_ptr<compiler::PassStatistics> pass_statistics_;
 };
 
 }  // namespace cpu
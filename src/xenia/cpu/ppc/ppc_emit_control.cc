@@ -76,6 +76,9 @@ int InstrEmit_branch(PPCHIRBuilder& f, const char* src, uint64_t cia,
     } else {
       // Call function.
       auto function = f.LookupFunction(nia_value);
+      if (!cond && lk && f.TryInlineCall(function)) {
+        return 0;
+      }
       if (cond) {
         if (!expect_true) {
           cond = f.IsFalse(cond);
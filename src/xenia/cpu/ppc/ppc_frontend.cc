@@ -121,6 +121,14 @@ bool PPCFrontend::DefineFunction(GuestFunction* function,
   return result;
 }
 
+bool PPCFrontend::OptimizeFunction(GuestFunction* function,
+                                   uint32_t debug_info_flags) {
+  auto translator = translator_pool_.Allocate(this);
+  bool result = translator->Translate(function, debug_info_flags, true);
+  translator_pool_.Release(translator);
+  return result;
+}
+
 }  // namespace ppc
 }  // namespace cpu
 }  // namespace xe
@@ -49,6 +49,8 @@ class PPCFrontend {
 
   bool DeclareFunction(GuestFunction* function);
   bool DefineFunction(GuestFunction* function, uint32_t debug_info_flags);
+  // Recompiles an already defined function with all optimizations.
+  bool OptimizeFunction(GuestFunction* function, uint32_t debug_info_flags);
 
  private:
   Processor* processor_;
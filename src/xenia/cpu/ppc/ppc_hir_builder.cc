@@ -10,6 +10,7 @@
 #include "xenia/cpu/ppc/ppc_hir_builder.h"
 
 #include <stddef.h>
+#include <algorithm>
 #include <cstring>
 
 #include "third_party/fmt/include/fmt/format.h"
@@ -78,6 +79,8 @@ void PPCHIRBuilder::Reset() {
   instr_offset_list_ = NULL;
   label_list_ = NULL;
   with_debug_info_ = false;
+  inline_calls_ = false;
+  inlined_instr_count_ = 0;
   HIRBuilder::Reset();
 }
 
@@ -91,6 +94,10 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
   instr_count_ = (function_->end_address() - function_->address()) / 4 + 1;
 
   with_debug_info_ = (flags & EMIT_DEBUG_COMMENTS) == EMIT_DEBUG_COMMENTS;
+  inline_calls_ = (flags & EMIT_INLINE_CALLS) == EMIT_INLINE_CALLS;
+  inlined_instr_count_ = 0;
+  std::memset(cr_compares_, 0, sizeof(cr_compares_));
+  fpscr_update_ = nullptr;
   if (with_debug_info_) {
     CommentFormat("{} fn {:08X}-{:08X} {}", function_->module()->name().c_str(),
                   function_->address(), function_->end_address(),
@@ -116,11 +123,8 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
   uint32_t end_address = function_->end_address();
   for (uint32_t address = start_address, offset = 0; address <= end_address;
        address += 4, offset++) {
-    trace_info_.dest_count = 0;
     uint32_t code =
         xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
-    auto opcode = LookupOpcode(code);
-    auto& opcode_info = GetOpcodeInfo(opcode);
 
     // Mark label, if we were assigned one earlier on in the walk.
     // We may still get a label, but it'll be inserted by LookupLabel
@@ -130,68 +134,153 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
       MarkLabel(label);
     }
 
-    Instr* first_instr = 0;
-    if (with_debug_info_) {
-      if (label) {
-        AnnotateLabel(address, label);
-      }
-      comment_buffer_.Reset();
-      comment_buffer_.AppendFormat("{:08X} {:08X} ", address, code);
-      DisasmPPC(address, code, &comment_buffer_);
-      Comment(comment_buffer_);
-      first_instr = last_instr();
-    }
+    // Stash instruction offset. It's either the SOURCE_OFFSET or the COMMENT.
+    instr_offset_list_[offset] = EmitGuestInstr(address, code, label);
+  }
 
-    // Mark source offset for debugging.
-    // We could omit this if we never wanted to debug.
-    SourceOffset(address);
-    if (!first_instr) {
-      first_instr = last_instr();
-    }
+  if (false) {
+    DumpAllOpcodeCounts();
+  }
 
-    // Stash instruction offset. It's either the SOURCE_OFFSET or the COMMENT.
-    instr_offset_list_[offset] = first_instr;
+  return Finalize();
+}
 
-    if (opcode == PPCOpcode::kInvalid) {
-      XELOGE("Invalid instruction {:08X} {:08X}", address, code);
-      Comment("INVALID!");
-      // TraceInvalidInstruction(i);
-      continue;
+PPCHIRBuilder::Instr* PPCHIRBuilder::EmitGuestInstr(uint32_t address,
+                                                    uint32_t code,
+                                                    Label* label) {
+  trace_info_.dest_count = 0;
+  auto opcode = LookupOpcode(code);
+  auto& opcode_info = GetOpcodeInfo(opcode);
+
+  Instr* first_instr = 0;
+  if (with_debug_info_) {
+    if (label) {
+      AnnotateLabel(address, label);
     }
-    ++opcode_translation_counts[static_cast<int>(opcode)];
+    comment_buffer_.Reset();
+    comment_buffer_.AppendFormat("{:08X} {:08X} ", address, code);
+    DisasmPPC(address, code, &comment_buffer_);
+    Comment(comment_buffer_);
+    first_instr = last_instr();
+  }
+
+  // Mark source offset for debugging.
+  // We could omit this if we never wanted to debug.
+  SourceOffset(address);
+  if (!first_instr) {
+    first_instr = last_instr();
+  }
+
+  if (opcode == PPCOpcode::kInvalid) {
+    XELOGE("Invalid instruction {:08X} {:08X}", address, code);
+    Comment("INVALID!");
+    // TraceInvalidInstruction(i);
+    return first_instr;
+  }
+  ++opcode_translation_counts[static_cast<int>(opcode)];
 
-    // Synchronize the PPC context as required.
-    // This will ensure all registers are saved to the PPC context before this
-    // instruction executes.
-    if (opcode_info.type == PPCOpcodeType::kSync) {
-      ContextBarrier();
+  // Synchronize the PPC context as required.
+  // This will ensure all registers are saved to the PPC context before this
+  // instruction executes.
+  if (opcode_info.type == PPCOpcodeType::kSync) {
+    ContextBarrier();
+  }
+
+  MaybeBreakOnInstruction(address);
+
+  InstrData i;
+  i.address = address;
+  i.code = code;
+  i.opcode = opcode;
+  i.opcode_info = &opcode_info;
+  if (!opcode_info.emit || opcode_info.emit(*this, i)) {
+    auto& disasm_info = GetOpcodeDisasmInfo(opcode);
+    XELOGE(
+        "Unimplemented instr {:08X} {:08X} {} - report the game to Xenia "
+        "developers; to skip, disable break_on_unimplemented_instructions",
+        address, code, disasm_info.name);
+    Comment("UNIMPLEMENTED!");
+    if (cvars::break_on_unimplemented_instructions) {
+      DebugBreak();
     }
+  }
+  return first_instr;
+}
 
-    MaybeBreakOnInstruction(address);
-
-    InstrData i;
-    i.address = address;
-    i.code = code;
-    i.opcode = opcode;
-    i.opcode_info = &opcode_info;
-    if (!opcode_info.emit || opcode_info.emit(*this, i)) {
-      auto& disasm_info = GetOpcodeDisasmInfo(opcode);
-      XELOGE(
-          "Unimplemented instr {:08X} {:08X} {} - report the game to Xenia "
-          "developers; to skip, disable break_on_unimplemented_instructions",
-          address, code, disasm_info.name);
-      Comment("UNIMPLEMENTED!");
-      if (cvars::break_on_unimplemented_instructions) {
-        DebugBreak();
-      }
+bool PPCHIRBuilder::CanInline(GuestFunction* function) {
+  // Only functions whose extents are already known, by having been scanned
+  // or declared by the module, are considered.
+  if (function == function_ || !function->has_end_address() ||
+      function->end_address() < function->address()) {
+    return false;
+  }
+  uint32_t instr_count =
+      (function->end_address() - function->address()) / 4 + 1;
+  if (instr_count > uint32_t(std::max(cvars::inline_max_instructions, 0)) ||
+      inlined_instr_count_ + instr_count > kMaxInlinedInstrCount) {
+    return false;
+  }
+
+  Memory* memory = frontend_->memory();
+  for (uint32_t address = function->address();
+       address <= function->end_address(); address += 4) {
+    uint32_t code =
+        xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    if (address == function->end_address()) {
+      // Must end with a plain blr, which becomes a fallthrough.
+      return code == 0x4E800020;
+    }
+    auto opcode = LookupOpcode(code);
+    auto& opcode_info = GetOpcodeInfo(opcode);
+    // Branches (including calls, which would make it a non-leaf), system
+    // calls and MSR accesses are all kSync.
+    if (opcode == PPCOpcode::kInvalid || !opcode_info.emit ||
+        opcode_info.type == PPCOpcodeType::kSync) {
+      return false;
+    }
+    switch (opcode) {
+      case PPCOpcode::td:
+      case PPCOpcode::tdi:
+      case PPCOpcode::tw:
+      case PPCOpcode::twi:
+      // May change LR, and with it where the blr returns to.
+      case PPCOpcode::mtspr:
+        return false;
+      default:
+        break;
     }
   }
+  return false;
+}
 
-  if (false) {
-    DumpAllOpcodeCounts();
+bool PPCHIRBuilder::TryInlineCall(Function* function) {
+  if (!inline_calls_ || !function || !function->is_guest()) {
+    return false;
   }
+  auto guest_function = static_cast<GuestFunction*>(function);
+  if (!CanInline(guest_function)) {
+    return false;
+  }
+  // For this function to be invalidated if the callee's code changes.
+  frontend_->processor()->AddInlinedCall(function_, guest_function);
+  function_->set_has_inlined_calls();
 
-  return Finalize();
+  if (with_debug_info_) {
+    CommentFormat("inlined {:08X}-{:08X} {}", guest_function->address(),
+                  guest_function->end_address(), guest_function->name());
+  }
+  Memory* memory = frontend_->memory();
+  // All but the final blr. LR has already been set to the return address by
+  // the caller, as the callee may read it.
+  for (uint32_t address = guest_function->address();
+       address < guest_function->end_address(); address += 4) {
+    uint32_t code =
+        xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    EmitGuestInstr(address, code, nullptr);
+  }
+  inlined_instr_count_ +=
+      (guest_function->end_address() - guest_function->address()) / 4 + 1;
+  return true;
 }
 
 void PPCHIRBuilder::MaybeBreakOnInstruction(uint32_t address) {
@@ -353,6 +442,21 @@ Value* PPCHIRBuilder::LoadCR(uint32_t n) {
 }
 
 Value* PPCHIRBuilder::LoadCRField(uint32_t n, uint32_t bit) {
+  auto& compare = cr_compares_[n];
+  if (bit <= 2 && compare.store &&
+      IsContextUnchangedSince(compare.store,
+                              offsetof(PPCContext, cr0) + (4 * n), 3)) {
+    switch (bit) {
+      case 0:
+        return compare.is_signed ? CompareSLT(compare.lhs, compare.rhs)
+                                 : CompareULT(compare.lhs, compare.rhs);
+      case 1:
+        return compare.is_signed ? CompareSGT(compare.lhs, compare.rhs)
+                                 : CompareUGT(compare.lhs, compare.rhs);
+      case 2:
+        return CompareEQ(compare.lhs, compare.rhs);
+    }
+  }
   return LoadContext(offsetof(PPCContext, cr0) + (4 * n) + bit, INT8_TYPE);
 }
 
@@ -406,6 +510,7 @@ void PPCHIRBuilder::UpdateCR(uint32_t n, Value* lhs, Value* rhs,
   }
   Value* eq = CompareEQ(lhs, rhs);
   StoreContext(offsetof(PPCContext, cr0) + (4 * n) + 2, eq);
+  cr_compares_[n] = {last_instr(), lhs, rhs, is_signed};
 
   // Value* so = AllocValue(UINT8_TYPE);
   // StoreContext(offsetof(PPCContext, cr) + (4 * n) + 3, so);
@@ -464,9 +569,39 @@ void PPCHIRBuilder::UpdateFPSCR(Value* result, bool update_cr1) {
   new_bits = Or(new_bits, Shl(ZeroExtend(ox, INT32_TYPE), 28));
 
   // Mix into fpscr while preserving sticky bits (FX and OX).
+  // The new bits are all zero for now, so this only needs doing again once
+  // something else has written the FPSCR.
+  if (fpscr_update_ &&
+      IsContextUnchangedSince(fpscr_update_, offsetof(PPCContext, fpscr), 4)) {
+    return;
+  }
   Value* bits = LoadFPSCR();
   bits = Or(And(bits, LoadConstantUint32(0x9FFFFFFF)), new_bits);
   StoreFPSCR(bits);
+  fpscr_update_ = last_instr();
+}
+
+bool PPCHIRBuilder::IsContextUnchangedSince(Instr* instr, size_t offset,
+                                            size_t size) {
+  // Values are local to their block, and anything may happen to the context
+  // across calls and other volatile instructions.
+  if (!current_block_ || instr->block != current_block_) {
+    return false;
+  }
+  for (auto i = instr->next; i; i = i->next) {
+    if (i->opcode->flags & OPCODE_FLAG_VOLATILE ||
+        i->opcode == &OPCODE_CONTEXT_BARRIER_info) {
+      return false;
+    }
+    if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+      size_t store_size = GetTypeSize(i->src2.value->type);
+      if (i->src1.offset < offset + size &&
+          i->src1.offset + store_size > offset) {
+        return false;
+      }
+    }
+  }
+  return true;
 }
 
 void PPCHIRBuilder::CopyFPSCRToCR1() {
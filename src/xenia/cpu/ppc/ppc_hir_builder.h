@@ -37,6 +37,8 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   enum EmitFlags {
     // Emit comment nodes.
     EMIT_DEBUG_COMMENTS = 1 << 0,
+    // Inline small leaf functions called with bl.
+    EMIT_INLINE_CALLS = 1 << 1,
   };
   bool Emit(GuestFunction* function, uint32_t flags);
 
@@ -44,6 +46,12 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   Function* LookupFunction(uint32_t address);
   Label* LookupLabel(uint32_t address);
 
+  // Emits the body of the function in place of a call to it if it's small
+  // enough and can't leave the body other than by returning. The inlined
+  // instructions keep the guest addresses of the callee in the source map.
+  // Returns false if nothing was emitted and a call is still needed.
+  bool TryInlineCall(Function* function);
+
   Value* LoadLR();
   void StoreLR(Value* value);
   Value* LoadCTR();
@@ -82,6 +90,16 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   Value* LoadReserved();
 
  private:
+  // Bounds the growth of a function through inlining.
+  static const uint32_t kMaxInlinedInstrCount = 512;
+
+  // Emits a single guest instruction, returning the first HIR instruction
+  // added for it.
+  Instr* EmitGuestInstr(uint32_t address, uint32_t code, Label* label);
+  bool CanInline(GuestFunction* function);
+  // Whether nothing emitted since the given instruction could have changed
+  // the context bytes [offset, offset + size).
+  bool IsContextUnchangedSince(Instr* instr, size_t offset, size_t size);
   void MaybeBreakOnInstruction(uint32_t address);
   void AnnotateLabel(uint32_t address, Label* label);
 
@@ -92,11 +110,28 @@ class PPCHIRBuilder : public hir::HIRBuilder {
 
   // Reset each Emit:
   bool with_debug_info_;
+  bool inline_calls_;
+  // Guest instructions inlined into the function so far.
+  uint32_t inlined_instr_count_;
   GuestFunction* function_;
   uint64_t start_address_;
   uint64_t instr_count_;
   Instr** instr_offset_list_;
   Label** label_list_;
+  // Last compare stored to each CR field by UpdateCR. Branches on the field
+  // in the same block repeat the compare right before branching, so the
+  // backend can fuse the two into a cmp + jcc, instead of testing the stored
+  // bit. The stores are still emitted and left to dead store elimination.
+  struct CRFieldCompare {
+    // The last of the stores made by UpdateCR, or null.
+    Instr* store;
+    Value* lhs;
+    Value* rhs;
+    bool is_signed;
+  } cr_compares_[8];
+  // Last store of the FPSCR by UpdateFPSCR. As the update only clears bits,
+  // repeating it is a no-op until something else writes the FPSCR.
+  Instr* fpscr_update_;
 
   // Reset each instruction.
   struct {
@@ -9,13 +9,17 @@
 
 #include "xenia/cpu/ppc/ppc_translator.h"
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
+#include "xenia/base/logging.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/reset_scope.h"
 #include "xenia/cpu/compiler/compiler_passes.h"
 #include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/module.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
 #include "xenia/cpu/ppc/ppc_hir_builder.h"
 #include "xenia/cpu/ppc/ppc_opcode_info.h"
@@ -52,13 +56,15 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
-  // Grouped simplification + constant propagation.
-  // Loops until no changes are made.
+  // Grouped simplification + constant propagation + dead code elimination.
+  // Loops until no changes are made (or an iteration limit is hit).
   auto sap = std::make_unique<passes::ConditionalGroupPass>();
   sap->AddPass(std::make_unique<passes::SimplificationPass>());
   if (validate) sap->AddPass(std::make_unique<passes::ValidationPass>());
   sap->AddPass(std::make_unique<passes::ConstantPropagationPass>());
   if (validate) sap->AddPass(std::make_unique<passes::ValidationPass>());
+  sap->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
+  if (validate) sap->AddPass(std::make_unique<passes::ValidationPass>());
   compiler_->AddPass(std::move(sap));
 
   if (backend->machine_info()->supports_extended_load_store) {
@@ -69,39 +75,73 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
     if (validate)
       compiler_->AddPass(std::make_unique<passes::ValidationPass>());
   }
-  compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
-  // if (validate)
-  // compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-
-  //// Removes all unneeded variables. Try not to add new ones after this.
-  // compiler_->AddPass(new passes::ValueReductionPass());
-  // if (validate) compiler_->AddPass(new passes::ValidationPass());
+  // Removes the context and local stores that are overwritten on every path,
+  // leaving the values they stored to dead code elimination.
+  if (cvars::dead_store_elimination) {
+    compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+  auto sdp = std::make_unique<passes::ConditionalGroupPass>();
+  sdp->AddPass(std::make_unique<passes::SimplificationPass>());
+  if (validate) sdp->AddPass(std::make_unique<passes::ValidationPass>());
+  sdp->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
+  if (validate) sdp->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler_->AddPass(std::move(sdp));
+
+  // Removes all unneeded variables. Try not to add new ones after this.
+  if (cvars::value_reduction) {
+    compiler_->AddPass(std::make_unique<passes::ValueReductionPass>());
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
 
   // Register allocation for the target backend.
   // Will modify the HIR to add loads/stores.
   // This should be the last pass before finalization, as after this all
   // registers are assigned and ready to be emitted.
-  compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
-      backend->machine_info()));
+  auto register_allocation_pass =
+      std::make_unique<passes::RegisterAllocationPass>(
+          backend->machine_info());
+  register_allocation_pass_ = register_allocation_pass.get();
+  compiler_->AddPass(std::move(register_allocation_pass));
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
+  // Block order is free after register allocation, but finalization
+  // removes the branches to the next block that it relies upon.
+  if (cvars::block_layout) {
+    auto block_layout_pass = std::make_unique<passes::BlockLayoutPass>();
+    block_layout_pass_ = block_layout_pass.get();
+    compiler_->AddPass(std::move(block_layout_pass));
+  }
+
   // Must come last. The HIR is not really HIR after this.
   compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+
+  // Baseline tier: only what the backend needs to emit code. Constants are
+  // still folded as sequences don't handle all-constant operands.
+  baseline_compiler_.reset(new Compiler(frontend->processor()));
+  auto cp = std::make_unique<passes::ConditionalGroupPass>();
+  cp->AddPass(std::make_unique<passes::ConstantPropagationPass>());
+  baseline_compiler_->AddPass(std::move(cp));
+  if (validate) {
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+  baseline_compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+      backend->machine_info()));
+  baseline_compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
 }
 
 PPCTranslator::~PPCTranslator() = default;
 
 bool PPCTranslator::Translate(GuestFunction* function,
-                              uint32_t debug_info_flags) {
+                              uint32_t debug_info_flags, bool optimize) {
   SCOPE_profile_cpu_f("cpu");
 
   // Reset() all caching when we leave.
   xe::make_reset_scope(builder_);
   xe::make_reset_scope(compiler_);
+  xe::make_reset_scope(baseline_compiler_);
   xe::make_reset_scope(assembler_);
   xe::make_reset_scope(&string_buffer_);
 
@@ -121,6 +161,26 @@ bool PPCTranslator::Translate(GuestFunction* function,
   if (cvars::trace_function_data) {
     debug_info_flags |= DebugInfoFlags::kDebugInfoTraceFunctionData;
   }
+
+  // Code persisted by a previous launch is only ever stored without any debug
+  // info, nor with MMIO accesses calling the ranges directly.
+  if (!debug_info_flags && !function->has_mmio_sites() &&
+      assembler_->AssembleFromStorage(function)) {
+    function->set_tier(GuestFunction::Tier::kOptimized);
+    return true;
+  }
+
+  // Functions with debug info are always fully optimized so that what the
+  // debugger sees doesn't change under it.
+  auto tier = GuestFunction::Tier::kOptimized;
+  if (cvars::tiered_jit && !optimize && !debug_info_flags) {
+    tier = GuestFunction::Tier::kBaseline;
+    *function->tier_up_counter() =
+        uint32_t(std::max(cvars::tier_up_threshold, 1));
+    function->ResetTierUpRequest();
+  }
+  function->set_tier(tier);
+
   std::unique_ptr<FunctionDebugInfo> debug_info;
   if (debug_info_flags) {
     debug_info.reset(new FunctionDebugInfo());
@@ -164,6 +224,13 @@ bool PPCTranslator::Translate(GuestFunction* function,
   if (debug_info) {
     emit_flags |= PPCHIRBuilder::EMIT_DEBUG_COMMENTS;
   }
+  // Coverage traces are indexed by addresses within the function, so inlined
+  // instructions would fall outside of them.
+  if (tier == GuestFunction::Tier::kOptimized &&
+      cvars::inline_max_instructions > 0 &&
+      !(debug_info_flags & DebugInfoFlags::kDebugInfoTraceFunctionCoverage)) {
+    emit_flags |= PPCHIRBuilder::EMIT_INLINE_CALLS;
+  }
   if (!builder_->Emit(function, emit_flags)) {
     return false;
   }
@@ -176,9 +243,47 @@ bool PPCTranslator::Translate(GuestFunction* function,
   }
 
   // Compile/optimize/etc.
-  if (!compiler_->Compile(builder_.get())) {
+  auto compiler = tier == GuestFunction::Tier::kBaseline
+                      ? baseline_compiler_.get()
+                      : compiler_.get();
+  compiler->set_statistics(cvars::dump_pass_statistics &&
+                                   compiler == compiler_.get()
+                               ? function->module()->pass_statistics()
+                               : nullptr);
+  if (block_layout_pass_) {
+    // Profiles gathered by the baseline code of this run take precedence.
+    const BranchProfile* profile = &function->branch_profile();
+    if (!profile->has_counts()) {
+      profile = frontend_->processor()->LookupSavedBranchProfile(
+          function->address());
+    }
+    block_layout_pass_->set_profile(profile);
+  }
+  if (!compiler->Compile(builder_.get())) {
     return false;
   }
+  if (cvars::log_register_allocation_stats && compiler == compiler_.get()) {
+    auto& stats = register_allocation_pass_->stats();
+    XELOGI(
+        "{:08X}: {} spills, {} reloads, {} moves ({} coalesced), {} locals in "
+        "registers, {} on the stack",
+        function->address(), stats.spills, stats.reloads, stats.moves,
+        stats.coalesced_moves, stats.register_locals, stats.stack_locals);
+  }
+  if (cvars::log_block_layout_stats && block_layout_pass_ &&
+      compiler == compiler_.get()) {
+    auto& stats = block_layout_pass_->stats();
+    if (stats.profiled_branches) {
+      XELOGI(
+          "{:08X}: {} of {} blocks cold, {} loop heads; hot side falling "
+          "through in {} -> {} of {} profiled branches, {} -> {} profiled "
+          "jumps",
+          function->address(), stats.cold_blocks, stats.blocks,
+          stats.loop_heads, stats.hot_fallthroughs_before,
+          stats.hot_fallthroughs_after, stats.profiled_branches,
+          stats.jumps_before, stats.jumps_after);
+    }
+  }
 
   // Stash optimized HIR.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmHir) {
@@ -17,6 +17,17 @@
 #include "xenia/cpu/compiler/compiler.h"
 #include "xenia/cpu/function.h"
 
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+class BlockLayoutPass;
+class RegisterAllocationPass;
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
 namespace xe {
 namespace cpu {
 namespace ppc {
@@ -30,7 +41,10 @@ class PPCTranslator {
   explicit PPCTranslator(PPCFrontend* frontend);
   ~PPCTranslator();
 
-  bool Translate(GuestFunction* function, uint32_t debug_info_flags);
+  // Compiles the function at the baseline tier if tiered compilation is
+  // enabled, unless optimize is set.
+  bool Translate(GuestFunction* function, uint32_t debug_info_flags,
+                 bool optimize = false);
 
  private:
   void DumpSource(GuestFunction* function, StringBuffer* string_buffer);
@@ -39,6 +53,10 @@ class PPCTranslator {
   std::unique_ptr<PPCScanner> scanner_;
   std::unique_ptr<PPCHIRBuilder> builder_;
   std::unique_ptr<compiler::Compiler> compiler_;
+  std::unique_ptr<compiler::Compiler> baseline_compiler_;
+  // Owned by compiler_.
+  compiler::passes::RegisterAllocationPass* register_allocation_pass_ = nullptr;
+  compiler::passes::BlockLayoutPass* block_layout_pass_ = nullptr;
   std::unique_ptr<backend::Assembler> assembler_;
 
   StringBuffer string_buffer_;
@@ -0,0 +1,8 @@
+test_vavgsw_1:
+  #_ REGISTER_IN v3 [00000001, FFFFFFFF, 80000000, 7FFFFFFF]
+  #_ REGISTER_IN v4 [00000002, FFFFFFFE, 7FFFFFFF, 7FFFFFFF]
+  vavgsw v5, v3, v4
+  blr
+  #_ REGISTER_OUT v3 [00000001, FFFFFFFF, 80000000, 7FFFFFFF]
+  #_ REGISTER_OUT v4 [00000002, FFFFFFFE, 7FFFFFFF, 7FFFFFFF]
+  #_ REGISTER_OUT v5 [00000002, FFFFFFFF, 00000000, 7FFFFFFF]
@@ -4,3 +4,17 @@ test_vexptefp_1:
   blr
   #_ REGISTER_OUT v3 [40000000, 40400000, 40800000, 40A00000]
   #_ REGISTER_OUT v4 [40800000, 41000000, 41800000, 42000000]
+
+test_vexptefp_2:
+  #_ REGISTER_IN v3 [BF800000, 00000000, 41200000, C1200000]
+  vexptefp v4, v3
+  blr
+  #_ REGISTER_OUT v3 [BF800000, 00000000, 41200000, C1200000]
+  #_ REGISTER_OUT v4 [3F000000, 3F800000, 44800000, 3A800000]
+
+test_vexptefp_3:
+  #_ REGISTER_IN v3 [FF800000, 7F800000, 43000000, C3200000]
+  vexptefp v4, v3
+  blr
+  #_ REGISTER_OUT v3 [FF800000, 7F800000, 43000000, C3200000]
+  #_ REGISTER_OUT v4 [00000000, 7F800000, 7F800000, 00000000]
@@ -0,0 +1,13 @@
+test_vlogefp_1:
+  #_ REGISTER_IN v3 [3F800000, 40000000, 3E800000, 44800000]
+  vlogefp v4, v3
+  blr
+  #_ REGISTER_OUT v3 [3F800000, 40000000, 3E800000, 44800000]
+  #_ REGISTER_OUT v4 [00000000, 3F800000, C0000000, 41200000]
+
+test_vlogefp_2:
+  #_ REGISTER_IN v3 [00000000, 80000000, BF800000, 7F800000]
+  vlogefp v4, v3
+  blr
+  #_ REGISTER_OUT v3 [00000000, 80000000, BF800000, 7F800000]
+  #_ REGISTER_OUT v4 [FF800000, FF800000, 7FC00000, 7F800000]
@@ -0,0 +1,8 @@
+test_vrlw_1:
+  #_ REGISTER_IN v3 [12345678, 87654321, FFFFFFFF, 80000001]
+  #_ REGISTER_IN v4 [00000004, 0000001F, 00000021, FFFFFFE7]
+  vrlw v5, v3, v4
+  blr
+  #_ REGISTER_OUT v3 [12345678, 87654321, FFFFFFFF, 80000001]
+  #_ REGISTER_OUT v4 [00000004, 0000001F, 00000021, FFFFFFE7]
+  #_ REGISTER_OUT v5 [23456781, C3B2A190, FFFFFFFF, 000000C0]
@@ -0,0 +1,8 @@
+test_vsrab_1:
+  #_ REGISTER_IN v3 [12345678, 87654321, 11223344, F5807FFF]
+  #_ REGISTER_IN v4 [00010203, 04050607, 08090A0B, FC0D0E0F]
+  vsrab v5, v3, v4
+  blr
+  #_ REGISTER_OUT v3 [12345678, 87654321, 11223344, F5807FFF]
+  #_ REGISTER_OUT v4 [00010203, 04050607, 08090A0B, FC0D0E0F]
+  #_ REGISTER_OUT v5 [121A150F, F8030100, 11110C08, FFFC01FF]
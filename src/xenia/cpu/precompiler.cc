@@ -0,0 +1,253 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/precompiler.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/base/logging.h"
+#include "xenia/cpu/function.h"
+#include "xenia/cpu/module.h"
+#include "xenia/cpu/processor.h"
+
+namespace xe {
+namespace cpu {
+
+namespace {
+
+uint64_t QueryMicroseconds() {
+  return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count());
+}
+
+}  // namespace
+
+Precompiler::Precompiler(Processor* processor, Module* module)
+    : processor_(processor), module_(module) {}
+
+Precompiler::~Precompiler() { Stop(); }
+
+bool Precompiler::Start(uint32_t entry_point,
+                        const std::vector<uint32_t>& other_roots,
+                        uint32_t thread_count) {
+  if (running_ || !thread_count) {
+    return false;
+  }
+
+  size_t root_count;
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    stopping_ = false;
+    if (entry_point && module_->ContainsAddress(entry_point)) {
+      reachable_queue_.push_back(entry_point);
+      seen_addresses_.insert(entry_point);
+    }
+    for (uint32_t address : other_roots) {
+      if (module_->ContainsAddress(address) &&
+          seen_addresses_.insert(address).second) {
+        other_queue_.push_back(address);
+        other_pending_.insert(address);
+      }
+    }
+    if (reachable_queue_.empty() && other_queue_.empty()) {
+      return false;
+    }
+    // The workers add to seen_addresses_ once started.
+    root_count = seen_addresses_.size();
+  }
+
+  start_time_us_ = QueryMicroseconds();
+  start_demand_compiles_ = processor_->demand_compile_count();
+  running_ = true;
+  live_workers_ = thread_count;
+
+  xe::threading::Thread::CreationParameters params;
+  params.create_suspended = true;
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    auto thread = xe::threading::Thread::Create(params, [this]() {
+      WorkerMain();
+      OnWorkerFinished();
+    });
+    if (!thread) {
+      --live_workers_;
+      continue;
+    }
+    thread->set_name(fmt::format("Precompiler {}", i));
+    thread->set_priority(xe::threading::ThreadPriority::kBelowNormal);
+    thread->Resume();
+    workers_.push_back(std::move(thread));
+  }
+  if (workers_.empty()) {
+    running_ = false;
+    return false;
+  }
+
+  XELOGI("Precompiler: compiling {} from {} roots on {} threads",
+         module_->name(), root_count, workers_.size());
+  return true;
+}
+
+void Precompiler::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    stopping_ = true;
+    reachable_queue_.clear();
+    other_queue_.clear();
+    other_pending_.clear();
+  }
+  queue_cond_.notify_all();
+  for (auto& worker : workers_) {
+    xe::threading::Wait(worker.get(), false);
+  }
+  workers_.clear();
+}
+
+Precompiler::Stats Precompiler::QueryStats() {
+  Stats stats;
+  stats.functions_compiled = functions_compiled_;
+  stats.functions_failed = functions_failed_;
+  // Our own compilations go through the same path as the guest demands.
+  uint32_t demand_compiles =
+      processor_->demand_compile_count() - start_demand_compiles_;
+  stats.guest_demand_compiles =
+      demand_compiles -
+      std::min(demand_compiles,
+               stats.functions_compiled + stats.functions_failed);
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    stats.functions_pending =
+        uint32_t(reachable_queue_.size() + other_pending_.size());
+  }
+  stats.compile_time_us = compile_time_us_;
+  return stats;
+}
+
+bool Precompiler::PopAddress(uint32_t* out_address) {
+  std::unique_lock<std::mutex> lock(queue_mutex_);
+  // Wait while the queues are empty but another worker may still discover
+  // new call targets.
+  queue_cond_.wait(lock, [this]() {
+    return stopping_ || !reachable_queue_.empty() || !other_pending_.empty() ||
+           !busy_workers_;
+  });
+  if (stopping_) {
+    return false;
+  }
+  if (!reachable_queue_.empty()) {
+    *out_address = reachable_queue_.front();
+    reachable_queue_.pop_front();
+    ++busy_workers_;
+    return true;
+  }
+  while (!other_queue_.empty()) {
+    uint32_t address = other_queue_.front();
+    other_queue_.pop_front();
+    // Entries promoted to the reachable queue are left behind as stale.
+    if (other_pending_.erase(address)) {
+      *out_address = address;
+      ++busy_workers_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void Precompiler::WorkerMain() {
+  uint32_t address;
+  while (PopAddress(&address)) {
+    // Skip anything a guest thread (or another module load) got to first, but
+    // still follow its calls.
+    auto function = processor_->QueryFunction(address);
+    if (!function) {
+      uint64_t start_us = QueryMicroseconds();
+      function = processor_->ResolveFunction(address);
+      if (function) {
+        compile_time_us_ += QueryMicroseconds() - start_us;
+        ++functions_compiled_;
+      } else {
+        ++functions_failed_;
+      }
+    }
+    if (function && function->is_guest()) {
+      EnqueueCallTargets(static_cast<GuestFunction*>(function));
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      --busy_workers_;
+    }
+    queue_cond_.notify_all();
+  }
+}
+
+void Precompiler::EnqueueCallTargets(GuestFunction* function) {
+  if (!function->has_end_address()) {
+    return;
+  }
+  auto memory = processor_->memory();
+  std::vector<uint32_t> targets;
+  for (uint32_t address = function->address();
+       address <= function->end_address(); address += 4) {
+    uint32_t code =
+        xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    // bl / bla: primary opcode 18 with LK set.
+    if ((code >> 26) != 18 || !(code & 1)) {
+      continue;
+    }
+    uint32_t li = code & 0x03FFFFFC;
+    if (li & 0x02000000) {
+      li |= 0xFC000000;
+    }
+    uint32_t target = (code & 2) ? li : address + li;
+    if (module_->ContainsAddress(target)) {
+      targets.push_back(target);
+    }
+  }
+  if (targets.empty()) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    if (stopping_) {
+      return;
+    }
+    for (uint32_t target : targets) {
+      if (seen_addresses_.insert(target).second) {
+        reachable_queue_.push_back(target);
+      } else if (other_pending_.erase(target)) {
+        // Promote functions we only knew from .pdata.
+        reachable_queue_.push_back(target);
+      }
+    }
+  }
+  queue_cond_.notify_all();
+}
+
+void Precompiler::OnWorkerFinished() {
+  if (--live_workers_) {
+    return;
+  }
+  auto stats = QueryStats();
+  XELOGI(
+      "Precompiler: finished {} in {} ms - {} functions compiled, {} failed, "
+      "{} compiled on demand by guest threads, {} ms of compilation moved off "
+      "guest threads",
+      module_->name(), (QueryMicroseconds() - start_time_us_) / 1000,
+      stats.functions_compiled, stats.functions_failed,
+      stats.guest_demand_compiles, stats.compile_time_us / 1000);
+  running_ = false;
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,107 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_PRECOMPILER_H_
+#define XENIA_CPU_PRECOMPILER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace cpu {
+
+class GuestFunction;
+class Module;
+class Processor;
+
+// Speculatively compiles the functions of a freshly loaded module on a small
+// pool of background threads so that guest threads find most of their code
+// already translated.
+//
+// Functions reachable from the entry point through direct calls are compiled
+// first, followed by everything else listed in the module's .pdata section.
+// Compilation goes through Processor::ResolveFunction, so a guest thread that
+// demands a function currently being precompiled simply waits for it, and one
+// that demands a function not yet reached compiles it itself as usual.
+class Precompiler {
+ public:
+  struct Stats {
+    // Functions compiled by the precompiler threads.
+    uint32_t functions_compiled;
+    // Functions the precompiler attempted but failed to compile.
+    uint32_t functions_failed;
+    // Functions guest threads had to compile themselves while the precompiler
+    // was running (misses).
+    uint32_t guest_demand_compiles;
+    // Functions still waiting in the queues.
+    uint32_t functions_pending;
+    // Total compilation time spent on precompiler threads, which would
+    // otherwise have been spent stalling guest threads.
+    uint64_t compile_time_us;
+  };
+
+  Precompiler(Processor* processor, Module* module);
+  ~Precompiler();
+
+  Module* module() const { return module_; }
+  bool is_running() const { return running_; }
+
+  // Starts compiling the given roots with thread_count worker threads.
+  // entry_point may be 0 if the module has none.
+  bool Start(uint32_t entry_point, const std::vector<uint32_t>& other_roots,
+             uint32_t thread_count);
+  // Drops all pending work and waits for the workers to exit.
+  void Stop();
+
+  Stats QueryStats();
+
+ private:
+  void WorkerMain();
+  bool PopAddress(uint32_t* out_address);
+  // Queues the targets of all direct calls made by the function.
+  void EnqueueCallTargets(GuestFunction* function);
+  void OnWorkerFinished();
+
+  Processor* processor_ = nullptr;
+  Module* module_ = nullptr;
+
+  std::mutex queue_mutex_;
+  std::condition_variable queue_cond_;
+  // Functions reachable from the entry point; always drained first.
+  std::deque<uint32_t> reachable_queue_;
+  // Functions only known from .pdata.
+  std::deque<uint32_t> other_queue_;
+  std::unordered_set<uint32_t> other_pending_;
+  std::unordered_set<uint32_t> seen_addresses_;
+  uint32_t busy_workers_ = 0;
+  bool stopping_ = false;
+
+  std::vector<std::unique_ptr<xe::threading::Thread>> workers_;
+  std::atomic<uint32_t> live_workers_ = {0};
+  std::atomic<bool> running_ = {false};
+
+  std::atomic<uint32_t> functions_compiled_ = {0};
+  std::atomic<uint32_t> functions_failed_ = {0};
+  std::atomic<uint64_t> compile_time_us_ = {0};
+  uint64_t start_time_us_ = 0;
+  uint32_t start_demand_compiles_ = 0;
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_PRECOMPILER_H_
@@ -9,6 +9,9 @@
 
 #include "xenia/cpu/processor.h"
 
+#include <algorithm>
+#include <chrono>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/atomic.h"
 #include "xenia/base/byte_order.h"
@@ -20,12 +23,16 @@
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/threading.h"
+#include "xenia/cpu/backend/code_cache.h"
 #include "xenia/cpu/breakpoint.h"
+#include "xenia/cpu/compiler/pass_statistics.h"
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/module.h"
 #include "xenia/cpu/ppc/ppc_decode_data.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
+#include "xenia/cpu/precompiler.h"
+#include "xenia/cpu/sampling_profiler.h"
 #include "xenia/cpu/stack_walker.h"
 #include "xenia/cpu/thread.h"
 #include "xenia/cpu/thread_state.h"
@@ -82,8 +89,37 @@ Processor::Processor(xe::Memory* memory, ExportResolver* export_resolver)
     : memory_(memory), export_resolver_(export_resolver) {}
 
 Processor::~Processor() {
+  // The profile refers to the functions of the modules.
+  if (sampling_profiler_) {
+    sampling_profiler_->Stop();
+    sampling_profiler_->Write(cvars::sampling_profile_path);
+    sampling_profiler_.reset();
+  }
+
+  // Background compilation threads must be gone before the modules they
+  // compile.
+  precompilers_.clear();
+  ShutdownTierUp();
+
+  auto mmio_handler = MMIOHandler::global_handler();
+  if (mmio_handler) {
+    mmio_handler->SetFaultCallback(nullptr, nullptr);
+  }
+  if (cvars::log_mmio_sites) {
+    LogMmioSites();
+  }
+
+  if (!cvars::branch_profile_path.empty()) {
+    WriteBranchProfiles(cvars::branch_profile_path);
+  }
+
   {
-    auto global_lock = global_critical_region_.Acquire();
+    std::lock_guard<std::mutex> lock(modules_mutex_);
+    for (auto& module : modules_) {
+      if (module->pass_statistics()) {
+        module->pass_statistics()->Dump(module->name());
+      }
+    }
     modules_.clear();
   }
 
@@ -146,6 +182,26 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
         functions_trace_path_, 32 * 1024 * 1024, true);
   }
 
+  if (!cvars::branch_profile_path.empty()) {
+    BranchProfile::ReadFile(cvars::branch_profile_path,
+                            &saved_branch_profiles_);
+  }
+
+  // Loads and stores faulting on MMIO ranges are counted, and recompiled to
+  // call the ranges directly once they fault often.
+  auto mmio_handler = MMIOHandler::global_handler();
+  if (mmio_handler) {
+    mmio_handler->SetFaultCallback(MmioFaultCallbackThunk, this);
+  }
+
+  if (cvars::sampling_profiler) {
+    sampling_profiler_ = std::make_unique<SamplingProfiler>(this);
+    if (!sampling_profiler_->Start(std::chrono::microseconds(
+            std::max(cvars::sampling_profiler_interval_us, 1)))) {
+      sampling_profiler_.reset();
+    }
+  }
+
   return true;
 }
 
@@ -162,13 +218,13 @@ void Processor::PreLaunch() {
 }
 
 bool Processor::AddModule(std::unique_ptr<Module> module) {
-  auto global_lock = global_critical_region_.Acquire();
+  std::lock_guard<std::mutex> lock(modules_mutex_);
   modules_.push_back(std::move(module));
   return true;
 }
 
 Module* Processor::GetModule(const std::string_view name) {
-  auto global_lock = global_critical_region_.Acquire();
+  std::lock_guard<std::mutex> lock(modules_mutex_);
   for (const auto& module : modules_) {
     if (module->name() == name) {
       return module.get();
@@ -178,7 +234,7 @@ Module* Processor::GetModule(const std::string_view name) {
 }
 
 std::vector<Module*> Processor::GetModules() {
-  auto global_lock = global_critical_region_.Acquire();
+  std::lock_guard<std::mutex> lock(modules_mutex_);
   std::vector<Module*> clone(modules_.size());
   for (const auto& module : modules_) {
     clone.push_back(module.get());
@@ -221,38 +277,321 @@ Function* Processor::ResolveFunction(uint32_t address) {
   Entry::Status status = entry_table_.GetOrCreate(address, &entry);
   if (status == Entry::STATUS_NEW) {
     // Needs to be generated. We have the 'lock' on it and must do so now.
+    ++demand_compile_count_;
 
     // Grab symbol declaration.
     auto function = LookupFunction(address);
     if (!function) {
-      entry->status = Entry::STATUS_FAILED;
+      entry_table_.Complete(entry, Entry::STATUS_FAILED);
       return nullptr;
     }
 
     if (!DemandFunction(function)) {
-      entry->status = Entry::STATUS_FAILED;
+      entry_table_.Complete(entry, Entry::STATUS_FAILED);
       return nullptr;
     }
     entry->function = function;
     entry->end_address = function->end_address();
-    status = entry->status = Entry::STATUS_READY;
+    status = Entry::STATUS_READY;
+    entry_table_.Complete(entry, status);
   }
   if (status == Entry::STATUS_READY) {
-    // Ready to use.
-    return entry->function;
+    // Ready to use, unless invalidated since.
+    auto function = entry->function;
+    if (function->is_guest() &&
+        !static_cast<GuestFunction*>(function)->machine_code() &&
+        !DemandFunction(function)) {
+      return nullptr;
+    }
+    return function;
   } else {
     // Failed or bad state.
     return nullptr;
   }
 }
 
+void Processor::InvalidateFunctions(uint32_t low, uint32_t high) {
+  auto functions = entry_table_.FindInRange(low, high);
+  {
+    // Callers still being translated have recorded the call before reading
+    // the callee, and are waited for below.
+    std::lock_guard<std::mutex> lock(inlined_callees_mutex_);
+    auto it = inlined_callees_.begin();
+    while (it != inlined_callees_.end() && it->first < high) {
+      if (it->second.end_address < low) {
+        ++it;
+        continue;
+      }
+      functions.insert(functions.end(), it->second.callers.begin(),
+                       it->second.callers.end());
+      // Recorded again when they're translated anew.
+      it = inlined_callees_.erase(it);
+    }
+  }
+  std::sort(functions.begin(), functions.end());
+  functions.erase(std::unique(functions.begin(), functions.end()),
+                  functions.end());
+
+  uint32_t invalidated_count = 0;
+  for (auto function : functions) {
+    if (!function->is_guest()) {
+      continue;
+    }
+    // Wait for any translation in progress (including tier-up) to finish,
+    // and keep others from starting until the function is declared again.
+    if (function->module()->RedefineFunction(function) !=
+        Symbol::Status::kNew) {
+      continue;
+    }
+    backend_->InvalidateFunction(static_cast<GuestFunction*>(function));
+    function->set_status(Symbol::Status::kDeclared);
+    ++invalidated_count;
+  }
+  if (invalidated_count) {
+    XELOGI("Invalidated {} functions in {:08X}-{:08X}", invalidated_count, low,
+           high);
+  }
+}
+
+void Processor::AddInlinedCall(GuestFunction* caller, GuestFunction* callee) {
+  std::lock_guard<std::mutex> lock(inlined_callees_mutex_);
+  auto& inlined_callee = inlined_callees_[callee->address()];
+  inlined_callee.end_address = callee->end_address();
+  auto& callers = inlined_callee.callers;
+  if (std::find(callers.begin(), callers.end(), caller) == callers.end()) {
+    callers.push_back(caller);
+  }
+}
+
+void Processor::PrecompileModule(
+    Module* module, uint32_t entry_point,
+    const std::vector<uint32_t>& function_addresses) {
+  int32_t thread_count = cvars::precompile_threads;
+  if (thread_count < 0) {
+    // Leave most of the host to the guest threads, which will be starting up
+    // at the same time.
+    thread_count = std::min(
+        4, std::max(1, int32_t(xe::threading::logical_processor_count()) / 2));
+  }
+  if (!thread_count) {
+    return;
+  }
+
+  auto precompiler = std::make_unique<Precompiler>(this, module);
+  if (!precompiler->Start(entry_point, function_addresses,
+                          uint32_t(thread_count))) {
+    return;
+  }
+  auto global_lock = global_critical_region_.Acquire();
+  precompilers_.push_back(std::move(precompiler));
+}
+
+void Processor::StopPrecompiling(Module* module) {
+  std::unique_ptr<Precompiler> precompiler;
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    auto it = std::find_if(
+        precompilers_.begin(), precompilers_.end(),
+        [module](const std::unique_ptr<Precompiler>& module_precompiler) {
+          return module_precompiler->module() == module;
+        });
+    if (it == precompilers_.end()) {
+      return;
+    }
+    precompiler = std::move(*it);
+    precompilers_.erase(it);
+  }
+  // The workers may be waiting for the global lock while translating.
+  precompiler->Stop();
+}
+
+void Processor::RequestTierUp(GuestFunction* function) {
+  if (!function->MarkTierUpRequested()) {
+    return;
+  }
+  QueueRecompile(function);
+}
+
+void Processor::QueueRecompile(GuestFunction* function) {
+  {
+    std::lock_guard<std::mutex> lock(tier_up_mutex_);
+    if (tier_up_shutdown_) {
+      return;
+    }
+    tier_up_queue_.push_back(function);
+    if (!tier_up_thread_) {
+      tier_up_thread_ = xe::threading::Thread::Create(
+          {}, [this]() { TierUpThreadMain(); });
+      if (!tier_up_thread_) {
+        XELOGE("Unable to create the tier-up compilation thread");
+        tier_up_queue_.clear();
+        tier_up_shutdown_ = true;
+        return;
+      }
+      tier_up_thread_->set_name("Tier-up Compiler");
+    }
+  }
+  tier_up_cond_.notify_one();
+}
+
+void Processor::TierUpThreadMain() {
+  while (true) {
+    GuestFunction* function;
+    {
+      std::unique_lock<std::mutex> lock(tier_up_mutex_);
+      tier_up_cond_.wait(lock, [this]() {
+        return tier_up_shutdown_ || !tier_up_queue_.empty();
+      });
+      if (tier_up_shutdown_) {
+        return;
+      }
+      function = tier_up_queue_.front();
+      tier_up_queue_.pop_front();
+    }
+
+    // Keep the function from being invalidated meanwhile. Skip it if it
+    // already has been.
+    if (function->module()->RedefineFunction(function) !=
+        Symbol::Status::kNew) {
+      continue;
+    }
+
+    // Threads may still be running the baseline code, so it's only retired
+    // when assembling, to be reclaimed once no thread is running it.
+    auto start = std::chrono::steady_clock::now();
+    bool optimized = frontend_->OptimizeFunction(function, debug_info_flags_);
+    if (optimized) {
+      // Carry breakpoints over to the new code.
+      OnFunctionDefined(function);
+    }
+    function->set_status(Symbol::Status::kDefined);
+    if (!optimized) {
+      XELOGW("Unable to recompile function {:08X}, keeping baseline code",
+             function->address());
+      continue;
+    }
+
+    std::lock_guard<std::mutex> lock(tier_up_mutex_);
+    ++tier_up_count_;
+    tier_up_time_us_ += uint64_t(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count());
+  }
+}
+
+void Processor::ShutdownTierUp() {
+  {
+    std::lock_guard<std::mutex> lock(tier_up_mutex_);
+    tier_up_shutdown_ = true;
+    tier_up_queue_.clear();
+  }
+  tier_up_cond_.notify_all();
+  if (tier_up_thread_) {
+    xe::threading::Wait(tier_up_thread_.get(), false);
+    tier_up_thread_.reset();
+  }
+  if (tier_up_count_) {
+    XELOGI("Recompiled {} functions with all optimizations in {} ms",
+           tier_up_count_, tier_up_time_us_ / 1000);
+  }
+}
+
+void Processor::MmioFaultCallbackThunk(void* context, uint64_t host_pc,
+                                       const MMIORange* range) {
+  reinterpret_cast<Processor*>(context)->OnMmioFault(host_pc, range);
+}
+
+void Processor::OnMmioFault(uint64_t host_pc, const MMIORange* range) {
+  auto function = backend_->code_cache()->LookupFunction(host_pc);
+  if (!function) {
+    return;
+  }
+  // Code the function has replaced will be gone soon anyway.
+  auto code = function->code();
+  if (!code || host_pc - reinterpret_cast<uintptr_t>(code->machine_code) >=
+                   code->machine_code_length) {
+    return;
+  }
+  uint32_t guest_address = function->MapMachineCodeToGuestAddress(host_pc);
+
+  bool recompile = false;
+  {
+    std::lock_guard<std::mutex> lock(mmio_sites_mutex_);
+    auto& site =
+        mmio_sites_[(uint64_t(function->address()) << 32) | guest_address];
+    site.guest_address = guest_address;
+    site.function_address = function->address();
+    site.range = range;
+    ++site.fault_count;
+    if (cvars::specialize_mmio_access && !site.specialized &&
+        site.fault_count >=
+            uint64_t(std::max(cvars::mmio_specialize_threshold, 1))) {
+      site.specialized = true;
+      recompile = true;
+    }
+  }
+  if (recompile) {
+    // Baseline code won't request a tier-up anymore, as it's being done.
+    function->set_has_mmio_sites();
+    function->MarkTierUpRequested();
+    QueueRecompile(function);
+  }
+}
+
+std::vector<Processor::MmioSite> Processor::QueryMmioSites() {
+  std::vector<MmioSite> sites;
+  {
+    std::lock_guard<std::mutex> lock(mmio_sites_mutex_);
+    sites.reserve(mmio_sites_.size());
+    for (auto& it : mmio_sites_) {
+      sites.push_back(it.second);
+    }
+  }
+  std::stable_sort(sites.begin(), sites.end(),
+                   [](const MmioSite& a, const MmioSite& b) {
+                     return a.fault_count > b.fault_count;
+                   });
+  return sites;
+}
+
+std::unordered_map<uint32_t, const MMIORange*>
+Processor::GetMmioSpecializations(uint32_t function_address) {
+  std::unordered_map<uint32_t, const MMIORange*> ranges;
+  std::lock_guard<std::mutex> lock(mmio_sites_mutex_);
+  for (auto it = mmio_sites_.lower_bound(uint64_t(function_address) << 32);
+       it != mmio_sites_.end() &&
+       it->second.function_address == function_address;
+       ++it) {
+    if (it->second.specialized) {
+      ranges.emplace(it->second.guest_address, it->second.range);
+    }
+  }
+  return ranges;
+}
+
+void Processor::LogMmioSites() {
+  auto sites = QueryMmioSites();
+  if (sites.empty()) {
+    return;
+  }
+  const size_t kMaxLoggedSites = 32;
+  XELOGI("Loads and stores that faulted on MMIO ranges the most:");
+  for (size_t i = 0; i < std::min(sites.size(), kMaxLoggedSites); ++i) {
+    auto& site = sites[i];
+    XELOGI("  {:08X} (in {:08X}): {} faults on range {:08X}{}",
+           site.guest_address, site.function_address, site.fault_count,
+           site.range->address, site.specialized ? ", recompiled" : "");
+  }
+}
+
 Function* Processor::LookupFunction(uint32_t address) {
   // TODO(benvanik): fast reject invalid addresses/log errors.
 
   // Find the module that contains the address.
   Module* code_module = nullptr;
   {
-    auto global_lock = global_critical_region_.Acquire();
+    std::lock_guard<std::mutex> lock(modules_mutex_);
     // TODO(benvanik): sort by code address (if contiguous) so can bsearch.
     // TODO(benvanik): cache last module low/high, as likely to be in there.
     for (const auto& module : modules_) {
@@ -488,6 +827,50 @@ void Processor::OnThreadCreated(uint32_t thread_handle,
   thread_debug_infos_.emplace(thread_info->thread_id, std::move(thread_info));
 }
 
+void Processor::OnThreadEnter() {
+  if (sampling_profiler_) {
+    sampling_profiler_->OnThreadEnter();
+  }
+}
+
+void Processor::OnThreadLeave() {
+  if (sampling_profiler_) {
+    sampling_profiler_->OnThreadExit();
+  }
+}
+
+const BranchProfile* Processor::LookupSavedBranchProfile(
+    uint32_t address) const {
+  auto it = saved_branch_profiles_.find(address);
+  return it != saved_branch_profiles_.end() ? &it->second : nullptr;
+}
+
+void Processor::WriteBranchProfiles(const std::filesystem::path& path) {
+  std::map<uint32_t, const BranchProfile*> profiles;
+  for (auto& it : saved_branch_profiles_) {
+    profiles[it.first] = &it.second;
+  }
+  for (auto& module : modules_) {
+    module->ForEachFunction([&profiles](Function* function) {
+      if (!function->is_guest()) {
+        return;
+      }
+      auto& profile = static_cast<GuestFunction*>(function)->branch_profile();
+      if (profile.has_counts()) {
+        profiles[function->address()] = &profile;
+      }
+    });
+  }
+  BranchProfile::WriteFile(path, profiles);
+}
+
+bool Processor::WriteSamplingProfile(const std::filesystem::path& path) {
+  if (!sampling_profiler_) {
+    return false;
+  }
+  return sampling_profiler_->Write(path);
+}
+
 void Processor::OnThreadExit(uint32_t thread_id) {
   auto global_lock = global_critical_region_.Acquire();
   auto it = thread_debug_infos_.find(thread_id);
@@ -10,14 +10,20 @@
 #ifndef XENIA_CPU_PROCESSOR_H_
 #define XENIA_CPU_PROCESSOR_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/cvar.h"
 #include "xenia/base/mapped_memory.h"
 #include "xenia/base/mutex.h"
+#include "xenia/base/threading.h"
 #include "xenia/cpu/backend/backend.h"
 #include "xenia/cpu/debug_listener.h"
 #include "xenia/cpu/entry_table.h"
@@ -37,6 +43,8 @@ namespace cpu {
 constexpr fourcc_t kProcessorSaveSignature = make_fourcc("PROC");
 
 class Breakpoint;
+class Precompiler;
+class SamplingProfiler;
 class StackWalker;
 class XexModule;
 
@@ -115,6 +123,58 @@ class Processor {
   Function* LookupFunction(uint32_t address);
   Function* LookupFunction(Module* module, uint32_t address);
   Function* ResolveFunction(uint32_t address);
+  // Makes the guest functions starting in [low, high) get translated again
+  // the next time they are called, for when their guest code has changed or
+  // is being unloaded, along with the functions that have inlined any of
+  // them. Their old code is reclaimed by the backend once no thread is running
+  // it anymore.
+  void InvalidateFunctions(uint32_t low, uint32_t high);
+  // Records that the code of caller includes the code of callee, before the
+  // callee's guest code is emitted into it.
+  void AddInlinedCall(GuestFunction* caller, GuestFunction* callee);
+
+  // Starts compiling the functions of a loaded module in the background,
+  // beginning with those reachable from the entry point (if any) and then the
+  // other given function addresses.
+  void PrecompileModule(Module* module, uint32_t entry_point,
+                        const std::vector<uint32_t>& function_addresses);
+  // Stops compiling the functions of a module in the background, waiting for
+  // the compilations in progress, before the module is unloaded.
+  void StopPrecompiling(Module* module);
+  // Number of functions compiled through ResolveFunction so far.
+  uint32_t demand_compile_count() const { return demand_compile_count_; }
+
+  // Queues a baseline-compiled function for recompilation with all
+  // optimizations. The new code replaces the old one in the indirection table
+  // once ready. Called from generated code, so it must not block.
+  void RequestTierUp(GuestFunction* function);
+
+  // A guest load or store whose host code faulted on an MMIO range.
+  struct MmioSite {
+    uint32_t guest_address;
+    // Function the code was compiled for, which differs from the one
+    // containing guest_address if it was inlined.
+    uint32_t function_address;
+    const MMIORange* range;
+    uint64_t fault_count;
+    // Whether the function has been queued for recompilation with the
+    // access calling the range directly.
+    bool specialized;
+  };
+  // Sites with the most faults first.
+  std::vector<MmioSite> QueryMmioSites();
+  // Ranges to call directly from the loads and stores of the function, by
+  // the guest address of the instruction.
+  std::unordered_map<uint32_t, const MMIORange*> GetMmioSpecializations(
+      uint32_t function_address);
+
+  // Branch profile of the function saved by an earlier run to
+  // branch_profile_path, or nullptr.
+  const BranchProfile* LookupSavedBranchProfile(uint32_t address) const;
+
+  // Writes what the sampling profiler has collected so far. Returns false if
+  // it isn't running.
+  bool WriteSamplingProfile(const std::filesystem::path& path);
 
   bool Execute(ThreadState* thread_state, uint32_t address);
   bool ExecuteRaw(ThreadState* thread_state, uint32_t address);
@@ -190,6 +250,10 @@ class Processor {
   // TODO(benvanik): hide.
   void OnThreadCreated(uint32_t handle, ThreadState* thread_state,
                        Thread* thread);
+  // Called on guest threads themselves once they start running and before
+  // they exit, for the sampling profiler.
+  void OnThreadEnter();
+  void OnThreadLeave();
   void OnThreadExit(uint32_t thread_id);
   void OnThreadDestroyed(uint32_t thread_id);
   void OnThreadEnteringWait(uint32_t thread_id);
@@ -237,6 +301,20 @@ class Processor {
 
   bool DemandFunction(Function* function);
 
+  // Queues a function for the tier-up thread to recompile, even if it has
+  // been already.
+  void QueueRecompile(GuestFunction* function);
+  void TierUpThreadMain();
+  void ShutdownTierUp();
+  // Saves the branch profiles of the functions run so far, and of those that
+  // weren't from the earlier runs.
+  void WriteBranchProfiles(const std::filesystem::path& path);
+
+  static void MmioFaultCallbackThunk(void* context, uint64_t host_pc,
+                                     const MMIORange* range);
+  void OnMmioFault(uint64_t host_pc, const MMIORange* range);
+  void LogMmioSites();
+
   Memory* memory_ = nullptr;
   std::unique_ptr<StackWalker> stack_walker_;
 
@@ -248,6 +326,9 @@ class Processor {
   // If specified, the file trace data gets written to when running.
   std::filesystem::path functions_trace_path_;
   std::unique_ptr<ChunkedMappedMemoryWriter> functions_trace_file_;
+  std::unique_ptr<SamplingProfiler> sampling_profiler_;
+  // Loaded on setup, never modified after.
+  std::unordered_map<uint32_t, BranchProfile> saved_branch_profiles_;
 
   std::unique_ptr<ppc::PPCFrontend> frontend_;
   std::unique_ptr<backend::Backend> backend_;
@@ -256,10 +337,38 @@ class Processor {
   EntryTable entry_table_;
   xe::global_critical_region global_critical_region_;
   ExecutionState execution_state_ = ExecutionState::kPaused;
+  // Guards modules_ only, as every function resolution looks up its module.
+  std::mutex modules_mutex_;
   std::vector<std::unique_ptr<Module>> modules_;
   Module* builtin_module_ = nullptr;
   uint32_t next_builtin_address_ = 0xFFFF0000u;
 
+  // Functions that have inlined the function starting at the key address,
+  // which are invalidated along with it. Kept until then, even if their code
+  // has since been replaced without inlining it.
+  struct InlinedCallee {
+    uint32_t end_address;
+    std::vector<GuestFunction*> callers;
+  };
+  std::mutex inlined_callees_mutex_;
+  std::map<uint32_t, InlinedCallee> inlined_callees_;
+
+  std::vector<std::unique_ptr<Precompiler>> precompilers_;
+  std::atomic<uint32_t> demand_compile_count_ = {0};
+
+  // Background recompilation of hot baseline functions.
+  std::mutex tier_up_mutex_;
+  std::condition_variable tier_up_cond_;
+  std::deque<GuestFunction*> tier_up_queue_;
+  std::unique_ptr<xe::threading::Thread> tier_up_thread_;
+  bool tier_up_shutdown_ = false;
+  uint32_t tier_up_count_ = 0;
+  uint64_t tier_up_time_us_ = 0;
+
+  // By function address in the high 32 bits and guest address in the low.
+  std::mutex mmio_sites_mutex_;
+  std::map<uint64_t, MmioSite> mmio_sites_;
+
   // Maps thread ID to state. Updated on thread create, and threads are never
   // removed. Must be guarded with the global lock.
   std::map<uint32_t, std::unique_ptr<ThreadDebugInfo>> thread_debug_infos_;
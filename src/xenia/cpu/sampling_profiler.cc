@@ -0,0 +1,320 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/sampling_profiler.h"
+
+#include <algorithm>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/cpu/backend/backend.h"
+#include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/function.h"
+#include "xenia/cpu/processor.h"
+
+namespace xe {
+namespace cpu {
+
+thread_local SamplingProfiler::ThreadSamples*
+    SamplingProfiler::current_thread_samples_ = nullptr;
+
+namespace {
+
+const char* const kCategoryNames[] = {
+    "guest code",
+    "kernel exports",
+    "host thunks",
+    "other host code",
+};
+static_assert(xe::countof(kCategoryNames) ==
+                  size_t(SamplingProfiler::Category::kCount),
+              "Category names must match the categories");
+
+// How many of the hottest functions and instructions are logged.
+const size_t kFlatProfileLength = 32;
+
+template <typename Key, typename Value, typename Less>
+std::vector<std::pair<Key, Value>> SortedTop(
+    const std::unordered_map<Key, Value>& map, Less less) {
+  std::vector<std::pair<Key, Value>> entries(map.begin(), map.end());
+  size_t count = std::min(entries.size(), kFlatProfileLength);
+  std::partial_sort(entries.begin(), entries.begin() + count, entries.end(),
+                    less);
+  entries.resize(count);
+  return entries;
+}
+
+}  // namespace
+
+SamplingProfiler::SamplingProfiler(Processor* processor)
+    : processor_(processor) {}
+
+SamplingProfiler::~SamplingProfiler() { Stop(); }
+
+bool SamplingProfiler::Start(std::chrono::microseconds interval) {
+  interval_ = interval;
+  if (!InstallSampler()) {
+    return false;
+  }
+  aggregation_thread_ = xe::threading::Thread::Create(
+      {}, [this]() { AggregationThreadMain(); });
+  if (!aggregation_thread_) {
+    XELOGE("Unable to create the sampling profiler aggregation thread");
+    return false;
+  }
+  aggregation_thread_->set_name("Sampling Profiler");
+  XELOGI("Sampling guest threads every {} us of CPU time", interval.count());
+  return true;
+}
+
+void SamplingProfiler::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutdown_ = true;
+    for (auto& thread : threads_) {
+      StopThreadSampling(thread.get());
+      AggregateThread(thread.get());
+    }
+  }
+  aggregation_cond_.notify_all();
+  if (aggregation_thread_) {
+    xe::threading::Wait(aggregation_thread_.get(), false);
+    aggregation_thread_.reset();
+  }
+}
+
+void SamplingProfiler::OnThreadEnter() {
+  auto thread = std::make_unique<ThreadSamples>();
+  thread->profiler = this;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (shutdown_ || !StartThreadSampling(thread.get())) {
+    return;
+  }
+  current_thread_samples_ = thread.get();
+  threads_.push_back(std::move(thread));
+}
+
+void SamplingProfiler::OnThreadExit() {
+  auto thread = current_thread_samples_;
+  if (!thread) {
+    return;
+  }
+  // Samples still pending delivery are ignored from here on.
+  current_thread_samples_ = nullptr;
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  std::lock_guard<std::mutex> lock(mutex_);
+  StopThreadSampling(thread);
+  AggregateThread(thread);
+  auto it = std::find_if(
+      threads_.begin(), threads_.end(),
+      [thread](const std::unique_ptr<ThreadSamples>& registered_thread) {
+        return registered_thread.get() == thread;
+      });
+  if (it != threads_.end()) {
+    threads_.erase(it);
+  }
+}
+
+void SamplingProfiler::RecordSample(uint64_t host_pc, uint64_t host_sp) {
+  auto thread = current_thread_samples_;
+  if (!thread) {
+    return;
+  }
+  RecordThreadSample(thread, host_pc, host_sp);
+}
+
+void SamplingProfiler::RecordThreadSample(ThreadSamples* thread,
+                                          uint64_t host_pc, uint64_t host_sp) {
+  uint32_t write_index = thread->write_index.load(std::memory_order_relaxed);
+  if (write_index - thread->read_index.load(std::memory_order_acquire) >=
+      kRingSize) {
+    thread->dropped_count.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  Sample& sample = thread->ring[write_index % kRingSize];
+  sample.frame_count = uint32_t(
+      thread->profiler->processor_->backend()->CaptureStack(
+          host_pc, host_sp, thread->stack_high, sample.frame_host_pcs,
+          kMaxFrameCount));
+  thread->write_index.store(write_index + 1, std::memory_order_release);
+}
+
+void SamplingProfiler::AggregationThreadMain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!shutdown_) {
+    if (SampleThreads()) {
+      aggregation_cond_.wait_for(lock, interval_);
+    } else {
+      // Often enough for the rings not to fill up at the default interval.
+      aggregation_cond_.wait_for(lock, std::chrono::milliseconds(100));
+    }
+    for (auto& thread : threads_) {
+      AggregateThread(thread.get());
+    }
+  }
+}
+
+void SamplingProfiler::AggregateThread(ThreadSamples* thread) {
+  uint32_t read_index = thread->read_index.load(std::memory_order_relaxed);
+  uint32_t write_index = thread->write_index.load(std::memory_order_acquire);
+  for (; read_index != write_index; ++read_index) {
+    AggregateSample(thread->ring[read_index % kRingSize]);
+  }
+  thread->read_index.store(read_index, std::memory_order_release);
+  dropped_count_ += thread->dropped_count.exchange(0);
+}
+
+void SamplingProfiler::AggregateSample(const Sample& sample) {
+  if (!sample.frame_count) {
+    return;
+  }
+  auto code_cache = processor_->backend()->code_cache();
+  auto code_base = code_cache->execute_base_address();
+
+  // Guest functions of the frames, innermost first. Return addresses are
+  // looked up one byte back to land in the call.
+  GuestFunction* functions[kMaxFrameCount];
+  uint32_t guest_addresses[kMaxFrameCount];
+  size_t function_count = 0;
+  bool leaf_in_guest_code = false;
+  for (uint32_t i = 0; i < sample.frame_count; ++i) {
+    uint64_t host_pc = sample.frame_host_pcs[i] - (i ? 1 : 0);
+    auto function = code_cache->LookupFunction(host_pc);
+    if (!function) {
+      continue;
+    }
+    if (!i) {
+      leaf_in_guest_code = true;
+    }
+    functions[function_count] = function;
+    // Also maps code replaced by a recompilation that's still running.
+    guest_addresses[function_count] =
+        function->MapMachineCodeToGuestAddress(host_pc);
+    ++function_count;
+  }
+
+  uint64_t leaf_pc = sample.frame_host_pcs[0];
+  Category category;
+  const char* leaf_tag = nullptr;
+  if (leaf_in_guest_code) {
+    category = Category::kGuest;
+    ++function_counts_[functions[0]].self_count;
+    ++instruction_counts_[guest_addresses[0]];
+  } else if (leaf_pc - code_base < code_cache->total_size()) {
+    category = Category::kThunk;
+    leaf_tag = "[thunk]";
+  } else if (function_count &&
+             functions[0]->behavior() == Function::Behavior::kExtern) {
+    // Imports are called through stub functions, which run the export.
+    category = Category::kKernelExport;
+    leaf_tag = "[kernel]";
+    ++export_counts_[GetFunctionName(functions[0])];
+  } else {
+    category = Category::kHost;
+    leaf_tag = "[host]";
+  }
+  ++category_counts_[size_t(category)];
+
+  // Recursive functions are counted once per sample.
+  for (size_t i = 0; i < function_count; ++i) {
+    if (std::find(functions, functions + i, functions[i]) ==
+        functions + i) {
+      ++function_counts_[functions[i]].total_count;
+    }
+  }
+
+  std::string stack;
+  for (size_t i = function_count; i-- > 0;) {
+    if (!stack.empty()) {
+      stack += ';';
+    }
+    stack += GetFunctionName(functions[i]);
+  }
+  if (leaf_tag) {
+    if (!stack.empty()) {
+      stack += ';';
+    }
+    stack += leaf_tag;
+  }
+  ++folded_stacks_[stack];
+}
+
+std::string SamplingProfiler::GetFunctionName(GuestFunction* function) const {
+  if (function->name().empty()) {
+    return fmt::format("sub_{:08X}", function->address());
+  }
+  // Semicolons separate the frames of folded stacks.
+  std::string name = function->name();
+  std::replace(name.begin(), name.end(), ';', ':');
+  return name;
+}
+
+bool SamplingProfiler::Write(const std::filesystem::path& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& thread : threads_) {
+    AggregateThread(thread.get());
+  }
+
+  auto file = xe::filesystem::OpenFile(path, "w");
+  if (!file) {
+    XELOGE("Unable to open {} for writing the sampling profile",
+           xe::path_to_utf8(path));
+    return false;
+  }
+  for (auto& it : folded_stacks_) {
+    fmt::print(file, "{} {}\n", it.first, it.second);
+  }
+  fclose(file);
+
+  uint64_t sample_count = 0;
+  for (uint64_t count : category_counts_) {
+    sample_count += count;
+  }
+  XELOGI("Sampling profile of {} samples written to {} ({} dropped):",
+         sample_count, xe::path_to_utf8(path), dropped_count_);
+  if (!sample_count) {
+    return true;
+  }
+  auto percent = [sample_count](uint64_t count) {
+    return 100.0 * double(count) / double(sample_count);
+  };
+  for (size_t i = 0; i < size_t(Category::kCount); ++i) {
+    XELOGI("  {:<16} {:>10} {:>6.2f}%", kCategoryNames[i],
+           category_counts_[i], percent(category_counts_[i]));
+  }
+
+  XELOGI("  Hottest guest functions (self, total):");
+  for (auto& it : SortedTop(function_counts_, [](auto& a, auto& b) {
+         return a.second.self_count > b.second.self_count;
+       })) {
+    XELOGI("    {:08X} {:<40} {:>6.2f}% {:>6.2f}%", it.first->address(),
+           GetFunctionName(it.first), percent(it.second.self_count),
+           percent(it.second.total_count));
+  }
+  XELOGI("  Hottest guest instructions:");
+  for (auto& it : SortedTop(instruction_counts_, [](auto& a, auto& b) {
+         return a.second > b.second;
+       })) {
+    XELOGI("    {:08X} {:>6.2f}%", it.first, percent(it.second));
+  }
+  if (!export_counts_.empty()) {
+    XELOGI("  Hottest kernel exports:");
+    for (auto& it : SortedTop(export_counts_, [](auto& a, auto& b) {
+           return a.second > b.second;
+         })) {
+      XELOGI("    {:<49} {:>6.2f}%", it.first, percent(it.second));
+    }
+  }
+  return true;
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,156 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_SAMPLING_PROFILER_H_
+#define XENIA_CPU_SAMPLING_PROFILER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace cpu {
+
+class GuestFunction;
+class Processor;
+
+// Low-overhead profiler for guest code, unlike function tracing which
+// instruments every instruction.
+//
+// On Linux, a timer on the CPU time of each registered thread interrupts it
+// periodically, and the signal handler captures the host PC and the generated
+// code frames above it into a per-thread ring. On Windows, the background
+// thread instead suspends each registered thread that has run since the
+// previous interval and captures the same from its context. The background
+// thread maps the samples to guest functions and instructions through the
+// code cache and the source maps and aggregates them.
+//
+// Samples are split between generated guest code, kernel exports (host code
+// called through an import), host thunks in the code cache and other host
+// code.
+class SamplingProfiler {
+ public:
+  enum class Category {
+    kGuest,
+    kKernelExport,
+    kThunk,
+    kHost,
+    kCount,
+  };
+
+  explicit SamplingProfiler(Processor* processor);
+  ~SamplingProfiler();
+
+  // Starts sampling the threads registered from now on. Returns false if
+  // sampling isn't supported.
+  bool Start(std::chrono::microseconds interval);
+  // Stops sampling all threads and aggregates what remains.
+  void Stop();
+
+  // Must be called on the thread to be sampled.
+  void OnThreadEnter();
+  void OnThreadExit();
+
+  // Writes folded stacks of guest functions (outermost first, with a sample
+  // count per unique stack) and logs a flat profile of everything sampled so
+  // far.
+  bool Write(const std::filesystem::path& path);
+
+  // Called from the signal handler of the interrupted thread with its
+  // context.
+  static void RecordSample(uint64_t host_pc, uint64_t host_sp);
+
+ private:
+  static const size_t kMaxFrameCount = 32;
+  static const uint32_t kRingSize = 512;
+
+  struct Sample {
+    uint32_t frame_count;
+    // Innermost first.
+    uint64_t frame_host_pcs[kMaxFrameCount];
+  };
+  struct ThreadSamples {
+    SamplingProfiler* profiler = nullptr;
+    // Highest address of the host stack, bounding stack walks.
+    uint64_t stack_high = 0;
+    // Timer interrupting the thread, or handle of the thread where it's
+    // sampled from the aggregation thread.
+    void* handle = nullptr;
+    bool has_handle = false;
+    // CPU cycles of the thread at its latest sample, where it's sampled from
+    // the aggregation thread.
+    uint64_t cycle_time = 0;
+    // Written by the signal handler, read by the aggregation.
+    std::atomic<uint32_t> write_index = {0};
+    std::atomic<uint32_t> read_index = {0};
+    std::atomic<uint32_t> dropped_count = {0};
+    Sample ring[kRingSize];
+  };
+  struct FunctionCounts {
+    uint64_t self_count = 0;
+    uint64_t total_count = 0;
+  };
+
+  // Platform-specific.
+  bool InstallSampler();
+  // Called on the thread to be sampled. Also sets stack_high.
+  bool StartThreadSampling(ThreadSamples* thread);
+  // May be called again after sampling has been stopped.
+  void StopThreadSampling(ThreadSamples* thread);
+  // Samples the registered threads, if the platform samples them from the
+  // aggregation thread rather than from their own. Called there every
+  // interval with mutex_ held, so nothing may allocate while a thread is
+  // suspended. Returns false if the platform doesn't.
+  bool SampleThreads();
+
+  static void RecordThreadSample(ThreadSamples* thread, uint64_t host_pc,
+                                 uint64_t host_sp);
+
+  void AggregationThreadMain();
+  // Must be called with mutex_ held.
+  void AggregateThread(ThreadSamples* thread);
+  void AggregateSample(const Sample& sample);
+  std::string GetFunctionName(GuestFunction* function) const;
+
+  static thread_local ThreadSamples* current_thread_samples_;
+
+  Processor* processor_ = nullptr;
+  std::chrono::microseconds interval_;
+
+  std::unique_ptr<xe::threading::Thread> aggregation_thread_;
+  std::condition_variable aggregation_cond_;
+  bool shutdown_ = false;
+
+  // Guards everything below.
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadSamples>> threads_;
+  uint64_t category_counts_[size_t(Category::kCount)] = {};
+  uint64_t dropped_count_ = 0;
+  std::unordered_map<std::string, uint64_t> folded_stacks_;
+  std::unordered_map<GuestFunction*, FunctionCounts> function_counts_;
+  // Samples in each guest instruction, by guest address.
+  std::unordered_map<uint32_t, uint64_t> instruction_counts_;
+  // Samples in each kernel export, by the name of its import.
+  std::unordered_map<std::string, uint64_t> export_counts_;
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_SAMPLING_PROFILER_H_
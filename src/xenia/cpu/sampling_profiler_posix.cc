@@ -0,0 +1,112 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/sampling_profiler.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#include "xenia/base/logging.h"
+
+// Not exposed by older glibc versions.
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+namespace xe {
+namespace cpu {
+
+static_assert(sizeof(timer_t) <= sizeof(void*),
+              "timer_t must fit in ThreadSamples::handle");
+
+static void SamplingSignalHandler(int signal, siginfo_t* info,
+                                  void* context) {
+  int saved_errno = errno;
+  auto mcontext = &static_cast<ucontext_t*>(context)->uc_mcontext;
+  SamplingProfiler::RecordSample(uint64_t(mcontext->gregs[REG_RIP]),
+                                 uint64_t(mcontext->gregs[REG_RSP]));
+  errno = saved_errno;
+}
+
+bool SamplingProfiler::InstallSampler() {
+  struct sigaction action = {};
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  action.sa_sigaction = SamplingSignalHandler;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, nullptr) == -1) {
+    XELOGE("Unable to install the sampling profiler signal handler");
+    return false;
+  }
+  return true;
+}
+
+bool SamplingProfiler::StartThreadSampling(ThreadSamples* thread) {
+  pthread_attr_t attr;
+  if (pthread_getattr_np(pthread_self(), &attr)) {
+    return false;
+  }
+  void* stack_low;
+  size_t stack_size;
+  int result = pthread_attr_getstack(&attr, &stack_low, &stack_size);
+  pthread_attr_destroy(&attr);
+  if (result) {
+    return false;
+  }
+  thread->stack_high = uint64_t(uintptr_t(stack_low) + stack_size);
+
+  struct sigevent sev = {};
+  sev.sigev_notify = SIGEV_THREAD_ID;
+  sev.sigev_signo = SIGPROF;
+  sev.sigev_notify_thread_id = pid_t(syscall(SYS_gettid));
+  timer_t timer;
+  if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &timer) == -1) {
+    XELOGE("Unable to create a sampling profiler timer: {}",
+           std::strerror(errno));
+    return false;
+  }
+  std::memcpy(&thread->handle, &timer, sizeof(timer));
+  thread->has_handle = true;
+
+  auto seconds = std::chrono::duration_cast<std::chrono::seconds>(interval_);
+  struct itimerspec spec = {};
+  spec.it_interval.tv_sec = time_t(seconds.count());
+  spec.it_interval.tv_nsec = long(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(interval_ - seconds)
+          .count());
+  spec.it_value = spec.it_interval;
+  if (timer_settime(timer, 0, &spec, nullptr) == -1) {
+    StopThreadSampling(thread);
+    return false;
+  }
+  return true;
+}
+
+void SamplingProfiler::StopThreadSampling(ThreadSamples* thread) {
+  if (!thread->has_handle) {
+    return;
+  }
+  timer_t timer;
+  std::memcpy(&timer, &thread->handle, sizeof(timer));
+  timer_delete(timer);
+  thread->has_handle = false;
+}
+
+bool SamplingProfiler::SampleThreads() {
+  // The threads' own timers interrupt them.
+  return false;
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,85 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/sampling_profiler.h"
+
+#include "xenia/base/logging.h"
+#include "xenia/base/platform_win.h"
+
+namespace xe {
+namespace cpu {
+
+bool SamplingProfiler::InstallSampler() {
+  // There are no signals, the aggregation thread samples the threads.
+  return true;
+}
+
+bool SamplingProfiler::StartThreadSampling(ThreadSamples* thread) {
+  ULONG_PTR stack_low, stack_high;
+  GetCurrentThreadStackLimits(&stack_low, &stack_high);
+  thread->stack_high = uint64_t(stack_high);
+
+  HANDLE handle;
+  if (!DuplicateHandle(GetCurrentProcess(), GetCurrentThread(),
+                       GetCurrentProcess(), &handle,
+                       THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT |
+                           THREAD_QUERY_LIMITED_INFORMATION,
+                       FALSE, 0)) {
+    XELOGE("Unable to open a thread for the sampling profiler: {:08X}",
+           GetLastError());
+    return false;
+  }
+  ULONG64 cycle_time;
+  thread->cycle_time =
+      QueryThreadCycleTime(handle, &cycle_time) ? uint64_t(cycle_time) : 0;
+  thread->handle = handle;
+  thread->has_handle = true;
+  return true;
+}
+
+void SamplingProfiler::StopThreadSampling(ThreadSamples* thread) {
+  if (!thread->has_handle) {
+    return;
+  }
+  CloseHandle(thread->handle);
+  thread->has_handle = false;
+}
+
+bool SamplingProfiler::SampleThreads() {
+  for (auto& thread : threads_) {
+    if (!thread->has_handle) {
+      continue;
+    }
+    HANDLE handle = thread->handle;
+    // Threads that haven't run since their latest sample are skipped, like
+    // CPU time timers wouldn't have expired for them.
+    ULONG64 cycle_time;
+    if (!QueryThreadCycleTime(handle, &cycle_time) ||
+        uint64_t(cycle_time) == thread->cycle_time) {
+      continue;
+    }
+    thread->cycle_time = uint64_t(cycle_time);
+    // Fails once the thread has exited.
+    if (SuspendThread(handle) == DWORD(-1)) {
+      continue;
+    }
+    CONTEXT context;
+    context.ContextFlags = CONTEXT_CONTROL;
+    // Only returns once the thread is actually suspended.
+    if (GetThreadContext(handle, &context)) {
+      RecordThreadSample(thread.get(), uint64_t(context.Rip),
+                         uint64_t(context.Rsp));
+    }
+    ResumeThread(handle);
+  }
+  return true;
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,204 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/cpu/backend/x64/x64_code_cache.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace cpu {
+namespace test {
+
+using xe::cpu::backend::x64::EmitFunctionInfo;
+using xe::cpu::backend::x64::X64CodeCache;
+
+namespace {
+
+struct PlacedCode {
+  uint8_t* address;
+  size_t size;
+  uint8_t fill;
+};
+
+// Has every thread place pieces of code of varying sizes, as if they were
+// compiling different functions at the same time. Returns the placed code of
+// every thread.
+std::vector<std::vector<PlacedCode>> PlaceConcurrently(
+    X64CodeCache* code_cache, uint32_t thread_count, uint32_t code_count,
+    std::atomic<bool>* placing = nullptr) {
+  std::vector<std::vector<PlacedCode>> placed(thread_count);
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&, t]() {
+      std::vector<uint8_t> machine_code;
+      for (uint32_t i = 0; i < code_count; ++i) {
+        size_t size = 16 + ((i * 37 + t * 11) % 512);
+        uint8_t fill = uint8_t(t * 31 + i);
+        machine_code.assign(size, fill);
+        EmitFunctionInfo func_info = {};
+        func_info.code_size.body = size;
+        func_info.code_size.total = size;
+        void* execute_address;
+        void* write_address;
+        code_cache->PlaceHostCode(0, machine_code.data(), func_info,
+                                  execute_address, write_address);
+        placed[t].push_back(
+            {reinterpret_cast<uint8_t*>(execute_address), size, fill});
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  if (placing) {
+    *placing = false;
+  }
+  return placed;
+}
+
+std::unique_ptr<X64CodeCache> CreateCodeCache() {
+  auto code_cache = X64CodeCache::Create();
+  REQUIRE(code_cache->Initialize());
+  return code_cache;
+}
+
+}  // namespace
+
+TEST_CASE("CODE_CACHE_CONCURRENT_PLACE", "[code_cache]") {
+  auto code_cache = CreateCodeCache();
+
+  // Look up host addresses while code is being placed, as the sampling
+  // profiler and the exception handler do.
+  std::atomic<bool> placing = {true};
+  std::atomic<uint32_t> bad_lookup_count = {0};
+  std::thread reader([&]() {
+    while (placing) {
+      X64CodeCache::CodeFrameInfo frame;
+      if (code_cache->LookupCodeFrame(
+              code_cache->execute_base_address() + 0x100, &frame) &&
+          (reinterpret_cast<uintptr_t>(frame.code) >
+               code_cache->execute_base_address() + 0x100 ||
+           frame.function)) {
+        ++bad_lookup_count;
+      }
+    }
+  });
+  auto placed = PlaceConcurrently(code_cache.get(), 8, 1024, &placing);
+  reader.join();
+  REQUIRE(bad_lookup_count == 0);
+
+  std::vector<PlacedCode> all_placed;
+  for (auto& thread_placed : placed) {
+    all_placed.insert(all_placed.end(), thread_placed.begin(),
+                      thread_placed.end());
+  }
+  std::sort(all_placed.begin(), all_placed.end(),
+            [](const PlacedCode& a, const PlacedCode& b) {
+              return a.address < b.address;
+            });
+  for (size_t i = 0; i < all_placed.size(); ++i) {
+    auto& code = all_placed[i];
+    REQUIRE((reinterpret_cast<uintptr_t>(code.address) & 15) == 0);
+    if (i + 1 < all_placed.size()) {
+      REQUIRE(code.address + code.size <= all_placed[i + 1].address);
+    }
+    REQUIRE(std::all_of(code.address, code.address + code.size,
+                        [&code](uint8_t value) { return value == code.fill; }));
+    for (auto host_pc : {code.address, code.address + code.size - 1}) {
+      X64CodeCache::CodeFrameInfo frame;
+      REQUIRE(code_cache->LookupCodeFrame(reinterpret_cast<uintptr_t>(host_pc),
+                                          &frame));
+      REQUIRE(frame.code == code.address);
+      REQUIRE(frame.code_size == code.size);
+    }
+  }
+}
+
+TEST_CASE("CODE_CACHE_RECLAIM", "[code_cache]") {
+  auto code_cache = CreateCodeCache();
+  auto placed = PlaceConcurrently(code_cache.get(), 1, 3)[0];
+  auto& retired = placed[1];
+  uintptr_t retired_pc = reinterpret_cast<uintptr_t>(retired.address) + 4;
+  X64CodeCache::CodeFrameInfo frame;
+
+  // A thread that entered guest code before the code was retired keeps it
+  // until it reports a safepoint without it on its stack.
+  X64CodeCache::CodeThread thread;
+  code_cache->RegisterThread(&thread);
+  thread.guest_depth = 1;
+  thread.safe_epoch = code_cache->retire_epoch();
+  code_cache->RetireCode(retired.address);
+  auto stats = code_cache->GetStats();
+  REQUIRE(stats.live_count == 2);
+  REQUIRE(stats.dead_count == 1);
+  REQUIRE(code_cache->LookupCodeFrame(retired_pc, &frame));
+
+  uint64_t epoch = code_cache->retire_epoch();
+  uint64_t running_pcs[] = {uint64_t(retired_pc)};
+  code_cache->ReportSafepoint(&thread, epoch, running_pcs, 1);
+  REQUIRE(code_cache->GetStats().dead_count == 1);
+
+  uint64_t other_pcs[] = {reinterpret_cast<uintptr_t>(placed[0].address)};
+  code_cache->ReportSafepoint(&thread, epoch, other_pcs, 1);
+  stats = code_cache->GetStats();
+  REQUIRE(stats.dead_count == 0);
+  REQUIRE(stats.reclaimed_count == 1);
+  REQUIRE(stats.free_bytes >= retired.size);
+  REQUIRE(!code_cache->LookupCodeFrame(retired_pc, &frame));
+  REQUIRE(retired.address[0] == 0xCC);
+
+  // The space is reused by code that fits, and the neighbors are untouched.
+  auto reused = PlaceConcurrently(code_cache.get(), 1, 1)[0][0];
+  REQUIRE(reused.size <= retired.size);
+  REQUIRE(reused.address == retired.address);
+  for (size_t i : {size_t(0), size_t(2)}) {
+    auto& code = placed[i];
+    REQUIRE(std::all_of(code.address, code.address + code.size,
+                        [&code](uint8_t value) { return value == code.fill; }));
+  }
+
+  // Without threads running guest code, retired code is reclaimed at once.
+  thread.guest_depth = 0;
+  code_cache->RetireCode(placed[2].address);
+  REQUIRE(code_cache->GetStats().reclaimed_count == 2);
+  code_cache->UnregisterThread(&thread);
+}
+
+// Run explicitly with "[.benchmark]" to measure code placement throughput
+// under contention.
+TEST_CASE("CODE_CACHE_PLACE_BENCHMARK", "[code_cache][.benchmark]") {
+  const uint32_t code_count = 4096;
+  for (uint32_t thread_count :
+       {1u, std::max(2u, std::thread::hardware_concurrency())}) {
+    auto code_cache = CreateCodeCache();
+    auto start = std::chrono::steady_clock::now();
+    PlaceConcurrently(code_cache.get(), thread_count, code_count);
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    uint64_t placements = uint64_t(code_count) * thread_count;
+    WARN(fmt::format(
+        "X64CodeCache: {} placements on {} threads in {} us ({:.1f} "
+        "ns/placement)",
+        placements, thread_count, duration.count(),
+        duration.count() * 1000.0 / placements));
+  }
+}
+
+}  // namespace test
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,130 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/cpu/entry_table.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace cpu {
+namespace test {
+
+namespace {
+
+// Has every thread resolve the same set of addresses in a different order,
+// completing the entries it created itself. Returns the number of entries
+// created, which must match the number of distinct addresses.
+uint32_t ResolveConcurrently(EntryTable& table,
+                             const std::vector<uint32_t>& addresses,
+                             uint32_t thread_count, uint32_t rounds) {
+  std::atomic<uint32_t> created_count = {0};
+  std::atomic<uint32_t> bad_status_count = {0};
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < thread_count; ++t) {
+    threads.emplace_back([&, t]() {
+      for (uint32_t round = 0; round < rounds; ++round) {
+        for (size_t i = 0; i < addresses.size(); ++i) {
+          uint32_t address =
+              addresses[(i * (t * 2 + 1) + round) % addresses.size()];
+          Entry* entry;
+          auto status = table.GetOrCreate(address, &entry);
+          if (status == Entry::STATUS_NEW) {
+            ++created_count;
+            entry->end_address = address + 4;
+            table.Complete(entry, Entry::STATUS_READY);
+          } else if (status != Entry::STATUS_READY ||
+                     entry->address != address) {
+            ++bad_status_count;
+          }
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  REQUIRE(bad_status_count == 0);
+  return created_count;
+}
+
+}  // namespace
+
+TEST_CASE("ENTRY_TABLE_CONCURRENT_CREATE", "[entry_table]") {
+  EntryTable table;
+  std::vector<uint32_t> addresses;
+  // Both inside and outside of the direct-mapped range.
+  for (uint32_t i = 0; i < 4096; ++i) {
+    addresses.push_back(0x82000000 + i * 0x40);
+  }
+  for (uint32_t i = 0; i < 256; ++i) {
+    addresses.push_back(0x10000000 + i * 0x40);
+  }
+  REQUIRE(ResolveConcurrently(table, addresses, 8, 4) == addresses.size());
+
+  for (uint32_t address : addresses) {
+    auto entry = table.Get(address);
+    REQUIRE(entry != nullptr);
+    REQUIRE(entry->address == address);
+  }
+  REQUIRE(table.Get(0x82000004) == nullptr);
+  REQUIRE(table.FindWithAddress(0x82000040).size() == 1);
+  REQUIRE(table.FindInRange(0x82000000, 0x82000100).size() == 4);
+  REQUIRE(table.FindInRange(0x81000000, 0x82000000).empty());
+}
+
+TEST_CASE("ENTRY_TABLE_WAIT_FOR_COMPILING", "[entry_table]") {
+  EntryTable table;
+  Entry* entry;
+  REQUIRE(table.GetOrCreate(0x82000000, &entry) == Entry::STATUS_NEW);
+
+  std::atomic<int> waiter_status = {-1};
+  std::thread waiter([&]() {
+    Entry* waiter_entry;
+    waiter_status = table.GetOrCreate(0x82000000, &waiter_entry);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  REQUIRE(waiter_status == -1);
+  table.Complete(entry, Entry::STATUS_FAILED);
+  waiter.join();
+  REQUIRE(waiter_status == Entry::STATUS_FAILED);
+}
+
+// Run explicitly with "[.benchmark]" to measure resolve throughput under
+// contention.
+TEST_CASE("ENTRY_TABLE_BENCHMARK", "[entry_table][.benchmark]") {
+  std::vector<uint32_t> addresses;
+  for (uint32_t i = 0; i < 65536; ++i) {
+    addresses.push_back(0x82000000 + i * 0x20);
+  }
+  uint32_t thread_count =
+      std::max(2u, std::thread::hardware_concurrency());
+  const uint32_t rounds = 32;
+
+  EntryTable table;
+  auto start = std::chrono::steady_clock::now();
+  ResolveConcurrently(table, addresses, thread_count, rounds);
+  auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  uint64_t lookups = uint64_t(addresses.size()) * thread_count * rounds;
+  WARN(fmt::format(
+      "EntryTable: {} lookups on {} threads in {} us ({:.1f} ns/lookup)",
+      lookups, thread_count, duration.count(),
+      duration.count() * 1000.0 / lookups));
+}
+
+}  // namespace test
+}  // namespace cpu
+}  // namespace xe
@@ -148,3 +148,33 @@ TEST_CASE("EXTRACT_INT32_CONSTANT", "[instr]") {
             });
   }
 }
+
+TEST_CASE("EXTRACT_FOLDED", "[instr]") {
+  for (int i = 0; i < 16; ++i) {
+    TestFunction([i](HIRBuilder& b) {
+      auto vec = b.LoadConstantVec128(
+          vec128b(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+      StoreGPR(b, 3,
+               b.ZeroExtend(b.Extract(vec, b.LoadConstantInt8(i), INT8_TYPE),
+                            INT64_TYPE));
+      StoreGPR(b, 4,
+               b.ZeroExtend(
+                   b.Extract(vec, b.LoadConstantInt8(i & 0x7), INT16_TYPE),
+                   INT64_TYPE));
+      StoreGPR(b, 5,
+               b.ZeroExtend(
+                   b.Extract(vec, b.LoadConstantInt8(i & 0x3), INT32_TYPE),
+                   INT64_TYPE));
+      b.Return();
+    })
+        .Run([](PPCContext* ctx) {},
+             [i](PPCContext* ctx) {
+               uint64_t h = (i & 0x7) * 2;
+               uint64_t w = (i & 0x3) * 4;
+               REQUIRE(ctx->r[3] == uint64_t(i));
+               REQUIRE(ctx->r[4] == ((h << 8) | (h + 1)));
+               REQUIRE(ctx->r[5] == ((w << 24) | ((w + 1) << 16) |
+                                     ((w + 2) << 8) | (w + 3)));
+             });
+  }
+}
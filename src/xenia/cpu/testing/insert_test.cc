@@ -87,3 +87,30 @@ TEST_CASE("INSERT_INT32", "[instr]") {
         });
   }
 }
+
+TEST_CASE("INSERT_FOLDED", "[instr]") {
+  for (int i = 0; i < 16; ++i) {
+    TestFunction([i](HIRBuilder& b) {
+      auto value = b.Insert(b.LoadConstantVec128(vec128b(
+                                0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
+                                14, 15)),
+                            b.LoadConstantInt32(i), b.LoadConstantInt8(100));
+      value = b.Insert(value, b.LoadConstantInt32(i & 0x7),
+                       b.LoadConstantInt16(1000));
+      value = b.Insert(value, b.LoadConstantInt32(i & 0x3),
+                       b.LoadConstantInt32(100000));
+      StoreVR(b, 3, value);
+      b.Return();
+    })
+        .Run([](PPCContext* ctx) {},
+             [i](PPCContext* ctx) {
+               auto result = ctx->v[3];
+               auto expected = vec128b(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+                                       12, 13, 14, 15);
+               expected.i8[i ^ 0x3] = 100;
+               expected.i16[(i & 0x7) ^ 0x1] = 1000;
+               expected.i32[i & 0x3] = 100000;
+               REQUIRE(result == expected);
+             });
+  }
+}
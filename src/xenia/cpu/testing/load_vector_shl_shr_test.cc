@@ -76,3 +76,18 @@ TEST_CASE("LOAD_VECTOR_SHR", "[instr]") {
                                        26, 27, 28, 29, 30, 31));
            });
 }
+
+TEST_CASE("LOAD_VECTOR_SHL_SHR_FOLDED", "[instr]") {
+  TestFunction([](HIRBuilder& b) {
+    StoreVR(b, 3, b.LoadVectorShl(b.LoadConstantInt8(7)));
+    StoreVR(b, 4, b.LoadVectorShr(b.LoadConstantInt8(7)));
+    b.Return();
+  })
+      .Run([](PPCContext* ctx) {},
+           [](PPCContext* ctx) {
+             REQUIRE(ctx->v[3] == vec128b(7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+                                          17, 18, 19, 20, 21, 22));
+             REQUIRE(ctx->v[4] == vec128b(9, 10, 11, 12, 13, 14, 15, 16, 17,
+                                          18, 19, 20, 21, 22, 23, 24));
+           });
+}
@@ -153,3 +153,41 @@ TEST_CASE("PERMUTE_V128_BY_V128", "[instr]") {
                                   20, 19, 18, 17, 16));
       });
 }
+
+TEST_CASE("PERMUTE_V128_BY_INT32_FOLDED", "[instr]") {
+  uint32_t mask = MakePermuteMask(1, 3, 0, 2, 1, 1, 0, 0);
+  TestFunction([mask](HIRBuilder& b) {
+    StoreVR(b, 3,
+            b.Permute(b.LoadConstantUint32(mask),
+                      b.LoadConstantVec128(vec128i(0, 1, 2, 3)),
+                      b.LoadConstantVec128(vec128i(4, 5, 6, 7)), INT32_TYPE));
+    b.Return();
+  })
+      .Run([](PPCContext* ctx) {},
+           [](PPCContext* ctx) {
+             auto result = ctx->v[3];
+             REQUIRE(result == vec128i(7, 2, 5, 0));
+           });
+}
+
+TEST_CASE("PERMUTE_V128_BY_V128_FOLDED", "[instr]") {
+  TestFunction([](HIRBuilder& b) {
+    StoreVR(b, 3,
+            b.Permute(b.LoadConstantVec128(vec128b(31, 0, 30, 1, 29, 2, 28, 3,
+                                                   16, 15, 17, 14, 0xE0, 0x2D,
+                                                   0x42, 0xFF)),
+                      b.LoadConstantVec128(vec128b(0, 1, 2, 3, 4, 5, 6, 7, 8,
+                                                   9, 10, 11, 12, 13, 14, 15)),
+                      b.LoadConstantVec128(vec128b(16, 17, 18, 19, 20, 21, 22,
+                                                   23, 24, 25, 26, 27, 28, 29,
+                                                   30, 31)),
+                      INT8_TYPE));
+    b.Return();
+  })
+      .Run([](PPCContext* ctx) {},
+           [](PPCContext* ctx) {
+             auto result = ctx->v[3];
+             REQUIRE(result == vec128b(31, 0, 30, 1, 29, 2, 28, 3, 16, 15, 17,
+                                       14, 0, 13, 2, 31));
+           });
+}
@@ -0,0 +1,60 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/testing/util.h"
+
+using namespace xe;
+using namespace xe::cpu;
+using namespace xe::cpu::hir;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+TEST_CASE("ROTATE_LEFT", "[instr]") {
+  TestFunction test([](HIRBuilder& b) {
+    auto sh = b.Truncate(LoadGPR(b, 5), INT8_TYPE);
+    StoreGPR(b, 3,
+             b.ZeroExtend(b.RotateLeft(b.Truncate(LoadGPR(b, 4), INT32_TYPE),
+                                       sh),
+                          INT64_TYPE));
+    StoreGPR(b, 4, b.RotateLeft(LoadGPR(b, 4), sh));
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[4] = 0x0123456789ABCDEFull;
+        ctx->r[5] = 8;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 0xABCDEF89ull);
+        REQUIRE(ctx->r[4] == 0x23456789ABCDEF01ull);
+      });
+}
+
+TEST_CASE("ROTATE_LEFT_FOLDED", "[instr]") {
+  TestFunction([](HIRBuilder& b) {
+    StoreGPR(b, 3,
+             b.ZeroExtend(b.RotateLeft(b.LoadConstantUint32(0x89ABCDEF),
+                                       b.LoadConstantInt8(8)),
+                          INT64_TYPE));
+    StoreGPR(b, 4,
+             b.RotateLeft(b.LoadConstantUint64(0x0123456789ABCDEFull),
+                          b.LoadConstantInt8(8)));
+    StoreGPR(b, 5,
+             b.ZeroExtend(b.RotateLeft(b.LoadConstantInt8(int8_t(0x81)),
+                                       b.LoadConstantInt8(1)),
+                          INT64_TYPE));
+    b.Return();
+  })
+      .Run([](PPCContext* ctx) {},
+           [](PPCContext* ctx) {
+             REQUIRE(ctx->r[3] == 0xABCDEF89ull);
+             REQUIRE(ctx->r[4] == 0x23456789ABCDEF01ull);
+             REQUIRE(ctx->r[5] == 0x03ull);
+           });
+}
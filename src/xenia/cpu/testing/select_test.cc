@@ -0,0 +1,75 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/testing/util.h"
+
+using namespace xe;
+using namespace xe::cpu;
+using namespace xe::cpu::hir;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+TEST_CASE("SELECT_V128_BY_V128", "[instr]") {
+  TestFunction test([](HIRBuilder& b) {
+    StoreVR(b, 3, b.Select(LoadVR(b, 3), LoadVR(b, 4), LoadVR(b, 5)));
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->v[3] = vec128i(0x00000000, 0xFFFFFFFF, 0xFF00FF00, 0x0F0F0F0F);
+        ctx->v[4] = vec128i(0x11111111, 0x22222222, 0x33333333, 0x44444444);
+        ctx->v[5] = vec128i(0xAAAAAAAA, 0xBBBBBBBB, 0xCCCCCCCC, 0xDDDDDDDD);
+      },
+      [](PPCContext* ctx) {
+        auto result = ctx->v[3];
+        REQUIRE(result ==
+                vec128i(0x11111111, 0xBBBBBBBB, 0xCC33CC33, 0x4D4D4D4D));
+      });
+}
+
+TEST_CASE("SELECT_V128_BY_V128_FOLDED", "[instr]") {
+  TestFunction([](HIRBuilder& b) {
+    // The compare keeps the control from being a constant until constant
+    // propagation runs.
+    auto ctrl = b.VectorCompareUGT(
+        b.LoadConstantVec128(vec128i(0, 2, 0, 2)),
+        b.LoadConstantVec128(vec128i(1, 1, 1, 1)), INT32_TYPE);
+    StoreVR(b, 3,
+            b.Select(ctrl,
+                     b.LoadConstantVec128(
+                         vec128i(0x11111111, 0x22222222, 0x33333333,
+                                 0x44444444)),
+                     b.LoadConstantVec128(
+                         vec128i(0xAAAAAAAA, 0xBBBBBBBB, 0xCCCCCCCC,
+                                 0xDDDDDDDD))));
+    // All clear and all set controls pick one side whole.
+    StoreVR(b, 4,
+            b.Select(b.VectorCompareUGT(b.LoadZeroVec128(),
+                                        b.LoadZeroVec128(), INT32_TYPE),
+                     LoadVR(b, 4), LoadVR(b, 5)));
+    StoreVR(b, 5,
+            b.Select(b.VectorCompareEQ(b.LoadZeroVec128(), b.LoadZeroVec128(),
+                                       INT32_TYPE),
+                     LoadVR(b, 4), LoadVR(b, 5)));
+    b.Return();
+  })
+      .Run(
+          [](PPCContext* ctx) {
+            ctx->v[4] = vec128i(0x11111111, 0x22222222, 0x33333333, 0x44444444);
+            ctx->v[5] = vec128i(0xAAAAAAAA, 0xBBBBBBBB, 0xCCCCCCCC, 0xDDDDDDDD);
+          },
+          [](PPCContext* ctx) {
+            REQUIRE(ctx->v[3] ==
+                    vec128i(0x11111111, 0xBBBBBBBB, 0x33333333, 0xDDDDDDDD));
+            REQUIRE(ctx->v[4] ==
+                    vec128i(0x11111111, 0x22222222, 0x33333333, 0x44444444));
+            REQUIRE(ctx->v[5] ==
+                    vec128i(0xAAAAAAAA, 0xBBBBBBBB, 0xCCCCCCCC, 0xDDDDDDDD));
+          });
+}
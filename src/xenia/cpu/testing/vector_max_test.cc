@@ -125,3 +125,20 @@ TEST_CASE("VECTOR_MAX_I32_UNSIGNED", "[instr]") {
         REQUIRE(result == vec128i(-1000000, 1, UINT_MAX, 3));
       });
 }
+
+TEST_CASE("VECTOR_MAX_FOLDED", "[instr]") {
+  TestFunction([](HIRBuilder& b) {
+    auto src1 = b.LoadConstantVec128(vec128i(0, 1, 123, 3));
+    auto src2 = b.LoadConstantVec128(vec128i(-1000000, 0, INT_MAX, 0));
+    StoreVR(b, 3, b.VectorMax(src1, src2, INT32_TYPE));
+    StoreVR(b, 4, b.VectorMax(src1, src2, INT32_TYPE, ARITHMETIC_UNSIGNED));
+    StoreVR(b, 5, b.VectorMax(src1, src2, INT8_TYPE));
+    b.Return();
+  })
+      .Run([](PPCContext* ctx) {},
+           [](PPCContext* ctx) {
+             REQUIRE(ctx->v[3] == vec128i(0, 1, INT_MAX, 3));
+             REQUIRE(ctx->v[4] == vec128i(-1000000, 1, INT_MAX, 3));
+             REQUIRE(ctx->v[5] == vec128i(0, 1, 0x7F00007B, 3));
+           });
+}
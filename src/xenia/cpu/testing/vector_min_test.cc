@@ -125,3 +125,20 @@ TEST_CASE("VECTOR_MIN_I32_UNSIGNED", "[instr]") {
         REQUIRE(result == vec128i(0, 0, 123, 0));
       });
 }
+
+TEST_CASE("VECTOR_MIN_FOLDED", "[instr]") {
+  TestFunction([](HIRBuilder& b) {
+    auto src1 = b.LoadConstantVec128(vec128i(0, 1, 123, 3));
+    auto src2 = b.LoadConstantVec128(vec128i(-1000000, 0, INT_MAX, 0));
+    StoreVR(b, 3, b.VectorMin(src1, src2, INT32_TYPE));
+    StoreVR(b, 4, b.VectorMin(src1, src2, INT32_TYPE, ARITHMETIC_UNSIGNED));
+    StoreVR(b, 5, b.VectorMin(src1, src2, INT8_TYPE, ARITHMETIC_UNSIGNED));
+    b.Return();
+  })
+      .Run([](PPCContext* ctx) {},
+           [](PPCContext* ctx) {
+             REQUIRE(ctx->v[3] == vec128i(-1000000, 0, 123, 0));
+             REQUIRE(ctx->v[4] == vec128i(0, 0, 123, 0));
+             REQUIRE(ctx->v[5] == vec128i(0, 0, 0x0000007B, 0));
+           });
+}
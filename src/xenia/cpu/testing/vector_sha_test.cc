@@ -150,3 +150,33 @@ TEST_CASE("VECTOR_SHA_I32_CONSTANT", "[instr]") {
                 vec128i(0xFFFFFFFF, 0xFFFFFFFF, 0x00000000, 0x12345678));
       });
 }
+
+TEST_CASE("VECTOR_SHA_FOLDED", "[instr]") {
+  TestFunction([](HIRBuilder& b) {
+    auto src = b.LoadConstantVec128(
+        vec128i(0x80000000, 0xFFFFFFFF, 0x00000001, 0x12345678));
+    StoreVR(b, 3,
+            b.VectorSha(src, b.LoadConstantVec128(vec128i(31, 16, 1, 32)),
+                        INT32_TYPE));
+    StoreVR(b, 4,
+            b.VectorSha(src, b.LoadConstantVec128(vec128s(1, 2, 3, 4, 5, 6, 7,
+                                                          16)),
+                        INT16_TYPE));
+    StoreVR(b, 5,
+            b.VectorSha(src, b.LoadConstantVec128(vec128b(
+                                 1, 2, 3, 4, 5, 6, 7, 8, 1, 2, 3, 4, 5, 6, 7,
+                                 8)),
+                        INT8_TYPE));
+    b.Return();
+  })
+      .Run([](PPCContext* ctx) {},
+           [](PPCContext* ctx) {
+             REQUIRE(ctx->v[3] ==
+                     vec128i(0xFFFFFFFF, 0xFFFFFFFF, 0x00000000, 0x12345678));
+             REQUIRE(ctx->v[4] == vec128s(0xC000, 0x0000, 0xFFFF, 0xFFFF,
+                                          0x0000, 0x0000, 0x0024, 0x5678));
+             REQUIRE(ctx->v[5] == vec128b(0xC0, 0x00, 0x00, 0x00, 0xFF, 0xFF,
+                                          0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00,
+                                          0x00, 0x00, 0x00, 0x78));
+           });
+}
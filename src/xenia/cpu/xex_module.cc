@@ -1082,6 +1082,27 @@ bool XexModule::LoadContinue() {
     page += desc.page_count;
   }
 
+  // Kick off background compilation of everything we know to be a function:
+  // the entry point and the call graph below it first, then the rest of the
+  // .pdata (RUNTIME_FUNCTION) entries.
+  if (!is_patch()) {
+    uint32_t entry_point = 0;
+    GetOptHeader(XEX_HEADER_ENTRY_POINT, &entry_point);
+    std::vector<uint32_t> function_addresses;
+    auto pdata = GetPESection(".pdata");
+    if (pdata) {
+      auto entries = memory()->TranslateVirtual<const xe::be<uint32_t>*>(
+          pdata->address);
+      for (uint32_t i = 0; i + 1 < pdata->size / 4; i += 2) {
+        uint32_t begin_address = entries[i];
+        if (begin_address) {
+          function_addresses.push_back(begin_address);
+        }
+      }
+    }
+    processor_->PrecompileModule(this, entry_point, function_addresses);
+  }
+
   return true;
 }
 
@@ -1091,6 +1112,15 @@ bool XexModule::Unload() {
   }
   loaded_ = false;
 
+  // Nothing may translate the code of the module anymore either.
+  processor_->StopPrecompiling(this);
+
+  // Nothing may run the code translated from the module anymore, and another
+  // module may be loaded at the same addresses later.
+  if (high_address_ > low_address_) {
+    processor_->InvalidateFunctions(low_address_, high_address_);
+  }
+
   // If this isn't a patch, just deallocate the memory occupied by the exe
   if (!is_patch()) {
     assert_not_zero(base_address_);
@@ -20,6 +20,7 @@
 #include "xenia/base/cvar.h"
 #include "xenia/base/debugging.h"
 #include "xenia/base/exception_handler.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/mapped_memory.h"
 #include "xenia/base/profiling.h"
@@ -39,6 +40,7 @@
 #include "xenia/kernel/xbdm/xbdm_module.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_module.h"
 #include "xenia/memory.h"
+#include "xenia/memory_snapshot.h"
 #include "xenia/ui/imgui_dialog.h"
 #include "xenia/vfs/devices/disc_image_device.h"
 #include "xenia/vfs/devices/host_path_device.h"
@@ -54,6 +56,12 @@ DEFINE_string(
     "or the module specified by the game. Leave blank to launch the default "
     "module.",
     "General");
+DEFINE_bool(
+    incremental_save_states, false,
+    "Store only the memory changed since the previous save state or restore. "
+    "Restoring an incremental save state requires the save states it's based "
+    "on to be in the same place.",
+    "General");
 
 namespace xe {
 
@@ -87,6 +95,8 @@ Emulator::Emulator(const std::filesystem::path& command_line,
 Emulator::~Emulator() {
   // Note that we delete things in the reverse order they were initialized.
 
+  WaitForSave();
+
   // Give the systems time to shutdown before we delete them.
   if (graphics_system_) {
     graphics_system_->Shutdown();
@@ -138,6 +148,7 @@ X_STATUS Emulator::Setup(
   if (!memory_->Initialize()) {
     return false;
   }
+  save_state_manager_ = std::make_unique<SaveStateManager>(memory_.get());
 
   // Shared export resolver used to attach and query for HLE exports.
   export_resolver_ = std::make_unique<xe::cpu::ExportResolver>();
@@ -164,6 +175,9 @@ X_STATUS Emulator::Setup(
   if (!processor_->Setup(std::move(backend))) {
     return X_STATUS_UNSUCCESSFUL;
   }
+  if (!cache_root_.empty()) {
+    processor_->backend()->set_code_storage_root(cache_root_ / "jit");
+  }
 
   // Initialize the APU.
   if (audio_system_factory) {
@@ -408,43 +422,69 @@ void Emulator::Resume() {
   }
 }
 
-bool Emulator::SaveToFile(const std::filesystem::path& path) {
-  Pause();
+namespace {
 
-  filesystem::CreateFile(path);
-  auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite, 0,
-                                1024ull * 1024ull * 1024ull * 2ull);
-  if (!map) {
-    return false;
-  }
+// Size of the buffer for the state other than the memory.
+constexpr size_t kSaveStateBufferSize = 256 * 1024 * 1024;
 
-  // Save the emulator state to a file
-  ByteStream stream(map->data(), map->size());
-  stream.Write(kEmulatorSaveSignature);
-  stream.Write(title_id_.has_value());
-  if (title_id_.has_value()) {
-    stream.Write(title_id_.value());
-  }
+}  // namespace
 
+bool Emulator::SaveToFile(const std::filesystem::path& path) {
+  // The previous save must be written before basing this one on it.
+  WaitForSave();
+
+  Pause();
+
+  // Save the emulator state to a buffer, and capture the memory.
+  std::shared_ptr<uint8_t[]> state(new uint8_t[kSaveStateBufferSize]);
+  ByteStream state_stream(state.get(), kSaveStateBufferSize);
   // It's important we don't hold the global lock here! XThreads need to step
   // forward (possibly through guarded regions) without worry!
-  processor_->Save(&stream);
-  graphics_system_->Save(&stream);
-  audio_system_->Save(&stream);
-  kernel_state_->Save(&stream);
-  memory_->Save(&stream);
-  map->Close(stream.offset());
+  processor_->Save(&state_stream);
+  graphics_system_->Save(&state_stream);
+  audio_system_->Save(&state_stream);
+  kernel_state_->Save(&state_stream);
+  size_t state_size = state_stream.offset();
+
+  std::shared_ptr<MemorySnapshot> snapshot =
+      save_state_manager_->CaptureMemory(path, cvars::incremental_save_states);
 
   Resume();
-  return true;
+
+  if (!snapshot) {
+    XELOGE("Failed to capture the memory for save state {}",
+           xe::path_to_utf8(path));
+    return false;
+  }
+  return save_state_manager_->Save(path, std::move(snapshot), title_id_,
+                                   std::move(state), state_size);
+}
+
+void Emulator::WaitForSave() {
+  if (save_state_manager_) {
+    save_state_manager_->WaitForSave();
+  }
 }
 
 bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
+  WaitForSave();
+
   // Restore the emulator state from a file
-  auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite);
+  auto map = MappedMemory::Open(path, MappedMemory::Mode::kRead);
   if (!map) {
     return false;
   }
+  ByteStream stream(map->data(), map->size());
+  SaveStateManager::Header header;
+  if (!SaveStateManager::ReadHeader(&stream, &header)) {
+    return false;
+  }
+  if (title_id_.has_value() != header.title_id.has_value() ||
+      title_id_.value() != header.title_id.value()) {
+    // Swapping between titles is unsupported at the moment.
+    assert_always();
+    return false;
+  }
 
   restoring_ = true;
 
@@ -453,24 +493,6 @@ bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
   kernel_state_->TerminateTitle();
 
   auto lock = global_critical_region::AcquireDirect();
-  ByteStream stream(map->data(), map->size());
-  if (stream.Read<uint32_t>() != kEmulatorSaveSignature) {
-    return false;
-  }
-
-  auto has_title_id = stream.Read<bool>();
-  std::optional<uint32_t> title_id;
-  if (!has_title_id) {
-    title_id = {};
-  } else {
-    title_id = stream.Read<uint32_t>();
-  }
-  if (title_id_.has_value() != title_id.has_value() ||
-      title_id_.value() != title_id.value()) {
-    // Swapping between titles is unsupported at the moment.
-    assert_always();
-    return false;
-  }
 
   if (!processor_->Restore(&stream)) {
     XELOGE("Could not restore processor!");
@@ -488,7 +510,9 @@ bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
     XELOGE("Could not restore kernel state!");
     return false;
   }
-  if (!memory_->Restore(&stream)) {
+  // Also the memory of the saves it's based on, after restoring the other
+  // state so that it can't modify the unchanged pages.
+  if (!save_state_manager_->RestoreMemory(path, header, &stream)) {
     XELOGE("Could not restore memory!");
     return false;
   }
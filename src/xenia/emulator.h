@@ -18,6 +18,7 @@
 #include "xenia/base/exception_handler.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/memory.h"
+#include "xenia/save_state_manager.h"
 #include "xenia/vfs/virtual_file_system.h"
 #include "xenia/xbox.h"
 
@@ -44,8 +45,6 @@ class Window;
 
 namespace xe {
 
-constexpr fourcc_t kEmulatorSaveSignature = make_fourcc("XSAV");
-
 // The main type that runs the whole emulator.
 // This is responsible for initializing and managing all the various subsystems.
 class Emulator {
@@ -151,8 +150,13 @@ class Emulator {
   void Resume();
   bool is_paused() const { return paused_; }
 
+  // Saves the state once captured, writing the file in the background. With
+  // incremental_save_states, only the memory changed since the previous save or
+  // restore is stored, and restoring needs the previous file.
   bool SaveToFile(const std::filesystem::path& path);
   bool RestoreFromFile(const std::filesystem::path& path);
+  // Waits until the file of the last save has been written.
+  void WaitForSave();
 
   // The game can request another title to be loaded.
   bool TitleRequested();
@@ -202,6 +206,8 @@ class Emulator {
   bool paused_;
   bool restoring_;
   threading::Fence restore_fence_;  // Fired on restore finish.
+
+  std::unique_ptr<SaveStateManager> save_state_manager_;
 };
 
 }  // namespace xe
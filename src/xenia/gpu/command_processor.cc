@@ -454,6 +454,10 @@ uint32_t CommandProcessor::ExecutePrimaryBuffer(uint32_t read_index,
 
   trace_writer_.WritePrimaryBufferStart(start_ptr, write_index - read_index);
 
+  // Let the caches know about the guest writes done until the commands were
+  // submitted.
+  memory_->PollPhysicalMemoryWrites();
+
   // Execute commands!
   RingBuffer reader(memory_->TranslatePhysical(primary_buffer_ptr_),
                     primary_buffer_size_);
@@ -936,6 +940,10 @@ bool CommandProcessor::ExecutePacketType3_WAIT_REG_MEM(RingBuffer* reader,
     }
   } while (!matched);
 
+  // The guest may have written data for the following commands during the
+  // wait.
+  memory_->PollPhysicalMemoryWrites();
+
   return true;
 }
 
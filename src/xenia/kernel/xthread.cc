@@ -399,6 +399,7 @@ X_STATUS XThread::Create() {
 
     // Profiler needs to know about the thread.
     xe::Profiler::ThreadEnter(thread_name_.c_str());
+    emulator()->processor()->OnThreadEnter();
 
     // Execute user code.
     current_xthread_tls_ = this;
@@ -409,6 +410,7 @@ X_STATUS XThread::Create() {
     current_thread_ = nullptr;
     current_xthread_tls_ = nullptr;
 
+    emulator()->processor()->OnThreadLeave();
     xe::Profiler::ThreadExit();
 
     // Release the self-reference to the thread.
@@ -465,6 +467,7 @@ X_STATUS XThread::Exit(int exit_code) {
   // NOTE: unless PlatformExit fails, expect it to never return!
   current_xthread_tls_ = nullptr;
   current_thread_ = nullptr;
+  emulator()->processor()->OnThreadLeave();
   xe::Profiler::ThreadExit();
 
   running_ = false;
@@ -1046,6 +1049,7 @@ object_ref<XThread> XThread::Restore(KernelState* kernel_state,
 
       // Profiler needs to know about the thread.
       xe::Profiler::ThreadEnter(thread->name().c_str());
+      thread->kernel_state_->processor()->OnThreadEnter();
 
       current_xthread_tls_ = thread;
       current_thread_ = thread;
@@ -1067,6 +1071,7 @@ object_ref<XThread> XThread::Restore(KernelState* kernel_state,
       current_thread_ = nullptr;
       current_xthread_tls_ = nullptr;
 
+      thread->kernel_state_->processor()->OnThreadLeave();
       xe::Profiler::ThreadExit();
 
       // Release the self-reference to the thread.
@@ -32,6 +32,28 @@ DEFINE_bool(protect_on_release, false,
             "Protect released memory to prevent accesses.", "Memory");
 DEFINE_bool(scribble_heap, false,
             "Scribble 0xCD into all allocated heap memory.", "Memory");
+DEFINE_bool(huge_pages, false,
+            "Back guest memory in heaps with 64 KB or larger pages and the JIT "
+            "code cache with transparent huge pages where the host supports "
+            "them (Linux with transparent_hugepage enabled set to madvise or "
+            "always), reducing TLB misses. Huge pages are split back where "
+            "parts of them are protected, such as physical memory watched by "
+            "the GPU.",
+            "Memory");
+DEFINE_string(
+    physical_write_watch, "any",
+    "Method of detecting guest writes to physical memory cached by the GPU.\n"
+    "Use: [any, protect, userfaultfd]\n"
+    " protect:\n"
+    "  Protect the pages and handle the access violation on the first write "
+    "to each.\n"
+    " userfaultfd:\n"
+    "  Asynchronous userfaultfd write protection (Linux 6.7+), resolved by "
+    "the kernel, with the written pages collected in bulk when the GPU "
+    "processes commands.\n"
+    " any:\n"
+    "  userfaultfd if available, protect otherwise.",
+    "Memory");
 
 namespace xe {
 uint32_t get_page_count(uint32_t value, uint32_t page_size) {
@@ -95,10 +117,20 @@ Memory::~Memory() {
   assert_true(active_memory_ == this);
   active_memory_ = nullptr;
 
+  if (cvars::huge_pages && mapping_base_) {
+    size_t huge_page_bytes = QueryHugePageBytes();
+    size_t huge_page_size = xe::memory::huge_page_size();
+    XELOGI("Guest memory was backed by {} huge pages ({} MB)",
+           huge_page_size ? huge_page_bytes / huge_page_size : 0,
+           huge_page_bytes >> 20);
+  }
+
   // Uninstall the MMIO handler, as we won't be able to service more
   // requests.
   mmio_handler_.reset();
 
+  physical_write_watch_.reset();
+
   for (auto invalidation_callback : physical_memory_invalidation_callbacks_) {
     delete invalidation_callback;
   }
@@ -157,6 +189,10 @@ bool Memory::Initialize() {
   virtual_membase_ = mapping_base_;
   physical_membase_ = mapping_base_ + 0x100000000ull;
 
+  if (cvars::huge_pages && !xe::memory::huge_page_size()) {
+    XELOGW("Huge pages are not supported by the host");
+  }
+
   // Prepare virtual heaps.
   heaps_.v00000000.Initialize(this, virtual_membase_, HeapType::kGuestVirtual,
                               0x00000000, 0x40000000, 4096);
@@ -205,6 +241,18 @@ bool Memory::Initialize() {
     return false;
   }
 
+  if (cvars::physical_write_watch == "userfaultfd" ||
+      cvars::physical_write_watch == "any") {
+    physical_write_watch_ = xe::memory::WriteWatch::Create();
+    if (physical_write_watch_) {
+      XELOGI("Watching writes to physical memory with userfaultfd");
+    } else if (cvars::physical_write_watch == "userfaultfd") {
+      XELOGW(
+          "Unable to watch writes to physical memory with userfaultfd, "
+          "protecting pages instead");
+    }
+  }
+
   // ?
   uint32_t unk_phys_alloc;
   heaps_.vA0000000.Alloc(0x340000, 64 * 1024, kMemoryAllocationReserve,
@@ -526,6 +574,24 @@ void Memory::EnablePhysicalMemoryAccessCallbacks(
                                          enable_data_providers);
 }
 
+void Memory::PollPhysicalMemoryWrites() {
+  if (!physical_write_watch_) {
+    return;
+  }
+  std::vector<std::pair<uint32_t, uint32_t>> written_ranges;
+  for (PhysicalHeap* heap :
+       {&heaps_.vA0000000, &heaps_.vC0000000, &heaps_.vE0000000}) {
+    written_ranges.clear();
+    heap->GetWrittenWatchedRanges(&written_ranges);
+    // Protection is still lifted, for pages that couldn't be watched without
+    // it.
+    for (auto& range : written_ranges) {
+      heap->TriggerCallbacks(global_critical_region_.Acquire(), range.first,
+                             range.second, true, true);
+    }
+  }
+}
+
 uint32_t Memory::SystemHeapAlloc(uint32_t size, uint32_t alignment,
                                  uint32_t system_heap_flags) {
   // TODO(benvanik): lightweight pool.
@@ -580,26 +646,9 @@ void Memory::DumpMap() {
   XELOGE("");
 }
 
-bool Memory::Save(ByteStream* stream) {
-  XELOGD("Serializing memory...");
-  heaps_.v00000000.Save(stream);
-  heaps_.v40000000.Save(stream);
-  heaps_.v80000000.Save(stream);
-  heaps_.v90000000.Save(stream);
-  heaps_.physical.Save(stream);
-
-  return true;
-}
-
-bool Memory::Restore(ByteStream* stream) {
-  XELOGD("Restoring memory...");
-  heaps_.v00000000.Restore(stream);
-  heaps_.v40000000.Restore(stream);
-  heaps_.v80000000.Restore(stream);
-  heaps_.v90000000.Restore(stream);
-  heaps_.physical.Restore(stream);
-
-  return true;
+size_t Memory::QueryHugePageBytes() {
+  // The entire 4gb space + 512mb physical.
+  return xe::memory::QueryHugePageBytes(mapping_base_, 0x120000000);
 }
 
 xe::memory::PageAccess ToPageAccess(uint32_t protect) {
@@ -649,7 +698,20 @@ void BaseHeap::Initialize(Memory* memory, uint8_t* membase, HeapType heap_type,
   heap_size_ = heap_size;
   page_size_ = page_size;
   host_address_offset_ = host_address_offset;
+  // Protection in heaps with 4 KB pages changes at the granularity of host
+  // pages, which would keep splitting huge pages.
+  huge_pages_ = cvars::huge_pages && page_size >= 64 * 1024 &&
+                xe::memory::huge_page_size();
   page_table_.resize(heap_size / page_size);
+  free_pages_.Reset(uint32_t(page_table_.size()));
+}
+
+void BaseHeap::AdviseHugePages(void* host_address, size_t length) {
+  // Committing maps new memory over the range on some hosts, dropping the
+  // previous advice.
+  if (huge_pages_) {
+    xe::memory::AdviseHugePages(host_address, length);
+  }
 }
 
 void BaseHeap::Dispose() {
@@ -745,81 +807,11 @@ uint32_t BaseHeap::GetUnreservedPageCount() {
   return count;
 }
 
-bool BaseHeap::Save(ByteStream* stream) {
-  XELOGD("Heap {:08X}-{:08X}", heap_base_, heap_base_ + (heap_size_ - 1));
-
-  for (size_t i = 0; i < page_table_.size(); i++) {
-    auto& page = page_table_[i];
-    stream->Write(page.qword);
-    if (!page.state) {
-      // Unallocated.
-      continue;
-    }
-
-    // TODO(DrChat): write compressed with snappy.
-    if (page.state & kMemoryAllocationCommit) {
-      void* addr = TranslateRelative(i * page_size_);
-
-      memory::PageAccess old_access;
-      memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
-                      &old_access);
-
-      stream->Write(addr, page_size_);
-
-      memory::Protect(addr, page_size_, old_access, nullptr);
-    }
-  }
-
-  return true;
-}
-
-bool BaseHeap::Restore(ByteStream* stream) {
-  XELOGD("Heap {:08X}-{:08X}", heap_base_, heap_base_ + (heap_size_ - 1));
-
-  for (size_t i = 0; i < page_table_.size(); i++) {
-    auto& page = page_table_[i];
-    page.qword = stream->Read<uint64_t>();
-    if (!page.state) {
-      // Unallocated.
-      continue;
-    }
-
-    memory::PageAccess page_access = memory::PageAccess::kNoAccess;
-    if ((page.current_protect & kMemoryProtectRead) &&
-        (page.current_protect & kMemoryProtectWrite)) {
-      page_access = memory::PageAccess::kReadWrite;
-    } else if (page.current_protect & kMemoryProtectRead) {
-      page_access = memory::PageAccess::kReadOnly;
-    }
-
-    // Commit the memory if it isn't already. We do not need to reserve any
-    // memory, as the mapping has already taken care of that.
-    if (page.state & kMemoryAllocationCommit) {
-      xe::memory::AllocFixed(TranslateRelative(i * page_size_), page_size_,
-                             memory::AllocationType::kCommit,
-                             memory::PageAccess::kReadWrite);
-    }
-
-    // Now read into memory. We'll set R/W protection first, then set the
-    // protection back to its previous state.
-    // TODO(DrChat): read compressed with snappy.
-    if (page.state & kMemoryAllocationCommit) {
-      void* addr = TranslateRelative(i * page_size_);
-      xe::memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
-                          nullptr);
-
-      stream->Read(addr, page_size_);
-
-      xe::memory::Protect(addr, page_size_, page_access, nullptr);
-    }
-  }
-
-  return true;
-}
-
 void BaseHeap::Reset() {
   // TODO(DrChat): protect pages.
   std::memset(page_table_.data(), 0, sizeof(PageEntry) * page_table_.size());
+  free_pages_.Reset(uint32_t(page_table_.size()));
+  snapshot_page_hashes_.clear();
   // TODO(Triang3l): Remove access callbacks from pages if this is a physical
   // memory heap.
 }
@@ -891,6 +883,9 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
       XELOGE("BaseHeap::AllocFixed failed to alloc range from host");
       return false;
     }
+    if (alloc_type == xe::memory::AllocationType::kCommit) {
+      AdviseHugePages(result, page_count * page_size_);
+    }
 
     if (cvars::scribble_heap && protect & kMemoryProtectWrite) {
       std::memset(result, 0xCD, page_count * page_size_);
@@ -910,6 +905,7 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
     page_entry.current_protect = protect;
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  free_pages_.MarkUsed(start_page_number, page_count);
 
   return true;
 }
@@ -939,91 +935,24 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
   auto global_lock = global_critical_region_.Acquire();
 
   // Find a free page range.
-  // The base page must match the requested alignment, so we first scan for
-  // a free aligned page and only then check for continuous free pages.
-  // TODO(benvanik): optimized searching (free list buckets, bitmap, etc).
-  uint32_t start_page_number = UINT_MAX;
-  uint32_t end_page_number = UINT_MAX;
+  // The base page must match the requested alignment. Top-down allocations
+  // keep a whole number of alignment strides below the high address.
   uint32_t page_scan_stride = alignment / page_size_;
   high_page_number = high_page_number - (high_page_number % page_scan_stride);
-  if (top_down) {
-    for (int64_t base_page_number =
-             high_page_number - xe::round_up(page_count, page_scan_stride);
-         base_page_number >= low_page_number;
-         base_page_number -= page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = uint32_t(base_page_number);
-      end_page_number = uint32_t(base_page_number) + page_count - 1;
-      assert_true(end_page_number < page_table_.size());
-      bool any_taken = false;
-      for (uint32_t page_number = uint32_t(base_page_number);
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least before this page.
-          any_taken = true;
-          if (page_count > page_number) {
-            // Not enough space left to fit entire page range. Breaks outer
-            // loop.
-            base_page_number = -1;
-          } else {
-            base_page_number = page_number - page_count;
-            base_page_number -= base_page_number % page_scan_stride;
-            base_page_number += page_scan_stride;  // cancel out loop logic
-          }
-          break;
-        }
-      }
-      if (!any_taken) {
-        // Found our place.
-        break;
-      }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
-    }
-  } else {
-    for (uint32_t base_page_number = low_page_number;
-         base_page_number <= high_page_number - page_count;
-         base_page_number += page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = base_page_number;
-      end_page_number = base_page_number + page_count - 1;
-      bool any_taken = false;
-      for (uint32_t page_number = base_page_number;
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least after this page.
-          any_taken = true;
-          base_page_number = xe::round_up(page_number + 1, page_scan_stride);
-          base_page_number -= page_scan_stride;  // cancel out loop logic
-          break;
-        }
-      }
-      if (!any_taken) {
-        // Found our place.
-        break;
-      }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
-    }
-  }
-  if (start_page_number == UINT_MAX || end_page_number == UINT_MAX) {
+  uint32_t high_base_page_number_offset =
+      top_down ? xe::round_up(page_count, page_scan_stride) : page_count;
+  uint32_t start_page_number;
+  if (high_page_number < high_base_page_number_offset ||
+      !free_pages_.Find(low_page_number,
+                        high_page_number - high_base_page_number_offset,
+                        page_count, page_scan_stride, top_down,
+                        &start_page_number)) {
     // Out of memory.
     XELOGE("BaseHeap::Alloc failed to find contiguous range");
     assert_always("Heap exhausted!");
     return false;
   }
+  uint32_t end_page_number = start_page_number + page_count - 1;
 
   // Allocate from host.
   if (allocation_type == kMemoryAllocationReserve) {
@@ -1039,6 +968,9 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
       XELOGE("BaseHeap::Alloc failed to alloc range from host");
       return false;
     }
+    if (alloc_type == xe::memory::AllocationType::kCommit) {
+      AdviseHugePages(result, page_count * page_size_);
+    }
 
     if (cvars::scribble_heap && (protect & kMemoryProtectWrite)) {
       std::memset(result, 0xCD, page_count * page_size_);
@@ -1055,6 +987,7 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
     page_entry.current_protect = protect;
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  free_pages_.MarkUsed(start_page_number, page_count);
 
   *out_address = heap_base_ + (start_page_number * page_size_);
   return true;
@@ -1145,6 +1078,7 @@ bool BaseHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
     auto& page_entry = page_table_[page_number];
     page_entry.qword = 0;
   }
+  free_pages_.MarkFree(base_page_number, base_page_entry.region_page_count);
 
   return true;
 }
@@ -1604,7 +1538,6 @@ void PhysicalHeap::EnableAccessCallbacks(uint32_t physical_address,
   xe::memory::PageAccess protect_access =
       enable_data_providers ? xe::memory::PageAccess::kNoAccess
                             : xe::memory::PageAccess::kReadOnly;
-  uint8_t* protect_base = membase_ + heap_base_;
   uint32_t protect_system_page_first = UINT32_MAX;
   auto global_lock = global_critical_region_.Acquire();
   for (uint32_t i = system_page_first; i <= system_page_last; ++i) {
@@ -1659,19 +1592,86 @@ void PhysicalHeap::EnableAccessCallbacks(uint32_t physical_address,
       }
     } else {
       if (protect_system_page_first != UINT32_MAX) {
-        xe::memory::Protect(
-            protect_base + protect_system_page_first * system_page_size_,
-            (i - protect_system_page_first) * system_page_size_,
-            protect_access);
+        WatchSystemPages(protect_system_page_first,
+                         i - protect_system_page_first, protect_access);
         protect_system_page_first = UINT32_MAX;
       }
     }
   }
   if (protect_system_page_first != UINT32_MAX) {
-    xe::memory::Protect(
-        protect_base + protect_system_page_first * system_page_size_,
-        (system_page_last + 1 - protect_system_page_first) * system_page_size_,
-        protect_access);
+    WatchSystemPages(protect_system_page_first,
+                     system_page_last + 1 - protect_system_page_first,
+                     protect_access);
+  }
+}
+
+void PhysicalHeap::WatchSystemPages(uint32_t system_page_first,
+                                    uint32_t system_page_count,
+                                    xe::memory::PageAccess protect_access) {
+  uint8_t* base = membase_ + heap_base_ + system_page_first * system_page_size_;
+  size_t length = size_t(system_page_count) * system_page_size_;
+  // The write watch only replaces write protection, and pages it fails to
+  // watch are reported as written when polled, which unprotects them.
+  auto write_watch = memory_->physical_write_watch_.get();
+  if (write_watch && protect_access == xe::memory::PageAccess::kReadOnly &&
+      write_watch->Watch(base, length)) {
+    return;
+  }
+  xe::memory::Protect(base, length, protect_access);
+}
+
+void PhysicalHeap::GetWrittenWatchedRanges(
+    std::vector<std::pair<uint32_t, uint32_t>>* out_ranges) {
+  auto write_watch = memory_->physical_write_watch_.get();
+  if (!write_watch) {
+    return;
+  }
+  std::vector<std::pair<size_t, size_t>> written;
+  uint8_t* watch_base = membase_ + heap_base_;
+  auto global_lock = global_critical_region_.Acquire();
+  // Only scanning spans of 64-page blocks with watched pages, which the
+  // callbacks are triggered for if any of their pages is watched.
+  uint32_t block_count = uint32_t(system_page_flags_.size());
+  for (uint32_t i = 0; i < block_count;) {
+    if (!system_page_flags_[i].notify_on_invalidation) {
+      ++i;
+      continue;
+    }
+    uint32_t block_end = i + 1;
+    while (block_end < block_count &&
+           system_page_flags_[block_end].notify_on_invalidation) {
+      ++block_end;
+    }
+    size_t span_offset = size_t(i) * 64 * system_page_size_;
+    size_t span_length =
+        size_t(std::min(block_end * 64, system_page_count_)) *
+            system_page_size_ -
+        span_offset;
+    size_t written_first = written.size();
+    if (!write_watch->GetWritten(watch_base + span_offset, span_length,
+                                 &written)) {
+      // Have to assume everything has been written.
+      written.resize(written_first);
+      written.emplace_back(0, span_length);
+    }
+    for (size_t j = written_first; j < written.size(); ++j) {
+      written[j].first += span_offset;
+    }
+    i = block_end;
+  }
+  // Convert from system pages, which start host_address_offset before the
+  // heap.
+  for (auto& range : written) {
+    uint32_t first = uint32_t(
+        std::min(xe::sat_sub(range.first, size_t(host_address_offset())),
+                 size_t(heap_size_ - 1)));
+    uint32_t end = uint32_t(
+        std::min(xe::sat_sub(range.first + range.second,
+                             size_t(host_address_offset())),
+                 size_t(heap_size_)));
+    if (end > first) {
+      out_ranges->emplace_back(heap_base_ + first, end - first);
+    }
   }
 }
 
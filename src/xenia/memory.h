@@ -17,8 +17,10 @@
 #include <utility>
 #include <vector>
 
+#include "xenia/base/free_page_index.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
+#include "xenia/base/write_watch.h"
 #include "xenia/cpu/mmio_handler.h"
 
 namespace xe {
@@ -57,6 +59,9 @@ enum MemoryProtectFlag : uint32_t {
   kMemoryProtectNoAccess = 0,
 };
 
+// Host access to guest pages with the MemoryProtectFlag protection.
+xe::memory::PageAccess ToPageAccess(uint32_t protect);
+
 // Equivalent to the Win32 MEMORY_BASIC_INFORMATION struct.
 struct HeapAllocationInfo {
   // A pointer to the base address of the region of pages.
@@ -187,9 +192,6 @@ class BaseHeap {
   xe::memory::PageAccess QueryRangeAccess(uint32_t low_address,
                                           uint32_t high_address);
 
-  bool Save(ByteStream* stream);
-  bool Restore(ByteStream* stream);
-
   void Reset();
 
  protected:
@@ -199,6 +201,10 @@ class BaseHeap {
                   uint32_t heap_base, uint32_t heap_size, uint32_t page_size,
                   uint32_t host_address_offset = 0);
 
+  // Advises the host memory just committed for the pages to be backed by huge
+  // pages if enabled for the heap.
+  void AdviseHugePages(void* host_address, size_t length);
+
   Memory* memory_;
   uint8_t* membase_;
   HeapType heap_type_;
@@ -206,8 +212,16 @@ class BaseHeap {
   uint32_t heap_size_;
   uint32_t page_size_;
   uint32_t host_address_offset_;
+  bool huge_pages_;
   xe::global_critical_region global_critical_region_;
   std::vector<PageEntry> page_table_;
+  // Pages not reserved, kept in sync with page_table_.
+  FreePageIndex free_pages_;
+  // Hashes of the committed pages at the last MemorySnapshot capture, 0 for
+  // zero pages and others, empty if not captured since the last restore.
+  std::vector<uint64_t> snapshot_page_hashes_;
+
+  friend class MemorySnapshot;
 };
 
 // Normal heap allowing allocations from guest virtual address ranges.
@@ -260,10 +274,20 @@ class PhysicalHeap : public BaseHeap {
       std::unique_lock<std::recursive_mutex> global_lock_locked_once,
       uint32_t virtual_address, uint32_t length, bool is_write,
       bool unwatch_exact_range, bool unprotect = true);
+  // Appends the virtual address ranges of watched pages that may have been
+  // written, when writes are collected by the memory's write watch instead
+  // of access violations.
+  void GetWrittenWatchedRanges(
+      std::vector<std::pair<uint32_t, uint32_t>>* out_ranges);
 
   uint32_t GetPhysicalAddress(uint32_t address) const;
 
  protected:
+  // Watches the system pages for writes, with the write watch if possible
+  // or by protecting them.
+  void WatchSystemPages(uint32_t system_page_first, uint32_t system_page_count,
+                        xe::memory::PageAccess protect_access);
+
   VirtualHeap* parent_heap_;
 
   uint32_t system_page_size_;
@@ -437,6 +461,12 @@ class Memory {
   void EnablePhysicalMemoryAccessCallbacks(
       uint32_t physical_address, uint32_t length,
       bool enable_invalidation_notifications, bool enable_data_providers);
+  // With physical_write_watch, writes to watched physical memory don't cause
+  // access violations, and only trigger the invalidation callbacks once
+  // polled. Must be called where the callbacks must have been triggered for
+  // the writes done so far, such as before the GPU processes new commands.
+  // Does nothing if writes are detected through access violations.
+  void PollPhysicalMemoryWrites();
 
   // Forces triggering of watch callbacks for a virtual address range if pages
   // are watched there and unwatching them. Returns whether any page was
@@ -475,8 +505,9 @@ class Memory {
   // Dumps a map of all allocated memory to the log.
   void DumpMap();
 
-  bool Save(ByteStream* stream);
-  bool Restore(ByteStream* stream);
+  // Returns how many bytes of guest memory are currently backed by host huge
+  // pages with huge_pages enabled.
+  size_t QueryHugePageBytes();
 
  private:
   int MapViews(uint8_t* mapping_base);
@@ -517,6 +548,8 @@ class Memory {
   } views_ = {{0}};
 
   std::unique_ptr<cpu::MMIOHandler> mmio_handler_;
+  // Used instead of protection for invalidation notifications if available.
+  std::unique_ptr<xe::memory::WriteWatch> physical_write_watch_;
 
   struct {
     VirtualHeap v00000000;
@@ -531,6 +564,7 @@ class Memory {
   } heaps_;
 
   friend class BaseHeap;
+  friend class MemorySnapshot;
 
   friend class PhysicalHeap;
   xe::global_critical_region global_critical_region_;
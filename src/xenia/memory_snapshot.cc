@@ -0,0 +1,428 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/memory_snapshot.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <string>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "third_party/snappy/snappy.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/mutex.h"
+#include "xenia/base/threading.h"
+#include "xenia/base/xxhash.h"
+#include "xenia/memory.h"
+
+namespace xe {
+
+namespace {
+
+// Uncompressed size of the chunks compressed separately - large enough for
+// snappy to compress well, small enough to spread across the workers.
+constexpr size_t kChunkSize = 1024 * 1024;
+
+// Calls the function with each worker index from 0 to worker_count - 1 on
+// worker threads, and returns once all of them are done.
+void RunOnWorkers(uint32_t worker_count,
+                  const std::function<void(uint32_t)>& function) {
+  std::vector<std::unique_ptr<xe::threading::Thread>> workers;
+  std::vector<uint32_t> inline_workers;
+  for (uint32_t i = 1; i < worker_count; ++i) {
+    auto worker = xe::threading::Thread::Create(
+        {}, [&function, i]() { function(i); });
+    if (!worker) {
+      inline_workers.push_back(i);
+      continue;
+    }
+    worker->set_name(fmt::format("Save State Worker {}", i));
+    workers.push_back(std::move(worker));
+  }
+  function(0);
+  for (uint32_t i : inline_workers) {
+    function(i);
+  }
+  for (auto& worker : workers) {
+    xe::threading::Wait(worker.get(), false);
+  }
+}
+
+uint32_t GetWorkerCount(size_t item_count, size_t items_per_worker) {
+  return uint32_t(std::max(
+      size_t(1), std::min(size_t(xe::threading::logical_processor_count()),
+                          item_count / items_per_worker)));
+}
+
+bool IsZeroPage(const uint8_t* data, size_t length) {
+  auto words = reinterpret_cast<const uint64_t*>(data);
+  for (size_t i = 0; i < length / sizeof(uint64_t); i += 8) {
+    if (words[i] | words[i + 1] | words[i + 2] | words[i + 3] | words[i + 4] |
+        words[i + 5] | words[i + 6] | words[i + 7]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+std::vector<BaseHeap*> MemorySnapshot::GetSavedHeaps(Memory* memory) {
+  // The physical heaps at 0xA0000000 and above are views of the same memory
+  // as the physical heap.
+  return {&memory->heaps_.v00000000, &memory->heaps_.v40000000,
+          &memory->heaps_.v80000000, &memory->heaps_.v90000000,
+          &memory->heaps_.physical};
+}
+
+std::unique_ptr<MemorySnapshot> MemorySnapshot::Capture(Memory* memory,
+                                                        bool incremental) {
+  auto snapshot = std::unique_ptr<MemorySnapshot>(new MemorySnapshot());
+  auto heaps = GetSavedHeaps(memory);
+  auto global_lock = global_critical_region::AcquireDirect();
+
+  snapshot->incremental_ = incremental;
+  for (BaseHeap* heap : heaps) {
+    if (heap->snapshot_page_hashes_.empty()) {
+      snapshot->incremental_ = false;
+    }
+  }
+
+  // Gather the committed pages.
+  struct Page {
+    BaseHeap* heap;
+    uint32_t page_number;
+  };
+  std::vector<Page> pages;
+  snapshot->heaps_.resize(heaps.size());
+  for (size_t i = 0; i < heaps.size(); ++i) {
+    BaseHeap* heap = heaps[i];
+    auto& heap_capture = snapshot->heaps_[i];
+    heap_capture.page_table.reserve(heap->page_table_.size());
+    for (uint32_t page_number = 0; page_number < heap->page_table_.size();
+         ++page_number) {
+      const PageEntry& page_entry = heap->page_table_[page_number];
+      heap_capture.page_table.push_back(page_entry.qword);
+      if (page_entry.state & kMemoryAllocationCommit) {
+        pages.push_back({heap, page_number});
+      }
+    }
+  }
+
+  // Make the committed pages the host can't read readable while capturing.
+  // Besides the pages the guest can't read, these include pages protected by
+  // access watches and MMIO ranges, whose protection differs from the guest
+  // one, so the exact host protection is restored afterwards.
+  struct ProtectedRange {
+    void* base_address;
+    size_t length;
+    xe::memory::PageAccess access;
+  };
+  std::vector<ProtectedRange> protected_ranges;
+  for (BaseHeap* heap : heaps) {
+    uint8_t* heap_host_base = heap->TranslateRelative(0);
+    size_t heap_host_size = heap->page_table_.size() * heap->page_size_;
+    auto make_readable = [&](void* range_base_address, size_t range_length,
+                             xe::memory::PageAccess access) {
+      if (access != xe::memory::PageAccess::kNoAccess) {
+        return;
+      }
+      // Only the committed parts, page by page as heap pages may be larger
+      // than host pages.
+      size_t range_start =
+          size_t(static_cast<uint8_t*>(range_base_address) - heap_host_base);
+      size_t range_end = range_start + range_length;
+      size_t page_number = range_start / heap->page_size_;
+      while (page_number * heap->page_size_ < range_end) {
+        if (!(heap->page_table_[page_number].state &
+              kMemoryAllocationCommit)) {
+          ++page_number;
+          continue;
+        }
+        size_t start = std::max(page_number * heap->page_size_, range_start);
+        while (page_number * heap->page_size_ < range_end &&
+               (heap->page_table_[page_number].state &
+                kMemoryAllocationCommit)) {
+          ++page_number;
+        }
+        size_t end = std::min(page_number * heap->page_size_, range_end);
+        protected_ranges.push_back(
+            {heap_host_base + start, end - start, access});
+        xe::memory::Protect(heap_host_base + start, end - start,
+                            xe::memory::PageAccess::kReadOnly);
+      }
+    };
+    if (!xe::memory::QueryProtectRanges(heap_host_base, heap_host_size,
+                                        make_readable)) {
+      XELOGE("Unable to query the host protection of heap {:08X}",
+             heap->heap_base_);
+      for (const ProtectedRange& range : protected_ranges) {
+        xe::memory::Protect(range.base_address, range.length, range.access);
+      }
+      return nullptr;
+    }
+  }
+
+  // Classify the pages by their contents.
+  std::vector<PageKind> page_kinds(pages.size());
+  std::vector<uint64_t> page_hashes(pages.size());
+  uint32_t worker_count = GetWorkerCount(pages.size(), 256);
+  RunOnWorkers(worker_count, [&](uint32_t worker) {
+    size_t end = pages.size() * (worker + 1) / worker_count;
+    for (size_t i = pages.size() * worker / worker_count; i < end; ++i) {
+      const Page& page = pages[i];
+      const uint8_t* data = page.heap->TranslateRelative(
+          size_t(page.page_number) * page.heap->page_size_);
+      if (IsZeroPage(data, page.heap->page_size_)) {
+        page_kinds[i] = PageKind::kZero;
+        page_hashes[i] = 0;
+        continue;
+      }
+      uint64_t hash = XXH3_64bits(data, page.heap->page_size_);
+      page_hashes[i] = hash;
+      page_kinds[i] =
+          snapshot->incremental_ &&
+                  page.heap->snapshot_page_hashes_[page.page_number] == hash
+              ? PageKind::kUnchanged
+              : PageKind::kStored;
+    }
+  });
+
+  // Lay out the stored pages in chunks.
+  std::vector<size_t> page_offsets(pages.size());
+  size_t data_size = 0;
+  size_t chunk_start = 0;
+  size_t heap_index = 0;
+  for (size_t i = 0; i < pages.size(); ++i) {
+    const Page& page = pages[i];
+    while (heaps[heap_index] != page.heap) {
+      ++heap_index;
+    }
+    snapshot->heaps_[heap_index].page_kinds.push_back(page_kinds[i]);
+    switch (page_kinds[i]) {
+      case PageKind::kZero:
+        ++snapshot->zero_page_count_;
+        continue;
+      case PageKind::kUnchanged:
+        ++snapshot->unchanged_page_count_;
+        continue;
+      case PageKind::kStored:
+        break;
+    }
+    ++snapshot->stored_page_count_;
+    if (data_size != chunk_start &&
+        data_size + page.heap->page_size_ - chunk_start > kChunkSize) {
+      snapshot->chunk_ends_.push_back(data_size);
+      chunk_start = data_size;
+    }
+    page_offsets[i] = data_size;
+    data_size += page.heap->page_size_;
+  }
+  if (data_size != chunk_start) {
+    snapshot->chunk_ends_.push_back(data_size);
+  }
+
+  // Copy the stored pages, so the guest can modify them once resumed.
+  snapshot->page_data_.reset(new uint8_t[data_size]);
+  RunOnWorkers(worker_count, [&](uint32_t worker) {
+    size_t end = pages.size() * (worker + 1) / worker_count;
+    for (size_t i = pages.size() * worker / worker_count; i < end; ++i) {
+      if (page_kinds[i] != PageKind::kStored) {
+        continue;
+      }
+      const Page& page = pages[i];
+      std::memcpy(snapshot->page_data_.get() + page_offsets[i],
+                  page.heap->TranslateRelative(size_t(page.page_number) *
+                                               page.heap->page_size_),
+                  page.heap->page_size_);
+    }
+  });
+
+  // Remember the contents for the next incremental snapshot.
+  for (BaseHeap* heap : heaps) {
+    heap->snapshot_page_hashes_.assign(heap->page_table_.size(), 0);
+  }
+  for (size_t i = 0; i < pages.size(); ++i) {
+    const Page& page = pages[i];
+    page.heap->snapshot_page_hashes_[page.page_number] = page_hashes[i];
+  }
+  for (const ProtectedRange& range : protected_ranges) {
+    xe::memory::Protect(range.base_address, range.length, range.access);
+  }
+
+  return snapshot;
+}
+
+bool MemorySnapshot::Write(FILE* file) const {
+  std::vector<std::string> compressed_chunks(chunk_ends_.size());
+  std::atomic<size_t> next_chunk = {0};
+  RunOnWorkers(GetWorkerCount(chunk_ends_.size(), 1), [&](uint32_t worker) {
+    size_t i;
+    while ((i = next_chunk++) < compressed_chunks.size()) {
+      size_t chunk_offset = i ? chunk_ends_[i - 1] : 0;
+      snappy::Compress(
+          reinterpret_cast<const char*>(page_data_.get() + chunk_offset),
+          chunk_ends_[i] - chunk_offset, &compressed_chunks[i]);
+    }
+  });
+
+  auto write = [file](const void* data, size_t length) {
+    return fwrite(data, 1, length, file) == length;
+  };
+  auto write_u32 = [&write](uint32_t value) {
+    return write(&value, sizeof(value));
+  };
+  if (!write_u32(uint32_t(incremental_)) ||
+      !write_u32(uint32_t(heaps_.size()))) {
+    return false;
+  }
+  for (const HeapCapture& heap_capture : heaps_) {
+    if (!write_u32(uint32_t(heap_capture.page_table.size())) ||
+        !write(heap_capture.page_table.data(),
+               sizeof(uint64_t) * heap_capture.page_table.size()) ||
+        !write_u32(uint32_t(heap_capture.page_kinds.size())) ||
+        !write(heap_capture.page_kinds.data(),
+               sizeof(PageKind) * heap_capture.page_kinds.size())) {
+      return false;
+    }
+  }
+  if (!write_u32(uint32_t(compressed_chunks.size()))) {
+    return false;
+  }
+  for (size_t i = 0; i < compressed_chunks.size(); ++i) {
+    const std::string& compressed_chunk = compressed_chunks[i];
+    if (!write_u32(uint32_t(chunk_ends_[i] - (i ? chunk_ends_[i - 1] : 0))) ||
+        !write_u32(uint32_t(compressed_chunk.size())) ||
+        !write(compressed_chunk.data(), compressed_chunk.size())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool MemorySnapshot::Restore(Memory* memory, ByteStream* stream) {
+  auto heaps = GetSavedHeaps(memory);
+  auto global_lock = global_critical_region::AcquireDirect();
+
+  stream->Read<uint32_t>();  // Incremental.
+  if (stream->Read<uint32_t>() != heaps.size()) {
+    XELOGE("Memory snapshot has a different number of heaps");
+    return false;
+  }
+
+  // Restore the page tables and commit the pages that aren't unchanged.
+  // Committing may map new memory over them, so unchanged pages restored from
+  // the snapshot this one is based on must not be committed again.
+  struct Page {
+    BaseHeap* heap;
+    uint32_t page_number;
+    PageKind kind;
+  };
+  std::vector<Page> pages;
+  for (BaseHeap* heap : heaps) {
+    uint32_t page_count = stream->Read<uint32_t>();
+    if (page_count != heap->page_table_.size()) {
+      XELOGE("Memory snapshot heap {:08X} has a different number of pages",
+             heap->heap_base_);
+      return false;
+    }
+    std::vector<uint32_t> committed_pages;
+    heap->free_pages_.Reset(page_count);
+    for (uint32_t page_number = 0; page_number < page_count; ++page_number) {
+      PageEntry& page_entry = heap->page_table_[page_number];
+      page_entry.qword = stream->Read<uint64_t>();
+      if (page_entry.state) {
+        heap->free_pages_.MarkUsed(page_number, 1);
+      }
+      if (page_entry.state & kMemoryAllocationCommit) {
+        committed_pages.push_back(page_number);
+      }
+    }
+    if (stream->Read<uint32_t>() != committed_pages.size()) {
+      XELOGE("Memory snapshot heap {:08X} has inconsistent page kinds",
+             heap->heap_base_);
+      return false;
+    }
+    for (uint32_t page_number : committed_pages) {
+      auto kind = PageKind(stream->Read<uint8_t>());
+      uint8_t* data =
+          heap->TranslateRelative(size_t(page_number) * heap->page_size_);
+      if (kind != PageKind::kUnchanged) {
+        xe::memory::AllocFixed(data, heap->page_size_,
+                               xe::memory::AllocationType::kCommit,
+                               xe::memory::PageAccess::kReadWrite);
+        heap->AdviseHugePages(data, heap->page_size_);
+      }
+      pages.push_back({heap, page_number, kind});
+    }
+    // Hashes are only captured along with the pages.
+    heap->snapshot_page_hashes_.clear();
+  }
+
+  // Decompress the chunks sequentially while filling the pages.
+  uint32_t chunk_count = stream->Read<uint32_t>();
+  uint32_t chunk_index = 0;
+  std::vector<uint8_t> chunk;
+  size_t chunk_offset = 0;
+  for (const Page& page : pages) {
+    uint8_t* data = page.heap->TranslateRelative(size_t(page.page_number) *
+                                                 page.heap->page_size_);
+    uint32_t protect = page.heap->page_table_[page.page_number].current_protect;
+    if (page.kind == PageKind::kUnchanged) {
+      xe::memory::Protect(data, page.heap->page_size_, ToPageAccess(protect));
+      continue;
+    }
+    xe::memory::Protect(data, page.heap->page_size_,
+                        xe::memory::PageAccess::kReadWrite);
+    if (page.kind == PageKind::kZero) {
+      std::memset(data, 0, page.heap->page_size_);
+    } else {
+      if (chunk_offset >= chunk.size()) {
+        if (chunk_index >= chunk_count) {
+          XELOGE("Memory snapshot is missing page data");
+          return false;
+        }
+        ++chunk_index;
+        uint32_t length = stream->Read<uint32_t>();
+        uint32_t compressed_length = stream->Read<uint32_t>();
+        if (stream->offset() + compressed_length > stream->data_length()) {
+          XELOGE("Memory snapshot is truncated");
+          return false;
+        }
+        auto compressed =
+            reinterpret_cast<const char*>(stream->data() + stream->offset());
+        size_t uncompressed_length;
+        chunk.resize(length);
+        if (!snappy::GetUncompressedLength(compressed, compressed_length,
+                                           &uncompressed_length) ||
+            uncompressed_length != length ||
+            !snappy::RawUncompress(compressed, compressed_length,
+                                   reinterpret_cast<char*>(chunk.data()))) {
+          XELOGE("Memory snapshot page data is corrupted");
+          return false;
+        }
+        stream->Advance(compressed_length);
+        chunk_offset = 0;
+      }
+      if (chunk_offset + page.heap->page_size_ > chunk.size()) {
+        XELOGE("Memory snapshot page data is corrupted");
+        return false;
+      }
+      std::memcpy(data, chunk.data() + chunk_offset, page.heap->page_size_);
+      chunk_offset += page.heap->page_size_;
+    }
+    xe::memory::Protect(data, page.heap->page_size_, ToPageAccess(protect));
+  }
+
+  return true;
+}
+
+}  // namespace xe
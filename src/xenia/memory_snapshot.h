@@ -0,0 +1,87 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_MEMORY_SNAPSHOT_H_
+#define XENIA_MEMORY_SNAPSHOT_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "xenia/base/byte_stream.h"
+
+namespace xe {
+
+class BaseHeap;
+class Memory;
+
+// Guest memory captured for a save state.
+//
+// Capturing needs the guest paused, but only takes long enough to copy the
+// pages that need to be stored, using worker threads. Compressing and writing
+// them doesn't access guest memory, so it can be done after the guest is
+// resumed.
+//
+// Pages are stored compressed with snappy in chunks compressed in parallel,
+// and all-zero pages aren't stored at all. An incremental snapshot only stores
+// the pages changed since the previous capture, detected by comparing the
+// hashes of the pages, and must be restored after the snapshot it's based on.
+class MemorySnapshot {
+ public:
+  // Captures the heaps of the memory. Must be called with the guest paused.
+  // Falls back to a full snapshot if incremental, but nothing has been
+  // captured since the memory was initialized or restored. Returns nullptr if
+  // the host protection of the memory can't be queried.
+  static std::unique_ptr<MemorySnapshot> Capture(Memory* memory,
+                                                 bool incremental);
+
+  // Restores the heaps of the memory from a written snapshot. Pages that are
+  // unchanged in an incremental snapshot are kept as they are.
+  static bool Restore(Memory* memory, ByteStream* stream);
+
+  bool incremental() const { return incremental_; }
+  uint32_t stored_page_count() const { return stored_page_count_; }
+  uint32_t zero_page_count() const { return zero_page_count_; }
+  uint32_t unchanged_page_count() const { return unchanged_page_count_; }
+
+  // Compresses the stored pages with worker threads and writes the snapshot.
+  bool Write(FILE* file) const;
+
+ private:
+  enum class PageKind : uint8_t {
+    kZero,
+    kStored,
+    kUnchanged,
+  };
+
+  struct HeapCapture {
+    std::vector<uint64_t> page_table;
+    // For every committed page in the page table.
+    std::vector<PageKind> page_kinds;
+  };
+
+  MemorySnapshot() = default;
+
+  static std::vector<BaseHeap*> GetSavedHeaps(Memory* memory);
+
+  bool incremental_ = false;
+  uint32_t stored_page_count_ = 0;
+  uint32_t zero_page_count_ = 0;
+  uint32_t unchanged_page_count_ = 0;
+  std::vector<HeapCapture> heaps_;
+  // Contents of the stored pages in order, split into chunks compressed
+  // separately, ending at page boundaries.
+  std::unique_ptr<uint8_t[]> page_data_;
+  std::vector<size_t> chunk_ends_;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_MEMORY_SNAPSHOT_H_
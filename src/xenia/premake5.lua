@@ -8,8 +8,11 @@ project("xenia-core")
   language("C++")
   links({
     "fmt",
+    "snappy",
     "xenia-base",
   })
   defines({
   })
   files({"*.h", "*.cc"})
+
+include("testing")
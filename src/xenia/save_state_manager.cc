@@ -0,0 +1,214 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/save_state_manager.h"
+
+#include <algorithm>
+#include <string>
+#include <system_error>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/mapped_memory.h"
+#include "xenia/base/string.h"
+#include "xenia/memory.h"
+#include "xenia/memory_snapshot.h"
+
+namespace xe {
+
+SaveStateManager::SaveStateManager(Memory* memory) : memory_(memory) {}
+
+SaveStateManager::~SaveStateManager() { WaitForSave(); }
+
+bool SaveStateManager::ReadHeader(ByteStream* stream, Header* header) {
+  if (stream->data_length() < sizeof(uint32_t) * 2 + sizeof(uint64_t) * 2 ||
+      stream->Read<uint32_t>() != kEmulatorSaveSignature) {
+    XELOGE("Not a save state");
+    return false;
+  }
+  uint32_t version = stream->Read<uint32_t>();
+  if (version != kEmulatorSaveVersion) {
+    XELOGE("Unsupported save state version {}", version);
+    return false;
+  }
+  header->snapshot_id = stream->Read<uint64_t>();
+  header->base_snapshot_id = stream->Read<uint64_t>();
+  header->base_path = xe::to_path(stream->Read<std::string>());
+  if (stream->Read<bool>()) {
+    header->title_id = stream->Read<uint32_t>();
+  } else {
+    header->title_id = std::nullopt;
+  }
+  header->state_size = stream->Read<uint64_t>();
+  if (stream->offset() + header->state_size > stream->data_length()) {
+    XELOGE("Save state is truncated");
+    return false;
+  }
+  return true;
+}
+
+std::shared_ptr<MemorySnapshot> SaveStateManager::CaptureMemory(
+    const std::filesystem::path& path, bool incremental) {
+  // The previous save must be written before basing this one on it.
+  WaitForSave();
+  if (incremental) {
+    auto absolute_path = std::filesystem::absolute(path);
+    incremental = last_snapshot_id_ &&
+                  std::find(last_snapshot_paths_.begin(),
+                            last_snapshot_paths_.end(),
+                            absolute_path) == last_snapshot_paths_.end();
+  }
+  return MemorySnapshot::Capture(memory_, incremental);
+}
+
+bool SaveStateManager::Save(const std::filesystem::path& path,
+                            std::shared_ptr<MemorySnapshot> snapshot,
+                            std::optional<uint32_t> title_id,
+                            std::shared_ptr<uint8_t[]> state,
+                            size_t state_size) {
+  WaitForSave();
+
+  uint64_t snapshot_id = Clock::QueryHostSystemTime();
+  if (snapshot_id <= last_snapshot_id_) {
+    snapshot_id = last_snapshot_id_ + 1;
+  }
+  std::string base_path;
+  if (snapshot->incremental()) {
+    base_path = xe::path_to_utf8(last_snapshot_paths_.front());
+  }
+  auto header = std::make_shared<std::vector<uint8_t>>(64 + base_path.size());
+  ByteStream header_stream(header->data(), header->size());
+  header_stream.Write(kEmulatorSaveSignature);
+  header_stream.Write(kEmulatorSaveVersion);
+  header_stream.Write(snapshot_id);
+  header_stream.Write(snapshot->incremental() ? last_snapshot_id_
+                                              : uint64_t(0));
+  header_stream.Write(std::string_view(base_path));
+  header_stream.Write(title_id.has_value());
+  if (title_id.has_value()) {
+    header_stream.Write(title_id.value());
+  }
+  header_stream.Write(uint64_t(state_size));
+  header->resize(header_stream.offset());
+
+  if (!snapshot->incremental()) {
+    last_snapshot_paths_.clear();
+  }
+  last_snapshot_id_ = snapshot_id;
+  last_snapshot_paths_.insert(last_snapshot_paths_.begin(),
+                              std::filesystem::absolute(path));
+
+  // The guest doesn't need to wait for compressing and writing the memory.
+  save_thread_ = threading::Thread::Create(
+      {}, [this, path, header, state, state_size, snapshot]() {
+        auto temp_path = path;
+        temp_path += ".tmp";
+        FILE* file = xe::filesystem::OpenFile(temp_path, "wb");
+        bool written =
+            file &&
+            fwrite(header->data(), 1, header->size(), file) ==
+                header->size() &&
+            fwrite(state.get(), 1, state_size, file) == state_size &&
+            snapshot->Write(file);
+        if (file && fclose(file)) {
+          written = false;
+        }
+        std::error_code error;
+        if (written) {
+          std::filesystem::rename(temp_path, path, error);
+          written = !error;
+        }
+        if (!written) {
+          XELOGE("Failed to write save state {}", xe::path_to_utf8(path));
+          std::filesystem::remove(temp_path, error);
+          // Don't base the next save on the incomplete one.
+          last_snapshot_id_ = 0;
+          last_snapshot_paths_.clear();
+          return;
+        }
+        XELOGI(
+            "Saved state to {}: {} memory pages stored, {} zero, {} unchanged",
+            xe::path_to_utf8(path), snapshot->stored_page_count(),
+            snapshot->zero_page_count(), snapshot->unchanged_page_count());
+      });
+  if (!save_thread_) {
+    XELOGE("Failed to create the save state writing thread");
+    last_snapshot_id_ = 0;
+    last_snapshot_paths_.clear();
+    return false;
+  }
+  save_thread_->set_name("Save State Writer");
+  return true;
+}
+
+void SaveStateManager::WaitForSave() {
+  if (!save_thread_) {
+    return;
+  }
+  threading::Wait(save_thread_.get(), false);
+  save_thread_.reset();
+}
+
+bool SaveStateManager::RestoreMemory(const std::filesystem::path& path,
+                                     const Header& header,
+                                     ByteStream* stream) {
+  WaitForSave();
+
+  std::vector<std::filesystem::path> paths;
+  paths.push_back(std::filesystem::absolute(path));
+  // Pages unchanged in an incremental save are in the saves it's based on.
+  if (header.base_snapshot_id &&
+      !RestoreBaseMemory(header.base_path, header.base_snapshot_id, &paths)) {
+    return false;
+  }
+  if (!MemorySnapshot::Restore(memory_, stream)) {
+    return false;
+  }
+
+  // Base the next incremental save on this one.
+  last_snapshot_id_ = header.snapshot_id;
+  last_snapshot_paths_ = std::move(paths);
+  return true;
+}
+
+bool SaveStateManager::RestoreBaseMemory(
+    const std::filesystem::path& path, uint64_t snapshot_id,
+    std::vector<std::filesystem::path>* paths) {
+  auto absolute_path = std::filesystem::absolute(path);
+  if (std::find(paths->begin(), paths->end(), absolute_path) != paths->end()) {
+    XELOGE("Save state {} is based on itself", xe::path_to_utf8(path));
+    return false;
+  }
+  paths->push_back(absolute_path);
+
+  auto map = MappedMemory::Open(path, MappedMemory::Mode::kRead);
+  if (!map) {
+    XELOGE("Could not open save state {}", xe::path_to_utf8(path));
+    return false;
+  }
+  ByteStream stream(map->data(), map->size());
+  Header header;
+  if (!ReadHeader(&stream, &header)) {
+    return false;
+  }
+  if (header.snapshot_id != snapshot_id) {
+    XELOGE("Save state {} was overwritten after saving one based on it",
+           xe::path_to_utf8(path));
+    return false;
+  }
+  if (header.base_snapshot_id &&
+      !RestoreBaseMemory(header.base_path, header.base_snapshot_id, paths)) {
+    return false;
+  }
+  stream.Advance(header.state_size);
+  return MemorySnapshot::Restore(memory_, &stream);
+}
+
+}  // namespace xe
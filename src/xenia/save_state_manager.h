@@ -0,0 +1,99 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_SAVE_STATE_MANAGER_H_
+#define XENIA_SAVE_STATE_MANAGER_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "xenia/base/byte_stream.h"
+#include "xenia/base/memory.h"
+#include "xenia/base/threading.h"
+
+namespace xe {
+
+class Memory;
+class MemorySnapshot;
+
+constexpr fourcc_t kEmulatorSaveSignature = make_fourcc("XSAV");
+constexpr uint32_t kEmulatorSaveVersion = 1;
+
+// Writes and restores the files of save states: a header, the state of the
+// emulator other than the memory, and a memory snapshot.
+//
+// An incremental memory snapshot is based on the one of the last save or
+// restore, whose file must then stay in place to restore it. A file is never
+// based on itself, directly or through the files it's based on.
+class SaveStateManager {
+ public:
+  struct Header {
+    uint64_t snapshot_id;
+    // 0 if the memory isn't incremental.
+    uint64_t base_snapshot_id;
+    std::filesystem::path base_path;
+    std::optional<uint32_t> title_id;
+    // Size of the state other than the memory, which follows it.
+    uint64_t state_size;
+  };
+
+  explicit SaveStateManager(Memory* memory);
+  ~SaveStateManager();
+
+  // Reads the header of a file, leaving the stream at the state following it.
+  static bool ReadHeader(ByteStream* stream, Header* header);
+
+  // Captures the memory for a save to path. Must be called with the guest
+  // paused. The snapshot is full rather than incremental if path is the file
+  // of the last save or restore, or one of the files it's based on, as these
+  // must not be overwritten by a file based on them. Returns nullptr if the
+  // memory can't be captured.
+  std::shared_ptr<MemorySnapshot> CaptureMemory(
+      const std::filesystem::path& path, bool incremental);
+  // Writes the file of a save in the background. The file is written to a
+  // temporary file first, so that a failed write doesn't replace it.
+  bool Save(const std::filesystem::path& path,
+            std::shared_ptr<MemorySnapshot> snapshot,
+            std::optional<uint32_t> title_id, std::shared_ptr<uint8_t[]> state,
+            size_t state_size);
+  // Waits until the file of the last save has been written.
+  void WaitForSave();
+
+  // Restores the memory of the files the file at path is based on, and then
+  // its own from the stream, which must be at the end of the state following
+  // the header.
+  bool RestoreMemory(const std::filesystem::path& path, const Header& header,
+                     ByteStream* stream);
+
+ private:
+  // Restores the memory of a file another one is based on, after the memory
+  // of the files it's based on itself. Appends the absolute paths of the files
+  // to paths, which must have all the files restored so far.
+  bool RestoreBaseMemory(const std::filesystem::path& path,
+                         uint64_t snapshot_id,
+                         std::vector<std::filesystem::path>* paths);
+
+  Memory* memory_;
+
+  // Writing the file of the last save.
+  std::unique_ptr<threading::Thread> save_thread_;
+  // Last save saved or restored, which the next incremental save is based on,
+  // or 0 if none.
+  uint64_t last_snapshot_id_ = 0;
+  // Absolute paths of the file of the last save or restore and of the files
+  // it's based on, in order.
+  std::vector<std::filesystem::path> last_snapshot_paths_;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_SAVE_STATE_MANAGER_H_
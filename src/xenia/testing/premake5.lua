@@ -0,0 +1,13 @@
+project_root = "../../.."
+include(project_root.."/tools/build")
+
+test_suite("xenia-core-tests", project_root, ".", {
+  links = {
+    "fmt",
+    "snappy",
+    "xenia-base",
+    "xenia-core",
+    "xenia-cpu",
+    "xenia-ui", -- needed by xenia-base
+  },
+})
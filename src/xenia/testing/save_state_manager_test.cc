@@ -0,0 +1,155 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2021 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <system_error>
+
+#include "xenia/base/byte_stream.h"
+#include "xenia/base/mapped_memory.h"
+#include "xenia/memory.h"
+#include "xenia/memory_snapshot.h"
+#include "xenia/save_state_manager.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace test {
+
+namespace {
+
+class SaveStateTest {
+ public:
+  SaveStateTest() {
+    memory_ = std::make_unique<Memory>();
+    REQUIRE(memory_->Initialize());
+    manager_ = std::make_unique<SaveStateManager>(memory_.get());
+    REQUIRE(memory_->LookupHeap(0x40000000)
+                ->Alloc(4096, 4096,
+                        kMemoryAllocationReserve | kMemoryAllocationCommit,
+                        kMemoryProtectRead | kMemoryProtectWrite, false,
+                        &address_));
+    directory_ = std::filesystem::temp_directory_path() /
+                 "xenia_save_state_manager_test";
+    std::filesystem::create_directories(directory_);
+  }
+  ~SaveStateTest() {
+    manager_.reset();
+    std::error_code error;
+    std::filesystem::remove_all(directory_, error);
+  }
+
+  std::filesystem::path path(const char* name) const {
+    return directory_ / name;
+  }
+
+  uint32_t& value() { return *memory_->TranslateVirtual<uint32_t*>(address_); }
+
+  // Saves with only a marker as the state other than the memory.
+  bool Save(const std::filesystem::path& path) {
+    auto snapshot = manager_->CaptureMemory(path, true);
+    if (!snapshot) {
+      return false;
+    }
+    std::shared_ptr<uint8_t[]> state(new uint8_t[4]);
+    ByteStream state_stream(state.get(), 4);
+    state_stream.Write(uint32_t(0x53544154));
+    if (!manager_->Save(path, std::move(snapshot), std::nullopt,
+                        std::move(state), 4)) {
+      return false;
+    }
+    manager_->WaitForSave();
+    return std::filesystem::exists(path);
+  }
+
+  bool Restore(const std::filesystem::path& path,
+               SaveStateManager::Header* header) {
+    auto map = MappedMemory::Open(path, MappedMemory::Mode::kRead);
+    if (!map) {
+      return false;
+    }
+    ByteStream stream(map->data(), map->size());
+    if (!SaveStateManager::ReadHeader(&stream, header) ||
+        header->state_size != 4 || stream.Read<uint32_t>() != 0x53544154) {
+      return false;
+    }
+    return manager_->RestoreMemory(path, *header, &stream);
+  }
+
+ private:
+  std::unique_ptr<Memory> memory_;
+  std::unique_ptr<SaveStateManager> manager_;
+  uint32_t address_ = 0;
+  std::filesystem::path directory_;
+};
+
+}  // namespace
+
+TEST_CASE("Save twice to the same path and restore", "[save_state]") {
+  SaveStateTest test;
+  auto path = test.path("same.xsav");
+
+  test.value() = 1;
+  REQUIRE(test.Save(path));
+  test.value() = 2;
+  // Incremental on the file it's replacing unless saved in full.
+  REQUIRE(test.Save(path));
+  REQUIRE(!std::filesystem::exists(test.path("same.xsav.tmp")));
+
+  test.value() = 3;
+  SaveStateManager::Header header;
+  REQUIRE(test.Restore(path, &header));
+  REQUIRE(header.base_snapshot_id == 0);
+  REQUIRE(test.value() == 2);
+}
+
+TEST_CASE("Save over a file the last save is based on", "[save_state]") {
+  SaveStateTest test;
+  auto first_path = test.path("first.xsav");
+  auto second_path = test.path("second.xsav");
+
+  test.value() = 1;
+  REQUIRE(test.Save(first_path));
+  test.value() = 2;
+  REQUIRE(test.Save(second_path));
+  test.value() = 3;
+  REQUIRE(test.Save(first_path));
+
+  test.value() = 4;
+  SaveStateManager::Header header;
+  REQUIRE(test.Restore(first_path, &header));
+  REQUIRE(header.base_snapshot_id == 0);
+  REQUIRE(test.value() == 3);
+
+  // Its base has been replaced.
+  REQUIRE(!test.Restore(second_path, &header));
+}
+
+TEST_CASE("Restore an incremental save", "[save_state]") {
+  SaveStateTest test;
+  auto first_path = test.path("first.xsav");
+  auto second_path = test.path("second.xsav");
+
+  test.value() = 1;
+  REQUIRE(test.Save(first_path));
+  test.value() = 2;
+  REQUIRE(test.Save(second_path));
+
+  test.value() = 3;
+  SaveStateManager::Header header;
+  REQUIRE(test.Restore(second_path, &header));
+  REQUIRE(header.base_snapshot_id != 0);
+  REQUIRE(test.value() == 2);
+  REQUIRE(test.Restore(first_path, &header));
+  REQUIRE(test.value() == 1);
+}
+
+}  // namespace test
+}  // namespace xe